@@ -1,3 +1,7 @@
+#ifndef _GNU_SOURCE
+// splice, pipe2
+#define _GNU_SOURCE
+#endif
 #include "asyncio/asyncio.h"
 #include "asyncio/coroutine.h"
 #include "asyncio/device.h"
@@ -8,11 +12,25 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#ifdef OS_LINUX
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/sendfile.h>
+#elif defined(OS_COMMONUNIX)
+#include <unistd.h>
+#endif
 
 static ConcurrentQueue opPool;
 static ConcurrentQueue opTimerPool;
 static ConcurrentQueue eventPool;
 
+#ifdef OS_LINUX
+static void transferPipeCacheClose(void);
+#endif
+
 #ifdef OS_WINDOWS
 asyncBase *iocpNewAsyncBase();
 #endif
@@ -23,6 +41,9 @@ asyncBase *epollNewAsyncBase(void);
 #if defined(OS_DARWIN) || defined (OS_FREEBSD)
 asyncBase *kqueueNewAsyncBase(void);
 #endif
+#ifdef OS_COMMONUNIX
+asyncBase *pollNewAsyncBase(void);
+#endif
 
 struct Context {
   aioExecuteProc *StartProc;
@@ -52,6 +73,11 @@ static void connectFinish(asyncOpRoot* opptr)
   ((aioConnectCb*)opptr->callback)(opGetStatus(opptr), (aioObject*)opptr->object, opptr->arg);
 }
 
+static void writableFinish(asyncOpRoot *opptr)
+{
+  ((aioWritableCb*)opptr->callback)(opGetStatus(opptr), (aioObject*)opptr->object, opptr->arg);
+}
+
 static void acceptFinish(asyncOpRoot* opptr)
 {
   asyncOp *op = (asyncOp*)opptr;
@@ -103,6 +129,7 @@ static asyncOpRoot *newAsyncOp(aioObjectRoot *object,
   op->state = 0;
   op->transactionSize = context->TransactionSize;
   op->bytesTransferred = 0;
+  op->queuedBytes = 0;
   if (context->TransactionSize && (opCode & OPCODE_WRITE) && !(flags & afNoCopy)) {
     if (op->internalBuffer == 0) {
       op->internalBuffer = malloc(context->TransactionSize);
@@ -172,6 +199,11 @@ asyncBase *createAsyncBase(AsyncMethod method)
    case amKQueue :
       base = kqueueNewAsyncBase();
      break;
+#endif
+#if defined(OS_COMMONUNIX)
+    case amPoll :
+      base = pollNewAsyncBase();
+      break;
 #endif
     case amOSDefault :
     default:
@@ -182,7 +214,7 @@ asyncBase *createAsyncBase(AsyncMethod method)
 #elif defined(OS_DARWIN) || defined(OS_FREEBSD)
       base = kqueueNewAsyncBase();
 #else
-      base = selectNewAsyncBase();
+      base = pollNewAsyncBase();
 #endif
       break;
   }
@@ -191,6 +223,7 @@ asyncBase *createAsyncBase(AsyncMethod method)
   base->opsCount = 0;
 #endif
   pageMapInit(&base->timerMap);
+  timerHeapInit(&base->timerHeap);
   memset(&base->globalQueue, 0, sizeof(base->globalQueue));
   base->timerMapLock = 0;
   base->lastCheckPoint = time(0);
@@ -201,6 +234,10 @@ asyncBase *createAsyncBase(AsyncMethod method)
 void asyncLoop(asyncBase *base)
 {
   base->methodImpl.nextFinishedOperation(base);
+#ifdef OS_LINUX
+  // asyncBase has no destructor, so idle splice pipe of this thread closed when it leaves loop
+  transferPipeCacheClose();
+#endif
 }
 
 
@@ -221,7 +258,9 @@ aioUserEvent *newUserEvent(asyncBase *base, int isSemaphore, aioEventCb callback
 {
   // TODO: use malloc allocator for aioUserEvent
   aioUserEvent *event = 0;
-  asyncOpAlloc(base, sizeof(aioUserEvent), 1, 0, &eventPool, (asyncOpRoot**)&event);
+  // User event timers don't use backend timer objects, all of them stored in base timer heap
+  if (asyncOpAlloc(base, sizeof(aioUserEvent), 0, &eventPool, 0, (asyncOpRoot**)&event))
+    event->root.timerId = timerNodeNew(&event->root);
   event->root.opCode = actUserEvent;
   event->root.finishMethod = eventFinish;
   event->root.callback = (void*)callback;
@@ -241,12 +280,16 @@ aioUserEvent *newUserEvent(asyncBase *base, int isSemaphore, aioEventCb callback
 
 aioObject *newSocketIo(asyncBase *base, socketTy hSocket)
 {
-  return base->methodImpl.newAioObject(base, ioObjectSocket, &hSocket);
+  aioObject *object = base->methodImpl.newAioObject(base, ioObjectSocket, &hSocket);
+  writeQueueInit(object);
+  return object;
 }
 
 aioObject *newDeviceIo(asyncBase *base, iodevTy hDevice)
 {
-  return base->methodImpl.newAioObject(base, ioObjectDevice, &hDevice);
+  aioObject *object = base->methodImpl.newAioObject(base, ioObjectDevice, &hDevice);
+  writeQueueInit(object);
+  return object;
 }
 
 void deleteAioObject(aioObject *object)
@@ -259,18 +302,40 @@ asyncBase *aioGetBase(aioObject *object)
   return object->root.base;
 }
 
+void aioSetWriteWatermarks(aioObject *object, size_t lowWatermark, size_t highWatermark, AioWritePolicy policy)
+{
+  object->writeQueue.lowWatermark = lowWatermark;
+  object->writeQueue.highWatermark = highWatermark;
+  object->writeQueue.policy = policy;
+}
+
+void aioSetWriteCoalescing(aioObject *object, size_t maxBytes, unsigned maxOps)
+{
+  object->writeQueue.coalesceBytes = maxBytes;
+  object->writeQueue.coalesceOps = maxOps;
+}
+
+void aioGetWriteQueueStats(aioObject *object, aioWriteQueueStats *stats)
+{
+  stats->queuedBytes = object->writeQueue.queuedBytes;
+  stats->queuedOps = object->writeQueue.queuedOps;
+  stats->peakQueuedBytes = object->writeQueue.peakQueuedBytes;
+  stats->rejectedWrites = object->writeQueue.rejectedWrites;
+  stats->writeCalls = object->writeQueue.writeCalls;
+}
+
 void userEventStartTimer(aioUserEvent *event, uint64_t usTimeout, int counter)
 {
   event->counter = counter;
   event->root.timeout = usTimeout;
-  event->base->methodImpl.startTimer(&event->root);
+  timerHeapStart(event->base, event->root.timerId, usTimeout);
 }
 
 
 void userEventStopTimer(aioUserEvent *event)
 {
   event->counter = 0;
-  event->base->methodImpl.stopTimer(&event->root);
+  timerHeapStop(event->base, event->root.timerId);
 }
 
 void userEventActivate(aioUserEvent *event)
@@ -281,7 +346,7 @@ void userEventActivate(aioUserEvent *event)
 
 void deleteUserEvent(aioUserEvent *event)
 {
-  event->base->methodImpl.stopTimer(&event->root);
+  timerHeapStop(event->base, event->root.timerId);
   eventDecrementReference(event, 1 - TAG_EVENT_DELETE);
 }
 
@@ -363,9 +428,17 @@ asyncOpRoot *implWrite(aioObject *object,
   AsyncFlags extraFlags = afRunning;
 #endif
   size_t bytes = 0;
-  int result = object->root.type == ioObjectSocket ?
-    socketSyncWrite(object->hSocket, buffer, size, flags & afWaitAll, &bytes) :
-    deviceSyncWrite(object->hDevice, buffer, size, flags & afWaitAll, &bytes);
+  int result = 0;
+#ifndef OS_WINDOWS
+  // Coalescing mode: defer write to readiness event, so burst of small writes gathered into one syscall
+  if (object->writeQueue.coalesceOps <= 1)
+#endif
+  {
+    object->writeQueue.writeCalls++;
+    result = object->root.type == ioObjectSocket ?
+      socketSyncWrite(object->hSocket, buffer, size, flags & afWaitAll, &bytes) :
+      deviceSyncWrite(object->hDevice, buffer, size, flags & afWaitAll, &bytes);
+  }
   if (result) {
     *bytesTransferred = bytes;
     return 0;
@@ -454,6 +527,9 @@ ssize_t aioWrite(aioObject *object,
                  aioCb callback,
                  void *arg)
 {
+  if (writeQueueIsFull(object))
+    return -(ssize_t)aosQueueFull;
+
   struct Context context;
   fillContext(&context, object->root.base->methodImpl.write, rwFinish, (void*)((uintptr_t)buffer), size);
   runAioOperation(&object->root, newAsyncOp, implWriteProxy, makeResult, initOp, flags, usTimeout, (void*)callback, arg, actWrite, &context);
@@ -514,6 +590,9 @@ ssize_t aioWriteMsg(aioObject *object,
                     void *arg)
 {
   // Datagram socket can be accessed by multiple threads without lock
+  if (writeQueueIsFull(object))
+    return -(ssize_t)aosQueueFull;
+
   struct sockaddr_in remoteAddress;
   remoteAddress.sin_family = address->family;
   remoteAddress.sin_addr.s_addr = address->ipv4;
@@ -545,6 +624,421 @@ ssize_t aioWriteMsg(aioObject *object,
   return -(ssize_t)aosPending;
 }
 
+void aioWaitWritable(aioObject *object, aioWritableCb callback, void *arg)
+{
+  struct Context context;
+  fillContext(&context, 0, writableFinish, 0, 0);
+  asyncOpRoot *op = newAsyncOp(&object->root, afNone, 0, (void*)callback, arg, actWaitWritable, &context);
+  writeQueueSetWritable(object, op);
+}
+
+
+#define TRANSFER_CHUNK_SIZE 65536
+
+typedef struct transferState {
+  aioObject *src;
+  aioObject *dst;
+  void *callback;
+  void *arg;
+  AsyncFlags flags;
+  uint64_t usTimeout;
+  size_t size;
+  size_t transferred;
+  uint64_t offset;
+  size_t inPipe;
+  int isSendFile;
+  int endOfFile;
+  void *buffer;
+#ifdef OS_LINUX
+  int pipeFd[2];
+#endif
+} transferState;
+
+static ssize_t fileReadAt(iodevTy hDevice, void *buffer, size_t size, uint64_t offset)
+{
+#ifdef OS_WINDOWS
+  DWORD bytesRead = 0;
+  OVERLAPPED overlapped;
+  memset(&overlapped, 0, sizeof(overlapped));
+  overlapped.Offset = (DWORD)offset;
+  overlapped.OffsetHigh = (DWORD)(offset >> 32);
+  if (!ReadFile(hDevice, buffer, (DWORD)size, &bytesRead, &overlapped) &&
+      (GetLastError() != ERROR_IO_PENDING || !GetOverlappedResult(hDevice, &overlapped, &bytesRead, TRUE)))
+    return GetLastError() == ERROR_HANDLE_EOF ? 0 : -1;
+  return (ssize_t)bytesRead;
+#else
+  return pread(hDevice, buffer, size, (off_t)offset);
+#endif
+}
+
+#ifdef OS_LINUX
+// Idle pipe pair cached per thread, busy transfer owns its pipe until data leaves it
+static __tls int threadPipeFd[2] = {-1, -1};
+
+static int transferPipeAcquire(transferState *state)
+{
+  if (threadPipeFd[0] != -1) {
+    state->pipeFd[0] = threadPipeFd[0];
+    state->pipeFd[1] = threadPipeFd[1];
+    threadPipeFd[0] = threadPipeFd[1] = -1;
+    return 1;
+  }
+
+  return pipe2(state->pipeFd, O_NONBLOCK | O_CLOEXEC) == 0;
+}
+
+static void transferPipeRelease(transferState *state)
+{
+  if (state->pipeFd[0] == -1)
+    return;
+
+  if (state->inPipe == 0 && threadPipeFd[0] == -1) {
+    threadPipeFd[0] = state->pipeFd[0];
+    threadPipeFd[1] = state->pipeFd[1];
+  } else {
+    close(state->pipeFd[0]);
+    close(state->pipeFd[1]);
+  }
+}
+
+static void transferPipeCacheClose(void)
+{
+  if (threadPipeFd[0] == -1)
+    return;
+
+  close(threadPipeFd[0]);
+  close(threadPipeFd[1]);
+  threadPipeFd[0] = threadPipeFd[1] = -1;
+}
+
+static inline int objectFd(aioObject *object)
+{
+  return object->root.type == ioObjectSocket ? object->hSocket : object->hDevice;
+}
+
+// splice and sendfile have no MSG_NOSIGNAL analog, SIGPIPE blocked for calling thread
+// and pending signal consumed if peer closed connection
+static void sigpipeBlock(sigset_t *oldMask)
+{
+  sigset_t mask;
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGPIPE);
+  pthread_sigmask(SIG_BLOCK, &mask, oldMask);
+}
+
+static void sigpipeRestore(sigset_t *oldMask, int consume)
+{
+  if (consume) {
+    sigset_t mask;
+    struct timespec zero = {0, 0};
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGPIPE);
+    sigtimedwait(&mask, 0, &zero);
+  }
+
+  pthread_sigmask(SIG_SETMASK, oldMask, 0);
+}
+
+static AsyncOpStatus spliceReadExecute(asyncOpRoot *opptr)
+{
+  asyncOp *op = (asyncOp*)opptr;
+  transferState *state = (transferState*)opptr->arg;
+  ssize_t result = splice(objectFd(state->src), 0, state->pipeFd[1], 0, op->transactionSize, SPLICE_F_NONBLOCK | SPLICE_F_MOVE);
+  if (result > 0) {
+    op->bytesTransferred = (size_t)result;
+    return aosSuccess;
+  } else if (result == 0) {
+    return aosDisconnected;
+  } else {
+    return errno == EAGAIN ? aosPending : aosUnknownError;
+  }
+}
+
+static AsyncOpStatus spliceWriteExecute(asyncOpRoot *opptr)
+{
+  asyncOp *op = (asyncOp*)opptr;
+  transferState *state = (transferState*)opptr->arg;
+  AsyncOpStatus status = aosSuccess;
+  sigset_t oldMask;
+  sigpipeBlock(&oldMask);
+  while (op->bytesTransferred < op->transactionSize) {
+    ssize_t result = splice(state->pipeFd[0], 0, objectFd(state->dst), 0, op->transactionSize - op->bytesTransferred, SPLICE_F_NONBLOCK | SPLICE_F_MOVE);
+    if (result > 0) {
+      op->bytesTransferred += (size_t)result;
+    } else {
+      status = result == 0 || errno == EPIPE || errno == ECONNRESET ? aosDisconnected :
+               errno == EAGAIN ? aosPending : aosUnknownError;
+      break;
+    }
+  }
+
+  sigpipeRestore(&oldMask, status == aosDisconnected);
+  return status;
+}
+
+static AsyncOpStatus sendFileExecute(asyncOpRoot *opptr)
+{
+  asyncOp *op = (asyncOp*)opptr;
+  transferState *state = (transferState*)opptr->arg;
+  AsyncOpStatus status = aosSuccess;
+  sigset_t oldMask;
+  sigpipeBlock(&oldMask);
+  while (op->bytesTransferred < op->transactionSize) {
+    off_t offset = (off_t)(state->offset + op->bytesTransferred);
+    ssize_t result = sendfile(objectFd(state->dst), state->src->hDevice, &offset, op->transactionSize - op->bytesTransferred);
+    if (result > 0) {
+      op->bytesTransferred += (size_t)result;
+    } else if (result == 0) {
+      // File is shorter than requested size
+      state->endOfFile = 1;
+      break;
+    } else {
+      status = errno == EPIPE || errno == ECONNRESET ? aosDisconnected :
+               errno == EAGAIN ? aosPending : aosUnknownError;
+      break;
+    }
+  }
+
+  sigpipeRestore(&oldMask, status == aosDisconnected);
+  return status;
+}
+#endif
+
+// Zero-copy forwarding: transfer runs as sequence of read and write stages, each stage
+// is operation in object queue, so readiness of source or destination resumes transfer
+static void transferFinish(transferState *state, AsyncOpStatus status)
+{
+  aioObject *src = state->src;
+  aioObject *dst = state->dst;
+  void *callback = state->callback;
+  void *arg = state->arg;
+  size_t transferred = state->transferred;
+  int isSendFile = state->isSendFile;
+#ifdef OS_LINUX
+  transferPipeRelease(state);
+#endif
+  free(state->buffer);
+  free(state);
+
+  if (isSendFile)
+    ((aioCb*)callback)(status, dst, transferred, arg);
+  else
+    ((aioSpliceCb*)callback)(status, src, dst, transferred, arg);
+}
+
+static void transferStartStage(transferState *state,
+                               aioObject *object,
+                               aioExecuteProc *startProc,
+                               aioFinishProc *finishProc,
+                               void *buffer,
+                               size_t size,
+                               AsyncFlags flags,
+                               int opCode)
+{
+  struct Context context;
+  fillContext(&context, startProc, finishProc, buffer, size);
+  asyncOpRoot *op = newAsyncOp(&object->root, (state->flags & afRealtime) | flags, state->usTimeout, state, state, opCode, &context);
+  combinerPushOperation(op, aaStart);
+}
+
+static void transferReadStage(transferState *state);
+
+static void transferWriteFinish(asyncOpRoot *opptr)
+{
+  transferState *state = (transferState*)opptr->arg;
+  AsyncOpStatus status = opGetStatus(opptr);
+  size_t bytes = ((asyncOp*)opptr)->bytesTransferred;
+  state->transferred += bytes;
+  state->offset += bytes;
+  state->inPipe -= bytes < state->inPipe ? bytes : state->inPipe;
+  if (status == aosSuccess && (state->flags & afWaitAll) && state->transferred < state->size && !state->endOfFile)
+    transferReadStage(state);
+  else
+    transferFinish(state, status);
+}
+
+static void transferReadFinish(asyncOpRoot *opptr)
+{
+  transferState *state = (transferState*)opptr->arg;
+  AsyncOpStatus status = opGetStatus(opptr);
+  size_t bytes = ((asyncOp*)opptr)->bytesTransferred;
+  if (status != aosSuccess) {
+    transferFinish(state, status);
+    return;
+  }
+
+#ifdef OS_LINUX
+  state->inPipe = bytes;
+  transferStartStage(state, state->dst, spliceWriteExecute, transferWriteFinish, 0, bytes, afNoCopy, actSpliceWrite);
+#else
+  transferStartStage(state, state->dst, state->dst->root.base->methodImpl.write, transferWriteFinish, state->buffer, bytes, afWaitAll | afNoCopy, actWrite);
+#endif
+}
+
+static void transferReadStage(transferState *state)
+{
+  size_t size = state->size - state->transferred;
+  if (size > TRANSFER_CHUNK_SIZE)
+    size = TRANSFER_CHUNK_SIZE;
+
+  if (state->isSendFile) {
+    // File is always ready: read chunk synchronously and write it to socket
+    ssize_t bytes = fileReadAt(state->src->hDevice, state->buffer, size, state->offset);
+    if (bytes < 0) {
+      transferFinish(state, aosUnknownError);
+    } else if (bytes == 0) {
+      transferFinish(state, aosSuccess);
+    } else {
+      state->endOfFile = (size_t)bytes < size;
+      transferStartStage(state, state->dst, state->dst->root.base->methodImpl.write, transferWriteFinish, state->buffer, (size_t)bytes, afWaitAll | afNoCopy, actWrite);
+    }
+    return;
+  }
+
+#ifdef OS_LINUX
+  transferStartStage(state, state->src, spliceReadExecute, transferReadFinish, 0, size, afNone, actSpliceRead);
+#else
+  transferStartStage(state, state->src, state->src->root.base->methodImpl.read, transferReadFinish, state->buffer, size, afNone, actRead);
+#endif
+}
+
+static void transferBufferedFinish(asyncOpRoot *opptr)
+{
+  transferState *state = (transferState*)opptr->arg;
+  AsyncOpStatus status = opGetStatus(opptr);
+  state->transferred += ((asyncOp*)opptr)->bytesTransferred;
+  if (status == aosSuccess && (state->flags & afWaitAll) && state->transferred < state->size)
+    transferReadStage(state);
+  else
+    transferFinish(state, status);
+}
+
+static transferState *transferStateNew(aioObject *src, aioObject *dst, size_t size, AsyncFlags flags, uint64_t usTimeout, void *callback, void *arg)
+{
+  transferState *state = (transferState*)malloc(sizeof(transferState));
+  state->src = src;
+  state->dst = dst;
+  state->callback = callback;
+  state->arg = arg;
+  state->flags = flags;
+  state->usTimeout = usTimeout;
+  state->size = size;
+  state->transferred = 0;
+  state->offset = 0;
+  state->inPipe = 0;
+  state->isSendFile = 0;
+  state->endOfFile = 0;
+  state->buffer = 0;
+#ifdef OS_LINUX
+  state->pipeFd[0] = state->pipeFd[1] = -1;
+#endif
+  return state;
+}
+
+int aioSplice(aioObject *src,
+              aioObject *dst,
+              size_t size,
+              AsyncFlags flags,
+              uint64_t usTimeout,
+              aioSpliceCb callback,
+              void *arg)
+{
+  if (writeQueueIsFull(dst))
+    return -aosQueueFull;
+
+  transferState *state = transferStateNew(src, dst, size, flags, usTimeout, (void*)callback, arg);
+#ifdef OS_LINUX
+  if (!transferPipeAcquire(state)) {
+    free(state);
+    return -aosUnknownError;
+  }
+#else
+  state->buffer = malloc(TRANSFER_CHUNK_SIZE);
+#endif
+
+  // Data already read from source into object buffer goes first
+  struct ioBuffer *sb = &src->buffer;
+  size_t buffered = sb->dataSize - sb->offset;
+  if (buffered) {
+    if (buffered > size)
+      buffered = size;
+    transferStartStage(state, dst, dst->root.base->methodImpl.write, transferBufferedFinish, (uint8_t*)sb->ptr + sb->offset, buffered, afWaitAll, actWrite);
+    sb->offset += buffered;
+    if (sb->offset == sb->dataSize)
+      sb->offset = sb->dataSize = 0;
+  } else {
+    transferReadStage(state);
+  }
+
+  return 0;
+}
+
+int aioSendFile(aioObject *socket,
+                aioObject *file,
+                uint64_t offset,
+                size_t size,
+                uint64_t usTimeout,
+                aioCb callback,
+                void *arg)
+{
+  if (writeQueueIsFull(socket))
+    return -aosQueueFull;
+
+  transferState *state = transferStateNew(file, socket, size, afWaitAll, usTimeout, (void*)callback, arg);
+  state->isSendFile = 1;
+  state->offset = offset;
+#ifdef OS_LINUX
+  transferStartStage(state, socket, sendFileExecute, transferWriteFinish, 0, size, afNoCopy, actSendFile);
+#else
+  state->buffer = malloc(TRANSFER_CHUNK_SIZE);
+  transferReadStage(state);
+#endif
+  return 0;
+}
+
+
+struct coroutineTransfer {
+  coroutineTy *coroutine;
+  AsyncOpStatus status;
+  size_t transferred;
+};
+
+static void coroutineSpliceCb(AsyncOpStatus status, aioObject *src, aioObject *dst, size_t transferred, void *arg)
+{
+  __UNUSED(src);
+  __UNUSED(dst);
+  struct coroutineTransfer *transfer = (struct coroutineTransfer*)arg;
+  transfer->status = status;
+  transfer->transferred = transferred;
+  coroutineCall(transfer->coroutine);
+}
+
+static void coroutineSendFileCb(AsyncOpStatus status, aioObject *socket, size_t transferred, void *arg)
+{
+  coroutineSpliceCb(status, 0, socket, transferred, arg);
+}
+
+ssize_t ioSplice(aioObject *src, aioObject *dst, size_t size, AsyncFlags flags, uint64_t usTimeout)
+{
+  struct coroutineTransfer transfer;
+  transfer.coroutine = coroutineCurrent();
+  int result = aioSplice(src, dst, size, flags, usTimeout, coroutineSpliceCb, &transfer);
+  if (result != 0)
+    return result;
+  coroutineYield();
+  return transfer.status == aosSuccess ? (ssize_t)transfer.transferred : -(int)transfer.status;
+}
+
+ssize_t ioSendFile(aioObject *socket, aioObject *file, uint64_t offset, size_t size, uint64_t usTimeout)
+{
+  struct coroutineTransfer transfer;
+  transfer.coroutine = coroutineCurrent();
+  int result = aioSendFile(socket, file, offset, size, usTimeout, coroutineSendFileCb, &transfer);
+  if (result != 0)
+    return result;
+  coroutineYield();
+  return transfer.status == aosSuccess ? (ssize_t)transfer.transferred : -(int)transfer.status;
+}
 
 int ioConnect(aioObject *object, const HostAddress *address, uint64_t usTimeout)
 {
@@ -591,6 +1085,9 @@ ssize_t ioRead(aioObject *object, void *buffer, size_t size, AsyncFlags flags, u
 
 ssize_t ioWrite(aioObject *object, const void *buffer, size_t size, AsyncFlags flags, uint64_t usTimeout)
 {
+  if (writeQueueIsFull(object))
+    return -(ssize_t)aosQueueFull;
+
   struct Context context;
   fillContext(&context, object->root.base->methodImpl.write, 0, (void*)((uintptr_t)buffer), size);
   asyncOpRoot *op = runIoOperation(&object->root, newAsyncOp, implWriteProxy, initOp, flags, usTimeout, actWrite, &context);
@@ -633,6 +1130,9 @@ ssize_t ioReadMsg(aioObject *object, void *buffer, size_t size, AsyncFlags flags
 ssize_t ioWriteMsg(aioObject *object, const HostAddress *address, const void *buffer, size_t size, AsyncFlags flags, uint64_t usTimeout)
 {
   // Datagram socket can be accessed by multiple threads without lock
+  if (writeQueueIsFull(object))
+    return -(ssize_t)aosQueueFull;
+
   struct sockaddr_in remoteAddress;
   remoteAddress.sin_family = address->family;
   remoteAddress.sin_addr.s_addr = address->ipv4;
@@ -666,6 +1166,18 @@ ssize_t ioWriteMsg(aioObject *object, const HostAddress *address, const void *bu
   return coroutineRwFinish(op, object);
 }
 
+int ioWaitWritable(aioObject *object)
+{
+  struct Context context;
+  fillContext(&context, 0, 0, 0, 0);
+  asyncOpRoot *op = newAsyncOp(&object->root, afCoroutine, 0, 0, 0, actWaitWritable, &context);
+  writeQueueSetWritable(object, op);
+  coroutineYield();
+  AsyncOpStatus status = opGetStatus(op);
+  releaseAsyncOp(op);
+  return status == aosSuccess ? 0 : -status;
+}
+
 
 void ioSleep(aioUserEvent *event, uint64_t usTimeout)
 {
@@ -677,7 +1189,7 @@ void ioSleep(aioUserEvent *event, uint64_t usTimeout)
   event->root.arg = coroutineCurrent();
   event->root.timeout = usTimeout;
   event->counter = 1;
-  event->base->methodImpl.startTimer(&event->root);
+  timerHeapStart(event->base, event->root.timerId, usTimeout);
   coroutineYield();
   event->root.callback = 0;
   event->root.arg = 0;
@@ -7,9 +7,17 @@
 #include <time.h>
 #ifndef WIN32
 #include <signal.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#else
+#include <windows.h>
 #endif
 
 #define PAGE_MAP_SIZE (1u << 16)
+#define TIMER_HEAP_INITIAL_SIZE 64
+#define TIMER_HEAP_EXPIRED_BATCH 64
+#define TIMER_NOT_STARTED ((size_t)-1)
+#define WRITE_COALESCE_MAX_IOV 64
 
 __tls unsigned currentFinishedSync;
 __tls unsigned messageLoopThreadId;
@@ -210,6 +218,186 @@ void processTimeoutQueue(asyncBase *base, time_t currentTime)
   __spinlock_release(&base->timerMapLock);
 }
 
+uint64_t getMonotonicTime(void)
+{
+#ifdef WIN32
+  LARGE_INTEGER counter;
+  LARGE_INTEGER frequency;
+  QueryPerformanceCounter(&counter);
+  QueryPerformanceFrequency(&frequency);
+  return (uint64_t)(counter.QuadPart / frequency.QuadPart * 1000000 +
+                    counter.QuadPart % frequency.QuadPart * 1000000 / frequency.QuadPart);
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec*1000000 + (uint64_t)ts.tv_nsec/1000;
+#endif
+}
+
+static void timerHeapSet(aioTimerHeap *heap, size_t index, aioTimerNode *node)
+{
+  heap->nodes[index] = node;
+  node->heapIndex = index;
+}
+
+static void timerHeapSiftUp(aioTimerHeap *heap, size_t index)
+{
+  aioTimerNode *node = heap->nodes[index];
+  while (index > 0) {
+    size_t parent = (index - 1) / 2;
+    if (heap->nodes[parent]->deadline <= node->deadline)
+      break;
+    timerHeapSet(heap, index, heap->nodes[parent]);
+    index = parent;
+  }
+
+  timerHeapSet(heap, index, node);
+}
+
+static void timerHeapSiftDown(aioTimerHeap *heap, size_t index)
+{
+  aioTimerNode *node = heap->nodes[index];
+  for (;;) {
+    size_t child = index*2 + 1;
+    if (child >= heap->num)
+      break;
+    if (child + 1 < heap->num && heap->nodes[child+1]->deadline < heap->nodes[child]->deadline)
+      child++;
+    if (node->deadline <= heap->nodes[child]->deadline)
+      break;
+    timerHeapSet(heap, index, heap->nodes[child]);
+    index = child;
+  }
+
+  timerHeapSet(heap, index, node);
+}
+
+static void timerHeapInsert(aioTimerHeap *heap, aioTimerNode *node)
+{
+  if (heap->num == heap->size) {
+    heap->size *= 2;
+    heap->nodes = realloc(heap->nodes, sizeof(aioTimerNode*)*heap->size);
+  }
+
+  timerHeapSet(heap, heap->num++, node);
+  timerHeapSiftUp(heap, node->heapIndex);
+}
+
+static void timerHeapRemove(aioTimerHeap *heap, aioTimerNode *node)
+{
+  size_t index = node->heapIndex;
+  size_t last = --heap->num;
+  node->heapIndex = TIMER_NOT_STARTED;
+  if (index != last) {
+    timerHeapSet(heap, index, heap->nodes[last]);
+    if (index > 0 && heap->nodes[index]->deadline < heap->nodes[(index-1)/2]->deadline)
+      timerHeapSiftUp(heap, index);
+    else
+      timerHeapSiftDown(heap, index);
+  }
+}
+
+void timerHeapInit(aioTimerHeap *heap)
+{
+  heap->num = 0;
+  heap->size = TIMER_HEAP_INITIAL_SIZE;
+  heap->nodes = malloc(sizeof(aioTimerNode*)*heap->size);
+  heap->lock = 0;
+}
+
+aioTimerNode *timerNodeNew(asyncOpRoot *op)
+{
+  aioTimerNode *node = malloc(sizeof(aioTimerNode));
+  node->op = op;
+  node->generation = 0;
+  node->deadline = 0;
+  node->heapIndex = TIMER_NOT_STARTED;
+  return node;
+}
+
+void timerHeapStart(asyncBase *base, aioTimerNode *node, uint64_t usTimeout)
+{
+  aioTimerHeap *heap = &base->timerHeap;
+  __spinlock_acquire(&heap->lock);
+  if (node->heapIndex != TIMER_NOT_STARTED)
+    timerHeapRemove(heap, node);
+  node->generation = opGetGeneration(node->op);
+  node->deadline = getMonotonicTime() + usTimeout;
+  timerHeapInsert(heap, node);
+  // Nearest deadline changed, rearm backend timer
+  if (node->heapIndex == 0)
+    base->methodImpl.armTimer(base, node->deadline);
+  __spinlock_release(&heap->lock);
+}
+
+void timerHeapStop(asyncBase *base, aioTimerNode *node)
+{
+  // Backend timer not rearmed here, spurious wakeup handled by processTimerHeap
+  aioTimerHeap *heap = &base->timerHeap;
+  __spinlock_acquire(&heap->lock);
+  if (node->heapIndex != TIMER_NOT_STARTED)
+    timerHeapRemove(heap, node);
+  __spinlock_release(&heap->lock);
+}
+
+uint64_t timerHeapNextDeadline(asyncBase *base)
+{
+  uint64_t deadline = 0;
+  aioTimerHeap *heap = &base->timerHeap;
+  __spinlock_acquire(&heap->lock);
+  if (heap->num)
+    deadline = heap->nodes[0]->deadline;
+  __spinlock_release(&heap->lock);
+  return deadline;
+}
+
+void processTimerHeap(asyncBase *base)
+{
+  aioTimerNode expired[TIMER_HEAP_EXPIRED_BATCH];
+  aioTimerHeap *heap = &base->timerHeap;
+  size_t i, expiredNum;
+  do {
+    uint64_t now = getMonotonicTime();
+    expiredNum = 0;
+    __spinlock_acquire(&heap->lock);
+    while (heap->num && heap->nodes[0]->deadline <= now && expiredNum < TIMER_HEAP_EXPIRED_BATCH) {
+      aioTimerNode *node = heap->nodes[0];
+      asyncOpRoot *op = node->op;
+      timerHeapRemove(heap, node);
+      expired[expiredNum++] = *node;
+
+      // Periodic user event timer rescheduled under lock for correct interaction with timerHeapStop
+      if (op->opCode == actUserEvent) {
+        aioUserEvent *event = (aioUserEvent*)op;
+        if (event->counter < 0 || (event->counter > 0 && --event->counter > 0)) {
+          uint64_t timeout = op->timeout ? op->timeout : 1;
+          node->deadline += timeout;
+          if (node->deadline <= now)
+            node->deadline = now + timeout;
+          timerHeapInsert(heap, node);
+        }
+      }
+    }
+
+    base->methodImpl.armTimer(base, heap->num ? heap->nodes[0]->deadline : 0);
+    __spinlock_release(&heap->lock);
+
+    for (i = 0; i < expiredNum; i++) {
+      asyncOpRoot *op = expired[i].op;
+      if (op->opCode == actUserEvent) {
+        aioUserEvent *event = (aioUserEvent*)op;
+        if (opGetGeneration(op) == expired[i].generation && eventTryActivate(event)) {
+          eventDeactivate(event);
+          op->finishMethod(op);
+          eventDecrementReference(event, 1);
+        }
+      } else {
+        opCancel(op, expired[i].generation, aosTimeout);
+      }
+    }
+  } while (expiredNum == TIMER_HEAP_EXPIRED_BATCH);
+}
+
 void initObjectRoot(aioObjectRoot *object, asyncBase *base, IoObjectTy type, aioObjectDestructor destructor)
 {
   object->Head = taggedAsyncOpNull();
@@ -338,9 +526,153 @@ void initAsyncOpRoot(asyncOpRoot *op,
   objectIncrementReference(object, 1);
 }
 
+static inline int isNativeWrite(asyncOpRoot *op)
+{
+  return (op->opCode & OPCODE_WRITE) &&
+         (op->object->type == ioObjectSocket || op->object->type == ioObjectDevice);
+}
+
+static void writableOpFinish(asyncOpRoot *op, AsyncOpStatus status)
+{
+  opForceStatus(op, status);
+  addToGlobalQueue(op);
+}
+
+static void writeQueueAdd(aioObject *object, asyncOp *op)
+{
+  struct aioWriteQueue *queue = &object->writeQueue;
+  size_t bytes = op->transactionSize > op->bytesTransferred ? op->transactionSize - op->bytesTransferred : 0;
+  uintptr_t queued = __uintptr_atomic_fetch_and_add(&queue->queuedBytes, bytes) + bytes;
+  __uintptr_atomic_fetch_and_add(&queue->queuedOps, 1);
+  // Statistics only, race with concurrent writers is acceptable
+  if (queued > queue->peakQueuedBytes)
+    queue->peakQueuedBytes = queued;
+  op->queuedBytes = bytes;
+}
+
+static void writeQueueRemove(aioObject *object, asyncOp *op)
+{
+  struct aioWriteQueue *queue = &object->writeQueue;
+  uintptr_t queued = __uintptr_atomic_fetch_and_add(&queue->queuedBytes, -(uintptr_t)op->queuedBytes) - op->queuedBytes;
+  __uintptr_atomic_fetch_and_add(&queue->queuedOps, (uintptr_t)-1);
+  op->queuedBytes = 0;
+  if (queued <= queue->lowWatermark && queue->writableOp) {
+    asyncOpRoot *writableOp = (asyncOpRoot*)__pointer_atomic_exchange(&queue->writableOp, 0);
+    if (writableOp)
+      writableOpFinish(writableOp, aosSuccess);
+  }
+}
+
+void writeQueueInit(aioObject *object)
+{
+  struct aioWriteQueue *queue = &object->writeQueue;
+  queue->queuedBytes = 0;
+  queue->queuedOps = 0;
+  queue->peakQueuedBytes = 0;
+  queue->rejectedWrites = 0;
+  queue->lowWatermark = 0;
+  queue->highWatermark = 0;
+  queue->policy = awpNone;
+  queue->writableOp = 0;
+  queue->coalesceBytes = 0;
+  queue->coalesceOps = 0;
+  queue->writeCalls = 0;
+}
+
+int writeQueueIsFull(aioObject *object)
+{
+  struct aioWriteQueue *queue = &object->writeQueue;
+  if (queue->policy == awpFailFast &&
+      queue->highWatermark &&
+      queue->queuedBytes >= queue->highWatermark) {
+    __uintptr_atomic_fetch_and_add(&queue->rejectedWrites, 1);
+    return 1;
+  }
+
+  return 0;
+}
+
+void writeQueueCancelWritable(aioObject *object)
+{
+  asyncOpRoot *op = (asyncOpRoot*)__pointer_atomic_exchange(&object->writeQueue.writableOp, 0);
+  if (op)
+    writableOpFinish(op, aosCanceled);
+}
+
+void writeQueueSetWritable(aioObject *object, asyncOpRoot *op)
+{
+  struct aioWriteQueue *queue = &object->writeQueue;
+  asyncOpRoot *previous = (asyncOpRoot*)__pointer_atomic_exchange(&queue->writableOp, op);
+  if (previous)
+    writableOpFinish(previous, aosCanceled);
+
+  // Queue can be drained before operation was published, check it again
+  if (queue->queuedBytes <= queue->lowWatermark &&
+      __pointer_atomic_compare_and_swap(&queue->writableOp, op, 0))
+    writableOpFinish(op, aosSuccess);
+}
+
+#ifndef WIN32
+ssize_t writeCoalesced(asyncOp *op, int fd, int isSocket, int sendFlags)
+{
+  aioObject *object = (aioObject*)op->root.object;
+  struct iovec iov[WRITE_COALESCE_MAX_IOV];
+  asyncOp *ops[WRITE_COALESCE_MAX_IOV];
+  size_t maxOps = object->writeQueue.coalesceOps < WRITE_COALESCE_MAX_IOV ? object->writeQueue.coalesceOps : WRITE_COALESCE_MAX_IOV;
+  size_t totalSize = op->transactionSize - op->bytesTransferred;
+  size_t count = 1;
+  iov[0].iov_base = (uint8_t*)op->buffer + op->bytesTransferred;
+  iov[0].iov_len = totalSize;
+  ops[0] = op;
+
+  // Gather following waiting write operations, head operation always goes first and whole
+  asyncOp *next = (asyncOp*)op->root.executeQueue.next;
+  while (next && count < maxOps) {
+    size_t size = next->transactionSize - next->bytesTransferred;
+    if (next->root.opCode != actWrite ||
+        opGetStatus(&next->root) != aosPending ||
+        totalSize + size > object->writeQueue.coalesceBytes)
+      break;
+    iov[count].iov_base = (uint8_t*)next->buffer + next->bytesTransferred;
+    iov[count].iov_len = size;
+    ops[count] = next;
+    totalSize += size;
+    count++;
+    next = (asyncOp*)next->root.executeQueue.next;
+  }
+
+  ssize_t result;
+  object->writeQueue.writeCalls++;
+  if (isSocket) {
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = count;
+    result = sendmsg(fd, &msg, sendFlags);
+  } else {
+    result = writev(fd, iov, (int)count);
+  }
+
+  if (result <= 0)
+    return result;
+
+  // Bytes after head operation belong to gathered operations, they will be finished by executeOperationList without syscall
+  size_t remaining = (size_t)result - (iov[0].iov_len < (size_t)result ? iov[0].iov_len : (size_t)result);
+  for (size_t i = 1; i < count && remaining; i++) {
+    size_t bytes = iov[i].iov_len < remaining ? iov[i].iov_len : remaining;
+    ops[i]->bytesTransferred += bytes;
+    remaining -= bytes;
+  }
+
+  return (size_t)result < iov[0].iov_len ? result : (ssize_t)iov[0].iov_len;
+}
+#endif
+
 static void opRun(asyncOpRoot *op, List *list)
 {
   eqPushBack(list, op);
+  if (isNativeWrite(op))
+    writeQueueAdd((aioObject*)op->object, (asyncOp*)op);
   if (op->timeout) {
     asyncBase *base = op->object->base;
     if (op->flags & afRealtime) {
@@ -413,6 +745,8 @@ void opRelease(asyncOpRoot *op, AsyncOpStatus status, List *executeList)
 
   if (executeList)
     eqRemove(executeList, op);
+  if (isNativeWrite(op))
+    writeQueueRemove((aioObject*)op->object, (asyncOp*)op);
   if (op->releaseMethod)
     op->releaseMethod(op);
   addToGlobalQueue(op);
@@ -535,17 +869,24 @@ int copyFromBuffer(void *dst, size_t *offset, struct ioBuffer *src, size_t size)
 }
 
 
+static inline void cancelObjectOperations(aioObjectRoot *object)
+{
+  // Writable notification parked outside of queues, must not outlive object
+  if (object->type == ioObjectSocket || object->type == ioObjectDevice)
+    writeQueueCancelWritable((aioObject*)object);
+  cancelOperationList(&object->readQueue, aosCanceled);
+  cancelOperationList(&object->writeQueue, aosCanceled);
+}
+
 static inline int combinerTaskHandlerCommon(aioObjectRoot *object, uint32_t tag)
 {
   if (object->CancelIoFlag) {
     object->CancelIoFlag = 0;
-    cancelOperationList(&object->readQueue, aosCanceled);
-    cancelOperationList(&object->writeQueue, aosCanceled);
+    cancelObjectOperations(object);
   }
 
   if (tag & COMBINER_TAG_DELETE) {
-    cancelOperationList(&object->readQueue, aosCanceled);
-    cancelOperationList(&object->writeQueue, aosCanceled);
+    cancelObjectOperations(object);
     if (object->destructorCb)
       object->destructorCb(object, object->destructorCbArg);
     object->destructor(object);
@@ -14,10 +14,14 @@ typedef enum IoActionTy {
   actAccept = OPCODE_READ,
   actRead,
   actReadMsg,
+  actSpliceRead,
   actConnect = OPCODE_WRITE,
   actWrite,
   actWriteMsg,
+  actSpliceWrite,
+  actSendFile,
   actUserEvent = OPCODE_OTHER,
+  actWaitWritable,
 } IoActionTy;
 
 typedef void combinerTaskHandlerTy(aioObjectRoot*, asyncOpRoot*, AsyncOpActionTy);
@@ -29,8 +33,24 @@ typedef void deleteObjectTy(aioObject*);
 typedef void startTimerTy(asyncOpRoot*);
 typedef void stopTimerTy(asyncOpRoot*);
 typedef void deleteTimerTy(asyncOpRoot*);
+typedef void armTimerTy(asyncBase*, uint64_t);
 typedef void activateTy(aioUserEvent*);
 
+typedef struct aioTimerNode {
+  asyncOpRoot *op;
+  uintptr_t generation;
+  uint64_t deadline;
+  size_t heapIndex;
+} aioTimerNode;
+
+// Per-base binary min-heap of timers, backend keeps one kernel timer armed at nearest deadline
+typedef struct aioTimerHeap {
+  aioTimerNode **nodes;
+  size_t num;
+  size_t size;
+  unsigned lock;
+} aioTimerHeap;
+
 struct asyncImpl {
   combinerTaskHandlerTy *combinerTaskHandler;
   enqueueOperationTy *enqueue;
@@ -44,6 +64,7 @@ struct asyncImpl {
   startTimerTy *startTimer;
   stopTimerTy *stopTimer;
   deleteTimerTy *deleteTimer;
+  armTimerTy *armTimer;
   activateTy *activate;
   aioExecuteProc *connect;
   aioExecuteProc *accept;
@@ -61,6 +82,7 @@ struct asyncBase {
   time_t lastCheckPoint;
   volatile unsigned messageLoopThreadCounter;
   volatile unsigned timerMapLock;
+  aioTimerHeap timerHeap;
 
 #ifndef NDEBUG
   int opsCount;
@@ -74,6 +96,21 @@ struct ioBuffer {
   size_t offset;
 };
 
+// Bytes of pending write operations, updated when operation enters or leaves object write queue
+struct aioWriteQueue {
+  volatile uintptr_t queuedBytes;
+  volatile uintptr_t queuedOps;
+  uintptr_t peakQueuedBytes;
+  volatile uintptr_t rejectedWrites;
+  size_t lowWatermark;
+  size_t highWatermark;
+  AioWritePolicy policy;
+  void *volatile writableOp;
+  size_t coalesceBytes;
+  unsigned coalesceOps;
+  uintptr_t writeCalls;
+};
+
 struct aioObject {
   aioObjectRoot root;
   union {
@@ -82,6 +119,7 @@ struct aioObject {
   };
 
   struct ioBuffer buffer;
+  struct aioWriteQueue writeQueue;
 };
 
 struct asyncOp {
@@ -92,6 +130,7 @@ struct asyncOp {
   size_t bytesTransferred;
   socketTy acceptSocket;
   HostAddress host;
+  size_t queuedBytes;
 
   void *internalBuffer;
   size_t internalBufferSize;
@@ -112,6 +151,22 @@ void pageMapInit(pageMap *map);
 void addToTimeoutQueue(asyncBase *base, asyncOpRoot *op);
 void processTimeoutQueue(asyncBase *base, time_t currentTime);
 
+uint64_t getMonotonicTime(void);
+void timerHeapInit(aioTimerHeap *heap);
+aioTimerNode *timerNodeNew(asyncOpRoot *op);
+void timerHeapStart(asyncBase *base, aioTimerNode *node, uint64_t usTimeout);
+void timerHeapStop(asyncBase *base, aioTimerNode *node);
+uint64_t timerHeapNextDeadline(asyncBase *base);
+void processTimerHeap(asyncBase *base);
+
+void writeQueueInit(aioObject *object);
+int writeQueueIsFull(aioObject *object);
+void writeQueueSetWritable(aioObject *object, asyncOpRoot *op);
+void writeQueueCancelWritable(aioObject *object);
+#ifndef WIN32
+ssize_t writeCoalesced(asyncOp *op, int fd, int isSocket, int sendFlags);
+#endif
+
 int copyFromBuffer(void *dst, size_t *offset, struct ioBuffer *src, size_t size);
 #ifdef __cplusplus
 }
@@ -4,34 +4,45 @@
 #include <string.h>
 
 
-void dynamicBufferGrow(dynamicBuffer *buffer, size_t extra)
+int dynamicBufferGrow(dynamicBuffer *buffer, size_t extra)
 {
-  size_t newMemorySize = buffer->allocatedSize;
-  while (newMemorySize < buffer->offset + extra)
-    newMemorySize *= 2;
+  if (extra > SIZE_MAX - buffer->offset)
+    return 0;
+
+  size_t required = buffer->offset + extra;
+  size_t newMemorySize = buffer->allocatedSize ? buffer->allocatedSize : 16;
+  while (newMemorySize < required)
+    newMemorySize = newMemorySize <= SIZE_MAX / 2 ? newMemorySize * 2 : required;
 
   if (newMemorySize != buffer->allocatedSize) {
     void *newBuffer;
     if (buffer->foreign) {
       newBuffer = malloc(newMemorySize);
-      buffer->foreign = 0;
+      if (newBuffer)
+        memcpy(newBuffer, buffer->data, buffer->size);
     } else {
       newBuffer = buffer->data ? realloc(buffer->data, newMemorySize) : malloc(newMemorySize);
     }
-      
+
+    // Buffer not changed on allocation failure
+    if (!newBuffer)
+      return 0;
+
+    buffer->foreign = 0;
     buffer->allocatedSize = newMemorySize;
     buffer->data = newBuffer;
   }
+
+  return 1;
 }
 
 
 void dynamicBufferInit(dynamicBuffer *buffer, size_t initialSize)
 {
-  if (initialSize)
-    buffer->data = malloc(initialSize);
+  buffer->data = initialSize ? malloc(initialSize) : 0;
   buffer->offset = 0;
   buffer->size = 0;
-  buffer->allocatedSize = initialSize;
+  buffer->allocatedSize = buffer->data ? initialSize : 0;
   buffer->foreign = 0;
 }
 
@@ -45,7 +56,8 @@ void *dynamicBufferAlloc(dynamicBuffer *buffer, size_t size)
 {
   void *ptr;
 
-  dynamicBufferGrow(buffer, size);
+  if (!dynamicBufferGrow(buffer, size))
+    return 0;
   ptr = dynamicBufferPtr(buffer);
   buffer->offset += size;
   if (buffer->offset > buffer->size)
@@ -74,11 +86,13 @@ size_t dynamicBufferRemaining(dynamicBuffer *buffer)
 }
 
 
-void dynamicBufferWrite(dynamicBuffer *buffer, const void *data, size_t size)
+int dynamicBufferWrite(dynamicBuffer *buffer, const void *data, size_t size)
 {
-  dynamicBufferGrow(buffer, size);
+  if (!dynamicBufferGrow(buffer, size))
+    return 0;
   memcpy(dynamicBufferPtr(buffer), data, size);
   buffer->offset += size;
   if (buffer->offset > buffer->size)
     buffer->size = buffer->offset;
+  return 1;
 }
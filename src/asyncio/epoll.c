@@ -13,6 +13,7 @@
 #include <sys/eventfd.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/epoll.h>
 #include <sys/timerfd.h>
@@ -26,7 +27,9 @@ typedef struct epollBase {
   asyncBase B;
   int epollFd;
   int eventFd;
+  int timerFd;
   aioObject *eventObject;
+  aioObject *timerObject;
 } epollBase;
 
 typedef struct EPollObject {
@@ -53,6 +56,7 @@ void epollInitializeTimer(asyncBase *base, asyncOpRoot *op);
 void epollStartTimer(asyncOpRoot *op);
 void epollStopTimer(asyncOpRoot *op);
 void epollDeleteTimer(asyncOpRoot *op);
+void epollArmTimer(asyncBase *base, uint64_t deadline);
 void epollActivate(aioUserEvent *op);
 AsyncOpStatus epollAsyncConnect(asyncOpRoot *opptr);
 AsyncOpStatus epollAsyncAccept(asyncOpRoot *opptr);
@@ -74,6 +78,7 @@ static struct asyncImpl epollImpl = {
   epollStartTimer,
   epollStopTimer,
   epollDeleteTimer,
+  epollArmTimer,
   epollActivate,
   epollAsyncConnect,
   epollAsyncAccept,
@@ -88,11 +93,13 @@ static void epollControl(int epollFd, int action, uint32_t events, int fd, void
   struct epoll_event ev;
   ev.events = events;
   ev.data.ptr = ptr;
-  if (epoll_ctl(epollFd,
-                action,
-                fd,
-                &ev) == -1)
-    fprintf(stderr, "epoll_ctl error, errno: %s\n", strerror(errno));
+  if (epoll_ctl(epollFd, action, fd, &ev) == -1) {
+    // EPERM for regular file expected: it can't be polled, used as data source only (aioSendFile)
+    int error = errno;
+    struct stat st;
+    if (error != EPERM || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+      fprintf(stderr, "epoll_ctl error, errno: %s\n", strerror(error));
+  }
 }
 
 static int getFd(EPollObject *object)
@@ -119,8 +126,12 @@ asyncBase *epollNewAsyncBase()
     }
 
     base->eventObject = epollNewAioObject(&base->B, ioObjectDevice, &base->eventFd);
-
     epollControl(base->epollFd, EPOLL_CTL_MOD, EPOLLIN | EPOLLONESHOT, base->eventFd, base->eventObject);
+
+    // Single timer for all user events and other timers stored in base timer heap
+    base->timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    base->timerObject = epollNewAioObject(&base->B, ioObjectDevice, &base->timerFd);
+    epollControl(base->epollFd, EPOLL_CTL_MOD, EPOLLIN | EPOLLONESHOT, base->timerFd, base->timerObject);
   }
 
   return (asyncBase *)base;
@@ -224,34 +235,17 @@ void epollNextFinishedOperation(asyncBase *base)
         eventfd_t eventValue;
         eventfd_read(localBase->eventFd, &eventValue);
         epollControl(localBase->epollFd, EPOLL_CTL_MOD, EPOLLIN | EPOLLONESHOT, localBase->eventFd, object);
+      } else if (object == &localBase->timerObject->root) {
+        uint64_t data;
+        if (read(localBase->timerFd, &data, sizeof(data)) == -1 && errno != EAGAIN)
+          fprintf(stderr, "epoll: timerfd read error, errno: %s\n", strerror(errno));
+        processTimerHeap(base);
+        epollControl(localBase->epollFd, EPOLL_CTL_MOD, EPOLLIN | EPOLLONESHOT, localBase->timerFd, object);
       } else if (object->type == ioObjectTimer) {
         uint64_t data;
         aioTimer *timer = (aioTimer*)object;
-        if (read(timer->fd, &data, sizeof(data))) {
-          asyncOpRoot *op = timer->op;
-          if (op->opCode == actUserEvent) {
-            aioUserEvent *event = (aioUserEvent*)op;
-            if (eventTryActivate(event)) {
-              // TODO: compare timer and event tag
-              if (event->counter > 0 && --event->counter == 0) {
-                epollStopTimer(op);
-              } else {
-                // We need rearm epoll for timer
-                epollControl(localBase->epollFd,
-                             EPOLL_CTL_MOD,
-                             EPOLLIN | EPOLLONESHOT,
-                             timer->fd,
-                             __tagged_pointer_make(timer, opGetGeneration(op)));
-              }
-
-              eventDeactivate(event);
-              op->finishMethod(op);
-              eventDecrementReference(event, 1);
-            }
-          } else {
-            opCancel(op, opEncodeTag(op, timerId), aosTimeout);
-          }
-        }
+        if (read(timer->fd, &data, sizeof(data)))
+          opCancel(timer->op, opEncodeTag(timer->op, timerId), aosTimeout);
       } else {
         uint32_t eventMask = 0;
         if (events[n].events & EPOLLIN)
@@ -353,11 +347,10 @@ void epollInitializeTimer(asyncBase *base, asyncOpRoot *op)
 void epollStartTimer(asyncOpRoot *op)
 {
   struct itimerspec its;
-  int periodic = op->opCode == actUserEvent;
   its.it_value.tv_sec = op->timeout / 1000000;
   its.it_value.tv_nsec = (op->timeout % 1000000) * 1000;
-  its.it_interval.tv_sec = periodic ? its.it_value.tv_sec : 0;
-  its.it_interval.tv_nsec = periodic ? its.it_value.tv_nsec : 0;
+  its.it_interval.tv_sec = 0;
+  its.it_interval.tv_nsec = 0;
 
   aioTimer *timer = (aioTimer*)op->timerId;
   timerfd_settime(timer->fd, 0, &its, 0);
@@ -388,6 +381,17 @@ void epollDeleteTimer(asyncOpRoot *op)
   free(timer);
 }
 
+void epollArmTimer(asyncBase *base, uint64_t deadline)
+{
+  // Absolute CLOCK_MONOTONIC time, zero deadline disarms timer
+  struct itimerspec its;
+  its.it_value.tv_sec = (time_t)(deadline / 1000000);
+  its.it_value.tv_nsec = (long)(deadline % 1000000) * 1000;
+  its.it_interval.tv_sec = 0;
+  its.it_interval.tv_nsec = 0;
+  timerfd_settime(((epollBase*)base)->timerFd, TFD_TIMER_ABSTIME, &its, 0);
+}
+
 void epollActivate(aioUserEvent *op)
 {
   epollEnqueue(op->base, &op->root);
@@ -486,9 +490,19 @@ AsyncOpStatus epollAsyncWrite(asyncOpRoot *opptr)
   EPollObject *object = (EPollObject*)op->root.object;
   int fd = getFd(object);
 
-  ssize_t bytesWritten = object->Object.root.type == ioObjectSocket ?
-    send(fd, (uint8_t *)op->buffer + op->bytesTransferred, op->transactionSize - op->bytesTransferred, MSG_NOSIGNAL) :
-    write(fd, (uint8_t *)op->buffer + op->bytesTransferred, op->transactionSize - op->bytesTransferred);
+  ssize_t bytesWritten;
+  if (op->transactionSize == op->bytesTransferred) {
+    // Data already sent by coalesced write of previous operation
+    bytesWritten = 0;
+  } else if (object->Object.writeQueue.coalesceOps > 1) {
+    bytesWritten = writeCoalesced(op, fd, object->Object.root.type == ioObjectSocket, MSG_NOSIGNAL);
+  } else {
+    object->Object.writeQueue.writeCalls++;
+    bytesWritten = object->Object.root.type == ioObjectSocket ?
+      send(fd, (uint8_t *)op->buffer + op->bytesTransferred, op->transactionSize - op->bytesTransferred, MSG_NOSIGNAL) :
+      write(fd, (uint8_t *)op->buffer + op->bytesTransferred, op->transactionSize - op->bytesTransferred);
+  }
+
   if (bytesWritten > 0) {
     op->bytesTransferred += (size_t)bytesWritten;
     if (op->root.flags & afWaitAll && op->bytesTransferred < op->transactionSize)
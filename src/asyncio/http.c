@@ -2,8 +2,14 @@
 
 #include "asyncio/asyncio.h"
 #include "asyncio/coroutine.h"
+#include "asyncio/socket.h"
+#include "asyncio/timer.h"
+#include <stdlib.h>
 #include <string.h>
 
+// Max memory reserved by Content-Length before body received
+#define HTTP_BODY_PRESIZE_LIMIT (1u << 20)
+
 static ConcurrentQueue opPool;
 static ConcurrentQueue opTimerPool;
 static ConcurrentQueue objectPool;
@@ -18,6 +24,12 @@ static AsyncOpStatus httpParseStart(asyncOpRoot *opptr);
 static int cancel(asyncOpRoot *opptr)
 {
   HTTPClient *client = (HTTPClient*)opptr->object;
+  if (client->pausedOp == opptr) {
+    // Paused operation has no child operation, finish it now
+    client->pausedOp = 0;
+    return 1;
+  }
+
   cancelIo(client->isHttps ? (aioObjectRoot*)client->sslSocket : (aioObjectRoot*)client->plainSocket);
   return 0;
 }
@@ -55,7 +67,7 @@ static void httpRequestProc(AsyncOpStatus status, aioObject *object, size_t tran
   __UNUSED(object);
   asyncOpRoot *opptr = (asyncOpRoot*)arg;
   HTTPClient *client = (HTTPClient*)opptr->object;
-  httpSetBuffer(&client->state, client->inBuffer, client->inBufferOffset+transferred);
+  httpSetBuffer(&client->state, client->inBuffer+client->inBufferOffset, client->inBufferDataSize+transferred);
   resumeParent(opptr, status);
 }
 
@@ -64,7 +76,7 @@ static void httpsRequestProc(AsyncOpStatus status, SSLSocket *object, size_t tra
   __UNUSED(object);
   asyncOpRoot *opptr = (asyncOpRoot*)arg;
   HTTPClient *client = (HTTPClient*)opptr->object;
-  httpSetBuffer(&client->state, client->inBuffer, client->inBufferOffset+transferred);
+  httpSetBuffer(&client->state, client->inBuffer+client->inBufferOffset, client->inBufferDataSize+transferred);
   resumeParent(opptr, status);
 }
 
@@ -101,7 +113,9 @@ static AsyncOpStatus httpParseStart(asyncOpRoot *opptr)
   HTTPOp *op = (HTTPOp*)opptr;
   HTTPClient *client = (HTTPClient*)op->root.object;
 
-  if (op->state == 0) {
+  // State 2: response only, request written by caller (pipelining)
+  if (op->state == 0 || op->state == 2) {
+    int sendRequest = op->state == 0;
     client->requestBytesSent = 0;
     httpInit(&client->state);
 
@@ -111,15 +125,18 @@ static AsyncOpStatus httpParseStart(asyncOpRoot *opptr)
 
     size_t bytesTransferred = 0;
     op->state = 1;
-    asyncOpRoot *childOp = client->isHttps ?
-      implSslWrite(client->sslSocket, op->internalBuffer, op->dataSize, afWaitAll, 0, httpsResumeProc, op) :
-      implWrite(client->plainSocket, op->internalBuffer, op->dataSize, afWaitAll, 0, httpResumeProc, op, &bytesTransferred);
+    asyncOpRoot *childOp = 0;
+    if (sendRequest)
+      childOp = client->isHttps ?
+        implSslWrite(client->sslSocket, op->internalBuffer, op->dataSize, afWaitAll, 0, httpsResumeProc, op) :
+        implWrite(client->plainSocket, op->internalBuffer, op->dataSize, afWaitAll, 0, httpResumeProc, op, &bytesTransferred);
     if (childOp) {
       combinerPushOperation(childOp, aaStart);
       return aosPending;
     }
     // sync completion — callback not invoked, all bytes sent (afWaitAll)
-    client->requestBytesSent = op->dataSize;
+    if (sendRequest)
+      client->requestBytesSent = op->dataSize;
   }
 
   for (;;) {
@@ -127,21 +144,38 @@ static AsyncOpStatus httpParseStart(asyncOpRoot *opptr)
       case ParserResultOk : {
         HttpComponent component;
         component.type = httpDtFinalize;
-        op->parseCallback(&component, op->parseArg);
-        return aosSuccess;  
+        return op->parseCallback(&component, op->parseArg) ? aosSuccess : aosUnknownError;
       }
       case ParserResultNeedMoreData : {
-        // copy 'tail' to begin of buffer
-        size_t offset = httpDataRemaining(&client->state);
-        if (offset)
-          memcpy(client->inBuffer, httpDataPtr(&client->state), offset);
+        if (client->readPaused) {
+          // Parser state kept, httpParse called again with same data after resume
+          client->pausedOp = opptr;
+          return aosPending;
+        }
 
+        // Body fragments already consumed in place, usually only incomplete line or next
+        // pipelined response remains; it moved to buffer begin when space behind it too small
+        size_t offset = (size_t)((const uint8_t*)httpDataPtr(&client->state) - client->inBuffer);
+        size_t dataSize = httpDataRemaining(&client->state);
+        if (dataSize == 0) {
+          offset = 0;
+        } else if (client->inBufferSize - offset - dataSize < client->inBufferSize/4) {
+          memmove(client->inBuffer, client->inBuffer+offset, dataSize);
+          offset = 0;
+        }
+
+        // Line longer than read buffer
+        if (dataSize == client->inBufferSize)
+          return aosBufferTooSmall;
+
+        uint8_t *readPtr = client->inBuffer + offset + dataSize;
+        size_t readSize = client->inBufferSize - offset - dataSize;
         asyncOpRoot *readOp;
         size_t bytesTransferred = 0;
         if (client->isHttps)
           readOp = implSslRead(client->sslSocket,
-                               client->inBuffer+offset,
-                               client->inBufferSize-offset,
+                               readPtr,
+                               readSize,
                                afNone,
                                0,
                                httpsRequestProc,
@@ -149,8 +183,8 @@ static AsyncOpStatus httpParseStart(asyncOpRoot *opptr)
                                &bytesTransferred);
         else
           readOp = implRead(client->plainSocket,
-                            client->inBuffer+offset,
-                            client->inBufferSize-offset,
+                            readPtr,
+                            readSize,
                             afNone,
                             0,
                             httpRequestProc,
@@ -158,11 +192,12 @@ static AsyncOpStatus httpParseStart(asyncOpRoot *opptr)
                             &bytesTransferred);
 
         client->inBufferOffset = offset;
+        client->inBufferDataSize = dataSize;
         if (readOp) {
           combinerPushOperation(readOp, aaStart);
           return aosPending;
         } else {
-          httpSetBuffer(&client->state, client->inBuffer, client->inBufferOffset+bytesTransferred);
+          httpSetBuffer(&client->state, readPtr-dataSize, dataSize+bytesTransferred);
         }
         break;
       }
@@ -214,7 +249,7 @@ void httpParseDefaultInit(HTTPParseDefaultContext *context)
   dynamicBufferInit(&context->buffer, 65536);
 }
 
-void httpParseDefault(HttpComponent *component, void *arg)
+int httpParseDefault(HttpComponent *component, void *arg)
 {
   HTTPParseDefaultContext *context = (HTTPParseDefaultContext*)arg;
   switch (component->type) {
@@ -237,9 +272,19 @@ void httpParseDefault(HttpComponent *component, void *arg)
 
     case httpDtHeaderEntry : {
       switch (component->header.entryType) {
+        case hhContentLength : {
+          // Whole body stored in one allocation instead of repeated growth; Content-Length not
+          // trusted for larger reservation, bigger body grows buffer as it arrives
+          size_t reserve = component->header.sizeValue < HTTP_BODY_PRESIZE_LIMIT ? component->header.sizeValue : HTTP_BODY_PRESIZE_LIMIT;
+          dynamicBufferGrow(&context->buffer, reserve+1);
+          break;
+        }
+
         case hhContentType : {
           context->contentTypeOffset = context->buffer.offset;
           char *out = (char*)dynamicBufferAlloc(&context->buffer, component->header.stringValue.size+1);
+          if (!out)
+            return 0;
           memcpy(out, component->header.stringValue.data, component->header.stringValue.size);
           out[component->header.stringValue.size] = 0;
           context->contentType.size = component->header.stringValue.size;
@@ -255,13 +300,19 @@ void httpParseDefault(HttpComponent *component, void *arg)
       if (context->bodyOffset == 0)
           context->bodyOffset = context->buffer.offset;
 
+      // Truncated body not reported as response, request failed instead
       char *out = (char*)dynamicBufferAlloc(&context->buffer, component->data.size);
+      if (!out)
+        return 0;
       memcpy(out, component->data.data, component->data.size);
       break;
     }
 
     case httpDtFinalize : {
-      *(char*)dynamicBufferAlloc(&context->buffer, 1) = 0;
+      char *terminator = (char*)dynamicBufferAlloc(&context->buffer, 1);
+      if (!terminator)
+        return 0;
+      *terminator = 0;
       if (context->contentTypeOffset)
         context->contentType.data = (char*)context->buffer.data + context->contentTypeOffset;
       context->body.data = (char*)context->buffer.data + context->bodyOffset;
@@ -269,6 +320,50 @@ void httpParseDefault(HttpComponent *component, void *arg)
       break;
     }
   }
+  return 1;
+}
+
+void httpParseStreamInit(HTTPParseStreamContext *context, httpBodyCb *bodyCallback, void *arg)
+{
+  context->bodyCallback = bodyCallback;
+  context->arg = arg;
+}
+
+int httpParseStream(HttpComponent *component, void *arg)
+{
+  HTTPParseStreamContext *context = (HTTPParseStreamContext*)arg;
+  switch (component->type) {
+    case httpDtInitialize : {
+      context->resultCode = 0;
+      context->chunked = 0;
+      context->contentLength = 0;
+      context->bodySize = 0;
+      break;
+    }
+
+    case httpDtStartLine : {
+      context->resultCode = component->startLine.code;
+      break;
+    }
+
+    case httpDtHeaderEntry : {
+      if (component->header.entryType == hhContentLength)
+        context->contentLength = component->header.sizeValue;
+      else if (component->header.entryType == hhTransferEncoding)
+        context->chunked = component->header.stringValue.size == 7 && memcmp(component->header.stringValue.data, "chunked", 7) == 0;
+      break;
+    }
+
+    case httpDtData :
+    case httpDtDataFragment : {
+      if (component->data.size) {
+        context->bodySize += component->data.size;
+        context->bodyCallback(component->data.data, component->data.size, context->arg);
+      }
+      break;
+    }
+  }
+  return 1;
 }
 
 static void httpClientDestructor(aioObjectRoot *root)
@@ -293,7 +388,10 @@ HTTPClient *httpClientNew(asyncBase *base, aioObject *socket)
   initObjectRoot(&client->root, base, ioObjectUserDefined, httpClientDestructor);
   client->isHttps = 0;
   client->inBufferOffset = 0;
+  client->inBufferDataSize = 0;
   client->requestBytesSent = 0;
+  client->readPaused = 0;
+  client->pausedOp = 0;
   httpSetBuffer(&client->state, client->inBuffer, 0);
   client->plainSocket = socket;
   return client;
@@ -311,7 +409,10 @@ HTTPClient *httpsClientNew(asyncBase *base, SSLSocket *socket)
   initObjectRoot(&client->root, base, ioObjectUserDefined, httpClientDestructor);
   client->isHttps = 1;
   client->inBufferOffset = 0;
+  client->inBufferDataSize = 0;
   client->requestBytesSent = 0;
+  client->readPaused = 0;
+  client->pausedOp = 0;
   httpSetBuffer(&client->state, client->inBuffer, 0);
   client->sslSocket = socket;
   return client;
@@ -322,6 +423,21 @@ void httpClientDelete(HTTPClient *client)
   objectDelete(&client->root);
 }
 
+void httpClientPause(HTTPClient *client)
+{
+  client->readPaused = 1;
+}
+
+void httpClientResume(HTTPClient *client)
+{
+  client->readPaused = 0;
+  if (client->pausedOp) {
+    asyncOpRoot *op = client->pausedOp;
+    client->pausedOp = 0;
+    resumeParent(op, aosSuccess);
+  }
+}
+
 void aioHttpConnect(HTTPClient *client,
                     const HostAddress *address,
                     const char *tlsextHostName,
@@ -422,3 +538,518 @@ AsyncOpStatus ioHttpRequest(HTTPClient *client,
   releaseAsyncOp(&op->root);
   return status;
 }
+
+// Keep-alive connection pool
+
+typedef struct HTTPPoolHost HTTPPoolHost;
+typedef struct HTTPPoolConnection HTTPPoolConnection;
+typedef struct HTTPPoolRequest HTTPPoolRequest;
+
+__NO_PADDING_BEGIN
+struct HTTPPoolRequest {
+  HTTPPoolRequest *next;
+  HTTPPoolHost *host;
+  HTTPPoolConnection *connection;
+  char *data;
+  size_t size;
+  uint64_t usTimeout;
+  httpParseCb *parseCallback;
+  void *parseArg;
+  httpPoolRequestCb *callback;
+  void *arg;
+  // Position in write order of connection
+  uint64_t sequence;
+  unsigned attempts;
+  int connectionClose;
+  // Method allows sending again after server could process request
+  int idempotent;
+};
+
+struct HTTPPoolConnection {
+  HTTPPoolConnection *next;
+  HTTPPoolHost *host;
+  HTTPClient *client;
+  int connected;
+  // Server announced 'Connection: close', no more requests
+  int closing;
+  int closed;
+  // Requests written and waiting response
+  unsigned inFlight;
+  // Connect, write and response operations not finished yet, connection memory lives until they end
+  unsigned pendingOps;
+  uint64_t requestsSent;
+  // Requests written completely, writes finish in order of requests
+  uint64_t requestsWritten;
+  uint64_t requestsServed;
+  timeMark lastUsed;
+};
+
+struct HTTPPoolHost {
+  HTTPPoolHost *next;
+  HTTPClientPool *pool;
+  HostAddress address;
+  int isHttps;
+  char *tlsextHostName;
+  HTTPPoolConnection *connections;
+  unsigned connectionsNum;
+  unsigned connectingNum;
+  HTTPPoolRequest *pendingHead;
+  HTTPPoolRequest *pendingTail;
+  size_t pendingNum;
+};
+
+struct HTTPClientPool {
+  asyncBase *base;
+  unsigned maxConnections;
+  unsigned pipelineDepth;
+  uint64_t idleTimeout;
+  aioUserEvent *idleEvent;
+  HTTPPoolHost *hosts;
+  // Including closed connections with unfinished operations
+  unsigned liveConnections;
+  int deleted;
+  HTTPClientPoolStats stats;
+};
+__NO_PADDING_END
+
+static void poolDispatch(HTTPPoolHost *host);
+
+static int poolHostMatch(const HTTPPoolHost *host, const HostAddress *address, int isHttps, const char *tlsextHostName)
+{
+  if (host->isHttps != isHttps ||
+      host->address.family != address->family ||
+      host->address.port != address->port)
+    return 0;
+  if (address->family == AF_INET ? host->address.ipv4 != address->ipv4 : memcmp(host->address.ipv6, address->ipv6, sizeof(address->ipv6)) != 0)
+    return 0;
+  if (!host->tlsextHostName || !tlsextHostName)
+    return host->tlsextHostName == tlsextHostName;
+  return strcmp(host->tlsextHostName, tlsextHostName) == 0;
+}
+
+static HTTPPoolHost *poolHostGet(HTTPClientPool *pool, const HostAddress *address, int isHttps, const char *tlsextHostName)
+{
+  for (HTTPPoolHost *host = pool->hosts; host; host = host->next) {
+    if (poolHostMatch(host, address, isHttps, tlsextHostName))
+      return host;
+  }
+
+  HTTPPoolHost *host = (HTTPPoolHost*)calloc(1, sizeof(HTTPPoolHost));
+  host->pool = pool;
+  host->address = *address;
+  host->isHttps = isHttps;
+  if (tlsextHostName) {
+    size_t size = strlen(tlsextHostName) + 1;
+    host->tlsextHostName = (char*)malloc(size);
+    memcpy(host->tlsextHostName, tlsextHostName, size);
+  }
+
+  host->next = pool->hosts;
+  pool->hosts = host;
+  return host;
+}
+
+static void poolPendingPush(HTTPPoolHost *host, HTTPPoolRequest *request, int front)
+{
+  if (front) {
+    request->next = host->pendingHead;
+    host->pendingHead = request;
+    if (!host->pendingTail)
+      host->pendingTail = request;
+  } else {
+    request->next = 0;
+    if (host->pendingTail)
+      host->pendingTail->next = request;
+    else
+      host->pendingHead = request;
+    host->pendingTail = request;
+  }
+
+  host->pendingNum++;
+}
+
+static HTTPPoolRequest *poolPendingPop(HTTPPoolHost *host)
+{
+  HTTPPoolRequest *request = host->pendingHead;
+  host->pendingHead = request->next;
+  if (!host->pendingHead)
+    host->pendingTail = 0;
+  host->pendingNum--;
+  return request;
+}
+
+static void poolRequestFinish(HTTPPoolRequest *request, AsyncOpStatus status)
+{
+  if (request->callback)
+    request->callback(status, request->host->pool, request->arg);
+  free(request->data);
+  free(request);
+}
+
+static void poolFailPending(HTTPPoolHost *host, AsyncOpStatus status)
+{
+  while (host->pendingHead)
+    poolRequestFinish(poolPendingPop(host), status);
+}
+
+static void poolFree(HTTPClientPool *pool)
+{
+  HTTPPoolHost *host = pool->hosts;
+  while (host) {
+    HTTPPoolHost *next = host->next;
+    free(host->tlsextHostName);
+    free(host);
+    host = next;
+  }
+
+  free(pool);
+}
+
+static void poolConnectionRelease(HTTPPoolConnection *connection)
+{
+  if (connection->closed && connection->pendingOps == 0) {
+    HTTPClientPool *pool = connection->host->pool;
+    free(connection);
+    if (--pool->liveConnections == 0 && pool->deleted)
+      poolFree(pool);
+  }
+}
+
+static void poolConnectionClose(HTTPPoolConnection *connection)
+{
+  if (connection->closed)
+    return;
+
+  HTTPPoolHost *host = connection->host;
+  for (HTTPPoolConnection **p = &host->connections; *p; p = &(*p)->next) {
+    if (*p == connection) {
+      *p = connection->next;
+      break;
+    }
+  }
+
+  host->connectionsNum--;
+  if (!connection->connected)
+    host->connectingNum--;
+  connection->closed = 1;
+  // Pipelined requests written directly to socket, cancel them together with responses
+  cancelIo(host->isHttps ? (aioObjectRoot*)connection->client->sslSocket : (aioObjectRoot*)connection->client->plainSocket);
+  httpClientDelete(connection->client);
+}
+
+static void poolConnectCb(AsyncOpStatus status, HTTPClient *client, void *arg)
+{
+  __UNUSED(client);
+  HTTPPoolConnection *connection = (HTTPPoolConnection*)arg;
+  HTTPPoolHost *host = connection->host;
+  if (!connection->closed) {
+    if (status == aosSuccess) {
+      connection->connected = 1;
+      connection->lastUsed = getTimeMark();
+      host->connectingNum--;
+    } else {
+      poolConnectionClose(connection);
+      // Nobody else can serve waiting requests
+      if (!host->connectionsNum)
+        poolFailPending(host, status);
+    }
+
+    poolDispatch(host);
+  }
+
+  connection->pendingOps--;
+  poolConnectionRelease(connection);
+}
+
+static int poolConnectionOpen(HTTPPoolHost *host, uint64_t usTimeout)
+{
+  HTTPClientPool *pool = host->pool;
+  socketTy fd = socketCreate(host->address.family, SOCK_STREAM, IPPROTO_TCP, 1);
+  if (fd == INVALID_SOCKET)
+    return 0;
+
+  HTTPPoolConnection *connection = (HTTPPoolConnection*)calloc(1, sizeof(HTTPPoolConnection));
+  aioObject *socket = newSocketIo(pool->base, fd);
+  connection->host = host;
+  connection->client = host->isHttps ?
+    httpsClientNew(pool->base, sslSocketNew(pool->base, socket)) :
+    httpClientNew(pool->base, socket);
+  connection->pendingOps = 1;
+  connection->next = host->connections;
+  host->connections = connection;
+  host->connectionsNum++;
+  host->connectingNum++;
+  pool->liveConnections++;
+  pool->stats.connects++;
+  aioHttpConnect(connection->client, &host->address, host->tlsextHostName, usTimeout, poolConnectCb, connection);
+  return 1;
+}
+
+static void poolWriteDone(HTTPPoolConnection *connection, AsyncOpStatus status)
+{
+  if (status == aosSuccess)
+    connection->requestsWritten++;
+  else
+    poolConnectionClose(connection);
+  connection->pendingOps--;
+  poolConnectionRelease(connection);
+}
+
+static void poolWriteCb(AsyncOpStatus status, aioObject *object, size_t transferred, void *arg)
+{
+  __UNUSED(object);
+  __UNUSED(transferred);
+  poolWriteDone((HTTPPoolConnection*)arg, status);
+}
+
+static void poolSslWriteCb(AsyncOpStatus status, SSLSocket *object, size_t transferred, void *arg)
+{
+  __UNUSED(object);
+  __UNUSED(transferred);
+  poolWriteDone((HTTPPoolConnection*)arg, status);
+}
+
+static int isConnectionClose(const Raw *value)
+{
+  static const char closeToken[] = "close";
+  if (value->size != sizeof(closeToken)-1)
+    return 0;
+  for (size_t i = 0; i < value->size; i++) {
+    char c = value->data[i];
+    if ((c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c) != closeToken[i])
+      return 0;
+  }
+
+  return 1;
+}
+
+// Watches connection persistence and forwards components to user parser
+static int poolParseCb(HttpComponent *component, void *arg)
+{
+  HTTPPoolRequest *request = (HTTPPoolRequest*)arg;
+  switch (component->type) {
+    case httpDtInitialize :
+      request->connectionClose = 0;
+      break;
+    case httpDtStartLine :
+      // HTTP/1.0 server closes connection after response
+      if (component->startLine.majorVersion == 1 && component->startLine.minorVersion == 0)
+        request->connectionClose = 1;
+      break;
+    case httpDtHeaderEntry :
+      if (component->header.entryType == hhConnection)
+        request->connectionClose = isConnectionClose(&component->header.stringValue);
+      break;
+  }
+
+  if (request->connectionClose)
+    request->connection->closing = 1;
+  return request->parseCallback(component, request->parseArg);
+}
+
+static void poolResponseCb(AsyncOpStatus status, HTTPClient *client, void *arg)
+{
+  __UNUSED(client);
+  HTTPPoolRequest *request = (HTTPPoolRequest*)arg;
+  HTTPPoolConnection *connection = request->connection;
+  HTTPPoolHost *host = connection->host;
+  HTTPClientPool *pool = host->pool;
+  connection->inFlight--;
+  if (status == aosSuccess) {
+    connection->requestsServed++;
+    connection->lastUsed = getTimeMark();
+    if (request->connectionClose)
+      poolConnectionClose(connection);
+    poolRequestFinish(request, aosSuccess);
+  } else {
+    // Request sent again when connection closed under it: by previous 'Connection: close'
+    // response or failure of other request (canceled), or by server while reused connection
+    // was idle. Server could process completely written request, only idempotent one repeated
+    int written = request->sequence < connection->requestsWritten;
+    int retry = !pool->deleted &&
+                request->attempts < 2 &&
+                (request->idempotent || !written) &&
+                ((connection->closed && status == aosCanceled) || (connection->requestsServed && status != aosTimeout));
+    // Response stream can't be resynchronized after error
+    poolConnectionClose(connection);
+    if (retry) {
+      pool->stats.retries++;
+      poolPendingPush(host, request, 1);
+    } else {
+      poolRequestFinish(request, status);
+    }
+  }
+
+  if (!pool->deleted)
+    poolDispatch(host);
+  connection->pendingOps--;
+  poolConnectionRelease(connection);
+}
+
+static void poolSend(HTTPPoolConnection *connection, HTTPPoolRequest *request)
+{
+  HTTPClientPool *pool = connection->host->pool;
+  HTTPClient *client = connection->client;
+  pool->stats.requests++;
+  if (connection->inFlight)
+    pool->stats.pipelined++;
+
+  request->connection = connection;
+  request->sequence = connection->requestsSent++;
+  request->attempts++;
+  connection->inFlight++;
+  connection->pendingOps += 2;
+  if (client->isHttps)
+    aioSslWrite(client->sslSocket, request->data, request->size, afWaitAll, request->usTimeout, poolSslWriteCb, connection);
+  else
+    aioWrite(client->plainSocket, request->data, request->size, afWaitAll, request->usTimeout, poolWriteCb, connection);
+
+  // Responses parsed in order of requests by client operation queue
+  HTTPOp *op = allocHttpOp(httpParseStart, requestFinish, client, httpOpRequest, poolParseCb, request, (void*)poolResponseCb, request, afNone, request->usTimeout);
+  op->state = 2;
+  combinerPushOperation(&op->root, aaStart);
+}
+
+static HTTPPoolConnection *poolPickConnection(HTTPPoolHost *host)
+{
+  HTTPPoolConnection *best = 0;
+  for (HTTPPoolConnection *connection = host->connections; connection; connection = connection->next) {
+    if (!connection->connected || connection->closing)
+      continue;
+    if (!connection->inFlight)
+      return connection;
+    if (connection->inFlight < host->pool->pipelineDepth && (!best || connection->inFlight < best->inFlight))
+      best = connection;
+  }
+
+  return best;
+}
+
+static void poolDispatch(HTTPPoolHost *host)
+{
+  HTTPClientPool *pool = host->pool;
+  while (host->pendingHead) {
+    HTTPPoolConnection *connection = poolPickConnection(host);
+    if (!connection)
+      break;
+    poolSend(connection, poolPendingPop(host));
+  }
+
+  while (host->pendingNum > host->connectingNum && host->connectionsNum < pool->maxConnections) {
+    if (!poolConnectionOpen(host, host->pendingHead->usTimeout)) {
+      if (!host->connectionsNum)
+        poolFailPending(host, aosUnknownError);
+      break;
+    }
+  }
+}
+
+static void poolIdleCb(aioUserEvent *event, void *arg)
+{
+  __UNUSED(event);
+  HTTPClientPool *pool = (HTTPClientPool*)arg;
+  timeMark now = getTimeMark();
+  for (HTTPPoolHost *host = pool->hosts; host; host = host->next) {
+    HTTPPoolConnection *connection = host->connections;
+    while (connection) {
+      HTTPPoolConnection *next = connection->next;
+      if (connection->connected && !connection->inFlight && usDiff(connection->lastUsed, now) >= pool->idleTimeout) {
+        pool->stats.idleEvictions++;
+        poolConnectionClose(connection);
+        poolConnectionRelease(connection);
+      }
+      connection = next;
+    }
+  }
+}
+
+HTTPClientPool *httpClientPoolNew(asyncBase *base, unsigned maxConnections, unsigned pipelineDepth, uint64_t usIdleTimeout)
+{
+  HTTPClientPool *pool = (HTTPClientPool*)calloc(1, sizeof(HTTPClientPool));
+  pool->base = base;
+  pool->maxConnections = maxConnections ? maxConnections : 1;
+  pool->pipelineDepth = pipelineDepth ? pipelineDepth : 1;
+  pool->idleTimeout = usIdleTimeout;
+  if (usIdleTimeout) {
+    pool->idleEvent = newUserEvent(base, 0, poolIdleCb, pool);
+    userEventStartTimer(pool->idleEvent, usIdleTimeout, -1);
+  }
+
+  return pool;
+}
+
+void httpClientPoolDelete(HTTPClientPool *pool)
+{
+  pool->deleted = 1;
+  if (pool->idleEvent) {
+    userEventStopTimer(pool->idleEvent);
+    deleteUserEvent(pool->idleEvent);
+  }
+
+  // Hold pool while connections released
+  pool->liveConnections++;
+  for (HTTPPoolHost *host = pool->hosts; host; host = host->next) {
+    poolFailPending(host, aosCanceled);
+    while (host->connections) {
+      HTTPPoolConnection *connection = host->connections;
+      poolConnectionClose(connection);
+      poolConnectionRelease(connection);
+    }
+  }
+
+  if (--pool->liveConnections == 0)
+    poolFree(pool);
+}
+
+void httpClientPoolGetStats(HTTPClientPool *pool, HTTPClientPoolStats *stats)
+{
+  *stats = pool->stats;
+}
+
+// RFC 9110 9.2.2
+static int isIdempotentRequest(const char *request, size_t size)
+{
+  const char *space = (const char*)memchr(request, ' ', size);
+  switch (space ? httpMethodId(request, (size_t)(space - request)) : hmUnknown) {
+    case hmGet :
+    case hmHead :
+    case hmPut :
+    case hmDelete :
+    case hmOptions :
+    case hmTrace :
+      return 1;
+    default :
+      return 0;
+  }
+}
+
+void aioHttpPoolRequest(HTTPClientPool *pool,
+                        const HostAddress *address,
+                        int isHttps,
+                        const char *tlsextHostName,
+                        const char *request,
+                        size_t requestSize,
+                        uint64_t usTimeout,
+                        httpParseCb parseCallback,
+                        void *parseArg,
+                        httpPoolRequestCb callback,
+                        void *arg)
+{
+  HTTPPoolHost *host = poolHostGet(pool, address, isHttps, tlsextHostName);
+  HTTPPoolRequest *poolRequest = (HTTPPoolRequest*)malloc(sizeof(HTTPPoolRequest));
+  poolRequest->host = host;
+  poolRequest->connection = 0;
+  poolRequest->data = (char*)malloc(requestSize);
+  memcpy(poolRequest->data, request, requestSize);
+  poolRequest->size = requestSize;
+  poolRequest->usTimeout = usTimeout;
+  poolRequest->parseCallback = parseCallback;
+  poolRequest->parseArg = parseArg;
+  poolRequest->callback = callback;
+  poolRequest->arg = arg;
+  poolRequest->attempts = 0;
+  poolRequest->connectionClose = 0;
+  poolRequest->idempotent = isIdempotentRequest(request, requestSize);
+  poolPendingPush(host, poolRequest, 0);
+  poolDispatch(host);
+}
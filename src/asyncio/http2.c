@@ -0,0 +1,1558 @@
+#include "asyncio/http2.h"
+
+#include "asyncio/dynamicBuffer.h"
+#include "asyncio/socket.h"
+#include "asyncio/timer.h"
+#include "p2putils/Hpack.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HTTP2_FRAME_HEADER_SIZE 9
+#define HTTP2_DEFAULT_WINDOW 65535
+#define HTTP2_DEFAULT_FRAME_SIZE 16384
+#define HTTP2_MAX_WINDOW 0x7FFFFFFF
+#define HTTP2_HEADER_TABLE_SIZE 4096
+// Local receive windows, WINDOW_UPDATE sent when half of window consumed. Connection window
+// credited only when buffered body released, so it bounds memory of all incomplete messages
+#define HTTP2_STREAM_WINDOW (1u << 20)
+#define HTTP2_CONNECTION_WINDOW (1u << 24)
+// Larger body can't be received while connection window held by other streams
+#define HTTP2_MAX_BODY_SIZE (HTTP2_CONNECTION_WINDOW/2)
+// Announced SETTINGS_MAX_HEADER_LIST_SIZE, also limit of encoded header block
+#define HTTP2_MAX_HEADER_LIST_SIZE 65536
+#define HTTP2_MAX_STREAMS 1024
+#define HTTP2_URGENCY_LEVELS 8
+#define HTTP2_DEFAULT_URGENCY 3
+#define HTTP2_STREAM_BUCKETS 256
+// DATA bytes scheduled for one socket write
+#define HTTP2_WRITE_BUDGET 65536
+#define HTTP2_IN_BUFFER_SIZE (4*(HTTP2_DEFAULT_FRAME_SIZE + HTTP2_FRAME_HEADER_SIZE))
+#define HTTP2_TIMER_PERIOD 10000
+
+static const char http2Preface[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+#define HTTP2_PREFACE_SIZE (sizeof(http2Preface)-1)
+
+typedef enum {
+  h2fData = 0,
+  h2fHeaders,
+  h2fPriority,
+  h2fRstStream,
+  h2fSettings,
+  h2fPushPromise,
+  h2fPing,
+  h2fGoaway,
+  h2fWindowUpdate,
+  h2fContinuation
+} Http2FrameTy;
+
+enum {
+  h2flEndStream = 0x1,
+  h2flAck = 0x1,
+  h2flEndHeaders = 0x4,
+  h2flPadded = 0x8,
+  h2flPriority = 0x20
+};
+
+enum {
+  h2sHeaderTableSize = 1,
+  h2sEnablePush,
+  h2sMaxConcurrentStreams,
+  h2sInitialWindowSize,
+  h2sMaxFrameSize,
+  h2sMaxHeaderListSize
+};
+
+enum {
+  h2eNoError = 0,
+  h2eProtocolError,
+  h2eInternalError,
+  h2eFlowControlError,
+  h2eSettingsTimeout,
+  h2eStreamClosed,
+  h2eFrameSizeError,
+  h2eRefusedStream,
+  h2eCancel,
+  h2eCompressionError,
+  h2eConnectError,
+  h2eEnhanceYourCalm
+};
+
+__NO_PADDING_BEGIN
+struct HTTP2Stream {
+  HTTP2Stream *hashNext;
+  // Send queue of urgency level; for client, also queue of requests waiting concurrency limit
+  HTTP2Stream *queueNext;
+  HTTP2Connection *connection;
+  uint32_t id;
+  unsigned urgency;
+  int queued;
+  int localClosed;
+  int remoteClosed;
+  // Server: request passed to handler, response not given yet
+  int delivered;
+  int reset;
+  int64_t sendWindow;
+  uint32_t recvUnacked;
+  unsigned status;
+  // Outgoing body
+  uint8_t *out;
+  size_t outSize;
+  size_t outOffset;
+  // Request headers before send, then received headers: sizes of name and value followed by them
+  dynamicBuffer headerData;
+  dynamicBuffer body;
+  timeMark started;
+  uint64_t usTimeout;
+  http2ResponseCb *callback;
+  void *arg;
+};
+
+struct HTTP2Connection {
+  asyncBase *base;
+  int isServer;
+  int isHttps;
+  aioObject *plainSocket;
+  SSLSocket *sslSocket;
+  HpackEncoder *encoder;
+  HpackDecoder *decoder;
+  uint8_t *inBuffer;
+  size_t inDataSize;
+  // Header block split into CONTINUATION frames
+  dynamicBuffer headerBlock;
+  uint32_t headerBlockStream;
+  int headerBlockEndStream;
+  int continuation;
+  // Header array of message passed to callback
+  dynamicBuffer headers;
+  // Frames waiting socket write, only one write in flight
+  dynamicBuffer out;
+  int writing;
+  int64_t sendWindow;
+  // Received bytes released but not acknowledged yet and bytes held in stream bodies
+  uint32_t recvUnacked;
+  uint32_t recvBuffered;
+  uint32_t peerInitialWindow;
+  uint32_t peerMaxFrameSize;
+  uint32_t peerMaxStreams;
+  uint32_t nextStreamId;
+  uint32_t lastPeerStreamId;
+  unsigned openStreams;
+  HTTP2Stream *streams[HTTP2_STREAM_BUCKETS];
+  HTTP2Stream *sendHead[HTTP2_URGENCY_LEVELS];
+  HTTP2Stream *sendTail[HTTP2_URGENCY_LEVELS];
+  HTTP2Stream *waitingHead;
+  HTTP2Stream *waitingTail;
+  // Server: client preface received; client: server SETTINGS received
+  int prefaceReceived;
+  int connecting;
+  int goaway;
+  int closed;
+  int deleted;
+  // Owner, read, write and connect operations, requests delivered to server handler
+  unsigned refs;
+  http2ConnectCb *connectCallback;
+  void *connectArg;
+  timeMark connectStarted;
+  uint64_t connectTimeout;
+  http2RequestCb *requestCallback;
+  void *requestArg;
+  http2CloseCb *closeCallback;
+  void *closeArg;
+  aioUserEvent *timer;
+  int timerActive;
+  unsigned timedStreams;
+  HTTP2Stats stats;
+};
+__NO_PADDING_END
+
+static void connectionFlush(HTTP2Connection *connection);
+static void connectionClose(HTTP2Connection *connection, AsyncOpStatus status);
+static void connectionStartWaiting(HTTP2Connection *connection);
+
+static inline uint32_t readUint32(const uint8_t *p)
+{
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static inline void writeUint32(uint8_t *p, uint32_t value)
+{
+  p[0] = (uint8_t)(value >> 24);
+  p[1] = (uint8_t)(value >> 16);
+  p[2] = (uint8_t)(value >> 8);
+  p[3] = (uint8_t)value;
+}
+
+static int rawEquals(const Raw *raw, const char *string)
+{
+  size_t size = strlen(string);
+  return raw->size == size && memcmp(raw->data, string, size) == 0;
+}
+
+// Stream buffers allocated on first use
+static void streamBufferWrite(dynamicBuffer *buffer, const void *data, size_t size)
+{
+  if (!buffer->allocatedSize)
+    dynamicBufferInit(buffer, size > 256 ? size : 256);
+  dynamicBufferWrite(buffer, data, size);
+}
+
+static void streamAddHeader(HTTP2Stream *stream, const char *name, size_t nameSize, const char *value, size_t valueSize)
+{
+  uint32_t sizes[2] = {(uint32_t)nameSize, (uint32_t)valueSize};
+  streamBufferWrite(&stream->headerData, sizes, sizeof(sizes));
+  streamBufferWrite(&stream->headerData, name, nameSize);
+  streamBufferWrite(&stream->headerData, value, valueSize);
+}
+
+static void writeFrameHeader(HTTP2Connection *connection, size_t length, uint8_t type, uint8_t flags, uint32_t streamId)
+{
+  uint8_t *p = (uint8_t*)dynamicBufferAlloc(&connection->out, HTTP2_FRAME_HEADER_SIZE);
+  p[0] = (uint8_t)(length >> 16);
+  p[1] = (uint8_t)(length >> 8);
+  p[2] = (uint8_t)length;
+  p[3] = type;
+  p[4] = flags;
+  writeUint32(p + 5, streamId & HTTP2_MAX_WINDOW);
+  connection->stats.framesOut++;
+}
+
+static void writeFrame(HTTP2Connection *connection, uint8_t type, uint8_t flags, uint32_t streamId, const void *payload, size_t length)
+{
+  writeFrameHeader(connection, length, type, flags, streamId);
+  if (length)
+    dynamicBufferWrite(&connection->out, payload, length);
+}
+
+static void writeWindowUpdate(HTTP2Connection *connection, uint32_t streamId, uint32_t increment)
+{
+  uint8_t payload[4];
+  writeUint32(payload, increment);
+  writeFrame(connection, h2fWindowUpdate, 0, streamId, payload, sizeof(payload));
+}
+
+static void writeRstStream(HTTP2Connection *connection, uint32_t streamId, uint32_t errorCode)
+{
+  uint8_t payload[4];
+  writeUint32(payload, errorCode);
+  writeFrame(connection, h2fRstStream, 0, streamId, payload, sizeof(payload));
+}
+
+static void writeSettings(HTTP2Connection *connection)
+{
+  uint8_t payload[24];
+  uint8_t *p = payload;
+  uint32_t settings[4][2] = {
+    {h2sMaxConcurrentStreams, HTTP2_MAX_STREAMS},
+    {h2sInitialWindowSize, HTTP2_STREAM_WINDOW},
+    {h2sMaxHeaderListSize, HTTP2_MAX_HEADER_LIST_SIZE},
+    {h2sEnablePush, 0}
+  };
+
+  // ENABLE_PUSH sent by client only
+  unsigned settingsNum = connection->isServer ? 3 : 4;
+  for (unsigned i = 0; i < settingsNum; i++) {
+    p[0] = (uint8_t)(settings[i][0] >> 8);
+    p[1] = (uint8_t)settings[i][0];
+    writeUint32(p + 2, settings[i][1]);
+    p += 6;
+  }
+
+  writeFrame(connection, h2fSettings, 0, 0, payload, (size_t)(p - payload));
+  writeWindowUpdate(connection, 0, HTTP2_CONNECTION_WINDOW - HTTP2_DEFAULT_WINDOW);
+}
+
+// HEADERS and CONTINUATION frames of block from encoder
+static void writeHeaderBlock(HTTP2Connection *connection, uint32_t streamId, int endStream)
+{
+  size_t size;
+  const uint8_t *data = (const uint8_t*)hpackEncodedData(connection->encoder, &size);
+  uint8_t type = h2fHeaders;
+  uint8_t flags = endStream ? h2flEndStream : 0;
+  do {
+    size_t frameSize = size < connection->peerMaxFrameSize ? size : connection->peerMaxFrameSize;
+    writeFrame(connection, type, flags | (frameSize == size ? h2flEndHeaders : 0), streamId, data, frameSize);
+    data += frameSize;
+    size -= frameSize;
+    type = h2fContinuation;
+    flags = 0;
+  } while (size);
+}
+
+static void encodeStoredHeaders(HTTP2Connection *connection, HTTP2Stream *stream)
+{
+  const uint8_t *p = (const uint8_t*)stream->headerData.data;
+  const uint8_t *end = p + stream->headerData.size;
+  while (p < end) {
+    uint32_t sizes[2];
+    memcpy(sizes, p, sizeof(sizes));
+    const char *name = (const char*)p + sizeof(sizes);
+    const char *value = name + sizes[0];
+    HpackIndexingTy indexing = hpackIndexed;
+    if ((sizes[0] == 13 && memcmp(name, "authorization", 13) == 0) ||
+        (sizes[0] == 19 && memcmp(name, "proxy-authorization", 19) == 0))
+      indexing = hpackNeverIndexed;
+    hpackEncodeHeader(connection->encoder, name, sizes[0], value, sizes[1], indexing);
+    p += sizeof(sizes) + sizes[0] + sizes[1];
+  }
+
+  dynamicBufferClear(&stream->headerData);
+}
+
+static unsigned streamBucket(uint32_t id)
+{
+  return (id >> 1) & (HTTP2_STREAM_BUCKETS - 1);
+}
+
+static HTTP2Stream *streamFind(HTTP2Connection *connection, uint32_t id)
+{
+  HTTP2Stream *stream = connection->streams[streamBucket(id)];
+  while (stream && stream->id != id)
+    stream = stream->hashNext;
+  return stream;
+}
+
+static void streamInsert(HTTP2Connection *connection, HTTP2Stream *stream)
+{
+  unsigned bucket = streamBucket(stream->id);
+  stream->hashNext = connection->streams[bucket];
+  connection->streams[bucket] = stream;
+  connection->openStreams++;
+  connection->stats.streams++;
+  if (connection->openStreams > connection->stats.peakStreams)
+    connection->stats.peakStreams = connection->openStreams;
+}
+
+static void streamQueue(HTTP2Connection *connection, HTTP2Stream *stream)
+{
+  if (stream->queued)
+    return;
+  stream->queued = 1;
+  stream->queueNext = 0;
+  if (connection->sendTail[stream->urgency])
+    connection->sendTail[stream->urgency]->queueNext = stream;
+  else
+    connection->sendHead[stream->urgency] = stream;
+  connection->sendTail[stream->urgency] = stream;
+}
+
+static void streamUnqueue(HTTP2Connection *connection, HTTP2Stream *stream)
+{
+  if (!stream->queued)
+    return;
+  HTTP2Stream *prev = 0;
+  HTTP2Stream *current = connection->sendHead[stream->urgency];
+  while (current != stream) {
+    prev = current;
+    current = current->queueNext;
+  }
+
+  if (prev)
+    prev->queueNext = stream->queueNext;
+  else
+    connection->sendHead[stream->urgency] = stream->queueNext;
+  if (connection->sendTail[stream->urgency] == stream)
+    connection->sendTail[stream->urgency] = prev;
+  stream->queued = 0;
+}
+
+static HTTP2Stream *streamNew(HTTP2Connection *connection, unsigned urgency)
+{
+  HTTP2Stream *stream = (HTTP2Stream*)calloc(1, sizeof(HTTP2Stream));
+  stream->connection = connection;
+  stream->urgency = urgency < HTTP2_URGENCY_LEVELS ? urgency : HTTP2_URGENCY_LEVELS-1;
+  return stream;
+}
+
+// Released DATA bytes returned to peer by connection WINDOW_UPDATE, written by next flush
+static void connectionCredit(HTTP2Connection *connection, size_t size)
+{
+  connection->recvUnacked += (uint32_t)size;
+  if (connection->recvUnacked >= HTTP2_CONNECTION_WINDOW/2 && !connection->closed) {
+    writeWindowUpdate(connection, 0, connection->recvUnacked);
+    connection->recvUnacked = 0;
+  }
+}
+
+static void streamFree(HTTP2Stream *stream)
+{
+  HTTP2Connection *connection = stream->connection;
+  connection->recvBuffered -= (uint32_t)stream->body.size;
+  connectionCredit(connection, stream->body.size);
+  free(stream->out);
+  dynamicBufferFree(&stream->headerData);
+  dynamicBufferFree(&stream->body);
+  free(stream);
+}
+
+// Removes stream from connection, memory still owned by caller
+static void streamDetach(HTTP2Connection *connection, HTTP2Stream *stream)
+{
+  HTTP2Stream **p = &connection->streams[streamBucket(stream->id)];
+  while (*p && *p != stream)
+    p = &(*p)->hashNext;
+  if (*p) {
+    *p = stream->hashNext;
+    connection->openStreams--;
+  }
+
+  streamUnqueue(connection, stream);
+  if (stream->usTimeout)
+    connection->timedStreams--;
+}
+
+static void streamBuildMessage(HTTP2Connection *connection, HTTP2Stream *stream, HTTP2Message *message)
+{
+  memset(message, 0, sizeof(HTTP2Message));
+  message->status = stream->status;
+  dynamicBufferClear(&connection->headers);
+  const uint8_t *p = (const uint8_t*)stream->headerData.data;
+  const uint8_t *end = p + stream->headerData.size;
+  while (p < end) {
+    uint32_t sizes[2];
+    memcpy(sizes, p, sizeof(sizes));
+    Raw name = {(const char*)p + sizeof(sizes), sizes[0]};
+    Raw value = {name.data + sizes[0], sizes[1]};
+    p += sizeof(sizes) + sizes[0] + sizes[1];
+    if (name.size && name.data[0] == ':') {
+      if (rawEquals(&name, ":method"))
+        message->method = value;
+      else if (rawEquals(&name, ":scheme"))
+        message->scheme = value;
+      else if (rawEquals(&name, ":authority"))
+        message->authority = value;
+      else if (rawEquals(&name, ":path"))
+        message->path = value;
+    } else {
+      HTTP2Header *header = (HTTP2Header*)dynamicBufferAlloc(&connection->headers, sizeof(HTTP2Header));
+      header->name = name;
+      header->value = value;
+    }
+  }
+
+  message->headers = (const HTTP2Header*)connection->headers.data;
+  message->headersNum = connection->headers.size / sizeof(HTTP2Header);
+  message->body = stream->body.data;
+  message->bodySize = stream->body.size;
+}
+
+// Client request finished by response, error or timeout
+static void streamFinish(HTTP2Connection *connection, HTTP2Stream *stream, AsyncOpStatus status)
+{
+  streamDetach(connection, stream);
+  HTTP2Message message;
+  if (status == aosSuccess)
+    streamBuildMessage(connection, stream, &message);
+  stream->callback(status, connection, status == aosSuccess ? &message : 0, stream->arg);
+  streamFree(stream);
+}
+
+static void streamStart(HTTP2Connection *connection, HTTP2Stream *stream)
+{
+  stream->id = connection->nextStreamId;
+  connection->nextStreamId += 2;
+  stream->sendWindow = connection->peerInitialWindow;
+  streamInsert(connection, stream);
+
+  hpackEncodeBegin(connection->encoder);
+  encodeStoredHeaders(connection, stream);
+  writeHeaderBlock(connection, stream->id, stream->outSize == 0);
+  if (stream->outSize)
+    streamQueue(connection, stream);
+  else
+    stream->localClosed = 1;
+}
+
+static void connectionStartWaiting(HTTP2Connection *connection)
+{
+  while (connection->waitingHead &&
+         !connection->connecting &&
+         !connection->closed &&
+         connection->openStreams < connection->peerMaxStreams) {
+    HTTP2Stream *stream = connection->waitingHead;
+    connection->waitingHead = stream->queueNext;
+    if (!connection->waitingHead)
+      connection->waitingTail = 0;
+    stream->queueNext = 0;
+    streamStart(connection, stream);
+  }
+}
+
+static void connectionTimerStart(HTTP2Connection *connection)
+{
+  if (!connection->timerActive) {
+    connection->timerActive = 1;
+    userEventStartTimer(connection->timer, HTTP2_TIMER_PERIOD, -1);
+  }
+}
+
+static void connectionTimerStop(HTTP2Connection *connection)
+{
+  if (connection->timerActive) {
+    connection->timerActive = 0;
+    userEventStopTimer(connection->timer);
+  }
+}
+
+static void connectionFree(HTTP2Connection *connection)
+{
+  deleteUserEvent(connection->timer);
+  hpackEncoderDelete(connection->encoder);
+  hpackDecoderDelete(connection->decoder);
+  dynamicBufferFree(&connection->headerBlock);
+  dynamicBufferFree(&connection->headers);
+  dynamicBufferFree(&connection->out);
+  free(connection->inBuffer);
+  free(connection);
+}
+
+static void connectionRelease(HTTP2Connection *connection)
+{
+  if (--connection->refs == 0)
+    connectionFree(connection);
+}
+
+static void connectionError(HTTP2Connection *connection, uint32_t errorCode)
+{
+  uint8_t payload[8];
+  writeUint32(payload, connection->lastPeerStreamId);
+  writeUint32(payload + 4, errorCode);
+  writeFrame(connection, h2fGoaway, 0, 0, payload, sizeof(payload));
+  // GOAWAY not held back by write in flight, socket closed right after it
+  connection->writing = 0;
+  connectionFlush(connection);
+  connectionClose(connection, aosUnknownError);
+}
+
+static void connectionClose(HTTP2Connection *connection, AsyncOpStatus status)
+{
+  if (connection->closed)
+    return;
+
+  connection->closed = 1;
+  connection->refs++;
+  connectionTimerStop(connection);
+
+  // Detach all streams first: callbacks may delete connection
+  HTTP2Stream *failed = 0;
+  for (unsigned i = 0; i < HTTP2_STREAM_BUCKETS; i++) {
+    while (connection->streams[i]) {
+      HTTP2Stream *stream = connection->streams[i];
+      streamDetach(connection, stream);
+      if (stream->delivered) {
+        // Server handler still owns request, stream freed by http2Respond
+        continue;
+      } else if (connection->isServer) {
+        streamFree(stream);
+      } else {
+        stream->queueNext = failed;
+        failed = stream;
+      }
+    }
+  }
+
+  while (connection->waitingHead) {
+    HTTP2Stream *stream = connection->waitingHead;
+    connection->waitingHead = stream->queueNext;
+    stream->queueNext = failed;
+    failed = stream;
+  }
+  connection->waitingTail = 0;
+
+  if (connection->isHttps)
+    sslSocketDelete(connection->sslSocket);
+  else
+    deleteAioObject(connection->plainSocket);
+
+  if (connection->connecting) {
+    connection->connecting = 0;
+    if (connection->connectCallback)
+      connection->connectCallback(status, connection, connection->connectArg);
+  }
+
+  while (failed) {
+    HTTP2Stream *stream = failed;
+    failed = stream->queueNext;
+    stream->callback(status, connection, 0, stream->arg);
+    streamFree(stream);
+  }
+
+  if (connection->closeCallback && !connection->deleted)
+    connection->closeCallback(connection, connection->closeArg);
+  connectionRelease(connection);
+}
+
+static void connectionTimerCb(aioUserEvent *event, void *arg)
+{
+  __UNUSED(event);
+  HTTP2Connection *connection = (HTTP2Connection*)arg;
+  if (connection->closed)
+    return;
+
+  timeMark now = getTimeMark();
+  if (connection->connecting && connection->connectTimeout && usDiff(connection->connectStarted, now) >= connection->connectTimeout) {
+    connectionClose(connection, aosTimeout);
+    return;
+  }
+
+  connection->refs++;
+  for (unsigned i = 0; i < HTTP2_STREAM_BUCKETS && !connection->closed; i++) {
+    HTTP2Stream *stream = connection->streams[i];
+    while (stream && !connection->closed) {
+      HTTP2Stream *next = stream->hashNext;
+      if (!connection->isServer && stream->usTimeout && usDiff(stream->started, now) >= stream->usTimeout) {
+        writeRstStream(connection, stream->id, h2eCancel);
+        streamFinish(connection, stream, aosTimeout);
+      }
+      stream = next;
+    }
+  }
+
+  // Requests still waiting concurrency limit
+  HTTP2Stream *expired = 0;
+  HTTP2Stream **p = &connection->waitingHead;
+  connection->waitingTail = 0;
+  while (*p) {
+    HTTP2Stream *stream = *p;
+    if (stream->usTimeout && usDiff(stream->started, now) >= stream->usTimeout) {
+      *p = stream->queueNext;
+      connection->timedStreams--;
+      stream->queueNext = expired;
+      expired = stream;
+    } else {
+      connection->waitingTail = stream;
+      p = &stream->queueNext;
+    }
+  }
+
+  while (expired) {
+    HTTP2Stream *stream = expired;
+    expired = stream->queueNext;
+    stream->callback(aosTimeout, connection, 0, stream->arg);
+    streamFree(stream);
+  }
+
+  if (!connection->closed) {
+    if (!connection->timedStreams && !connection->connecting)
+      connectionTimerStop(connection);
+    connectionFlush(connection);
+  }
+  connectionRelease(connection);
+}
+
+// DATA frames of queued streams: more urgent first, round robin inside urgency level
+static void connectionScheduleData(HTTP2Connection *connection)
+{
+  size_t budget = HTTP2_WRITE_BUDGET;
+  for (unsigned level = 0; level < HTTP2_URGENCY_LEVELS && budget; level++) {
+    while (connection->sendHead[level] && budget) {
+      if (connection->sendWindow <= 0) {
+        connection->stats.flowControlStalls++;
+        return;
+      }
+
+      HTTP2Stream *stream = connection->sendHead[level];
+      streamUnqueue(connection, stream);
+      if (stream->sendWindow <= 0) {
+        // Queued again by WINDOW_UPDATE
+        connection->stats.flowControlStalls++;
+        continue;
+      }
+
+      size_t size = stream->outSize - stream->outOffset;
+      if (size > connection->peerMaxFrameSize)
+        size = connection->peerMaxFrameSize;
+      if (size > (size_t)stream->sendWindow)
+        size = (size_t)stream->sendWindow;
+      if (size > (size_t)connection->sendWindow)
+        size = (size_t)connection->sendWindow;
+      if (size > budget)
+        size = budget;
+
+      int last = stream->outOffset + size == stream->outSize;
+      writeFrame(connection, h2fData, last ? h2flEndStream : 0, stream->id, stream->out + stream->outOffset, size);
+      stream->outOffset += size;
+      stream->sendWindow -= (int64_t)size;
+      connection->sendWindow -= (int64_t)size;
+      budget -= size;
+
+      if (!last) {
+        streamQueue(connection, stream);
+      } else {
+        stream->localClosed = 1;
+        free(stream->out);
+        stream->out = 0;
+        if (connection->isServer) {
+          // Response sent completely
+          streamDetach(connection, stream);
+          streamFree(stream);
+        }
+      }
+    }
+  }
+}
+
+static void connectionWriteDone(HTTP2Connection *connection, AsyncOpStatus status)
+{
+  connection->writing = 0;
+  if (!connection->closed) {
+    if (status == aosSuccess)
+      connectionFlush(connection);
+    else
+      connectionClose(connection, status);
+  }
+
+  connectionRelease(connection);
+}
+
+static void connectionWriteCb(AsyncOpStatus status, aioObject *object, size_t transferred, void *arg)
+{
+  __UNUSED(object);
+  __UNUSED(transferred);
+  connectionWriteDone((HTTP2Connection*)arg, status);
+}
+
+static void connectionSslWriteCb(AsyncOpStatus status, SSLSocket *object, size_t transferred, void *arg)
+{
+  __UNUSED(object);
+  __UNUSED(transferred);
+  connectionWriteDone((HTTP2Connection*)arg, status);
+}
+
+static void connectionFlush(HTTP2Connection *connection)
+{
+  if (connection->closed || connection->writing || connection->connecting == 2)
+    return;
+
+  connectionScheduleData(connection);
+  if (!connection->out.size)
+    return;
+
+  // Write functions copy data, buffer reused at once
+  connection->writing = 1;
+  connection->refs++;
+  ssize_t result = connection->isHttps ?
+    aioSslWrite(connection->sslSocket, connection->out.data, connection->out.size, afWaitAll, 0, connectionSslWriteCb, connection) :
+    aioWrite(connection->plainSocket, connection->out.data, connection->out.size, afWaitAll, 0, connectionWriteCb, connection);
+  dynamicBufferClear(&connection->out);
+  if (result == -(ssize_t)aosQueueFull) {
+    connection->writing = 0;
+    connectionClose(connection, aosQueueFull);
+    connectionRelease(connection);
+  }
+}
+
+typedef struct HeaderDecodeContext {
+  HTTP2Connection *connection;
+  HTTP2Stream *stream;
+  // Header list of stream over HTTP2_MAX_HEADER_LIST_SIZE, rest of block only decoded
+  int oversized;
+} HeaderDecodeContext;
+
+static int headerDecodeCb(const Raw *name, const Raw *value, void *arg)
+{
+  HeaderDecodeContext *context = (HeaderDecodeContext*)arg;
+  HTTP2Stream *stream = context->stream;
+  if (!stream || context->oversized)
+    return 1;
+
+  // Header list size as defined by RFC 7540 6.5.2, trailers counted together with headers
+  if (stream->headerData.size + name->size + value->size + 32 > HTTP2_MAX_HEADER_LIST_SIZE) {
+    context->oversized = 1;
+    return 1;
+  }
+
+  if (!context->connection->isServer && rawEquals(name, ":status")) {
+    stream->status = 0;
+    for (size_t i = 0; i < value->size && value->data[i] >= '0' && value->data[i] <= '9'; i++)
+      stream->status = stream->status*10 + (unsigned)(value->data[i] - '0');
+    return 1;
+  }
+
+  if (context->connection->isServer && rawEquals(name, "priority")) {
+    // RFC 9218 structured field, only urgency used
+    for (size_t i = 0; i + 2 < value->size; i++) {
+      if (value->data[i] == 'u' && value->data[i+1] == '=' && value->data[i+2] >= '0' && value->data[i+2] <= '7')
+        stream->urgency = (unsigned)(value->data[i+2] - '0');
+    }
+  }
+
+  streamAddHeader(stream, name->data, name->size, value->data, value->size);
+  return 1;
+}
+
+static void streamRemoteEnd(HTTP2Connection *connection, HTTP2Stream *stream)
+{
+  stream->remoteClosed = 1;
+  if (connection->isServer) {
+    stream->delivered = 1;
+    connection->refs++;
+    HTTP2Message message;
+    streamBuildMessage(connection, stream, &message);
+    connection->requestCallback(stream, &message, connection->requestArg);
+  } else {
+    // Request body not needed by server anymore
+    if (!stream->localClosed)
+      writeRstStream(connection, stream->id, h2eNoError);
+    streamFinish(connection, stream, aosSuccess);
+    connectionStartWaiting(connection);
+  }
+}
+
+// Stream id not used yet by its initiator; server never opens streams, push is disabled
+static int streamIdle(HTTP2Connection *connection, uint32_t id)
+{
+  int local = connection->isServer ? !(id & 1) : (id & 1);
+  return local ? id >= connection->nextStreamId : id > connection->lastPeerStreamId;
+}
+
+// Stream reset by local limit or stream error, server request dropped without response, client request failed
+static void streamAbort(HTTP2Connection *connection, HTTP2Stream *stream, uint32_t errorCode)
+{
+  writeRstStream(connection, stream->id, errorCode);
+  if (connection->isServer) {
+    streamDetach(connection, stream);
+    if (stream->delivered)
+      stream->reset = 1;
+    else
+      streamFree(stream);
+  } else {
+    streamFinish(connection, stream, aosUnknownError);
+    connectionStartWaiting(connection);
+  }
+}
+
+static void headerBlockComplete(HTTP2Connection *connection, uint32_t streamId, int endStream, const void *data, size_t size)
+{
+  HeaderDecodeContext context;
+  context.connection = connection;
+  context.stream = streamFind(connection, streamId);
+  context.oversized = 0;
+  int refused = 0;
+  if (!context.stream && connection->isServer) {
+    // New client stream id must be odd and greater than all previous ones
+    if (!(streamId & 1) || streamId <= connection->lastPeerStreamId) {
+      connectionError(connection, h2eProtocolError);
+      return;
+    }
+
+    connection->lastPeerStreamId = streamId;
+    if (connection->openStreams >= HTTP2_MAX_STREAMS || connection->goaway) {
+      refused = 1;
+    } else {
+      context.stream = streamNew(connection, HTTP2_DEFAULT_URGENCY);
+      context.stream->id = streamId;
+      context.stream->sendWindow = connection->peerInitialWindow;
+      streamInsert(connection, context.stream);
+    }
+  } else if (!context.stream && streamIdle(connection, streamId)) {
+    connectionError(connection, h2eProtocolError);
+    return;
+  }
+
+  // Block decoded even for unknown streams to keep HPACK state
+  if (hpackDecode(connection->decoder, data, size, headerDecodeCb, &context) != ParserResultOk) {
+    connectionError(connection, h2eCompressionError);
+    return;
+  }
+
+  if (refused) {
+    writeRstStream(connection, streamId, h2eRefusedStream);
+    return;
+  }
+
+  HTTP2Stream *stream = context.stream;
+  if (!stream || stream->remoteClosed)
+    return;
+
+  if (context.oversized) {
+    streamAbort(connection, stream, h2eEnhanceYourCalm);
+    return;
+  }
+
+  // Informational response followed by final one
+  if (!connection->isServer && stream->status >= 100 && stream->status < 200 && !endStream) {
+    stream->status = 0;
+    dynamicBufferClear(&stream->headerData);
+    return;
+  }
+
+  if (endStream)
+    streamRemoteEnd(connection, stream);
+}
+
+static void frameData(HTTP2Connection *connection, uint8_t flags, uint32_t streamId, const uint8_t *payload, size_t length)
+{
+  HTTP2Stream *stream = streamFind(connection, streamId);
+  if (!stream && streamIdle(connection, streamId)) {
+    connectionError(connection, h2eProtocolError);
+    return;
+  }
+
+  // Whole frame including padding counted by flow control
+  size_t frameLength = length;
+  if (connection->recvUnacked + connection->recvBuffered + frameLength > HTTP2_CONNECTION_WINDOW) {
+    connectionError(connection, h2eFlowControlError);
+    return;
+  }
+
+  size_t padding = 0;
+  if (flags & h2flPadded) {
+    if (length == 0 || payload[0] >= length) {
+      connectionError(connection, h2eProtocolError);
+      return;
+    }
+    padding = payload[0];
+    payload++;
+    length--;
+  }
+
+  if (stream && stream->recvUnacked + frameLength > HTTP2_STREAM_WINDOW) {
+    connectionError(connection, h2eFlowControlError);
+    return;
+  }
+
+  // Closed or half-closed (remote) stream
+  if (!stream || stream->remoteClosed) {
+    connectionCredit(connection, frameLength);
+    if (stream)
+      streamAbort(connection, stream, h2eStreamClosed);
+    else
+      writeRstStream(connection, streamId, h2eStreamClosed);
+    return;
+  }
+
+  // Only body bytes held until stream released, padding returned at once
+  size_t dataSize = length - padding;
+  connectionCredit(connection, frameLength - dataSize);
+  if (stream->body.size + dataSize > HTTP2_MAX_BODY_SIZE) {
+    streamAbort(connection, stream, h2eEnhanceYourCalm);
+    return;
+  }
+
+  streamBufferWrite(&stream->body, payload, dataSize);
+  connection->recvBuffered += (uint32_t)dataSize;
+  if (flags & h2flEndStream) {
+    streamRemoteEnd(connection, stream);
+  } else {
+    stream->recvUnacked += (uint32_t)frameLength;
+    if (stream->recvUnacked >= HTTP2_STREAM_WINDOW/2) {
+      writeWindowUpdate(connection, streamId, stream->recvUnacked);
+      stream->recvUnacked = 0;
+    }
+  }
+}
+
+static void frameHeaders(HTTP2Connection *connection, uint8_t flags, uint32_t streamId, const uint8_t *payload, size_t length)
+{
+  size_t padding = 0;
+  if (flags & h2flPadded) {
+    if (length == 0) {
+      connectionError(connection, h2eProtocolError);
+      return;
+    }
+    padding = payload[0];
+    payload++;
+    length--;
+  }
+
+  if (flags & h2flPriority) {
+    if (length < 5) {
+      connectionError(connection, h2eProtocolError);
+      return;
+    }
+    payload += 5;
+    length -= 5;
+  }
+
+  if (padding > length) {
+    connectionError(connection, h2eProtocolError);
+    return;
+  }
+
+  length -= padding;
+  if (length > HTTP2_MAX_HEADER_LIST_SIZE) {
+    connectionError(connection, h2eEnhanceYourCalm);
+    return;
+  }
+
+  if (flags & h2flEndHeaders) {
+    headerBlockComplete(connection, streamId, flags & h2flEndStream, payload, length);
+  } else {
+    connection->continuation = 1;
+    connection->headerBlockStream = streamId;
+    connection->headerBlockEndStream = flags & h2flEndStream;
+    dynamicBufferClear(&connection->headerBlock);
+    dynamicBufferWrite(&connection->headerBlock, payload, length);
+  }
+}
+
+static void frameSettings(HTTP2Connection *connection, uint8_t flags, uint32_t streamId, const uint8_t *payload, size_t length)
+{
+  if (streamId != 0) {
+    connectionError(connection, h2eProtocolError);
+    return;
+  }
+
+  if ((flags & h2flAck) ? length != 0 : length % 6 != 0) {
+    connectionError(connection, h2eFrameSizeError);
+    return;
+  }
+
+  if (flags & h2flAck)
+    return;
+
+  for (const uint8_t *p = payload; p < payload + length; p += 6) {
+    unsigned id = ((unsigned)p[0] << 8) | p[1];
+    uint32_t value = readUint32(p + 2);
+    switch (id) {
+      case h2sHeaderTableSize :
+        hpackEncoderSetMaxTableSize(connection->encoder, value < HTTP2_HEADER_TABLE_SIZE ? value : HTTP2_HEADER_TABLE_SIZE);
+        break;
+      case h2sMaxConcurrentStreams :
+        connection->peerMaxStreams = value;
+        break;
+      case h2sInitialWindowSize : {
+        if (value > HTTP2_MAX_WINDOW) {
+          connectionError(connection, h2eFlowControlError);
+          return;
+        }
+
+        // Change applied to all open streams, none of them may go over maximum window
+        int64_t delta = (int64_t)value - (int64_t)connection->peerInitialWindow;
+        connection->peerInitialWindow = value;
+        for (unsigned i = 0; i < HTTP2_STREAM_BUCKETS; i++) {
+          for (HTTP2Stream *stream = connection->streams[i]; stream; stream = stream->hashNext) {
+            if (stream->sendWindow + delta > HTTP2_MAX_WINDOW) {
+              connectionError(connection, h2eFlowControlError);
+              return;
+            }
+            stream->sendWindow += delta;
+            if (stream->out && stream->sendWindow > 0)
+              streamQueue(connection, stream);
+          }
+        }
+        break;
+      }
+      case h2sMaxFrameSize :
+        if (value < HTTP2_DEFAULT_FRAME_SIZE || value > 0xFFFFFF) {
+          connectionError(connection, h2eProtocolError);
+          return;
+        }
+        connection->peerMaxFrameSize = value;
+        break;
+      default :
+        break;
+    }
+  }
+
+  writeFrame(connection, h2fSettings, h2flAck, 0, 0, 0);
+  if (!connection->isServer && connection->connecting) {
+    connection->connecting = 0;
+    if (!connection->timedStreams)
+      connectionTimerStop(connection);
+    if (connection->connectCallback)
+      connection->connectCallback(aosSuccess, connection, connection->connectArg);
+  }
+
+  connectionStartWaiting(connection);
+}
+
+static void frameGoaway(HTTP2Connection *connection, const uint8_t *payload, size_t length)
+{
+  if (length < 8) {
+    connectionError(connection, h2eFrameSizeError);
+    return;
+  }
+
+  uint32_t lastStreamId = readUint32(payload) & HTTP2_MAX_WINDOW;
+  connection->goaway = 1;
+  if (connection->isServer)
+    return;
+
+  // Streams not processed by server and waiting requests can't be served by this connection
+  connection->peerMaxStreams = 0;
+  connection->refs++;
+  for (unsigned i = 0; i < HTTP2_STREAM_BUCKETS && !connection->closed; i++) {
+    HTTP2Stream *stream = connection->streams[i];
+    while (stream && !connection->closed) {
+      HTTP2Stream *next = stream->hashNext;
+      if (stream->id > lastStreamId)
+        streamFinish(connection, stream, aosDisconnected);
+      stream = next;
+    }
+  }
+
+  while (connection->waitingHead && !connection->closed) {
+    HTTP2Stream *stream = connection->waitingHead;
+    connection->waitingHead = stream->queueNext;
+    if (!connection->waitingHead)
+      connection->waitingTail = 0;
+    if (stream->usTimeout)
+      connection->timedStreams--;
+    stream->callback(aosDisconnected, connection, 0, stream->arg);
+    streamFree(stream);
+  }
+
+  connectionRelease(connection);
+}
+
+static void frameRstStream(HTTP2Connection *connection, uint32_t streamId)
+{
+  HTTP2Stream *stream = streamFind(connection, streamId);
+  connection->stats.resets++;
+  if (!stream)
+    return;
+
+  if (connection->isServer) {
+    streamDetach(connection, stream);
+    if (stream->delivered)
+      stream->reset = 1;
+    else
+      streamFree(stream);
+  } else {
+    streamFinish(connection, stream, aosDisconnected);
+    connectionStartWaiting(connection);
+  }
+}
+
+static void frameWindowUpdate(HTTP2Connection *connection, uint32_t streamId, const uint8_t *payload, size_t length)
+{
+  if (length != 4) {
+    connectionError(connection, h2eFrameSizeError);
+    return;
+  }
+
+  uint32_t increment = readUint32(payload) & HTTP2_MAX_WINDOW;
+  if (streamId == 0) {
+    if (increment == 0 || connection->sendWindow + increment > HTTP2_MAX_WINDOW) {
+      connectionError(connection, increment ? h2eFlowControlError : h2eProtocolError);
+      return;
+    }
+    connection->sendWindow += increment;
+  } else {
+    HTTP2Stream *stream = streamFind(connection, streamId);
+    if (increment == 0 || (stream && stream->sendWindow + increment > HTTP2_MAX_WINDOW)) {
+      uint32_t errorCode = increment ? h2eFlowControlError : h2eProtocolError;
+      if (stream)
+        streamAbort(connection, stream, errorCode);
+      else
+        writeRstStream(connection, streamId, errorCode);
+      return;
+    }
+
+    if (stream) {
+      stream->sendWindow += increment;
+      if (stream->out && stream->sendWindow > 0)
+        streamQueue(connection, stream);
+    }
+  }
+}
+
+static void frameProcess(HTTP2Connection *connection, uint8_t type, uint8_t flags, uint32_t streamId, const uint8_t *payload, size_t length)
+{
+  connection->stats.framesIn++;
+  if (connection->continuation) {
+    if (type != h2fContinuation || streamId != connection->headerBlockStream) {
+      connectionError(connection, h2eProtocolError);
+      return;
+    }
+
+    // HPACK state can't be kept without whole block, so connection closed
+    if (connection->headerBlock.size + length > HTTP2_MAX_HEADER_LIST_SIZE) {
+      connectionError(connection, h2eEnhanceYourCalm);
+      return;
+    }
+
+    dynamicBufferWrite(&connection->headerBlock, payload, length);
+    if (flags & h2flEndHeaders) {
+      connection->continuation = 0;
+      headerBlockComplete(connection, streamId, connection->headerBlockEndStream, connection->headerBlock.data, connection->headerBlock.size);
+    }
+    return;
+  }
+
+  switch (type) {
+    case h2fData :
+    case h2fHeaders :
+    case h2fRstStream :
+      if (streamId == 0) {
+        connectionError(connection, h2eProtocolError);
+        return;
+      }
+      if (type == h2fData)
+        frameData(connection, flags, streamId, payload, length);
+      else if (type == h2fHeaders)
+        frameHeaders(connection, flags, streamId, payload, length);
+      else if (length != 4)
+        connectionError(connection, h2eFrameSizeError);
+      else
+        frameRstStream(connection, streamId);
+      break;
+    case h2fSettings :
+      frameSettings(connection, flags, streamId, payload, length);
+      break;
+    case h2fPing :
+      if (length != 8)
+        connectionError(connection, h2eFrameSizeError);
+      else if (!(flags & h2flAck))
+        writeFrame(connection, h2fPing, h2flAck, 0, payload, length);
+      break;
+    case h2fGoaway :
+      frameGoaway(connection, payload, length);
+      break;
+    case h2fWindowUpdate :
+      frameWindowUpdate(connection, streamId, payload, length);
+      break;
+    case h2fPushPromise :
+    case h2fContinuation :
+      // Push disabled by our SETTINGS; CONTINUATION handled above
+      connectionError(connection, h2eProtocolError);
+      break;
+    default :
+      // PRIORITY and unknown frames ignored
+      break;
+  }
+}
+
+static void connectionRead(HTTP2Connection *connection);
+
+static void connectionProcessInput(HTTP2Connection *connection)
+{
+  size_t offset = 0;
+  if (connection->isServer && !connection->prefaceReceived) {
+    if (connection->inDataSize < HTTP2_PREFACE_SIZE) {
+      connectionRead(connection);
+      return;
+    }
+
+    if (memcmp(connection->inBuffer, http2Preface, HTTP2_PREFACE_SIZE) != 0) {
+      connectionClose(connection, aosUnknownError);
+      return;
+    }
+
+    connection->prefaceReceived = 1;
+    offset = HTTP2_PREFACE_SIZE;
+  }
+
+  while (!connection->closed && connection->inDataSize - offset >= HTTP2_FRAME_HEADER_SIZE) {
+    const uint8_t *p = connection->inBuffer + offset;
+    size_t length = ((size_t)p[0] << 16) | ((size_t)p[1] << 8) | p[2];
+    if (length > HTTP2_DEFAULT_FRAME_SIZE) {
+      connectionError(connection, h2eFrameSizeError);
+      return;
+    }
+
+    if (connection->inDataSize - offset < HTTP2_FRAME_HEADER_SIZE + length)
+      break;
+    frameProcess(connection, p[3], p[4], readUint32(p + 5) & HTTP2_MAX_WINDOW, p + HTTP2_FRAME_HEADER_SIZE, length);
+    offset += HTTP2_FRAME_HEADER_SIZE + length;
+  }
+
+  if (connection->closed)
+    return;
+
+  // Only incomplete frame left
+  if (offset) {
+    connection->inDataSize -= offset;
+    memmove(connection->inBuffer, connection->inBuffer + offset, connection->inDataSize);
+  }
+
+  connectionFlush(connection);
+  connectionRead(connection);
+}
+
+static void connectionReadDone(HTTP2Connection *connection, AsyncOpStatus status, size_t transferred)
+{
+  if (!connection->closed) {
+    if (status == aosSuccess && transferred) {
+      connection->inDataSize += transferred;
+      connectionProcessInput(connection);
+    } else {
+      connectionClose(connection, aosDisconnected);
+    }
+  }
+
+  connectionRelease(connection);
+}
+
+static void connectionReadCb(AsyncOpStatus status, aioObject *object, size_t transferred, void *arg)
+{
+  __UNUSED(object);
+  connectionReadDone((HTTP2Connection*)arg, status, transferred);
+}
+
+static void connectionSslReadCb(AsyncOpStatus status, SSLSocket *object, size_t transferred, void *arg)
+{
+  __UNUSED(object);
+  connectionReadDone((HTTP2Connection*)arg, status, transferred);
+}
+
+static void connectionRead(HTTP2Connection *connection)
+{
+  connection->refs++;
+  if (connection->isHttps)
+    aioSslRead(connection->sslSocket,
+               connection->inBuffer + connection->inDataSize,
+               HTTP2_IN_BUFFER_SIZE - connection->inDataSize,
+               afNone,
+               0,
+               connectionSslReadCb,
+               connection);
+  else
+    aioRead(connection->plainSocket,
+            connection->inBuffer + connection->inDataSize,
+            HTTP2_IN_BUFFER_SIZE - connection->inDataSize,
+            afNone,
+            0,
+            connectionReadCb,
+            connection);
+}
+
+static HTTP2Connection *connectionNew(asyncBase *base, int isServer, int isHttps)
+{
+  HTTP2Connection *connection = (HTTP2Connection*)calloc(1, sizeof(HTTP2Connection));
+  connection->base = base;
+  connection->isServer = isServer;
+  connection->isHttps = isHttps;
+  connection->encoder = hpackEncoderNew(HTTP2_HEADER_TABLE_SIZE);
+  connection->decoder = hpackDecoderNew(HTTP2_HEADER_TABLE_SIZE);
+  connection->inBuffer = (uint8_t*)malloc(HTTP2_IN_BUFFER_SIZE);
+  dynamicBufferInit(&connection->headerBlock, 4096);
+  dynamicBufferInit(&connection->headers, 1024);
+  dynamicBufferInit(&connection->out, 65536);
+  connection->sendWindow = HTTP2_DEFAULT_WINDOW;
+  connection->peerInitialWindow = HTTP2_DEFAULT_WINDOW;
+  connection->peerMaxFrameSize = HTTP2_DEFAULT_FRAME_SIZE;
+  // Until server SETTINGS received
+  connection->peerMaxStreams = 100;
+  connection->nextStreamId = 1;
+  connection->refs = 1;
+  connection->timer = newUserEvent(base, 0, connectionTimerCb, connection);
+  return connection;
+}
+
+HTTP2Connection *http2ClientNew(asyncBase *base, aioObject *socket)
+{
+  HTTP2Connection *connection = connectionNew(base, 0, 0);
+  connection->plainSocket = socket;
+  return connection;
+}
+
+HTTP2Connection *http2sClientNew(asyncBase *base, SSLSocket *socket)
+{
+  static const char *const protocols[] = {"h2"};
+  HTTP2Connection *connection = connectionNew(base, 0, 1);
+  connection->sslSocket = socket;
+  sslSocketSetAlpn(socket, protocols, 1);
+  return connection;
+}
+
+static void clientConnected(HTTP2Connection *connection, AsyncOpStatus status)
+{
+  if (!connection->closed) {
+    if (status == aosSuccess && connection->isHttps) {
+      size_t size;
+      const char *protocol = sslSocketAlpn(connection->sslSocket, &size);
+      if (!protocol || size != 2 || memcmp(protocol, "h2", 2) != 0)
+        status = aosUnknownError;
+    }
+
+    if (status == aosSuccess) {
+      // Preface and SETTINGS, then wait server SETTINGS
+      connection->connecting = 1;
+      dynamicBufferWrite(&connection->out, http2Preface, HTTP2_PREFACE_SIZE);
+      writeSettings(connection);
+      connectionFlush(connection);
+      connectionRead(connection);
+    } else {
+      connection->connecting = 1;
+      connectionClose(connection, status);
+    }
+  }
+
+  connectionRelease(connection);
+}
+
+static void clientConnectCb(AsyncOpStatus status, aioObject *object, void *arg)
+{
+  __UNUSED(object);
+  clientConnected((HTTP2Connection*)arg, status);
+}
+
+static void clientSslConnectCb(AsyncOpStatus status, SSLSocket *object, void *arg)
+{
+  __UNUSED(object);
+  clientConnected((HTTP2Connection*)arg, status);
+}
+
+void aioHttp2Connect(HTTP2Connection *connection,
+                     const HostAddress *address,
+                     const char *tlsextHostName,
+                     uint64_t usTimeout,
+                     http2ConnectCb callback,
+                     void *arg)
+{
+  connection->connectCallback = callback;
+  connection->connectArg = arg;
+  connection->connectStarted = getTimeMark();
+  connection->connectTimeout = usTimeout;
+  // Socket connect in progress, no writes allowed
+  connection->connecting = 2;
+  if (usTimeout)
+    connectionTimerStart(connection);
+
+  connection->refs++;
+  if (connection->isHttps)
+    aioSslConnect(connection->sslSocket, address, tlsextHostName, usTimeout, clientSslConnectCb, connection);
+  else
+    aioConnect(connection->plainSocket, address, usTimeout, clientConnectCb, connection);
+}
+
+void aioHttp2Request(HTTP2Connection *connection,
+                     const char *method,
+                     const char *authority,
+                     const char *path,
+                     const HTTP2Header *headers,
+                     size_t headersNum,
+                     const void *body,
+                     size_t bodySize,
+                     unsigned urgency,
+                     uint64_t usTimeout,
+                     http2ResponseCb callback,
+                     void *arg)
+{
+  if (connection->closed || connection->goaway) {
+    callback(connection->closed ? aosDisconnected : aosCanceled, connection, 0, arg);
+    return;
+  }
+
+  HTTP2Stream *stream = streamNew(connection, urgency);
+  stream->callback = callback;
+  stream->arg = arg;
+  stream->started = getTimeMark();
+  stream->usTimeout = usTimeout;
+  const char *scheme = connection->isHttps ? "https" : "http";
+  streamAddHeader(stream, ":method", 7, method, strlen(method));
+  streamAddHeader(stream, ":scheme", 7, scheme, strlen(scheme));
+  streamAddHeader(stream, ":authority", 10, authority, strlen(authority));
+  streamAddHeader(stream, ":path", 5, path, strlen(path));
+  for (size_t i = 0; i < headersNum; i++)
+    streamAddHeader(stream, headers[i].name.data, headers[i].name.size, headers[i].value.data, headers[i].value.size);
+  if (stream->urgency != HTTP2_DEFAULT_URGENCY) {
+    // Server orders responses by urgency too (RFC 9218)
+    char priority[4] = {'u', '=', (char)('0' + stream->urgency), 0};
+    streamAddHeader(stream, "priority", 8, priority, 3);
+  }
+  if (bodySize) {
+    stream->out = (uint8_t*)malloc(bodySize);
+    memcpy(stream->out, body, bodySize);
+    stream->outSize = bodySize;
+  }
+
+  if (usTimeout) {
+    connection->timedStreams++;
+    connectionTimerStart(connection);
+  }
+
+  stream->queueNext = 0;
+  if (connection->waitingTail)
+    connection->waitingTail->queueNext = stream;
+  else
+    connection->waitingHead = stream;
+  connection->waitingTail = stream;
+  connectionStartWaiting(connection);
+  connectionFlush(connection);
+}
+
+static HTTP2Connection *serverNew(asyncBase *base, int isHttps, http2RequestCb callback, void *arg)
+{
+  HTTP2Connection *connection = connectionNew(base, 1, isHttps);
+  connection->requestCallback = callback;
+  connection->requestArg = arg;
+  connection->nextStreamId = 2;
+  return connection;
+}
+
+static void serverStart(HTTP2Connection *connection)
+{
+  writeSettings(connection);
+  connectionFlush(connection);
+  connectionRead(connection);
+}
+
+HTTP2Connection *http2ServerNew(asyncBase *base, aioObject *socket, http2RequestCb callback, void *arg)
+{
+  HTTP2Connection *connection = serverNew(base, 0, callback, arg);
+  connection->plainSocket = socket;
+  serverStart(connection);
+  return connection;
+}
+
+HTTP2Connection *http2sServerNew(asyncBase *base, SSLSocket *socket, http2RequestCb callback, void *arg)
+{
+  HTTP2Connection *connection = serverNew(base, 1, callback, arg);
+  connection->sslSocket = socket;
+  serverStart(connection);
+  return connection;
+}
+
+void http2Respond(HTTP2Stream *stream, unsigned status, const HTTP2Header *headers, size_t headersNum, const void *body, size_t bodySize)
+{
+  HTTP2Connection *connection = stream->connection;
+  stream->delivered = 0;
+  if (connection->closed || stream->reset) {
+    streamFree(stream);
+    connectionRelease(connection);
+    return;
+  }
+
+  char buffer[32];
+  hpackEncodeBegin(connection->encoder);
+  int size = snprintf(buffer, sizeof(buffer), "%u", status);
+  hpackEncodeHeader(connection->encoder, ":status", 7, buffer, (size_t)size, hpackIndexed);
+  for (size_t i = 0; i < headersNum; i++)
+    hpackEncodeHeader(connection->encoder, headers[i].name.data, headers[i].name.size, headers[i].value.data, headers[i].value.size, hpackIndexed);
+  size = snprintf(buffer, sizeof(buffer), "%zu", bodySize);
+  hpackEncodeHeader(connection->encoder, "content-length", 14, buffer, (size_t)size, hpackIndexed);
+  writeHeaderBlock(connection, stream->id, bodySize == 0);
+
+  if (bodySize) {
+    stream->out = (uint8_t*)malloc(bodySize);
+    memcpy(stream->out, body, bodySize);
+    stream->outSize = bodySize;
+    streamQueue(connection, stream);
+  } else {
+    streamDetach(connection, stream);
+    streamFree(stream);
+  }
+
+  connectionFlush(connection);
+  connectionRelease(connection);
+}
+
+void http2ConnectionSetCloseCallback(HTTP2Connection *connection, http2CloseCb callback, void *arg)
+{
+  connection->closeCallback = callback;
+  connection->closeArg = arg;
+}
+
+void http2ConnectionDelete(HTTP2Connection *connection)
+{
+  connection->deleted = 1;
+  if (!connection->closed && connection->connecting != 2) {
+    uint8_t payload[8];
+    writeUint32(payload, connection->lastPeerStreamId);
+    writeUint32(payload + 4, h2eNoError);
+    writeFrame(connection, h2fGoaway, 0, 0, payload, sizeof(payload));
+    connectionFlush(connection);
+  }
+
+  connectionClose(connection, aosCanceled);
+  connectionRelease(connection);
+}
+
+void http2ConnectionGetStats(HTTP2Connection *connection, HTTP2Stats *stats)
+{
+  *stats = connection->stats;
+}
@@ -0,0 +1,543 @@
+#include "asyncio/httpServer.h"
+
+#include "asyncio/coroutine.h"
+#include "asyncio/dynamicBuffer.h"
+#include "asyncio/socket.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+__NO_PADDING_BEGIN
+struct HTTPServerConnection {
+  HTTPServerConnection *prev;
+  HTTPServerConnection *next;
+  HTTPServer *server;
+  aioObject *socket;
+  HostAddress address;
+  void *userData;
+  HttpRequestParserState state;
+  uint8_t *inBuffer;
+  size_t inBufferSize;
+  // Received bytes and offset of first not parsed byte
+  size_t dataSize;
+  size_t offset;
+  // Position of headers terminator search
+  size_t scanOffset;
+  dynamicBuffer out;
+  HttpRequestComponent lastComponent;
+  uint64_t requestsServed;
+  // Alive reference, pending read and write operations, request owned by handler
+  unsigned refs;
+  // Request headers received, parser works with current request
+  int parsing;
+  // Request passed to handler and response not written yet, input not processed
+  int active;
+  int keepAlive;
+  int http10;
+  int headRequest;
+  int closed;
+};
+
+struct HTTPServer {
+  asyncBase *base;
+  aioObject *listener;
+  HTTPServerConfig config;
+  httpServerRequestCb *callback;
+  void *arg;
+  // Accessed only from loop thread of base, see httpServer.h
+  HTTPServerConnection *connections;
+  // Alive reference, pending accept operation and connections
+  unsigned refs;
+  int deleted;
+  HTTPServerStats stats;
+};
+__NO_PADDING_END
+
+static void connectionProcess(HTTPServerConnection *connection);
+
+static const char *httpReasonPhrase(unsigned code)
+{
+  switch (code) {
+    case 100 : return "Continue";
+    case 200 : return "OK";
+    case 201 : return "Created";
+    case 202 : return "Accepted";
+    case 204 : return "No Content";
+    case 301 : return "Moved Permanently";
+    case 302 : return "Found";
+    case 304 : return "Not Modified";
+    case 400 : return "Bad Request";
+    case 401 : return "Unauthorized";
+    case 403 : return "Forbidden";
+    case 404 : return "Not Found";
+    case 405 : return "Method Not Allowed";
+    case 408 : return "Request Timeout";
+    case 413 : return "Payload Too Large";
+    case 431 : return "Request Header Fields Too Large";
+    case 500 : return "Internal Server Error";
+    case 501 : return "Not Implemented";
+    case 503 : return "Service Unavailable";
+    default : return "Unknown";
+  }
+}
+
+static int rawEqualsLowerCase(const Raw *value, const char *token)
+{
+  size_t size = strlen(token);
+  if (value->size != size)
+    return 0;
+  for (size_t i = 0; i < size; i++) {
+    char c = value->data[i];
+    if ((c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c) != token[i])
+      return 0;
+  }
+
+  return 1;
+}
+
+static void serverRelease(HTTPServer *server)
+{
+  if (--server->refs == 0)
+    free(server);
+}
+
+static void connectionRelease(HTTPServerConnection *connection)
+{
+  if (--connection->refs == 0) {
+    HTTPServer *server = connection->server;
+    dynamicBufferFree(&connection->out);
+    free(connection->inBuffer);
+    free(connection);
+    serverRelease(server);
+  }
+}
+
+static void connectionClose(HTTPServerConnection *connection)
+{
+  if (connection->closed)
+    return;
+
+  HTTPServer *server = connection->server;
+  connection->closed = 1;
+  if (connection->prev)
+    connection->prev->next = connection->next;
+  else
+    server->connections = connection->next;
+  if (connection->next)
+    connection->next->prev = connection->prev;
+
+  deleteAioObject(connection->socket);
+  if (server->config.closeCallback)
+    server->config.closeCallback(connection, server->arg);
+  connectionRelease(connection);
+}
+
+static void connectionWriteCb(AsyncOpStatus status, aioObject *socket, size_t transferred, void *arg)
+{
+  __UNUSED(socket);
+  __UNUSED(transferred);
+  HTTPServerConnection *connection = (HTTPServerConnection*)arg;
+  if (status != aosSuccess)
+    connectionClose(connection);
+  connectionRelease(connection);
+}
+
+static void connectionLastWriteCb(AsyncOpStatus status, aioObject *socket, size_t transferred, void *arg)
+{
+  __UNUSED(socket);
+  __UNUSED(transferred);
+  HTTPServerConnection *connection = (HTTPServerConnection*)arg;
+  if (status != aosSuccess || !connection->keepAlive) {
+    connectionClose(connection);
+  } else {
+    connection->active = 0;
+    connectionProcess(connection);
+  }
+
+  connectionRelease(connection);
+}
+
+// Sends accumulated output buffer, aioWrite copies data so buffer reused immediately;
+// on full write queue connection must be closed by caller, which still holds own reference
+static AsyncOpStatus connectionFlush(HTTPServerConnection *connection, int last)
+{
+  connection->refs++;
+  ssize_t result = aioWrite(connection->socket,
+                            connection->out.data,
+                            connection->out.size,
+                            afWaitAll,
+                            0,
+                            last ? connectionLastWriteCb : connectionWriteCb,
+                            connection);
+  dynamicBufferClear(&connection->out);
+  if (result == -(ssize_t)aosQueueFull) {
+    // Write callback will not be called
+    connection->refs--;
+    return aosQueueFull;
+  }
+
+  return aosSuccess;
+}
+
+static void connectionWriteHeader(HTTPServerConnection *connection, unsigned code, const char *contentType)
+{
+  char header[512];
+  int size = snprintf(header, sizeof(header), "HTTP/1.1 %u %s\r\n", code, httpReasonPhrase(code));
+  dynamicBufferWrite(&connection->out, header, (size_t)size);
+  if (contentType) {
+    size = snprintf(header, sizeof(header), "Content-Type: %s\r\n", contentType);
+    if (size > 0 && (size_t)size < sizeof(header))
+      dynamicBufferWrite(&connection->out, header, (size_t)size);
+  }
+
+  if (connection->server->deleted)
+    connection->keepAlive = 0;
+  if (!connection->keepAlive)
+    dynamicBufferWrite(&connection->out, "Connection: close\r\n", 19);
+  else if (connection->http10)
+    dynamicBufferWrite(&connection->out, "Connection: keep-alive\r\n", 24);
+}
+
+// Answers malformed request and closes connection
+static void connectionError(HTTPServerConnection *connection, unsigned code)
+{
+  connection->server->stats.badRequests++;
+  connection->active = 1;
+  connection->keepAlive = 0;
+  connection->headRequest = 0;
+  connectionWriteHeader(connection, code, 0);
+  dynamicBufferWrite(&connection->out, "Content-Length: 0\r\n\r\n", 21);
+  if (connectionFlush(connection, 1) != aosSuccess)
+    connectionClose(connection);
+}
+
+static void connectionReadCb(AsyncOpStatus status, aioObject *socket, size_t transferred, void *arg)
+{
+  __UNUSED(socket);
+  HTTPServerConnection *connection = (HTTPServerConnection*)arg;
+  if (status == aosSuccess && transferred) {
+    connection->dataSize += transferred;
+    connectionProcess(connection);
+  } else {
+    connectionClose(connection);
+  }
+
+  connectionRelease(connection);
+}
+
+static void connectionRead(HTTPServerConnection *connection)
+{
+  // Move not parsed tail to buffer begin
+  if (connection->offset) {
+    size_t tail = connection->dataSize - connection->offset;
+    if (tail)
+      memmove(connection->inBuffer, connection->inBuffer + connection->offset, tail);
+    connection->dataSize = tail;
+    connection->scanOffset -= connection->offset;
+    connection->offset = 0;
+  }
+
+  if (connection->dataSize == connection->inBufferSize) {
+    connectionError(connection, connection->parsing ? 400 : 431);
+    return;
+  }
+
+  connection->refs++;
+  aioRead(connection->socket,
+          connection->inBuffer + connection->dataSize,
+          connection->inBufferSize - connection->dataSize,
+          afNone,
+          connection->server->config.usKeepAliveTimeout,
+          connectionReadCb,
+          connection);
+}
+
+static void connectionCoroutineProc(void *arg)
+{
+  HTTPServerConnection *connection = (HTTPServerConnection*)arg;
+  HttpRequestComponent component = connection->lastComponent;
+  connection->server->callback(connection, &component, connection->server->arg);
+}
+
+static int connectionParseCb(HttpRequestComponent *component, void *arg)
+{
+  HTTPServerConnection *connection = (HTTPServerConnection*)arg;
+  HTTPServer *server = connection->server;
+  switch (component->type) {
+    case httpRequestDtMethod :
+      connection->headRequest = component->method == hmHead;
+      break;
+    case httpRequestDtVersion :
+      connection->http10 = component->version.majorVersion == 1 && component->version.minorVersion == 0;
+      connection->keepAlive = component->version.majorVersion > 1 || (component->version.majorVersion == 1 && component->version.minorVersion >= 1);
+      break;
+    case httpRequestDtHeaderEntry :
+      if (component->header.entryType == hhConnection) {
+        if (rawEqualsLowerCase(&component->header.stringValue, "close"))
+          connection->keepAlive = 0;
+        else if (rawEqualsLowerCase(&component->header.stringValue, "keep-alive"))
+          connection->keepAlive = 1;
+      } else if (component->header.entryType == hhExpect) {
+        // Client waits interim response before sending body
+        if (!connection->http10 && rawEqualsLowerCase(&component->header.stringValue, "100-continue")) {
+          dynamicBufferWrite(&connection->out, "HTTP/1.1 100 Continue\r\n\r\n", 25);
+          if (connectionFlush(connection, 0) != aosSuccess)
+            connectionClose(connection);
+        }
+      }
+      break;
+    case httpRequestDtDataLast :
+      // Handler owns request until response finished; input processing suspended, so data
+      // pointers into input buffer stay valid
+      connection->active = 1;
+      connection->refs++;
+      server->stats.requests++;
+      if (connection->requestsServed++)
+        server->stats.keepAliveReuses++;
+      if (server->config.coroutineStackSize) {
+        connection->lastComponent = *component;
+        coroutineCall(coroutineNew(connectionCoroutineProc, connection, server->config.coroutineStackSize));
+        return 1;
+      }
+      break;
+    default :
+      break;
+  }
+
+  server->callback(connection, component, server->arg);
+  return 1;
+}
+
+static void connectionProcess(HTTPServerConnection *connection)
+{
+  HTTPServer *server = connection->server;
+  while (!connection->closed && !connection->active) {
+    if (!connection->parsing) {
+      // Skip empty lines between requests
+      while (connection->offset < connection->dataSize &&
+             (connection->inBuffer[connection->offset] == '\r' || connection->inBuffer[connection->offset] == '\n'))
+        connection->offset++;
+      if (connection->scanOffset < connection->offset)
+        connection->scanOffset = connection->offset;
+
+      // Parser started only when request line and all headers received
+      const uint8_t *p = connection->inBuffer + connection->scanOffset;
+      const uint8_t *end = connection->inBuffer + connection->dataSize;
+      int found = 0;
+      while (end - p >= 4) {
+        p = (const uint8_t*)memchr(p, '\r', (size_t)(end - p - 3));
+        if (!p)
+          break;
+        if (p[1] == '\n' && p[2] == '\r' && p[3] == '\n') {
+          found = 1;
+          break;
+        }
+        p++;
+      }
+
+      if (!found) {
+        connection->scanOffset = connection->dataSize >= connection->offset + 3 ? connection->dataSize - 3 : connection->offset;
+        connectionRead(connection);
+        return;
+      }
+
+      connection->parsing = 1;
+      connection->keepAlive = 0;
+      connection->http10 = 0;
+      connection->headRequest = 0;
+      httpRequestParserInit(&connection->state);
+
+      HttpRequestComponent component;
+      component.type = httpRequestDtInitialize;
+      server->callback(connection, &component, server->arg);
+    }
+
+    httpRequestSetBuffer(&connection->state, connection->inBuffer + connection->offset, connection->dataSize - connection->offset);
+    ParserResultTy result = httpRequestParse(&connection->state, connectionParseCb, connection);
+    connection->offset = (size_t)((const uint8_t*)httpRequestDataPtr(&connection->state) - connection->inBuffer);
+    switch (result) {
+      case ParserResultOk :
+        connection->parsing = 0;
+        connection->scanOffset = connection->offset;
+        break;
+      case ParserResultNeedMoreData :
+        connectionRead(connection);
+        return;
+      default :
+        connectionError(connection, 400);
+        return;
+    }
+  }
+}
+
+static void serverAcceptCb(AsyncOpStatus status, aioObject *listener, HostAddress client, socketTy acceptSocket, void *arg)
+{
+  HTTPServer *server = (HTTPServer*)arg;
+  if (status == aosSuccess) {
+    if (server->deleted) {
+      socketClose(acceptSocket);
+    } else {
+      HTTPServerConnection *connection = (HTTPServerConnection*)malloc(sizeof(HTTPServerConnection));
+      memset(connection, 0, sizeof(HTTPServerConnection));
+      connection->server = server;
+      connection->socket = newSocketIo(server->base, acceptSocket);
+      connection->address = client;
+      connection->inBuffer = (uint8_t*)malloc(server->config.inBufferSize);
+      connection->inBufferSize = server->config.inBufferSize;
+      dynamicBufferInit(&connection->out, server->config.outBufferSize);
+      connection->refs = 1;
+      connection->next = server->connections;
+      if (server->connections)
+        server->connections->prev = connection;
+      server->connections = connection;
+      server->refs++;
+      server->stats.connections++;
+      connectionProcess(connection);
+    }
+  }
+
+  if (!server->deleted && (status == aosSuccess || status == aosTimeout)) {
+    aioAccept(listener, 0, serverAcceptCb, server);
+  } else {
+    if (!server->deleted)
+      fprintf(stderr, "HTTPServer: accept error %i, new connections not accepted\n", (int)status);
+    serverRelease(server);
+  }
+}
+
+void httpServerConfigInit(HTTPServerConfig *config)
+{
+  config->inBufferSize = 16384;
+  config->outBufferSize = 4096;
+  config->usKeepAliveTimeout = 60000000;
+  config->coroutineStackSize = 0;
+  config->closeCallback = 0;
+}
+
+HTTPServer *httpServerNew(asyncBase *base, const HostAddress *address, const HTTPServerConfig *config, httpServerRequestCb callback, void *arg)
+{
+  socketTy acceptSocket = socketCreate(address->family, SOCK_STREAM, IPPROTO_TCP, 1);
+  socketReuseAddr(acceptSocket);
+  if (socketBind(acceptSocket, address) != 0 || socketListen(acceptSocket) != 0) {
+    socketClose(acceptSocket);
+    return 0;
+  }
+
+  HTTPServer *server = (HTTPServer*)malloc(sizeof(HTTPServer));
+  memset(server, 0, sizeof(HTTPServer));
+  server->base = base;
+  if (config)
+    server->config = *config;
+  else
+    httpServerConfigInit(&server->config);
+  if (server->config.inBufferSize == 0)
+    server->config.inBufferSize = 16384;
+  if (server->config.outBufferSize == 0)
+    server->config.outBufferSize = 4096;
+  server->callback = callback;
+  server->arg = arg;
+  server->listener = newSocketIo(base, acceptSocket);
+  server->refs = 2;
+  aioAccept(server->listener, 0, serverAcceptCb, server);
+  return server;
+}
+
+void httpServerDelete(HTTPServer *server)
+{
+  server->deleted = 1;
+  deleteAioObject(server->listener);
+
+  // Connections with request in progress closed after response
+  HTTPServerConnection *connection = server->connections;
+  while (connection) {
+    HTTPServerConnection *next = connection->next;
+    if (connection->active)
+      connection->keepAlive = 0;
+    else
+      connectionClose(connection);
+    connection = next;
+  }
+
+  serverRelease(server);
+}
+
+void httpServerGetStats(HTTPServer *server, HTTPServerStats *stats)
+{
+  *stats = server->stats;
+}
+
+void *httpServerConnectionGetUserData(HTTPServerConnection *connection)
+{
+  return connection->userData;
+}
+
+void httpServerConnectionSetUserData(HTTPServerConnection *connection, void *userData)
+{
+  connection->userData = userData;
+}
+
+HostAddress httpServerConnectionGetAddress(HTTPServerConnection *connection)
+{
+  return connection->address;
+}
+
+void httpServerResponse(HTTPServerConnection *connection, unsigned code, const char *contentType, const void *body, size_t size)
+{
+  if (!connection->closed) {
+    char contentLength[64];
+    connectionWriteHeader(connection, code, contentType);
+    int length = snprintf(contentLength, sizeof(contentLength), "Content-Length: %zu\r\n\r\n", size);
+    dynamicBufferWrite(&connection->out, contentLength, (size_t)length);
+    if (size && !connection->headRequest)
+      dynamicBufferWrite(&connection->out, body, size);
+    if (connectionFlush(connection, 1) != aosSuccess)
+      connectionClose(connection);
+  }
+
+  connectionRelease(connection);
+}
+
+void httpServerChunkedBegin(HTTPServerConnection *connection, unsigned code, const char *contentType)
+{
+  if (connection->closed)
+    return;
+
+  // HTTP/1.0 clients don't support chunked encoding: body buffered and delimited by connection close
+  if (connection->http10)
+    connection->keepAlive = 0;
+  connectionWriteHeader(connection, code, contentType);
+  if (!connection->http10)
+    dynamicBufferWrite(&connection->out, "Transfer-Encoding: chunked\r\n", 28);
+  dynamicBufferWrite(&connection->out, "\r\n", 2);
+  // Header sent together with first chunk
+}
+
+void httpServerChunk(HTTPServerConnection *connection, const void *data, size_t size)
+{
+  if (connection->closed || connection->headRequest || size == 0)
+    return;
+
+  if (!connection->http10) {
+    char chunkSize[32];
+    int length = snprintf(chunkSize, sizeof(chunkSize), "%zx\r\n", size);
+    dynamicBufferWrite(&connection->out, chunkSize, (size_t)length);
+    dynamicBufferWrite(&connection->out, data, size);
+    dynamicBufferWrite(&connection->out, "\r\n", 2);
+    if (connectionFlush(connection, 0) != aosSuccess)
+      connectionClose(connection);
+  } else {
+    dynamicBufferWrite(&connection->out, data, size);
+  }
+}
+
+void httpServerChunkedEnd(HTTPServerConnection *connection)
+{
+  if (!connection->closed) {
+    if (!connection->http10 && !connection->headRequest)
+      dynamicBufferWrite(&connection->out, "0\r\n\r\n", 5);
+    if (connectionFlush(connection, 1) != aosSuccess)
+      connectionClose(connection);
+  }
+
+  connectionRelease(connection);
+}
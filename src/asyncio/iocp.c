@@ -20,6 +20,7 @@ typedef struct iocpBase {
   asyncBase B;
   HANDLE completionPort;
   HANDLE timerThread;
+  HANDLE heapTimer;
   LPFN_CONNECTEX ConnectExPtr;
 } iocpBase;
 
@@ -45,6 +46,7 @@ void iocpInitializeTimer(asyncBase *base, asyncOpRoot *op);
 void iocpStartTimer(asyncOpRoot *op);
 void iocpStopTimer(asyncOpRoot *op);
 void iocpDeleteTimer(asyncOpRoot *op);
+void iocpArmTimer(asyncBase *base, uint64_t deadline);
 void iocpActivate(aioUserEvent *event);
 AsyncOpStatus iocpAsyncConnect(asyncOpRoot *op);
 AsyncOpStatus iocpAsyncAccept(asyncOpRoot *op);
@@ -66,6 +68,7 @@ static struct asyncImpl iocpImpl = {
   iocpStartTimer,
   iocpStopTimer,
   iocpDeleteTimer,
+  iocpArmTimer,
   iocpActivate,
   iocpAsyncConnect,
   iocpAsyncAccept,
@@ -120,31 +123,13 @@ static AsyncOpStatus iocpGetOverlappedResult(iocpOp *op)
   }
 }
 
-static VOID CALLBACK userEventTimerCb(LPVOID lpArgToCompletionRoutine, DWORD dwTimerLowValue, DWORD dwTimerHighValue)
+static VOID CALLBACK heapTimerCb(LPVOID lpArgToCompletionRoutine, DWORD dwTimerLowValue, DWORD dwTimerHighValue)
 {
   __UNUSED(dwTimerLowValue);
   __UNUSED(dwTimerHighValue);
-  aioTimer *timer;
-  uintptr_t timerTag;
-  __tagged_pointer_decode(lpArgToCompletionRoutine, (void**)&timer, &timerTag);
-
-  int needReactivate = 1;
-  aioUserEvent *event = (aioUserEvent*)timer->op;
-  iocpBase *localBase = (iocpBase*)event->base;
-
-  if (eventTryActivate(event))
-    iocpActivate(event);
-
-  if (event->counter > 0) {
-    if (--event->counter == 0)
-      needReactivate = 0;
-  }
-
-  if (needReactivate) {
-    LARGE_INTEGER signalTime;
-    signalTime.QuadPart = -(int64_t)(event->root.timeout * 10);
-    SetWaitableTimer(timer->hTimer, &signalTime, 0, userEventTimerCb, timer, FALSE);
-  }
+  // Timer heap processed by message loop thread, base pointer used as completion key
+  iocpBase *localBase = (iocpBase*)lpArgToCompletionRoutine;
+  PostQueuedCompletionStatus(localBase->completionPort, 0, (ULONG_PTR)localBase, 0);
 }
 
 
@@ -198,6 +183,7 @@ asyncBase *iocpNewAsyncBase()
       CreateIoCompletionPort(INVALID_HANDLE_VALUE, 0, 0, 0);
     base->timerThread =
       CreateThread(NULL, 0x10000, timerThreadProc, NULL, THREAD_PRIORITY_NORMAL, &tid);
+    base->heapTimer = CreateWaitableTimer(NULL, FALSE, NULL);
     base->ConnectExPtr = 0;
     tmpSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
     WSAIoctl(tmpSocket,
@@ -240,7 +226,9 @@ void iocpNextFinishedOperation(asyncBase *base)
 
     for (i = 0; i < N; i++) {
       OVERLAPPED_ENTRY *entry = &entries[i];
-      if (entry->lpCompletionKey) {
+      if (entry->lpCompletionKey == (ULONG_PTR)localBase) {
+        processTimerHeap(base);
+      } else if (entry->lpCompletionKey) {
         asyncOpRoot *op = (asyncOpRoot*)entry->lpCompletionKey;
         if (op->opCode == actUserEvent) {
           aioUserEvent *event = (aioUserEvent*)op;
@@ -398,23 +386,15 @@ void iocpInitializeTimer(asyncBase *base, asyncOpRoot *op)
 static VOID CALLBACK timerStartProc(ULONG_PTR dwParam)
 {
   asyncOpRoot *op = (asyncOpRoot*)dwParam;
-  PTIMERAPCROUTINE timerCb;
   LARGE_INTEGER signalTime;
-
-  if (op->opCode == actUserEvent)
-    timerCb = userEventTimerCb;
-  else
-    timerCb = ioFinishedTimerCb;
-
   aioTimer *timer = (aioTimer*)op->timerId;
   signalTime.QuadPart = -(int64_t)(op->timeout * 10);
-  SetWaitableTimer(timer->hTimer, &signalTime, 0, timerCb, __tagged_pointer_make(timer, opGetGeneration(op)), FALSE);
+  SetWaitableTimer(timer->hTimer, &signalTime, 0, ioFinishedTimerCb, __tagged_pointer_make(timer, opGetGeneration(op)), FALSE);
 }
 
 void iocpStartTimer(asyncOpRoot *op)
 {
-  iocpBase *base = op->opCode == actUserEvent ?
-    (iocpBase*)(((aioUserEvent*)op)->base) : (iocpBase*)op->object->base;
+  iocpBase *base = (iocpBase*)op->object->base;
   QueueUserAPC(timerStartProc, base->timerThread, (ULONG_PTR)op);
 }
 
@@ -431,6 +411,27 @@ void iocpDeleteTimer(asyncOpRoot *op)
   free(timer);
 }
 
+static VOID CALLBACK heapTimerArmProc(ULONG_PTR dwParam)
+{
+  // Nearest deadline read again here, it can be changed after APC queued
+  iocpBase *base = (iocpBase*)dwParam;
+  uint64_t deadline = timerHeapNextDeadline(&base->B);
+  if (deadline) {
+    LARGE_INTEGER signalTime;
+    uint64_t now = getMonotonicTime();
+    signalTime.QuadPart = -(int64_t)((deadline > now ? deadline - now : 1) * 10);
+    SetWaitableTimer(base->heapTimer, &signalTime, 0, heapTimerCb, base, FALSE);
+  } else {
+    CancelWaitableTimer(base->heapTimer);
+  }
+}
+
+void iocpArmTimer(asyncBase *base, uint64_t deadline)
+{
+  __UNUSED(deadline);
+  QueueUserAPC(heapTimerArmProc, ((iocpBase*)base)->timerThread, (ULONG_PTR)base);
+}
+
 void iocpActivate(aioUserEvent *event)
 {
   iocpEnqueue(event->base, &event->root);
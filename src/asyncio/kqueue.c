@@ -16,6 +16,8 @@
 static ConcurrentQueue objectPool;
 
 #define MAX_EVENTS 256
+// EVFILT_TIMER identifier of base timer heap, per-operation timers numbered from 1
+#define HEAP_TIMER_ID 0
 
 typedef struct kqueueBase {
   asyncBase B;
@@ -47,6 +49,7 @@ void kqueueInitializeTimer(asyncBase *base, asyncOpRoot *op);
 void kqueueStartTimer(asyncOpRoot *op);
 void kqueueStopTimer(asyncOpRoot *op);
 void kqueueDeleteTimer(asyncOpRoot *op);
+void kqueueArmTimer(asyncBase *base, uint64_t deadline);
 void kqueueActivate(aioUserEvent *op);
 AsyncOpStatus kqueueAsyncConnect(asyncOpRoot *opptr);
 AsyncOpStatus kqueueAsyncAccept(asyncOpRoot *opptr);
@@ -68,6 +71,7 @@ static struct asyncImpl kqueueImpl = {
   kqueueStartTimer,
   kqueueStopTimer,
   kqueueDeleteTimer,
+  kqueueArmTimer,
   kqueueActivate,
   kqueueAsyncConnect,
   kqueueAsyncAccept,
@@ -208,26 +212,17 @@ void kqueueNextFinishedOperation(asyncBase *base)
     for (n = 0; n < nfds; n++) {
       uintptr_t timerId;
       aioObjectRoot *object;
+      if (events[n].filter == EVFILT_TIMER && events[n].ident == HEAP_TIMER_ID) {
+        processTimerHeap(base);
+        continue;
+      }
+
       __tagged_pointer_decode(events[n].udata, (void**)&object, &timerId);
       if (object == 0) {
         // EVFILT_USER with EV_CLEAR stays registered, no re-add needed
       } else if (object->type == ioObjectTimer) {
         aioTimer *timer = (aioTimer*)object;
-        asyncOpRoot *op = timer->op;
-        if (op->opCode == actUserEvent) {
-          aioUserEvent *event = (aioUserEvent*)op;
-          if (eventTryActivate(event)) {
-            // TODO: compare timer and event tag
-            if (event->counter > 0 && --event->counter == 0)
-              kqueueStopTimer(op);
-
-            eventDeactivate(event);
-            op->finishMethod(op);
-            eventDecrementReference(event, 1);
-          }
-        } else {
-          opCancel(op, opEncodeTag(op, timerId), aosTimeout);
-        }
+        opCancel(timer->op, opEncodeTag(timer->op, timerId), aosTimeout);
       } else {
         uint32_t eventMask = (events[n].flags & EV_EOF) ? IO_EVENT_ERROR : 0;
         if (events[n].filter == EVFILT_READ) {
@@ -320,12 +315,11 @@ void kqueueInitializeTimer(asyncBase *base, asyncOpRoot *op)
 void kqueueStartTimer(asyncOpRoot *op)
 {
   struct kevent event;
-  int periodic = op->opCode == actUserEvent;  
   aioTimer *timer = (aioTimer*)op->timerId;
   EV_SET(&event,
          timer->fd,
          EVFILT_TIMER,
-         EV_ADD | EV_ENABLE | (periodic ? 0 : EV_ONESHOT),
+         EV_ADD | EV_ENABLE | EV_ONESHOT,
          NOTE_USECONDS,
          op->timeout,
          __tagged_pointer_make(timer, opGetGeneration(op)));
@@ -349,6 +343,22 @@ void kqueueDeleteTimer(asyncOpRoot *op)
   free(timer);
 }
 
+void kqueueArmTimer(asyncBase *base, uint64_t deadline)
+{
+  struct kevent event;
+  if (deadline) {
+    uint64_t now = getMonotonicTime();
+    int64_t timeout = deadline > now ? (int64_t)(deadline - now) : 1;
+    EV_SET(&event, HEAP_TIMER_ID, EVFILT_TIMER, EV_ADD | EV_ENABLE | EV_ONESHOT, NOTE_USECONDS, timeout, 0);
+    if (kevent(((kqueueBase*)base)->kqueueFd, &event, 1, 0, 0, 0) == -1)
+      fprintf(stderr, "kqueueArmTimer: %s\n", strerror(errno));
+  } else {
+    // Timer can be already removed by EV_ONESHOT, ignore errors
+    EV_SET(&event, HEAP_TIMER_ID, EVFILT_TIMER, EV_DELETE, 0, 0, 0);
+    kevent(((kqueueBase*)base)->kqueueFd, &event, 1, 0, 0, 0);
+  }
+}
+
 void kqueueActivate(aioUserEvent *op)
 {
   kqueueEnqueue(op->base, &op->root);
@@ -444,11 +454,22 @@ AsyncOpStatus kqueueAsyncRead(asyncOpRoot *opptr)
 AsyncOpStatus kqueueAsyncWrite(asyncOpRoot *opptr)
 {
   asyncOp *op = (asyncOp*)opptr;
-  int fd = getFd((aioObject*)op->root.object);
+  aioObject *object = (aioObject*)op->root.object;
+  int fd = getFd(object);
+
+  ssize_t bytesWritten;
+  if (op->transactionSize == op->bytesTransferred) {
+    // Data already sent by coalesced write of previous operation
+    bytesWritten = 0;
+  } else if (object->writeQueue.coalesceOps > 1) {
+    bytesWritten = writeCoalesced(op, fd, 0, 0);
+  } else {
+    object->writeQueue.writeCalls++;
+    bytesWritten = write(fd,
+                         (uint8_t *)op->buffer + op->bytesTransferred,
+                         op->transactionSize - op->bytesTransferred);
+  }
 
-  ssize_t bytesWritten = write(fd,
-                               (uint8_t *)op->buffer + op->bytesTransferred,
-                               op->transactionSize - op->bytesTransferred);
   if (bytesWritten > 0) {
     op->bytesTransferred += bytesWritten;
     if (op->root.flags & afWaitAll && op->bytesTransferred < op->transactionSize)
@@ -0,0 +1,649 @@
+#include "asyncioImpl.h"
+#include "asyncio/coroutine.h"
+#include "atomic.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+static ConcurrentQueue objectPool;
+
+#define POLL_INITIAL_SIZE 64
+#define POLL_MAX_TIMEOUT 500
+#define POLL_NOT_REGISTERED ((size_t)-1)
+
+#ifdef MSG_NOSIGNAL
+#define POLL_SEND_FLAGS MSG_NOSIGNAL
+#else
+#define POLL_SEND_FLAGS 0
+#endif
+
+#ifdef POLLRDHUP
+#define POLL_HANGUP_EVENTS (POLLHUP | POLLRDHUP | POLLNVAL)
+#else
+#define POLL_HANGUP_EVENTS (POLLHUP | POLLNVAL)
+#endif
+
+__NO_PADDING_BEGIN
+typedef struct PollObject PollObject;
+
+typedef struct pollBase {
+  asyncBase B;
+  int pipeFd[2];
+  volatile unsigned wakeupPending;
+  volatile unsigned pollingThreads;
+
+  // Compact array of armed descriptors, each PollObject knows own position
+  unsigned lock;
+  unsigned generation;
+  struct pollfd *fds;
+  PollObject **objects;
+  size_t fdsNum;
+  size_t fdsSize;
+} pollBase;
+
+struct PollObject {
+  aioObject Object;
+  uint32_t IoEvents;
+  short events;
+  size_t index;
+};
+
+// Private copy of descriptor array for one message loop thread, first element is wakeup pipe
+typedef struct pollSnapshot {
+  struct pollfd *fds;
+  PollObject **objects;
+  PollObject **ready;
+  size_t num;
+  size_t size;
+  unsigned generation;
+} pollSnapshot;
+__NO_PADDING_END
+
+void pollCombinerTaskHandler(aioObjectRoot *object, asyncOpRoot *op, AsyncOpActionTy opMethod);
+void pollEnqueue(asyncBase *base, asyncOpRoot *op);
+void pollPostEmptyOperation(asyncBase *base);
+void pollNextFinishedOperation(asyncBase *base);
+aioObject *pollNewAioObject(asyncBase *base, IoObjectTy type, void *data);
+asyncOpRoot *pollNewAsyncOp(asyncBase *base, int isRealTime, ConcurrentQueue *objectPool, ConcurrentQueue *objectTimerPool);
+int pollCancelAsyncOp(asyncOpRoot *opptr);
+void pollDeleteObject(aioObject *object);
+void pollInitializeTimer(asyncBase *base, asyncOpRoot *op);
+void pollStartTimer(asyncOpRoot *op);
+void pollStopTimer(asyncOpRoot *op);
+void pollDeleteTimer(asyncOpRoot *op);
+void pollArmTimer(asyncBase *base, uint64_t deadline);
+void pollActivate(aioUserEvent *op);
+AsyncOpStatus pollAsyncConnect(asyncOpRoot *opptr);
+AsyncOpStatus pollAsyncAccept(asyncOpRoot *opptr);
+AsyncOpStatus pollAsyncRead(asyncOpRoot *opptr);
+AsyncOpStatus pollAsyncWrite(asyncOpRoot *opptr);
+AsyncOpStatus pollAsyncReadMsg(asyncOpRoot *op);
+AsyncOpStatus pollAsyncWriteMsg(asyncOpRoot *op);
+
+static struct asyncImpl pollImpl = {
+  pollCombinerTaskHandler,
+  pollEnqueue,
+  pollPostEmptyOperation,
+  pollNextFinishedOperation,
+  pollNewAioObject,
+  pollNewAsyncOp,
+  pollCancelAsyncOp,
+  pollDeleteObject,
+  pollInitializeTimer,
+  pollStartTimer,
+  pollStopTimer,
+  pollDeleteTimer,
+  pollArmTimer,
+  pollActivate,
+  pollAsyncConnect,
+  pollAsyncAccept,
+  pollAsyncRead,
+  pollAsyncWrite,
+  pollAsyncReadMsg,
+  pollAsyncWriteMsg
+};
+
+static int getFd(PollObject *object)
+{
+  switch (object->Object.root.type) {
+    case ioObjectDevice :
+      return object->Object.hDevice;
+    case ioObjectSocket :
+      return object->Object.hSocket;
+    default :
+      return -1;
+  }
+}
+
+static void pollWakeup(pollBase *base)
+{
+  // One pending byte in pipe is enough to interrupt all poll calls
+  if (__uint_atomic_compare_and_swap(&base->wakeupPending, 0, 1)) {
+    char data = 0;
+    if (write(base->pipeFd[1], &data, 1) == -1 && errno != EAGAIN)
+      fprintf(stderr, "pollWakeup: write to pipe failed, errno: %s\n", strerror(errno));
+  }
+}
+
+static void pollWakeupIfWaiting(pollBase *base)
+{
+  if (__uint_atomic_fetch_and_add(&base->pollingThreads, 0))
+    pollWakeup(base);
+}
+
+// Must be called with base->lock held
+static void pollRemove(pollBase *base, PollObject *object)
+{
+  size_t index = object->index;
+  size_t last = --base->fdsNum;
+  if (index != last) {
+    base->fds[index] = base->fds[last];
+    base->objects[index] = base->objects[last];
+    base->objects[index]->index = index;
+  }
+
+  object->index = POLL_NOT_REGISTERED;
+  object->events = 0;
+  base->generation++;
+}
+
+// Returns non-zero if new events were requested and poll threads need to be interrupted
+static int pollUpdate(pollBase *base, PollObject *object, short events, int fd)
+{
+  int needWakeup = 0;
+  __spinlock_acquire(&base->lock);
+  if (events != object->events) {
+    if (events == 0) {
+      pollRemove(base, object);
+    } else if (object->index == POLL_NOT_REGISTERED) {
+      if (base->fdsNum == base->fdsSize) {
+        base->fdsSize *= 2;
+        base->fds = realloc(base->fds, sizeof(struct pollfd)*base->fdsSize);
+        base->objects = realloc(base->objects, sizeof(PollObject*)*base->fdsSize);
+      }
+
+      object->index = base->fdsNum++;
+      base->fds[object->index].fd = fd;
+      base->fds[object->index].events = events;
+      base->fds[object->index].revents = 0;
+      base->objects[object->index] = object;
+      object->events = events;
+      base->generation++;
+      needWakeup = 1;
+    } else {
+      needWakeup = (events & ~object->events) != 0;
+      base->fds[object->index].events = events;
+      object->events = events;
+      base->generation++;
+    }
+  }
+
+  __spinlock_release(&base->lock);
+  return needWakeup;
+}
+
+static void pollSnapshotUpdate(pollBase *base, pollSnapshot *snapshot)
+{
+  __spinlock_acquire(&base->lock);
+  if (snapshot->generation != base->generation || snapshot->num == 0) {
+    size_t num = base->fdsNum + 1;
+    if (snapshot->size < num) {
+      snapshot->size = base->fdsSize + 1;
+      snapshot->fds = realloc(snapshot->fds, sizeof(struct pollfd)*snapshot->size);
+      snapshot->objects = realloc(snapshot->objects, sizeof(PollObject*)*snapshot->size);
+      snapshot->ready = realloc(snapshot->ready, sizeof(PollObject*)*snapshot->size);
+    }
+
+    snapshot->fds[0].fd = base->pipeFd[0];
+    snapshot->fds[0].events = POLLIN;
+    snapshot->objects[0] = 0;
+    memcpy(snapshot->fds + 1, base->fds, sizeof(struct pollfd)*base->fdsNum);
+    memcpy(snapshot->objects + 1, base->objects, sizeof(PollObject*)*base->fdsNum);
+    snapshot->num = num;
+    snapshot->generation = base->generation;
+  }
+
+  __spinlock_release(&base->lock);
+}
+
+static int pollTimeout(asyncBase *base, uint64_t now)
+{
+  uint64_t deadline = timerHeapNextDeadline(base);
+  if (deadline == 0)
+    return POLL_MAX_TIMEOUT;
+  else if (deadline <= now)
+    return 0;
+  else if (deadline - now >= (uint64_t)POLL_MAX_TIMEOUT*1000)
+    return POLL_MAX_TIMEOUT;
+  else
+    return (int)((deadline - now + 999) / 1000);
+}
+
+static void pollDispatch(pollBase *base, pollSnapshot *snapshot)
+{
+  size_t i;
+  size_t readyNum = 0;
+  if (snapshot->fds[0].revents) {
+    char buffer[64];
+    base->wakeupPending = 0;
+    while (read(base->pipeFd[0], buffer, sizeof(buffer)) > 0)
+      continue;
+  }
+
+  // Disarm all ready descriptors (EPOLLONESHOT emulation) with single lock acquire
+  __spinlock_acquire(&base->lock);
+  for (i = 1; i < snapshot->num; i++) {
+    short revents = snapshot->fds[i].revents;
+    if (!revents)
+      continue;
+
+    // Descriptor can be modified or removed by another thread after snapshot creation
+    PollObject *object = snapshot->objects[i];
+    if (object->index == POLL_NOT_REGISTERED ||
+        base->objects[object->index] != object ||
+        base->fds[object->index].fd != snapshot->fds[i].fd)
+      continue;
+
+    uint32_t eventMask = 0;
+    if (revents & (POLLIN | POLLERR) && object->events & POLLIN)
+      eventMask |= IO_EVENT_READ;
+    if (revents & (POLLOUT | POLLERR) && object->events & POLLOUT)
+      eventMask |= IO_EVENT_WRITE;
+    if (revents & POLL_HANGUP_EVENTS)
+      eventMask |= IO_EVENT_ERROR;
+
+    if (eventMask) {
+      pollRemove(base, object);
+      object->IoEvents = eventMask;
+      snapshot->ready[readyNum++] = object;
+    }
+  }
+  __spinlock_release(&base->lock);
+
+  for (i = 0; i < readyNum; i++)
+    combinerPushCounter(&snapshot->ready[i]->Object.root, COMBINER_TAG_ACCESS);
+}
+
+asyncBase *pollNewAsyncBase()
+{
+  pollBase *base = malloc(sizeof(pollBase));
+  if (base) {
+    base->B.methodImpl = pollImpl;
+    if (pipe(base->pipeFd) == -1) {
+      fprintf(stderr, " * pollNewAsyncBase: pipe failed\n");
+    } else {
+      fcntl(base->pipeFd[0], F_SETFL, fcntl(base->pipeFd[0], F_GETFL) | O_NONBLOCK);
+      fcntl(base->pipeFd[1], F_SETFL, fcntl(base->pipeFd[1], F_GETFL) | O_NONBLOCK);
+    }
+
+    base->wakeupPending = 0;
+    base->pollingThreads = 0;
+    base->lock = 0;
+    base->generation = 0;
+    base->fdsNum = 0;
+    base->fdsSize = POLL_INITIAL_SIZE;
+    base->fds = malloc(sizeof(struct pollfd)*base->fdsSize);
+    base->objects = malloc(sizeof(PollObject*)*base->fdsSize);
+  }
+
+  return (asyncBase *)base;
+}
+
+void pollEnqueue(asyncBase *base, asyncOpRoot *op)
+{
+  concurrentQueuePush(&base->globalQueue, op);
+  pollWakeup((pollBase*)base);
+}
+
+void pollPostEmptyOperation(asyncBase *base)
+{
+  pollEnqueue(base, 0);
+}
+
+void pollCombinerTaskHandler(aioObjectRoot *object, asyncOpRoot *op, AsyncOpActionTy opMethod)
+{
+  PollObject *fdObject = (object->type == ioObjectDevice || object->type == ioObjectSocket) ? (PollObject*)object : 0;
+  uint32_t ioEvents = fdObject ? fdObject->IoEvents : 0;
+
+  if (ioEvents & IO_EVENT_ERROR) {
+    // POLLHUP mapped to TAG_ERROR, cancel all operations with aosDisconnected status
+    int available = 0;
+    int fd = getFd(fdObject);
+    ioctl(fd, FIONREAD, &available);
+    if (available == 0)
+      cancelOperationList(&object->readQueue, aosDisconnected);
+    cancelOperationList(&object->writeQueue, aosDisconnected);
+  }
+
+  uint32_t needStart = ioEvents;
+  if (op)
+    processAction(op, opMethod, &needStart);
+  if (needStart & IO_EVENT_READ)
+    executeOperationList(&object->readQueue);
+  if (needStart & IO_EVENT_WRITE)
+    executeOperationList(&object->writeQueue);
+
+  if (fdObject) {
+    pollBase *base = (pollBase*)object->base;
+    short newEvents = 0;
+    if (object->readQueue.head)
+      newEvents |= POLLIN;
+    if (object->writeQueue.head)
+      newEvents |= POLLOUT;
+
+    if (ioEvents)
+      fdObject->IoEvents = 0;
+    if (pollUpdate(base, fdObject, newEvents, getFd(fdObject)))
+      pollWakeupIfWaiting(base);
+  }
+}
+
+void pollNextFinishedOperation(asyncBase *base)
+{
+  pollBase *localBase = (pollBase *)base;
+  pollSnapshot snapshot;
+  memset(&snapshot, 0, sizeof(snapshot));
+  messageLoopThreadId = __sync_fetch_and_add(&base->messageLoopThreadCounter, 1);
+
+  while (1) {
+    if (!executeGlobalQueue(base)) {
+      // Found quit marker
+      unsigned threadsRunning = __uint_atomic_fetch_and_add(&base->messageLoopThreadCounter, 0u-1) - 1;
+      if (threadsRunning)
+        pollEnqueue(base, 0);
+      free(snapshot.fds);
+      free(snapshot.objects);
+      free(snapshot.ready);
+      return;
+    }
+
+    // Register as waiting thread before snapshot creation, pollUpdate checks this counter after modification
+    __uint_atomic_fetch_and_add(&localBase->pollingThreads, 1);
+    pollSnapshotUpdate(localBase, &snapshot);
+    int nfds = poll(snapshot.fds, (nfds_t)snapshot.num, pollTimeout(base, getMonotonicTime()));
+    __uint_atomic_fetch_and_add(&localBase->pollingThreads, 0u-1);
+
+    time_t currentTime = time(0);
+    if (currentTime % base->messageLoopThreadCounter == messageLoopThreadId)
+      processTimeoutQueue(base, currentTime);
+    if (pollTimeout(base, getMonotonicTime()) == 0)
+      processTimerHeap(base);
+
+    if (nfds > 0)
+      pollDispatch(localBase, &snapshot);
+    else if (nfds == -1 && errno != EINTR)
+      fprintf(stderr, "poll error, errno: %s\n", strerror(errno));
+  }
+}
+
+
+aioObject *pollNewAioObject(asyncBase *base, IoObjectTy type, void *data)
+{
+  PollObject *object = 0;
+  if (!concurrentQueuePop(&objectPool, (void**)&object)) {
+    object = alignedMalloc(sizeof(PollObject), TAGGED_POINTER_ALIGNMENT);
+    object->Object.buffer.ptr = 0;
+    object->Object.buffer.totalSize = 0;
+  }
+
+  initObjectRoot(&object->Object.root, base, type, (aioObjectDestructor*)pollDeleteObject);
+  switch (type) {
+    case ioObjectDevice :
+      object->Object.hDevice = *(iodevTy *)data;
+      break;
+    case ioObjectSocket :
+      object->Object.hSocket = *(socketTy *)data;
+      break;
+    default :
+      break;
+  }
+
+  object->IoEvents = 0;
+  object->events = 0;
+  object->index = POLL_NOT_REGISTERED;
+  object->Object.buffer.offset = 0;
+  object->Object.buffer.dataSize = 0;
+  return &object->Object;
+}
+
+asyncOpRoot *pollNewAsyncOp(asyncBase *base, int isRealTime, ConcurrentQueue *objectPool, ConcurrentQueue *objectTimerPool)
+{
+  asyncOp *op = 0;
+  if (asyncOpAlloc(base, sizeof(asyncOp), isRealTime, objectPool, objectTimerPool, (asyncOpRoot**)&op)) {
+    op->internalBuffer = 0;
+    op->internalBufferSize = 0;
+  }
+
+  return &op->root;
+}
+
+int pollCancelAsyncOp(asyncOpRoot *opptr)
+{
+  __UNUSED(opptr);
+  return 1;
+}
+
+void pollDeleteObject(aioObject *object)
+{
+  pollBase *localBase = (pollBase*)object->root.base;
+  PollObject *pollObject = (PollObject*)object;
+  __spinlock_acquire(&localBase->lock);
+  if (pollObject->index != POLL_NOT_REGISTERED)
+    pollRemove(localBase, pollObject);
+  __spinlock_release(&localBase->lock);
+
+  switch (object->root.type) {
+    case ioObjectDevice :
+      close(object->hDevice);
+      object->hDevice = -1;
+      break;
+    case ioObjectSocket :
+      close(object->hSocket);
+      object->hSocket = -1;
+      break;
+    default :
+      break;
+  }
+
+  concurrentQueuePush(&objectPool, object);
+}
+
+void pollInitializeTimer(asyncBase *base, asyncOpRoot *op)
+{
+  __UNUSED(base);
+  op->timerId = timerNodeNew(op);
+}
+
+void pollStartTimer(asyncOpRoot *op)
+{
+  timerHeapStart(op->object->base, (aioTimerNode*)op->timerId, op->timeout);
+}
+
+void pollStopTimer(asyncOpRoot *op)
+{
+  timerHeapStop(op->object->base, (aioTimerNode*)op->timerId);
+}
+
+void pollDeleteTimer(asyncOpRoot *op)
+{
+  free(op->timerId);
+}
+
+void pollArmTimer(asyncBase *base, uint64_t deadline)
+{
+  // Poll timeout recalculated before each poll call, only threads already waiting must be interrupted
+  if (deadline)
+    pollWakeupIfWaiting((pollBase*)base);
+}
+
+void pollActivate(aioUserEvent *op)
+{
+  pollEnqueue(op->base, &op->root);
+}
+
+
+AsyncOpStatus pollAsyncConnect(asyncOpRoot *opptr)
+{
+  asyncOp *op = (asyncOp*)opptr;
+  int fd = getFd((PollObject*)op->root.object);
+  if (op->state == 0) {
+    op->state = 1;
+    struct sockaddr_storage sa;
+    socklen_t saLen = hostAddressToSockaddr(&op->host, &sa);
+    int result = connect(fd, (struct sockaddr *)&sa, saLen);
+    if (result == -1 && errno != EINPROGRESS)
+      return aosUnknownError;
+    else
+      return aosPending;
+  } else {
+    int error;
+    socklen_t size = sizeof(error);
+    getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &size);
+    return (error == 0) ? aosSuccess : aosUnknownError;
+  }
+}
+
+
+AsyncOpStatus pollAsyncAccept(asyncOpRoot *opptr)
+{
+  struct sockaddr_storage clientAddr;
+  asyncOp *op = (asyncOp*)opptr;
+  int fd = getFd((PollObject*)op->root.object);
+  socklen_t clientAddrSize = sizeof(clientAddr);
+  op->acceptSocket =
+    accept(fd, (struct sockaddr *)&clientAddr, &clientAddrSize);
+
+  if (op->acceptSocket != -1) {
+    int current = fcntl(op->acceptSocket, F_GETFL);
+    fcntl(op->acceptSocket, F_SETFL, O_NONBLOCK | current);
+    sockaddrToHostAddress(&clientAddr, &op->host);
+    return aosSuccess;
+  } else {
+    return errno == EAGAIN ? aosPending : aosUnknownError;
+  }
+}
+
+
+AsyncOpStatus pollAsyncRead(asyncOpRoot *opptr)
+{
+  asyncOp *op = (asyncOp*)opptr;
+  PollObject *object = (PollObject*)op->root.object;
+  struct ioBuffer *sb = &object->Object.buffer;
+  int fd = getFd(object);
+
+  if (copyFromBuffer(op->buffer, &op->bytesTransferred, sb, op->transactionSize))
+    return aosSuccess;
+
+  if (op->transactionSize <= object->Object.buffer.totalSize) {
+    while (op->bytesTransferred < op->transactionSize) {
+      ssize_t bytesRead = read(fd, sb->ptr, sb->totalSize);
+      if (bytesRead == 0)
+        return aosDisconnected;
+      else if (bytesRead < 0)
+        return errno == EAGAIN ? aosPending : aosUnknownError;
+      sb->dataSize = (size_t)bytesRead;
+
+      if (copyFromBuffer(op->buffer, &op->bytesTransferred, sb, op->transactionSize) || !(opptr->flags & afWaitAll))
+        break;
+    }
+
+    return aosSuccess;
+  } else {
+    ssize_t bytesRead = read(fd,
+                             (uint8_t *)op->buffer + op->bytesTransferred,
+                             op->transactionSize - op->bytesTransferred);
+
+    if (bytesRead > 0) {
+      op->bytesTransferred += (size_t)bytesRead;
+      if (op->root.flags & afWaitAll && op->bytesTransferred < op->transactionSize)
+        return aosPending;
+      else
+        return aosSuccess;
+    } else if (bytesRead == 0) {
+      return op->transactionSize - op->bytesTransferred > 0 ? aosDisconnected : aosSuccess;
+    } else {
+      return errno == EAGAIN ? aosPending : aosUnknownError;
+    }
+  }
+}
+
+
+AsyncOpStatus pollAsyncWrite(asyncOpRoot *opptr)
+{
+  asyncOp *op = (asyncOp*)opptr;
+  PollObject *object = (PollObject*)op->root.object;
+  int fd = getFd(object);
+
+  ssize_t bytesWritten;
+  if (op->transactionSize == op->bytesTransferred) {
+    // Data already sent by coalesced write of previous operation
+    bytesWritten = 0;
+  } else if (object->Object.writeQueue.coalesceOps > 1) {
+    bytesWritten = writeCoalesced(op, fd, object->Object.root.type == ioObjectSocket, POLL_SEND_FLAGS);
+  } else {
+    object->Object.writeQueue.writeCalls++;
+    bytesWritten = object->Object.root.type == ioObjectSocket ?
+      send(fd, (uint8_t *)op->buffer + op->bytesTransferred, op->transactionSize - op->bytesTransferred, POLL_SEND_FLAGS) :
+      write(fd, (uint8_t *)op->buffer + op->bytesTransferred, op->transactionSize - op->bytesTransferred);
+  }
+
+  if (bytesWritten > 0) {
+    op->bytesTransferred += (size_t)bytesWritten;
+    if (op->root.flags & afWaitAll && op->bytesTransferred < op->transactionSize)
+      return aosPending;
+    else
+      return aosSuccess;
+  } else if (bytesWritten == 0) {
+    return op->transactionSize - op->bytesTransferred > 0 ? aosDisconnected : aosSuccess;
+  } else {
+    return errno == EAGAIN ? aosPending : aosUnknownError;
+  }
+}
+
+
+AsyncOpStatus pollAsyncReadMsg(asyncOpRoot *opptr)
+{
+  asyncOp *op = (asyncOp*)opptr;
+  int fd = getFd((PollObject*)op->root.object);
+
+  struct sockaddr_storage source;
+  socklen_t addrlen = sizeof(source);
+  ssize_t result = recvfrom(fd, op->buffer, op->transactionSize, 0, (struct sockaddr*)&source, &addrlen);
+  if (result != -1) {
+    sockaddrToHostAddress(&source, &op->host);
+    op->bytesTransferred = (size_t)result;
+    return aosSuccess;
+  } else {
+    if (errno == EAGAIN)
+      return aosPending;
+    if (errno == ENOMEM)
+      return aosBufferTooSmall;
+    else
+      return aosUnknownError;
+  }
+}
+
+
+AsyncOpStatus pollAsyncWriteMsg(asyncOpRoot *opptr)
+{
+  asyncOp *op = (asyncOp*)opptr;
+  int fd = getFd((PollObject*)op->root.object);
+
+  struct sockaddr_storage remoteAddress;
+  socklen_t addrLen = hostAddressToSockaddr(&op->host, &remoteAddress);
+  ssize_t result = sendto(fd, op->buffer, op->transactionSize, 0, (struct sockaddr *)&remoteAddress, addrLen);
+  if (result != -1) {
+    return aosSuccess;
+  }
+
+  return aosPending;
+}
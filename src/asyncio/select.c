@@ -41,6 +41,7 @@ typedef struct selectBase {
   asyncBase B;
   int pipeFd[2];  
   fdStruct *fdMap;
+  timer_t heapTimer;
 } selectBase;
 
 void selectCombinerTaskHandler(aioObjectRoot *object, asyncOpRoot *op, AsyncOpActionTy opMethod);
@@ -55,6 +56,7 @@ void selectInitializeTimer(asyncBase *base, asyncOpRoot *op);
 void selectStartTimer(asyncOpRoot *op);
 void selectStopTimer(asyncOpRoot *op);
 void selectDeleteTimer(asyncOpRoot *op);
+void selectArmTimer(asyncBase *base, uint64_t deadline);
 void selectActivate(aioUserEvent *op);
 AsyncOpStatus selectAsyncConnect(asyncOpRoot *opptr);
 AsyncOpStatus selectAsyncAccept(asyncOpRoot *opptr);
@@ -77,6 +79,7 @@ static struct asyncImpl selectImpl = {
   selectStartTimer,
   selectStopTimer,
   selectDeleteTimer,
+  selectArmTimer,
   selectActivate,
   selectAsyncConnect,
   selectAsyncAccept,
@@ -115,17 +118,20 @@ static void timerCb(int sig, siginfo_t *si, void *uc)
   __UNUSED(uc);
   asyncOpRoot *op = (asyncOpRoot*)si->si_value.sival_ptr;
   selectBase *base = (selectBase*)op->object->base;
-  
-  if (op->opCode == actUserEvent) {
-    aioUserEvent *event = (aioUserEvent*)op;
-    if (event->counter > 0)
-      event->counter--;
-  }
-  
   if (write(base->pipeFd[1], &op, sizeof(op)) <= 0)
     fprintf(stderr, "ERROR(timerCb): write call error");
 }
 
+static void heapTimerCb(int sig, siginfo_t *si, void *uc)
+{
+  __UNUSED(sig);
+  __UNUSED(uc);
+  // Base pointer written to pipe as timer heap expiration marker
+  selectBase *base = (selectBase*)si->si_value.sival_ptr;
+  if (write(base->pipeFd[1], &base, sizeof(base)) <= 0)
+    fprintf(stderr, "ERROR(heapTimerCb): write call error");
+}
+
 
 static void startTimer(asyncOpRoot *op, uint64_t usTimeout, int periodic)
 {
@@ -180,6 +186,17 @@ __NO_EXPAND_RECURSIVE_MACRO_BEGIN
     if (sigaction(SIGRTMIN, &sAction, NULL) == -1) {
       fprintf(stderr, " * selectNewAsyncBase: sigaction error\n");
     }
+
+    sAction.sa_sigaction = heapTimerCb;
+    if (sigaction(SIGRTMIN+1, &sAction, NULL) == -1) {
+      fprintf(stderr, " * selectNewAsyncBase: sigaction error\n");
+    }
+
+    struct sigevent sEvent;
+    sEvent.sigev_notify = SIGEV_SIGNAL;
+    sEvent.sigev_signo = SIGRTMIN+1;
+    sEvent.sigev_value.sival_ptr = base;
+    timer_create(CLOCK_MONOTONIC, &sEvent, &base->heapTimer);
     
     memset(&sAction, 0, sizeof(sAction));
     sAction.sa_handler = SIG_IGN;        
@@ -260,10 +277,10 @@ void selectNextFinishedOperation(asyncBase *base)
           return;
     
         if (op) {
-          if (op->opCode == actUserEvent) {
+          if (op == (asyncOpRoot*)localBase) {
+            processTimerHeap(base);
+          } else if (op->opCode == actUserEvent) {
             aioUserEvent *event = (aioUserEvent*)op;
-            if (event->counter == 0)
-              stopTimer(op);
             event->root.finishMethod(&event->root);
           } else {
 //            if (op->object->type != ioObjectUserDefined)
@@ -347,6 +364,17 @@ void selectDeleteTimer(asyncOpRoot *op)
   __UNUSED(op);
 }
 
+void selectArmTimer(asyncBase *base, uint64_t deadline)
+{
+  // Absolute CLOCK_MONOTONIC time, zero deadline disarms timer
+  struct itimerspec its;
+  memset(&its, 0, sizeof(its));
+  its.it_value.tv_sec = (time_t)(deadline / 1000000);
+  its.it_value.tv_nsec = (long)(deadline % 1000000) * 1000;
+  if (timer_settime(((selectBase*)base)->heapTimer, TIMER_ABSTIME, &its, NULL) == -1)
+    fprintf(stderr, " * selectArmTimer: timer_settime error %s\n", strerror(errno));
+}
+
 void selectActivate(aioUserEvent *event)
 {
   selectBase *localBase = (selectBase*)event->base;
@@ -2,18 +2,100 @@
 #include "asyncio/coroutine.h"
 #include "asyncio/socket.h"
 #include "asyncio/socketSSL.h"
+#include "asyncio/timer.h"
 #include "asyncioImpl.h"
 #include "atomic.h"
 #include <openssl/bio.h>
+#include <openssl/err.h>
 #include <openssl/ssl.h>
+#include <stdio.h>
 #include <string.h>
+#ifndef OS_WINDOWS
+#include <pthread.h>
+#endif
 
 #define DEFAULT_SSL_READ_BUFFER_SIZE 16384
 #define DEFAULT_SSL_WRITE_BUFFER_SIZE 16384
+#define DEFAULT_SSL_SESSION_CACHE_SIZE 1024
+// Bigger write chunks returned to system instead of pool
+#define SSL_WRITE_CHUNK_POOL_LIMIT (1u << 20)
 
 static ConcurrentQueue opPool;
 static ConcurrentQueue opTimerPool;
 static ConcurrentQueue objectPool;
+static ConcurrentQueue chunkPool;
+
+static SSLContext *volatile defaultClientContext = 0;
+static BIO_METHOD *volatile socketBioMethod = 0;
+
+__NO_PADDING_BEGIN
+struct SSLWriteChunk {
+  SSLOp *op;
+  size_t size;
+  size_t capacity;
+  uint8_t *data;
+};
+
+__NO_PADDING_END
+
+__NO_PADDING_BEGIN
+typedef struct SSLSessionEntry {
+  char key[SSL_SESSION_KEY_SIZE];
+  SSL_SESSION *session;
+  uint64_t lastUsed;
+} SSLSessionEntry;
+
+struct SSLContext {
+  SSL_CTX *handle;
+  volatile unsigned refs;
+  int isServer;
+  // Client session cache, one resumable session per server, LRU eviction
+  unsigned sessionLock;
+  size_t sessionCacheSize;
+  size_t sessionsNum;
+  uint64_t sessionClock;
+  SSLSessionEntry *sessions;
+  SSLHandshakePool *handshakePool;
+  // ALPN protocol list in wire format (length-prefixed names)
+  unsigned char *alpn;
+  unsigned alpnSize;
+};
+
+struct SSLHandshakeJob {
+  SSLHandshakeJob *next;
+  SSLSocket *socket;
+  SSLOp *op;
+  // Operation reused after step submitted not resumed
+  uintptr_t opGeneration;
+  SSLHandshakePool *pool;
+  aioUserEvent *event;
+  timeMark submitTime;
+  int result;
+  int errCode;
+  int finished;
+  // Guarded by pool lock: submitted and result not delivered yet; socket deleted meanwhile is
+  // released by delivery
+  int inFlight;
+  int orphaned;
+};
+
+struct SSLHandshakePool {
+#ifdef OS_WINDOWS
+  SRWLOCK lock;
+  CONDITION_VARIABLE cond;
+  HANDLE *threads;
+#else
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  pthread_t *threads;
+#endif
+  unsigned threadsNum;
+  int stop;
+  SSLHandshakeJob *head;
+  SSLHandshakeJob *tail;
+  SSLHandshakePoolStats stats;
+};
+__NO_PADDING_END
 
 struct Context {
   aioExecuteProc *StartProc;
@@ -40,13 +122,18 @@ static inline void fillContext(struct Context *context,
 
 typedef enum {
   sslStInitalize = 0,
-  sslStProcessing
+  sslStProcessing,
+  // Write failed before operation created, reported by operation
+  sslStFailed
 } SSLSocketStateTy;
 
+// Handshakes and reads share read queue, writes have own queue: after handshake socket is full
+// duplex, write isn't blocked by pending read
 typedef enum {
   sslOpConnect = 0,
   sslOpRead,
-  sslOpWrite
+  sslOpAccept,
+  sslOpWrite = OPCODE_WRITE
 } SSLOpTy;
 
 __NO_PADDING_BEGIN
@@ -58,12 +145,304 @@ typedef struct coroReturnStruct {
 __NO_PADDING_END
 
 static AsyncOpStatus connectProc(asyncOpRoot *opptr);
+static AsyncOpStatus acceptProc(asyncOpRoot *opptr);
 static AsyncOpStatus readProc(asyncOpRoot *opptr);
 static void sslWriteWriteCb(AsyncOpStatus status, aioObject *object, size_t transferred, void *arg);
 
+static SSLSessionEntry *sessionFind(SSLContext *context, const char *key)
+{
+  for (size_t i = 0; i < context->sessionsNum; i++) {
+    if (strcmp(context->sessions[i].key, key) == 0)
+      return &context->sessions[i];
+  }
+
+  return 0;
+}
+
+static int sessionNewCb(SSL *ssl, SSL_SESSION *session)
+{
+  SSLSocket *S = (SSLSocket*)SSL_get_app_data(ssl);
+  if (!S || !S->sessionKey[0] || !SSL_SESSION_is_resumable(session))
+    return 0;
+
+  SSLContext *context = S->context;
+  SSL_SESSION *oldSession = 0;
+  __spinlock_acquire(&context->sessionLock);
+  SSLSessionEntry *entry = sessionFind(context, S->sessionKey);
+  if (!entry) {
+    if (context->sessionsNum < context->sessionCacheSize) {
+      entry = &context->sessions[context->sessionsNum++];
+      entry->session = 0;
+    } else {
+      // Evict least recently used session
+      entry = &context->sessions[0];
+      for (size_t i = 1; i < context->sessionsNum; i++) {
+        if (context->sessions[i].lastUsed < entry->lastUsed)
+          entry = &context->sessions[i];
+      }
+    }
+
+    oldSession = entry->session;
+    strcpy(entry->key, S->sessionKey);
+  } else {
+    oldSession = entry->session;
+  }
+
+  entry->session = session;
+  entry->lastUsed = ++context->sessionClock;
+  __spinlock_release(&context->sessionLock);
+
+  if (oldSession)
+    SSL_SESSION_free(oldSession);
+  // Session owned by cache now
+  return 1;
+}
+
+static SSL_SESSION *sessionAcquire(SSLContext *context, const char *key)
+{
+  SSL_SESSION *session = 0;
+  __spinlock_acquire(&context->sessionLock);
+  SSLSessionEntry *entry = sessionFind(context, key);
+  if (entry) {
+    session = entry->session;
+    SSL_SESSION_up_ref(session);
+    entry->lastUsed = ++context->sessionClock;
+  }
+  __spinlock_release(&context->sessionLock);
+  return session;
+}
+
+static void sessionClear(SSLContext *context)
+{
+  for (size_t i = 0; i < context->sessionsNum; i++)
+    SSL_SESSION_free(context->sessions[i].session);
+  context->sessionsNum = 0;
+}
+
+SSLContext *sslContextNew(int isServer)
+{
+  SSLContext *context = (SSLContext*)malloc(sizeof(SSLContext));
+#ifdef DEPRECATEDIN_1_1_0
+  context->handle = SSL_CTX_new(isServer ? TLS_server_method() : TLS_client_method());
+#else
+  context->handle = SSL_CTX_new(TLS_method());
+#endif
+  if (!context->handle) {
+    free(context);
+    return 0;
+  }
+
+  context->refs = 1;
+  context->isServer = isServer;
+  context->sessionLock = 0;
+  context->sessionCacheSize = DEFAULT_SSL_SESSION_CACHE_SIZE;
+  context->sessionsNum = 0;
+  context->sessionClock = 0;
+  context->sessions = 0;
+  context->handshakePool = 0;
+  context->alpn = 0;
+  context->alpnSize = 0;
+
+  SSL_CTX_set_verify(context->handle, SSL_VERIFY_NONE, NULL);
+  if (isServer) {
+    // Session tickets enabled by default and encrypted with context-wide key, session cache
+    // serves clients without ticket support
+    static const unsigned char sessionIdContext[] = "libp2p";
+    SSL_CTX_set_session_id_context(context->handle, sessionIdContext, sizeof(sessionIdContext)-1);
+    SSL_CTX_set_session_cache_mode(context->handle, SSL_SESS_CACHE_SERVER);
+    SSL_CTX_sess_set_cache_size(context->handle, DEFAULT_SSL_SESSION_CACHE_SIZE);
+  } else {
+    context->sessions = (SSLSessionEntry*)malloc(sizeof(SSLSessionEntry)*context->sessionCacheSize);
+    SSL_CTX_set_session_cache_mode(context->handle, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(context->handle, sessionNewCb);
+  }
+
+  return context;
+}
+
+void sslContextIncrementReference(SSLContext *context)
+{
+  __uint_atomic_fetch_and_add(&context->refs, 1);
+}
+
+void sslContextDecrementReference(SSLContext *context)
+{
+  if (__uint_atomic_fetch_and_add(&context->refs, (unsigned)-1) == 1) {
+    sessionClear(context);
+    free(context->sessions);
+    free(context->alpn);
+    SSL_CTX_free(context->handle);
+    free(context);
+  }
+}
+
+int sslContextLoadCertificate(SSLContext *context, const char *certificateFile, const char *privateKeyFile)
+{
+  if (SSL_CTX_use_certificate_chain_file(context->handle, certificateFile) != 1) {
+    fprintf(stderr, "ERROR: can't load certificate from %s\n", certificateFile);
+    return 0;
+  }
+
+  if (SSL_CTX_use_PrivateKey_file(context->handle, privateKeyFile, SSL_FILETYPE_PEM) != 1) {
+    fprintf(stderr, "ERROR: can't load private key from %s\n", privateKeyFile);
+    return 0;
+  }
+
+  if (SSL_CTX_check_private_key(context->handle) != 1) {
+    fprintf(stderr, "ERROR: private key %s does not match certificate %s\n", privateKeyFile, certificateFile);
+    return 0;
+  }
+
+  return 1;
+}
+
+int sslContextUseCertificate(SSLContext *context, X509 *certificate, EVP_PKEY *privateKey)
+{
+  return SSL_CTX_use_certificate(context->handle, certificate) == 1 &&
+         SSL_CTX_use_PrivateKey(context->handle, privateKey) == 1 &&
+         SSL_CTX_check_private_key(context->handle) == 1;
+}
+
+void sslContextSetSessionCacheSize(SSLContext *context, size_t size)
+{
+  if (size == 0)
+    size = 1;
+
+  if (context->isServer) {
+    SSL_CTX_sess_set_cache_size(context->handle, (long)size);
+  } else {
+    __spinlock_acquire(&context->sessionLock);
+    if (size < context->sessionsNum) {
+      for (size_t i = size; i < context->sessionsNum; i++)
+        SSL_SESSION_free(context->sessions[i].session);
+      context->sessionsNum = size;
+    }
+    context->sessions = (SSLSessionEntry*)realloc(context->sessions, sizeof(SSLSessionEntry)*size);
+    context->sessionCacheSize = size;
+    __spinlock_release(&context->sessionLock);
+  }
+}
+
+void sslContextSetHandshakePool(SSLContext *context, SSLHandshakePool *pool)
+{
+  context->handshakePool = pool;
+}
+
+static unsigned char *alpnEncode(const char *const *protocols, size_t protocolsNum, unsigned *size)
+{
+  size_t total = 0;
+  for (size_t i = 0; i < protocolsNum; i++) {
+    size_t length = strlen(protocols[i]);
+    if (length == 0 || length > 255)
+      return 0;
+    total += length + 1;
+  }
+
+  if (total == 0 || total > 0xFFFF)
+    return 0;
+
+  unsigned char *data = (unsigned char*)malloc(total);
+  unsigned char *p = data;
+  for (size_t i = 0; i < protocolsNum; i++) {
+    size_t length = strlen(protocols[i]);
+    *p++ = (unsigned char)length;
+    memcpy(p, protocols[i], length);
+    p += length;
+  }
+
+  *size = (unsigned)total;
+  return data;
+}
+
+static int alpnSelectCb(SSL *ssl, const unsigned char **out, unsigned char *outSize, const unsigned char *in, unsigned inSize, void *arg)
+{
+  __UNUSED(ssl);
+  SSLContext *context = (SSLContext*)arg;
+  unsigned char *selected;
+  if (SSL_select_next_proto(&selected, outSize, context->alpn, context->alpnSize, in, inSize) != OPENSSL_NPN_NEGOTIATED)
+    return SSL_TLSEXT_ERR_NOACK;
+  *out = selected;
+  return SSL_TLSEXT_ERR_OK;
+}
+
+int sslContextSetAlpn(SSLContext *context, const char *const *protocols, size_t protocolsNum)
+{
+  unsigned size;
+  unsigned char *data = alpnEncode(protocols, protocolsNum, &size);
+  if (!data)
+    return 0;
+
+  free(context->alpn);
+  context->alpn = data;
+  context->alpnSize = size;
+  if (context->isServer) {
+    SSL_CTX_set_alpn_select_cb(context->handle, alpnSelectCb, context);
+    return 1;
+  } else {
+    // Returns 0 on success
+    return SSL_CTX_set_alpn_protos(context->handle, data, size) == 0;
+  }
+}
+
+SSL_CTX *sslContextHandle(SSLContext *context)
+{
+  return context->handle;
+}
+
+static SSLContext *sslDefaultClientContext()
+{
+  SSLContext *context = defaultClientContext;
+  if (context)
+    return context;
+
+  context = sslContextNew(0);
+  if (!__pointer_atomic_compare_and_swap((void *volatile*)&defaultClientContext, 0, context)) {
+    sslContextDecrementReference(context);
+    context = defaultClientContext;
+  }
+
+  return context;
+}
+
+static void sessionKeyFill(SSLSocket *socket, const HostAddress *address, const char *tlsextHostName)
+{
+  if (address && address->family == AF_INET) {
+    snprintf(socket->sessionKey, sizeof(socket->sessionKey), "%s/%08x:%u",
+             tlsextHostName ? tlsextHostName : "",
+             (unsigned)address->ipv4,
+             (unsigned)address->port);
+  } else if (tlsextHostName) {
+    snprintf(socket->sessionKey, sizeof(socket->sessionKey), "%s", tlsextHostName);
+  } else {
+    socket->sessionKey[0] = 0;
+  }
+}
+
+static void sessionResume(SSLSocket *socket, const HostAddress *address, const char *tlsextHostName)
+{
+  if (socket->context->isServer)
+    return;
+  sessionKeyFill(socket, address, tlsextHostName);
+  if (socket->sessionKey[0]) {
+    SSL_SESSION *session = sessionAcquire(socket->context, socket->sessionKey);
+    if (session) {
+      SSL_set_session(socket->ssl, session);
+      SSL_SESSION_free(session);
+    }
+  }
+}
+
 static int cancel(asyncOpRoot *opptr)
 {
   SSLSocket *S = (SSLSocket*)opptr->object;
+  // Operation held until handshake end has no child operation, socket I/O belongs to handshake
+  for (SSLOp **p = &S->heldOps; *p; p = &(*p)->heldNext) {
+    if (&(*p)->root == opptr) {
+      *p = (*p)->heldNext;
+      return 1;
+    }
+  }
+
   cancelIo((aioObjectRoot*)S->object);
   return 0;
 }
@@ -79,9 +458,32 @@ static void rwFinish(asyncOpRoot *opptr)
   ((sslCb*)opptr->callback)(opGetStatus(opptr), (SSLSocket*)opptr->object, op->bytesTransferred, opptr->arg);
 }
 
+static void heldOpsHold(SSLSocket *S, SSLOp *op)
+{
+  op->heldNext = S->heldOps;
+  S->heldOps = op;
+}
+
+// Handshake finished by any way: continue operations waiting for it
+static void heldOpsResume(SSLSocket *S)
+{
+  AsyncOpStatus status = S->isConnected ? aosSuccess : aosUnknownError;
+  SSLOp *op = S->heldOps;
+  S->handshaking = 0;
+  S->heldOps = 0;
+  while (op) {
+    SSLOp *next = op->heldNext;
+    resumeParent(&op->root, status);
+    op = next;
+  }
+}
+
 static void releaseOp(asyncOpRoot *opptr)
 {
   SSLOp *op = (SSLOp*)opptr;
+  SSLSocket *S = (SSLSocket*)opptr->object;
+  if ((opptr->opCode == sslOpConnect || opptr->opCode == sslOpAccept) && S->handshaking)
+    heldOpsResume(S);
   if (op->internalBuffer) {
     free(op->internalBuffer);
     op->internalBuffer = 0;
@@ -158,17 +560,169 @@ static ssize_t coroutineRwFinish(SSLOp *op, SSLSocket *object)
   return status == aosSuccess ? (ssize_t)bytesTransferred : -(int)status;
 }
 
-size_t copyFromOut(SSLSocket *S)
+static SSLWriteChunk *writeChunkAlloc(size_t capacity)
 {
-  size_t nBytes = BIO_ctrl_pending(S->bioOut);
-  if (nBytes > S->sslWriteBufferSize) {
-    S->sslWriteBuffer = realloc(S->sslWriteBuffer, nBytes);
-    S->sslWriteBufferSize = nBytes;
+  SSLWriteChunk *chunk = 0;
+  if (!concurrentQueuePop(&chunkPool, (void**)&chunk)) {
+    chunk = (SSLWriteChunk*)malloc(sizeof(SSLWriteChunk));
+    chunk->capacity = 0;
+    chunk->data = 0;
   }
 
-  // TODO: correct processing >4Gb data blocks
-  BIO_read(S->bioOut, S->sslWriteBuffer, (int)nBytes);
-  return nBytes;
+  if (chunk->capacity < capacity) {
+    chunk->data = (uint8_t*)realloc(chunk->data, capacity);
+    chunk->capacity = capacity;
+  }
+
+  chunk->op = 0;
+  chunk->size = 0;
+  return chunk;
+}
+
+static void writeChunkRelease(SSLWriteChunk *chunk)
+{
+  if (chunk->capacity <= SSL_WRITE_CHUNK_POOL_LIMIT) {
+    concurrentQueuePush(&chunkPool, chunk);
+  } else {
+    free(chunk->data);
+    free(chunk);
+  }
+}
+
+static SSLWriteChunk *writeChunkDetach(SSLSocket *S)
+{
+  SSLWriteChunk *chunk = S->writeChunk;
+  S->writeChunk = 0;
+  return chunk;
+}
+
+
+static int socketBioWrite(BIO *bio, const char *data, size_t size, size_t *written)
+{
+  SSLSocket *S = (SSLSocket*)BIO_get_data(bio);
+  SSLWriteChunk *chunk = S->writeChunk;
+  BIO_clear_retry_flags(bio);
+  if (!chunk) {
+    chunk = writeChunkAlloc(size > DEFAULT_SSL_WRITE_BUFFER_SIZE ? size : DEFAULT_SSL_WRITE_BUFFER_SIZE);
+    S->writeChunk = chunk;
+  } else if (chunk->size + size > chunk->capacity) {
+    size_t capacity = chunk->capacity*2;
+    if (capacity < chunk->size + size)
+      capacity = chunk->size + size;
+    chunk->data = (uint8_t*)realloc(chunk->data, capacity);
+    chunk->capacity = capacity;
+  }
+
+  // Single copy: TLS record goes from OpenSSL buffer to chunk, chunk goes to socket as is
+  memcpy(chunk->data + chunk->size, data, size);
+  chunk->size += size;
+  *written = size;
+  return 1;
+}
+
+static int socketBioRead(BIO *bio, char *data, size_t size, size_t *readBytes)
+{
+  SSLSocket *S = (SSLSocket*)BIO_get_data(bio);
+  size_t available = S->sslReadDataSize - S->sslReadOffset;
+  BIO_clear_retry_flags(bio);
+  if (!available) {
+    BIO_set_retry_read(bio);
+    *readBytes = 0;
+    return 0;
+  }
+
+  if (size > available)
+    size = available;
+  memcpy(data, S->sslReadBuffer + S->sslReadOffset, size);
+  S->sslReadOffset += size;
+  *readBytes = size;
+  return 1;
+}
+
+static long socketBioCtrl(BIO *bio, int cmd, long num, void *ptr)
+{
+  __UNUSED(num);
+  __UNUSED(ptr);
+  SSLSocket *S = (SSLSocket*)BIO_get_data(bio);
+  switch (cmd) {
+    case BIO_CTRL_FLUSH :
+      return 1;
+    case BIO_CTRL_PENDING :
+      return (long)(S->sslReadDataSize - S->sslReadOffset);
+    case BIO_CTRL_WPENDING :
+      return S->writeChunk ? (long)S->writeChunk->size : 0;
+    default :
+      return 0;
+  }
+}
+
+static BIO_METHOD *sslSocketBioMethod()
+{
+  BIO_METHOD *method = socketBioMethod;
+  if (method)
+    return method;
+
+  method = BIO_meth_new(BIO_get_new_index() | BIO_TYPE_SOURCE_SINK, "asyncio socket");
+  BIO_meth_set_write_ex(method, socketBioWrite);
+  BIO_meth_set_read_ex(method, socketBioRead);
+  BIO_meth_set_ctrl(method, socketBioCtrl);
+  if (!__pointer_atomic_compare_and_swap((void *volatile*)&socketBioMethod, 0, method)) {
+    BIO_meth_free(method);
+    method = socketBioMethod;
+  }
+
+  return method;
+}
+
+// Free space of read-ahead buffer for next socket read, OpenSSL consumes all buffered data
+// before asking for more, so buffer usually rewinds without moving data
+static uint8_t *readBufferPrepare(SSLSocket *S, size_t *size)
+{
+  if (S->sslReadOffset == S->sslReadDataSize) {
+    S->sslReadOffset = 0;
+    S->sslReadDataSize = 0;
+  } else if (S->sslReadOffset) {
+    memmove(S->sslReadBuffer, S->sslReadBuffer + S->sslReadOffset, S->sslReadDataSize - S->sslReadOffset);
+    S->sslReadDataSize -= S->sslReadOffset;
+    S->sslReadOffset = 0;
+  }
+
+  *size = S->sslReadBufferSize - S->sslReadDataSize;
+  return S->sslReadBuffer + S->sslReadDataSize;
+}
+
+// Classify SSL_read_ex failure: lack of input data is not an error
+static AsyncOpStatus sslReadStatus(SSLSocket *S, int readResult)
+{
+  if (readResult == 1)
+    return aosSuccess;
+  switch (SSL_get_error(S->ssl, readResult)) {
+    case SSL_ERROR_WANT_READ :
+    case SSL_ERROR_WANT_WRITE :
+      return aosSuccess;
+    case SSL_ERROR_ZERO_RETURN :
+      return aosDisconnected;
+    default :
+      return aosUnknownError;
+  }
+}
+
+static void sslChunkWriteCb(AsyncOpStatus status, aioObject *object, size_t transferred, void *arg)
+{
+  __UNUSED(status);
+  __UNUSED(object);
+  __UNUSED(transferred);
+  writeChunkRelease((SSLWriteChunk*)arg);
+}
+
+// Send pending handshake data, nobody waits for result
+static void writeChunkFlush(SSLSocket *S)
+{
+  SSLWriteChunk *chunk = writeChunkDetach(S);
+  if (chunk) {
+    if (aioWrite(S->object, chunk->data, chunk->size, afWaitAll | afNoCopy, 0, sslChunkWriteCb, chunk) == -(ssize_t)aosQueueFull)
+      writeChunkRelease(chunk);
+  }
 }
 
 static void sslConnectConnectCb(AsyncOpStatus status, aioObject *object, void *arg)
@@ -182,75 +736,341 @@ static void sslConnectReadCb(AsyncOpStatus status, aioObject *object, size_t tra
   __UNUSED(object);
   SSLOp *op = (SSLOp*)arg;
   SSLSocket *socket = (SSLSocket*)op->root.object;
-  // TODO: correct processing >4Gb data blocks
-  BIO_write(socket->bioIn, socket->sslReadBuffer, (int)transferred);
+  socket->sslReadDataSize += transferred;
   resumeParent((asyncOpRoot*)arg, status);
 }
 
-static AsyncOpStatus connectProc(asyncOpRoot *opptr)
+static void handshakePoolLock(SSLHandshakePool *pool)
 {
-  SSLOp *op = (SSLOp*)opptr;
-  SSLSocket *socket = (SSLSocket*)op->root.object;
+#ifdef OS_WINDOWS
+  AcquireSRWLockExclusive(&pool->lock);
+#else
+  pthread_mutex_lock(&pool->lock);
+#endif
+}
 
-  if (op->state == sslStInitalize) {
-    op->state = sslStProcessing;
-    aioConnect(socket->object, &op->address, 0, sslConnectConnectCb, op);
-    return aosPending;
+static void handshakePoolUnlock(SSLHandshakePool *pool)
+{
+#ifdef OS_WINDOWS
+  ReleaseSRWLockExclusive(&pool->lock);
+#else
+  pthread_mutex_unlock(&pool->lock);
+#endif
+}
+
+static void handshakePoolWorker(SSLHandshakePool *pool)
+{
+  handshakePoolLock(pool);
+  for (;;) {
+    while (!pool->head && !pool->stop) {
+#ifdef OS_WINDOWS
+      SleepConditionVariableSRW(&pool->cond, &pool->lock, INFINITE, 0);
+#else
+      pthread_cond_wait(&pool->cond, &pool->lock);
+#endif
+    }
+
+    if (!pool->head)
+      break;
+
+    SSLHandshakeJob *job = pool->head;
+    pool->head = job->next;
+    if (!pool->head)
+      pool->tail = 0;
+    pool->stats.queueDepth--;
+    uint64_t waitTime = usDiff(job->submitTime, getTimeMark());
+    pool->stats.totalWaitTime += waitTime;
+    if (waitTime > pool->stats.maxWaitTime)
+      pool->stats.maxWaitTime = waitTime;
+    handshakePoolUnlock(pool);
+
+    // Socket BIO works with read-ahead buffer and write chunk, event loop doesn't touch them
+    // until result delivered
+    SSL *ssl = job->socket->ssl;
+    ERR_clear_error();
+    job->result = SSL_do_handshake(ssl);
+    job->errCode = SSL_get_error(ssl, job->result);
+    ERR_clear_error();
+    job->finished = 1;
+    userEventActivate(job->event);
+
+    handshakePoolLock(pool);
+  }
+  handshakePoolUnlock(pool);
+}
+
+#ifdef OS_WINDOWS
+static DWORD WINAPI handshakePoolThreadProc(LPVOID arg)
+{
+  handshakePoolWorker((SSLHandshakePool*)arg);
+  return 0;
+}
+#else
+static void *handshakePoolThreadProc(void *arg)
+{
+  handshakePoolWorker((SSLHandshakePool*)arg);
+  return 0;
+}
+#endif
+
+SSLHandshakePool *sslHandshakePoolNew(unsigned threadsNum)
+{
+  SSLHandshakePool *pool = (SSLHandshakePool*)calloc(1, sizeof(SSLHandshakePool));
+  pool->threadsNum = threadsNum ? threadsNum : 1;
+#ifdef OS_WINDOWS
+  InitializeSRWLock(&pool->lock);
+  InitializeConditionVariable(&pool->cond);
+  pool->threads = (HANDLE*)malloc(sizeof(HANDLE)*pool->threadsNum);
+  for (unsigned i = 0; i < pool->threadsNum; i++)
+    pool->threads[i] = CreateThread(0, 0, handshakePoolThreadProc, pool, 0, 0);
+#else
+  pthread_mutex_init(&pool->lock, 0);
+  pthread_cond_init(&pool->cond, 0);
+  pool->threads = (pthread_t*)malloc(sizeof(pthread_t)*pool->threadsNum);
+  for (unsigned i = 0; i < pool->threadsNum; i++)
+    pthread_create(&pool->threads[i], 0, handshakePoolThreadProc, pool);
+#endif
+  return pool;
+}
+
+void sslHandshakePoolDelete(SSLHandshakePool *pool)
+{
+  // Workers finish queued jobs before exit
+  handshakePoolLock(pool);
+  pool->stop = 1;
+  handshakePoolUnlock(pool);
+#ifdef OS_WINDOWS
+  WakeAllConditionVariable(&pool->cond);
+  WaitForMultipleObjects(pool->threadsNum, pool->threads, TRUE, INFINITE);
+  for (unsigned i = 0; i < pool->threadsNum; i++)
+    CloseHandle(pool->threads[i]);
+#else
+  pthread_cond_broadcast(&pool->cond);
+  for (unsigned i = 0; i < pool->threadsNum; i++)
+    pthread_join(pool->threads[i], 0);
+  pthread_cond_destroy(&pool->cond);
+  pthread_mutex_destroy(&pool->lock);
+#endif
+  free(pool->threads);
+  free(pool);
+}
+
+void sslHandshakePoolGetStats(SSLHandshakePool *pool, SSLHandshakePoolStats *stats)
+{
+  handshakePoolLock(pool);
+  *stats = pool->stats;
+  handshakePoolUnlock(pool);
+}
+
+static void sslSocketRelease(SSLSocket *socket);
+
+// Runs in owning base: worker finished handshake step, continue operation
+static void handshakeDoneCb(aioUserEvent *event, void *arg)
+{
+  __UNUSED(event);
+  SSLSocket *socket = (SSLSocket*)arg;
+  SSLHandshakeJob *job = socket->handshakeJob;
+  SSLHandshakePool *pool = job->pool;
+  uint64_t latency = usDiff(job->submitTime, getTimeMark());
+  handshakePoolLock(pool);
+  pool->stats.steps++;
+  pool->stats.totalLatency += latency;
+  if (latency > pool->stats.maxLatency)
+    pool->stats.maxLatency = latency;
+  int orphaned = job->orphaned;
+  job->inFlight = 0;
+  handshakePoolUnlock(pool);
+
+  if (orphaned) {
+    sslSocketRelease(socket);
+    return;
+  }
+
+  // Canceled operation waits for step and finishes here
+  SSLOp *op = job->op;
+  if (opGetGeneration(&op->root) == job->opGeneration)
+    resumeParent(&op->root, aosSuccess);
+}
+
+// Returns 1 if step of job is running, socket released after it
+static int handshakeJobDetach(SSLHandshakeJob *job)
+{
+  SSLHandshakePool *pool = job->pool;
+  int running = 0;
+  handshakePoolLock(pool);
+  if (job->inFlight) {
+    SSLHandshakeJob *prev = 0;
+    SSLHandshakeJob *current = pool->head;
+    while (current && current != job) {
+      prev = current;
+      current = current->next;
+    }
+
+    if (current) {
+      // Queued job not started yet
+      if (prev)
+        prev->next = job->next;
+      else
+        pool->head = job->next;
+      if (pool->tail == job)
+        pool->tail = prev;
+      pool->stats.queueDepth--;
+      job->inFlight = 0;
+    } else {
+      job->orphaned = 1;
+      running = 1;
+    }
+  }
+  handshakePoolUnlock(pool);
+  return running;
+}
+
+static void handshakeSubmit(SSLSocket *S, SSLOp *op)
+{
+  SSLHandshakeJob *job = S->handshakeJob;
+  if (!job) {
+    job = (SSLHandshakeJob*)malloc(sizeof(SSLHandshakeJob));
+    job->socket = S;
+    job->event = newUserEvent(S->root.base, 0, handshakeDoneCb, S);
+    job->inFlight = 0;
+    S->handshakeJob = job;
+  }
+
+  SSLHandshakePool *pool = S->context->handshakePool;
+  job->next = 0;
+  job->op = op;
+  job->opGeneration = opGetGeneration(&op->root);
+  job->pool = pool;
+  job->finished = 0;
+  job->orphaned = 0;
+  job->submitTime = getTimeMark();
+
+  handshakePoolLock(pool);
+  job->inFlight = 1;
+  if (pool->tail)
+    pool->tail->next = job;
+  else
+    pool->head = job;
+  pool->tail = job;
+  if (++pool->stats.queueDepth > pool->stats.peakQueueDepth)
+    pool->stats.peakQueueDepth = pool->stats.queueDepth;
+  handshakePoolUnlock(pool);
+#ifdef OS_WINDOWS
+  WakeConditionVariable(&pool->cond);
+#else
+  pthread_cond_signal(&pool->cond);
+#endif
+}
+
+static AsyncOpStatus handshakeProc(SSLOp *op, SSLSocket *socket)
+{
+  int handshakeResult;
+  int errCode;
+  socket->handshaking = 1;
+  if (socket->context->handshakePool) {
+    SSLHandshakeJob *job = socket->handshakeJob;
+    if (!job || !job->finished) {
+      handshakeSubmit(socket, op);
+      return aosPending;
+    }
+
+    job->finished = 0;
+    handshakeResult = job->result;
+    errCode = job->errCode;
+  } else {
+    handshakeResult = SSL_do_handshake(socket->ssl);
+    errCode = SSL_get_error(socket->ssl, handshakeResult);
+  }
+
+  if (handshakeResult == 1 || errCode == SSL_ERROR_WANT_READ) {
+    // Send last handshake message (or server session tickets) immediately
+    writeChunkFlush(socket);
   }
 
-  int connectResult = SSL_connect(socket->ssl);
-  int errCode = SSL_get_error(socket->ssl, connectResult);
-  if (connectResult == 1) {
-    // Successfully connected
+  if (handshakeResult == 1) {
+    // Handshake finished
+    socket->isConnected = 1;
     return aosSuccess;
   } else if (errCode == SSL_ERROR_WANT_READ) {
     // Need data exchange
-    size_t connectSize = copyFromOut(socket);
-    aioWrite(socket->object, socket->sslWriteBuffer, connectSize, afWaitAll, 0, 0, 0);
-    aioRead(socket->object, socket->sslReadBuffer, socket->sslReadBufferSize, afNone, 0, sslConnectReadCb, op);
+    size_t size;
+    uint8_t *buffer = readBufferPrepare(socket, &size);
+    aioRead(socket->object, buffer, size, afNone, 0, sslConnectReadCb, op);
     return aosPending;
   } else {
     return aosUnknownError;
   }
 }
 
+static AsyncOpStatus connectProc(asyncOpRoot *opptr)
+{
+  SSLOp *op = (SSLOp*)opptr;
+  SSLSocket *socket = (SSLSocket*)op->root.object;
+
+  if (op->state == sslStInitalize) {
+    op->state = sslStProcessing;
+    aioConnect(socket->object, &op->address, 0, sslConnectConnectCb, op);
+    return aosPending;
+  }
+
+  return handshakeProc(op, socket);
+}
+
+static AsyncOpStatus acceptProc(asyncOpRoot *opptr)
+{
+  SSLOp *op = (SSLOp*)opptr;
+  return handshakeProc(op, (SSLSocket*)op->root.object);
+}
+
 static void sslReadReadCb(AsyncOpStatus status, aioObject *object, size_t transferred, void *arg)
 {
   __UNUSED(object);
   SSLOp *op = (SSLOp*)arg;
   SSLSocket *socket = (SSLSocket*)op->root.object;
-  // TODO: correct processing >4Gb data blocks
   if (status == aosSuccess)
-    BIO_write(socket->bioIn, socket->sslReadBuffer, (int)transferred);
+    socket->sslReadDataSize += transferred;
   resumeParent((asyncOpRoot*)arg, status);
 }
 
+
 static AsyncOpStatus readProc(asyncOpRoot *opptr)
 {
   SSLOp *op = (SSLOp*)opptr;
   SSLSocket *socket = (SSLSocket*)op->root.object;
+  if (socket->handshaking) {
+    heldOpsHold(socket, op);
+    return aosPending;
+  }
 
   for (;;) {
     uint8_t *ptr = ((uint8_t*)op->buffer) + op->bytesTransferred;
     size_t size = op->transactionSize-op->bytesTransferred;
 
+
     size_t readResult = 0;
-    int R;
-    // TODO: correct processing >4Gb data blocks
-    while ( (R = SSL_read(socket->ssl, ptr, (int)size)) > 0) {
-      readResult += (size_t)R;
+    size_t R;
+    int sslResult = 1;
+    while (size && (sslResult = SSL_read_ex(socket->ssl, ptr, size, &R)) == 1) {
+      readResult += R;
       ptr += R;
-      size -= (size_t)R;
+      size -= R;
     }
 
     op->bytesTransferred += readResult;
+    if (!readResult) {
+      AsyncOpStatus status = sslReadStatus(socket, sslResult);
+      if (status != aosSuccess)
+        return status;
+    }
     if (op->bytesTransferred == op->transactionSize || (op->bytesTransferred && !(op->root.flags & afWaitAll))) {
       return aosSuccess;
     } else {
       size_t bytes = 0;
-      asyncOpRoot *readOp = implRead(socket->object, socket->sslReadBuffer, socket->sslReadBufferSize, afNone, 0, sslReadReadCb, op, &bytes);
+      size_t readSize;
+      uint8_t *readBuffer = readBufferPrepare(socket, &readSize);
+      asyncOpRoot *readOp = implRead(socket->object, readBuffer, readSize, afNone, 0, sslReadReadCb, op, &bytes);
       if (!readOp) {
-        BIO_write(socket->bioIn, socket->sslReadBuffer, (int)bytes);
+        socket->sslReadDataSize += bytes;
       } else {
         combinerPushOperation(readOp, aaStart);
         return aosPending;
@@ -259,17 +1079,39 @@ static AsyncOpStatus readProc(asyncOpRoot *opptr)
   }
 }
 
-void sslSocketDestructor(aioObjectRoot *root)
+static void sslSocketRelease(SSLSocket *socket)
 {
-  SSLSocket *socket = (SSLSocket*)root;
+  // Deliberate close without close_notify exchange, keep session resumable
+  if (socket->isConnected)
+    SSL_set_shutdown(socket->ssl, SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
   SSL_free(socket->ssl);
-  SSL_CTX_free(socket->sslContext);
+  if (socket->writeChunk)
+    writeChunkRelease(writeChunkDetach(socket));
+  if (socket->handshakeJob) {
+    deleteUserEvent(socket->handshakeJob->event);
+    free(socket->handshakeJob);
+  }
+  sslContextDecrementReference(socket->context);
   deleteAioObject(socket->object);
   concurrentQueuePush(&objectPool, socket);
 }
 
+void sslSocketDestructor(aioObjectRoot *root)
+{
+  SSLSocket *socket = (SSLSocket*)root;
+  // Handshake step on pool worker uses SSL object and socket buffers
+  if (socket->handshakeJob && handshakeJobDetach(socket->handshakeJob))
+    return;
+  sslSocketRelease(socket);
+}
+
 
 SSLSocket *sslSocketNew(asyncBase *base, aioObject *existingSocket)
+{
+  return sslSocketNewWithContext(base, existingSocket, sslDefaultClientContext());
+}
+
+SSLSocket *sslSocketNewWithContext(asyncBase *base, aioObject *existingSocket, SSLContext *context)
 {
   // Create socket if need
   aioObject *socket = existingSocket;
@@ -285,20 +1127,24 @@ SSLSocket *sslSocketNew(asyncBase *base, aioObject *existingSocket)
     S = (SSLSocket*)malloc(sizeof(SSLSocket));
     S->sslReadBufferSize = DEFAULT_SSL_READ_BUFFER_SIZE;
     S->sslReadBuffer = (uint8_t*)malloc(S->sslReadBufferSize);
-    S->sslWriteBufferSize = DEFAULT_SSL_READ_BUFFER_SIZE;
-    S->sslWriteBuffer = (uint8_t*)malloc(S->sslReadBufferSize);
   }
 
-#ifdef DEPRECATEDIN_1_1_0
-  S->sslContext = SSL_CTX_new (TLS_client_method());
-#else
-  S->sslContext = SSL_CTX_new (TLS_method());
-#endif
-  SSL_CTX_set_verify(S->sslContext, SSL_VERIFY_NONE, NULL);
-  S->ssl = SSL_new(S->sslContext);
-  S->bioIn = BIO_new(BIO_s_mem());
-  S->bioOut = BIO_new(BIO_s_mem());
-  SSL_set_bio(S->ssl, S->bioIn, S->bioOut);
+  sslContextIncrementReference(context);
+  S->context = context;
+  S->isConnected = 0;
+  S->sessionKey[0] = 0;
+  S->sslReadOffset = 0;
+  S->sslReadDataSize = 0;
+  S->writeChunk = 0;
+  S->handshakeJob = 0;
+  S->handshaking = 0;
+  S->heldOps = 0;
+  S->ssl = SSL_new(context->handle);
+  SSL_set_app_data(S->ssl, S);
+  S->bio = BIO_new(sslSocketBioMethod());
+  BIO_set_data(S->bio, S);
+  BIO_set_init(S->bio, 1);
+  SSL_set_bio(S->ssl, S->bio, S->bio);
 
   initObjectRoot(&S->root, base, ioObjectUserDefined, sslSocketDestructor);
   S->object = socket;
@@ -310,6 +1156,31 @@ void sslSocketDelete(SSLSocket *socket)
   objectDelete(&socket->root);
 }
 
+int sslSocketSessionReused(SSLSocket *socket)
+{
+  return SSL_session_reused(socket->ssl);
+}
+
+int sslSocketSetAlpn(SSLSocket *socket, const char *const *protocols, size_t protocolsNum)
+{
+  unsigned size;
+  unsigned char *data = alpnEncode(protocols, protocolsNum, &size);
+  if (!data)
+    return 0;
+  int result = SSL_set_alpn_protos(socket->ssl, data, size) == 0;
+  free(data);
+  return result;
+}
+
+const char *sslSocketAlpn(SSLSocket *socket, size_t *size)
+{
+  const unsigned char *data = 0;
+  unsigned length = 0;
+  SSL_get0_alpn_selected(socket->ssl, &data, &length);
+  *size = length;
+  return (const char*)data;
+}
+
 socketTy sslGetSocket(const SSLSocket *socket)
 {
   return aioObjectSocket(socket->object);
@@ -334,7 +1205,20 @@ void aioSslConnect(SSLSocket *socket,
 
   if (tlsextHostName)
     SSL_set_tlsext_host_name(socket->ssl, op->buffer);
+  sessionResume(socket, address, tlsextHostName);
+
+  combinerPushOperation(&op->root, aaStart);
+}
 
+void aioSslAccept(SSLSocket *socket,
+                  uint64_t usTimeout,
+                  sslConnectCb callback,
+                  void *arg)
+{
+  SSL_set_accept_state(socket->ssl);
+  struct Context context;
+  fillContext(&context, acceptProc, connectFinish, 0, 0);
+  SSLOp *op = (SSLOp*)newReadAsyncOp(&socket->root, afNone, usTimeout, (void*)callback, arg, sslOpAccept, &context);
   combinerPushOperation(&op->root, aaStart);
 }
 
@@ -348,28 +1232,47 @@ asyncOpRoot *implSslRead(SSLSocket *socket,
                          size_t *bytesTransferred)
 {
   size_t sslBytesTransferred = 0;
+  if (socket->handshaking) {
+    // Wait for handshake end in operation context
+    struct Context context;
+    fillContext(&context, readProc, rwFinish, buffer, size);
+    SSLOp *sslOp = (SSLOp*)newReadAsyncOp(&socket->root, flags, usTimeout, (void*)callback, arg, sslOpRead, &context);
+    return &sslOp->root;
+  }
 
   for (;;) {
     uint8_t *ptr = ((uint8_t*)buffer) + sslBytesTransferred;
     size_t remaining = size - sslBytesTransferred;
+
+
     size_t readResult = 0;
-    int R;
-    // TODO: correct processing >4Gb data blocks
-    while ( (R = SSL_read(socket->ssl, ptr, (int)remaining)) > 0) {
-      readResult += (size_t)R;
+    size_t R;
+    int sslResult = 1;
+    while (remaining && (sslResult = SSL_read_ex(socket->ssl, ptr, remaining, &R)) == 1) {
+      readResult += R;
       ptr += R;
-      remaining -= (size_t)R;
+      remaining -= R;
     }
 
     sslBytesTransferred += readResult;
+    if (!readResult && sslReadStatus(socket, sslResult) != aosSuccess) {
+      // Report error from operation context
+      struct Context context;
+      fillContext(&context, readProc, rwFinish, buffer, size);
+      SSLOp *sslOp = (SSLOp*)newReadAsyncOp(&socket->root, flags, usTimeout, (void*)callback, arg, sslOpRead, &context);
+      sslOp->bytesTransferred = sslBytesTransferred;
+      return &sslOp->root;
+    }
     if (sslBytesTransferred == size || (sslBytesTransferred && !(flags & afWaitAll))) {
       *bytesTransferred = sslBytesTransferred;
       return 0;
     } else {
       size_t bytes = 0;
-      asyncOpRoot *readOp = implRead(socket->object, socket->sslReadBuffer, socket->sslReadBufferSize, afNone, 0, sslReadReadCb, 0, &bytes);
+      size_t readSize;
+      uint8_t *readBuffer = readBufferPrepare(socket, &readSize);
+      asyncOpRoot *readOp = implRead(socket->object, readBuffer, readSize, afNone, 0, sslReadReadCb, 0, &bytes);
       if (!readOp) {
-        BIO_write(socket->bioIn, socket->sslReadBuffer, (int)bytes);
+        socket->sslReadDataSize += bytes;
       } else {
         struct Context context;
         fillContext(&context, readProc, rwFinish, buffer, size);
@@ -418,7 +1321,9 @@ ssize_t aioSslRead(SSLSocket *socket,
 void sslWriteWriteCb(AsyncOpStatus status, aioObject *object, size_t transferred, void *arg)
 {
   __UNUSED(object);
-  SSLOp *op = (SSLOp*)arg;
+  SSLWriteChunk *chunk = (SSLWriteChunk*)arg;
+  SSLOp *op = chunk->op;
+  writeChunkRelease(chunk);
   if (transferred > 0)
     op->bytesTransferred = op->transactionSize;
   resumeParent(&op->root, status);
@@ -429,16 +1334,29 @@ static AsyncOpStatus writeProc(asyncOpRoot *opptr)
   SSLOp *op = (SSLOp*)opptr;
   SSLSocket *socket = (SSLSocket*)opptr->object;
 
-  if (op->state == sslStInitalize) {
+  if (op->state == sslStFailed) {
+    return aosUnknownError;
+  } else if (op->state == sslStInitalize) {
     size_t bytes = 0;
-    op->state = sslStProcessing;
-    SSL_write(socket->ssl, op->buffer, (int)op->transactionSize);
-    size_t writeSize = copyFromOut(socket);
-    asyncOpRoot *writeOp = implWrite(socket->object, socket->sslWriteBuffer, writeSize, afWaitAll, 0, sslWriteWriteCb, op, &bytes);
-    if (writeOp) {
-      combinerPushOperation(writeOp, aaStart);
+    size_t written;
+    if (socket->handshaking) {
+      heldOpsHold(socket, op);
       return aosPending;
     }
+
+    op->state = sslStProcessing;
+    if (op->transactionSize && SSL_write_ex(socket->ssl, op->buffer, op->transactionSize, &written) != 1)
+      return aosUnknownError;
+    SSLWriteChunk *chunk = writeChunkDetach(socket);
+    if (chunk) {
+      chunk->op = op;
+      asyncOpRoot *writeOp = implWrite(socket->object, chunk->data, chunk->size, afWaitAll | afNoCopy, 0, sslWriteWriteCb, chunk, &bytes);
+      if (writeOp) {
+        combinerPushOperation(writeOp, aaStart);
+        return aosPending;
+      }
+      writeChunkRelease(chunk);
+    }
     op->bytesTransferred = op->transactionSize;
     return aosSuccess;
   } else {
@@ -455,18 +1373,41 @@ asyncOpRoot *implSslWrite(SSLSocket *socket,
                           sslCb callback,
                           void *arg)
 {
-  SSL_write(socket->ssl, buffer, (int)size);
-  size_t writeSize = copyFromOut(socket);
+  if (socket->handshaking) {
+    // Wait for handshake end in operation context
+    struct Context context;
+    fillContext(&context, writeProc, rwFinish, (void*)(uintptr_t)buffer, size);
+    SSLOp *sslOp = (SSLOp*)newWriteAsyncOp(&socket->root, flags, usTimeout, (void*)callback, arg, sslOpWrite, &context);
+    return &sslOp->root;
+  }
+
+
+  size_t written;
+  if (size && SSL_write_ex(socket->ssl, buffer, size, &written) != 1) {
+    // Report error from operation context
+    struct Context context;
+    fillContext(&context, writeProc, rwFinish, (void*)(uintptr_t)buffer, size);
+    SSLOp *sslOp = (SSLOp*)newWriteAsyncOp(&socket->root, flags | afNoCopy, usTimeout, (void*)callback, arg, sslOpWrite, &context);
+    sslOp->state = sslStFailed;
+    return &sslOp->root;
+  }
+
+  SSLWriteChunk *chunk = writeChunkDetach(socket);
+  if (!chunk)
+    return 0;
+
   size_t bytes = 0;
-  asyncOpRoot *op = implWrite(socket->object, socket->sslWriteBuffer, writeSize, afWaitAll, 0, sslWriteWriteCb, 0, &bytes);
+  asyncOpRoot *op = implWrite(socket->object, chunk->data, chunk->size, afWaitAll | afNoCopy, 0, sslWriteWriteCb, chunk, &bytes);
   if (!op) {
+    writeChunkRelease(chunk);
     return 0;
   } else {
     struct Context context;
     fillContext(&context, writeProc, rwFinish, (void*)(uintptr_t)buffer, size);
-    SSLOp *sslOp = (SSLOp*)newWriteAsyncOp(&socket->root, flags | afRunning, usTimeout, (void*)callback, arg, sslOpWrite, &context);
+    // Data already encrypted, no need to copy source buffer
+    SSLOp *sslOp = (SSLOp*)newWriteAsyncOp(&socket->root, flags | afRunning | afNoCopy, usTimeout, (void*)callback, arg, sslOpWrite, &context);
     sslOp->state = sslStProcessing;
-    op->arg = sslOp;
+    chunk->op = sslOp;
     combinerPushOperation(op, aaStart);
     return &sslOp->root;
   }
@@ -499,6 +1440,22 @@ int ioSslConnect(SSLSocket *socket, const HostAddress *address, const char *tlse
   fillContext(&context, connectProc, 0, (void*)(uintptr_t)tlsextHostName, tlsextHostName ? strlen(tlsextHostName)+1 : 0);
   SSLOp *op = (SSLOp*)newWriteAsyncOp(&socket->root, afCoroutine, usTimeout, 0, 0, sslOpConnect, &context);
   op->address = *address;
+  if (tlsextHostName)
+    SSL_set_tlsext_host_name(socket->ssl, op->buffer);
+  sessionResume(socket, address, tlsextHostName);
+  combinerPushOperation(&op->root, aaStart);
+  coroutineYield();
+  AsyncOpStatus status = opGetStatus(&op->root);
+  releaseAsyncOp(&op->root);
+  return status == aosSuccess ? 0 : -status;
+}
+
+int ioSslAccept(SSLSocket *socket, uint64_t usTimeout)
+{
+  SSL_set_accept_state(socket->ssl);
+  struct Context context;
+  fillContext(&context, acceptProc, 0, 0, 0);
+  SSLOp *op = (SSLOp*)newReadAsyncOp(&socket->root, afCoroutine, usTimeout, 0, 0, sslOpAccept, &context);
   combinerPushOperation(&op->root, aaStart);
   coroutineYield();
   AsyncOpStatus status = opGetStatus(&op->root);
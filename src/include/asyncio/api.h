@@ -44,10 +44,17 @@ typedef enum AsyncOpStatus {
   aosCanceled,
   aosBufferTooSmall,
   aosUnknownError,
+  aosQueueFull,
   aosLast
 } AsyncOpStatus;
 
 
+typedef enum AioWritePolicy {
+  awpNone = 0,
+  awpFailFast
+} AioWritePolicy;
+
+
 typedef enum AsyncFlags {
   afNone = 0,
   afWaitAll = 1,
@@ -92,6 +99,14 @@ typedef struct aioObject aioObject;
 typedef struct aioUserEvent aioUserEvent;
 typedef struct asyncOp asyncOp;
 
+typedef struct aioWriteQueueStats {
+  size_t queuedBytes;
+  size_t queuedOps;
+  size_t peakQueuedBytes;
+  size_t rejectedWrites;
+  size_t writeCalls;
+} aioWriteQueueStats;
+
 typedef struct List {
   asyncOpRoot *head;
   asyncOpRoot *tail;
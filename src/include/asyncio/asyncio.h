@@ -11,6 +11,8 @@ typedef void aioConnectCb(AsyncOpStatus, aioObject*, void*);
 typedef void aioAcceptCb(AsyncOpStatus, aioObject*, HostAddress, socketTy, void*);
 typedef void aioCb(AsyncOpStatus, aioObject*, size_t, void*);
 typedef void aioReadMsgCb(AsyncOpStatus, aioObject*, HostAddress, size_t, void*);
+typedef void aioWritableCb(AsyncOpStatus, aioObject*, void*);
+typedef void aioSpliceCb(AsyncOpStatus, aioObject*, aioObject*, size_t, void*);
   
 socketTy aioObjectSocket(aioObject *object);
 iodevTy aioObjectDevice(aioObject *object);
@@ -22,6 +24,16 @@ aioObject *newDeviceIo(asyncBase *base, iodevTy hDevice);
 void deleteAioObject(aioObject *object);
 asyncBase *aioGetBase(aioObject *object);
 
+// Write queue limits: with awpFailFast policy write functions return -aosQueueFull without
+// calling callback while queued bytes are at or above high watermark.
+// Writable notification fires when queued bytes drop to low watermark (one waiter per object).
+void aioSetWriteWatermarks(aioObject *object, size_t lowWatermark, size_t highWatermark, AioWritePolicy policy);
+void aioGetWriteQueueStats(aioObject *object, aioWriteQueueStats *stats);
+
+// Write coalescing (POSIX backends): writes are not tried synchronously, pending writes gathered
+// into one writev per readiness event, limited by maxBytes and maxOps; maxOps <= 1 disables it
+void aioSetWriteCoalescing(aioObject *object, size_t maxBytes, unsigned maxOps);
+
 void setSocketBuffer(aioObject *socket, size_t bufferSize);
 
 aioUserEvent *newUserEvent(asyncBase* base, int isSemaphore, aioEventCb callback, void* arg);
@@ -94,6 +106,27 @@ ssize_t aioWriteMsg(aioObject *object,
                     aioCb callback,
                     void *arg);
 
+void aioWaitWritable(aioObject *object, aioWritableCb callback, void *arg);
+
+// Forward up to size bytes from src to dst: splice through pipe on Linux, read/write through
+// internal buffer on other platforms. Without afWaitAll finishes after first forwarded chunk.
+// Returns -aosQueueFull (callback not called) if dst write queue is over high watermark
+int aioSplice(aioObject *src,
+              aioObject *dst,
+              size_t size,
+              AsyncFlags flags,
+              uint64_t usTimeout,
+              aioSpliceCb callback,
+              void *arg);
+
+// Send size bytes of file (device object) from offset to socket: sendfile on Linux
+int aioSendFile(aioObject *socket,
+                aioObject *file,
+                uint64_t offset,
+                size_t size,
+                uint64_t usTimeout,
+                aioCb callback,
+                void *arg);
 
 int ioConnect(aioObject *object, const HostAddress *address, uint64_t usTimeout);
 socketTy ioAccept(aioObject *object, uint64_t usTimeout);
@@ -101,6 +134,9 @@ ssize_t ioRead(aioObject *object, void *buffer, size_t size, AsyncFlags flags, u
 ssize_t ioReadMsg(aioObject *object, void *buffer, size_t size, AsyncFlags flags, uint64_t usTimeout);
 ssize_t ioWrite(aioObject *object, const void *buffer, size_t size, AsyncFlags flags, uint64_t usTimeout);
 ssize_t ioWriteMsg(aioObject *object, const HostAddress *address, const void *buffer, size_t size, AsyncFlags flags, uint64_t usTimeout);
+int ioWaitWritable(aioObject *object);
+ssize_t ioSplice(aioObject *src, aioObject *dst, size_t size, AsyncFlags flags, uint64_t usTimeout);
+ssize_t ioSendFile(aioObject *socket, aioObject *file, uint64_t offset, size_t size, uint64_t usTimeout);
 void ioSleep(aioUserEvent *event, uint64_t usTimeout);
 void ioWaitUserEvent(aioUserEvent *event);
 
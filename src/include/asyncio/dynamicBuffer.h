@@ -22,11 +22,15 @@ typedef struct dynamicBuffer dynamicBuffer;
 void dynamicBufferInit(dynamicBuffer *buffer, size_t initialSize);
 void dynamicBufferInitForeign(dynamicBuffer *buffer, void *data, size_t size);
 void dynamicBufferFree(dynamicBuffer *buffer);
+// Returns 0 if memory can't be allocated
 void *dynamicBufferAlloc(dynamicBuffer *buffer, size_t size);
+// Ensures space for 'extra' bytes after current offset; returns 0 on size overflow or allocation
+// failure, buffer not changed in this case
+int dynamicBufferGrow(dynamicBuffer *buffer, size_t extra);
 void dynamicBufferClear(dynamicBuffer *buffer);
 void *dynamicBufferPtr(dynamicBuffer *buffer);
 size_t dynamicBufferRemaining(dynamicBuffer *buffer);
-void dynamicBufferWrite(dynamicBuffer *buffer, const void *data, size_t size);
+int dynamicBufferWrite(dynamicBuffer *buffer, const void *data, size_t size);
 
 
 #ifdef __cplusplus
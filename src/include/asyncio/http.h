@@ -17,8 +17,11 @@ typedef struct HTTPClient HTTPClient;
 typedef struct HTTPInfo HTTPInfo;
 typedef struct HTTPOp HTTPOp;
 
+typedef struct HTTPClientPool HTTPClientPool;
+
 typedef void httpConnectCb(AsyncOpStatus, HTTPClient*, void*);
 typedef void httpRequestCb(AsyncOpStatus, HTTPClient*, void*);
+typedef void httpPoolRequestCb(AsyncOpStatus, HTTPClientPool*, void*);
 
 typedef struct HTTPClient {
   aioObjectRoot root;
@@ -30,9 +33,15 @@ typedef struct HTTPClient {
  
   uint8_t *inBuffer;
   size_t inBufferSize;
+  // Not parsed data window of read buffer; next read appends after it, window moved to
+  // buffer begin only when space behind it exhausted
   size_t inBufferOffset;
+  size_t inBufferDataSize;
   size_t requestBytesSent;
   HttpParserState state;
+  // Flow control: response operation waiting httpClientResume instead of reading
+  int readPaused;
+  asyncOpRoot *pausedOp;
 } HTTPClient;
 
 
@@ -47,6 +56,15 @@ typedef struct HTTPOp {
   size_t dataSize;
 } HTTPOp;
 
+typedef struct HTTPClientPoolStats {
+  uint64_t connects;
+  // Requests written to connections, including retries and pipelined ones
+  uint64_t requests;
+  uint64_t pipelined;
+  uint64_t retries;
+  uint64_t idleEvictions;
+} HTTPClientPoolStats;
+
 typedef struct HTTPParseDefaultContext {
   unsigned resultCode;
   Raw contentType;
@@ -57,13 +75,38 @@ typedef struct HTTPParseDefaultContext {
 } HTTPParseDefaultContext;
 
 
+// Streaming response body: fragments passed to callback in place from client read buffer and
+// valid only during call, so body of any size needs no more memory than read buffer
+typedef void httpBodyCb(const void *data, size_t size, void *arg);
+
+typedef struct HTTPParseStreamContext {
+  unsigned resultCode;
+  int chunked;
+  // Content-Length header value, 0 for chunked response
+  uint64_t contentLength;
+  uint64_t bodySize;
+  httpBodyCb *bodyCallback;
+  void *arg;
+} HTTPParseStreamContext;
+
+
 void httpParseDefaultInit(HTTPParseDefaultContext *context);
-void httpParseDefault(HttpComponent *component, void *arg);
+int httpParseDefault(HttpComponent *component, void *arg);
+
+void httpParseStreamInit(HTTPParseStreamContext *context, httpBodyCb *bodyCallback, void *arg);
+int httpParseStream(HttpComponent *component, void *arg);
 
 HTTPClient *httpClientNew(asyncBase *base, aioObject *socket);
 HTTPClient *httpsClientNew(asyncBase *base, SSLSocket *socket);
 void httpClientDelete(HTTPClient *client);
 
+// Stops reading response after already received data parsed, so consumer slower than network
+// holds back sender by TCP flow control. Both functions must be called from thread running
+// client event loop, for example from parse or body callback. Request timeout still applies
+// to paused request
+void httpClientPause(HTTPClient *client);
+void httpClientResume(HTTPClient *client);
+
 void aioHttpConnect(HTTPClient *client,
                     const HostAddress *address,
                     const char *tlsextHostName,
@@ -80,6 +123,29 @@ void aioHttpRequest(HTTPClient *client,
                     httpRequestCb callback,
                     void *arg);
 
+// Keep-alive client pool, connections keyed by address, protocol and TLS host name. Up to
+// maxConnections per key; with pipelineDepth > 1 requests written into busy connections without
+// waiting responses. Connections idle for usIdleTimeout closed (0 - never). Request interrupted
+// by 'Connection: close' response or by server closing reused connection sent again over new one
+// if it was not written completely or its method is idempotent (GET, HEAD, PUT, DELETE, OPTIONS,
+// TRACE); other requests fail.
+// Pool must be used from one thread
+HTTPClientPool *httpClientPoolNew(asyncBase *base, unsigned maxConnections, unsigned pipelineDepth, uint64_t usIdleTimeout);
+void httpClientPoolDelete(HTTPClientPool *pool);
+void httpClientPoolGetStats(HTTPClientPool *pool, HTTPClientPoolStats *stats);
+
+void aioHttpPoolRequest(HTTPClientPool *pool,
+                        const HostAddress *address,
+                        int isHttps,
+                        const char *tlsextHostName,
+                        const char *request,
+                        size_t requestSize,
+                        uint64_t usTimeout,
+                        httpParseCb parseCallback,
+                        void *parseArg,
+                        httpPoolRequestCb callback,
+                        void *arg);
+
 int ioHttpConnect(HTTPClient *client, const HostAddress *address, const char *tlsextHostName, uint64_t usTimeout);
 AsyncOpStatus ioHttpRequest(HTTPClient *client, const char *request, size_t requestSize, uint64_t usTimeout, httpParseCb parseCallback, void *parseArg);
                 
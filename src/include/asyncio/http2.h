@@ -0,0 +1,104 @@
+#ifndef __ASYNCIO_HTTP2_H_
+#define __ASYNCIO_HTTP2_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "asyncio/asyncio.h"
+#include "asyncio/socketSSL.h"
+#include "p2putils/CommonParse.h"
+
+// HTTP/2 (RFC 7540) client and server connections. Concurrent requests multiplexed as streams
+// over one TCP or TLS connection with HPACK header compression and connection and stream flow
+// control windows. TLS connections negotiate "h2" by ALPN, plain TCP ones use prior knowledge.
+// Received header lists limited to 64 KiB and bodies to 8 MiB, streams over limits are reset;
+// bodies held by unfinished messages counted by connection receive window until released.
+// Connection must be used from thread running its event loop
+
+typedef struct HTTP2Connection HTTP2Connection;
+typedef struct HTTP2Stream HTTP2Stream;
+
+typedef struct HTTP2Header {
+  Raw name;
+  Raw value;
+} HTTP2Header;
+
+// Response (client side) or request (server side), valid only during callback
+typedef struct HTTP2Message {
+  // Response status
+  unsigned status;
+  // Request pseudo-headers
+  Raw method;
+  Raw scheme;
+  Raw authority;
+  Raw path;
+  // Regular headers and trailers, lowercase names
+  const HTTP2Header *headers;
+  size_t headersNum;
+  const void *body;
+  size_t bodySize;
+} HTTP2Message;
+
+typedef struct HTTP2Stats {
+  uint64_t streams;
+  uint64_t framesIn;
+  uint64_t framesOut;
+  // DATA postponed by exhausted peer flow control window
+  uint64_t flowControlStalls;
+  uint64_t resets;
+  // Highest number of concurrently open streams
+  unsigned peakStreams;
+} HTTP2Stats;
+
+typedef void http2ConnectCb(AsyncOpStatus status, HTTP2Connection *connection, void *arg);
+typedef void http2ResponseCb(AsyncOpStatus status, HTTP2Connection *connection, const HTTP2Message *response, void *arg);
+// Server request handler; every request must be answered with http2Respond, also after
+// connection closed
+typedef void http2RequestCb(HTTP2Stream *stream, const HTTP2Message *request, void *arg);
+// Connection closed by peer or by protocol error, owner still must delete it
+typedef void http2CloseCb(HTTP2Connection *connection, void *arg);
+
+HTTP2Connection *http2ClientNew(asyncBase *base, aioObject *socket);
+// TLS client, socket offers "h2" by ALPN
+HTTP2Connection *http2sClientNew(asyncBase *base, SSLSocket *socket);
+// Connects (with TLS handshake for TLS client), sends connection preface and waits server SETTINGS
+void aioHttp2Connect(HTTP2Connection *connection,
+                     const HostAddress *address,
+                     const char *tlsextHostName,
+                     uint64_t usTimeout,
+                     http2ConnectCb callback,
+                     void *arg);
+
+// Requests over concurrency limit of server wait in queue. Urgency from 0 (highest) to 7 (lowest)
+// as in RFC 9218: DATA of more urgent streams written first, streams of same urgency interleaved
+// frame by frame. Headers and body copied
+void aioHttp2Request(HTTP2Connection *connection,
+                     const char *method,
+                     const char *authority,
+                     const char *path,
+                     const HTTP2Header *headers,
+                     size_t headersNum,
+                     const void *body,
+                     size_t bodySize,
+                     unsigned urgency,
+                     uint64_t usTimeout,
+                     http2ResponseCb callback,
+                     void *arg);
+
+// Server connection on accepted socket; for TLS, handshake must be finished with "h2" selected.
+// Response urgency taken from request 'priority' header
+HTTP2Connection *http2ServerNew(asyncBase *base, aioObject *socket, http2RequestCb callback, void *arg);
+HTTP2Connection *http2sServerNew(asyncBase *base, SSLSocket *socket, http2RequestCb callback, void *arg);
+void http2Respond(HTTP2Stream *stream, unsigned status, const HTTP2Header *headers, size_t headersNum, const void *body, size_t bodySize);
+
+void http2ConnectionSetCloseCallback(HTTP2Connection *connection, http2CloseCb callback, void *arg);
+// Sends GOAWAY and closes connection; waiting client requests finished with aosCanceled
+void http2ConnectionDelete(HTTP2Connection *connection);
+void http2ConnectionGetStats(HTTP2Connection *connection, HTTP2Stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //__ASYNCIO_HTTP2_H_
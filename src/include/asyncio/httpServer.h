@@ -0,0 +1,68 @@
+#ifndef __ASYNCIO_HTTPSERVER_H_
+#define __ASYNCIO_HTTPSERVER_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "asyncio/asyncio.h"
+#include "p2putils/HttpRequestParse.h"
+
+typedef struct HTTPServer HTTPServer;
+typedef struct HTTPServerConnection HTTPServerConnection;
+
+// Server state (connection list, reference counters, statistics) not synchronized: asyncBase of
+// server must run loop in one thread, and all functions below must be called from that thread
+
+// Called for every parsed request component, first one has type httpRequestDtInitialize. Component
+// data valid only during call, except httpRequestDtDataLast data: it valid until response finished.
+// Every request delivered with httpRequestDtDataLast must be answered with httpServerResponse or
+// httpServerChunkedEnd, including requests of already closed connections
+typedef void httpServerRequestCb(HTTPServerConnection *connection, HttpRequestComponent *component, void *arg);
+// Called once when connection closed by peer, by error or by server
+typedef void httpServerConnectionCb(HTTPServerConnection *connection, void *arg);
+
+typedef struct HTTPServerConfig {
+  // Per-connection request buffer, whole request including body must fit in it:
+  // longer headers answered with 431, longer request with 400
+  size_t inBufferSize;
+  // Initial size of per-connection response buffer, grows on demand
+  size_t outBufferSize;
+  // Idle keep-alive connection closed after this time (0 - never)
+  uint64_t usKeepAliveTimeout;
+  // Non-zero: httpRequestDtDataLast handled in new coroutine with this stack size, so handler can
+  // use blocking io* functions. Zero: handler called directly from event loop
+  unsigned coroutineStackSize;
+  httpServerConnectionCb *closeCallback;
+} HTTPServerConfig;
+
+typedef struct HTTPServerStats {
+  uint64_t connections;
+  uint64_t requests;
+  uint64_t keepAliveReuses;
+  uint64_t badRequests;
+} HTTPServerStats;
+
+void httpServerConfigInit(HTTPServerConfig *config);
+
+// Binds and listens address; returns 0 on error
+HTTPServer *httpServerNew(asyncBase *base, const HostAddress *address, const HTTPServerConfig *config, httpServerRequestCb callback, void *arg);
+void httpServerDelete(HTTPServer *server);
+void httpServerGetStats(HTTPServer *server, HTTPServerStats *stats);
+
+void *httpServerConnectionGetUserData(HTTPServerConnection *connection);
+void httpServerConnectionSetUserData(HTTPServerConnection *connection, void *userData);
+HostAddress httpServerConnectionGetAddress(HTTPServerConnection *connection);
+
+// Complete response with Content-Length
+void httpServerResponse(HTTPServerConnection *connection, unsigned code, const char *contentType, const void *body, size_t size);
+// Chunked response: header, any number of chunks, terminating chunk
+void httpServerChunkedBegin(HTTPServerConnection *connection, unsigned code, const char *contentType);
+void httpServerChunk(HTTPServerConnection *connection, const void *data, size_t size);
+void httpServerChunkedEnd(HTTPServerConnection *connection);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //__ASYNCIO_HTTPSERVER_H_
@@ -7,9 +7,29 @@ extern "C" {
 
 #include "asyncio/api.h"
 #include "openssl/bio.h"
+#include "openssl/ssl.h"
+
+#define SSL_SESSION_KEY_SIZE 128
 
 typedef struct SSLOp SSLOp;
 typedef struct SSLSocket SSLSocket;
+typedef struct SSLContext SSLContext;
+typedef struct SSLWriteChunk SSLWriteChunk;
+typedef struct SSLHandshakePool SSLHandshakePool;
+typedef struct SSLHandshakeJob SSLHandshakeJob;
+
+typedef struct SSLHandshakePoolStats {
+  // Handshake steps waiting for worker now and maximum since pool creation
+  size_t queueDepth;
+  size_t peakQueueDepth;
+  uint64_t steps;
+  // Microseconds from submission to worker start (wait) and to result delivery into owning
+  // base (latency)
+  uint64_t totalWaitTime;
+  uint64_t maxWaitTime;
+  uint64_t totalLatency;
+  uint64_t maxLatency;
+} SSLHandshakePoolStats;
 
 typedef void sslConnectCb(AsyncOpStatus status, SSLSocket *object, void *arg);
 typedef void sslCb(AsyncOpStatus status, SSLSocket *object, size_t transferred, void *arg);
@@ -19,14 +39,24 @@ typedef struct SSLSocket {
   
   aioObject *object;
   int isConnected;
-  SSL_CTX *sslContext;
+  SSLContext *context;
   SSL *ssl;
-  BIO *bioIn;
-  BIO *bioOut;
+  // Socket BIO: OpenSSL reads ciphertext directly from read-ahead buffer and writes records
+  // into chunk passed to socket write without copying
+  BIO *bio;
   size_t sslReadBufferSize;
+  size_t sslReadOffset;
+  size_t sslReadDataSize;
   uint8_t *sslReadBuffer;
-  size_t sslWriteBufferSize;
-  uint8_t *sslWriteBuffer;
+  SSLWriteChunk *writeChunk;
+  // Handshake step running on worker thread of context handshake pool
+  SSLHandshakeJob *handshakeJob;
+  // Read and write operations started while handshake runs wait for its end without touching
+  // SSL object
+  int handshaking;
+  struct SSLOp *heldOps;
+  // Client session cache key: server name and address
+  char sessionKey[SSL_SESSION_KEY_SIZE];
 } SSLSocket;
 
 typedef struct SSLOp {
@@ -38,11 +68,42 @@ typedef struct SSLOp {
   size_t bytesTransferred;  
   void *internalBuffer;
   size_t internalBufferSize;
+  struct SSLOp *heldNext;
 } SSLOp;
 
 
+// Shared refcounted TLS context, one per configuration instead of one SSL_CTX per socket.
+// Server context resumes sessions by internal session cache and tickets, client context keeps
+// last session per server (name and address) and offers it on next connect
+SSLContext *sslContextNew(int isServer);
+void sslContextIncrementReference(SSLContext *context);
+void sslContextDecrementReference(SSLContext *context);
+int sslContextLoadCertificate(SSLContext *context, const char *certificateFile, const char *privateKeyFile);
+int sslContextUseCertificate(SSLContext *context, X509 *certificate, EVP_PKEY *privateKey);
+void sslContextSetSessionCacheSize(SSLContext *context, size_t size);
+SSL_CTX *sslContextHandle(SSLContext *context);
+// Handshake offload: SSL_do_handshake steps (key exchange, signatures) of context sockets run on
+// pool worker threads instead of event loop, results return to owning base by user event.
+// Pool must outlive handshakes of all sockets using it
+void sslContextSetHandshakePool(SSLContext *context, SSLHandshakePool *pool);
+// ALPN (RFC 7301), protocols in preference order. Client context offers them, server context
+// selects first own protocol offered by client; without common protocol handshake proceeds
+// without ALPN. Returns 0 on invalid list
+int sslContextSetAlpn(SSLContext *context, const char *const *protocols, size_t protocolsNum);
+
+SSLHandshakePool *sslHandshakePoolNew(unsigned threadsNum);
+void sslHandshakePoolDelete(SSLHandshakePool *pool);
+void sslHandshakePoolGetStats(SSLHandshakePool *pool, SSLHandshakePoolStats *stats);
+
+// Uses process-wide client context
 SSLSocket *sslSocketNew(asyncBase *base, aioObject *existingSocket);
+SSLSocket *sslSocketNewWithContext(asyncBase *base, aioObject *existingSocket, SSLContext *context);
 void sslSocketDelete(SSLSocket *socket);
+int sslSocketSessionReused(SSLSocket *socket);
+// Client socket protocols offer, overrides context list; must be called before connect
+int sslSocketSetAlpn(SSLSocket *socket, const char *const *protocols, size_t protocolsNum);
+// Protocol selected by ALPN after handshake (not null-terminated), 0 if none
+const char *sslSocketAlpn(SSLSocket *socket, size_t *size);
 
 socketTy sslGetSocket(const SSLSocket *socket);
 
@@ -70,6 +131,11 @@ void aioSslConnect(SSLSocket *socket,
                    sslConnectCb callback,
                    void *arg);
 
+void aioSslAccept(SSLSocket *socket,
+                  uint64_t usTimeout,
+                  sslConnectCb callback,
+                  void *arg);
+
 ssize_t aioSslRead(SSLSocket *socket,
                    void *buffer,
                    size_t size,
@@ -88,6 +154,7 @@ ssize_t aioSslWrite(SSLSocket *socket,
 
 
 int ioSslConnect(SSLSocket *socket, const HostAddress *address, const char *tlsextHostName, uint64_t usTimeout);
+int ioSslAccept(SSLSocket *socket, uint64_t usTimeout);
 ssize_t ioSslRead(SSLSocket *socket, void *buffer, size_t size, AsyncFlags flags, uint64_t usTimeout);
 ssize_t ioSslWrite(SSLSocket *socket, const void *buffer, size_t size, AsyncFlags flags, uint64_t usTimeout);
 
@@ -1,92 +1,288 @@
 #include "p2pproto.h"
+#include "p2pcompress.h"
+#include "p2pchunk.h"
+#include "asyncio/timer.h"
+#include "atomic.h"
+#include <algorithm>
+#include <atomic>
 #include <list>
-#include <map>
+#include <unordered_set>
 #include <vector>
 #include <time.h>
 
+// Response times of last requests used for hedge delay
+#define P2P_LATENCY_WINDOW 256
+// Ids of last gossip messages remembered by node
+#define P2P_GOSSIP_HISTORY 4096
+// Peers with lower health selected only when no healthy peer available and by rare probe requests
+#define P2P_HEALTH_MIN 0.5
+
 class p2pNode;
 class p2pPeer;
 class xmstream;
+struct p2pRequestGroup;
+struct p2pGroupRequest;
+struct p2pFrame;
+struct p2pPeerList;
+struct p2pTask;
+struct p2pWorker;
 
 typedef void p2pNodeCb(p2pPeer*);
 typedef void p2pRequestCb(p2pPeer*, uint32_t, void*, size_t, void*);
 typedef void p2pSignalCb(p2pPeer*, void*, size_t, void*);
+// Completion of hedged, first-of-K and quorum requests; responses copied to output slots
+typedef void p2pResponseCb(AsyncOpStatus, p2pNode*, unsigned responsesNum, void*);
+
+// Peer selection strategy of p2pNode::ioRequest; timed out request retried on next selected peer.
+// Every strategy chooses among healthy peers first, see P2P_HEALTH_MIN
+enum p2pPeerSelectTy {
+  // Connected peers in turn
+  p2pSelectRoundRobin = 0,
+  // Peer with fewest requests in flight, ties resolved round-robin
+  p2pSelectLeastOutstanding,
+  // Better of two random peers by EWMA latency multiplied by requests in flight
+  p2pSelectPowerOfTwo,
+  // Owner of request key on hash ring; key keeps its peer while peer set not changed, keys of
+  // disconnected peer move to next one on ring
+  p2pSelectConsistentHash
+};
+
+struct p2pPeerStats {
+  uint64_t requests;
+  uint64_t responses;
+  // Timed out requests and requests lost with connection
+  uint64_t failures;
+  // Losing requests of hedged, first-of-K and quorum requests
+  uint64_t canceled;
+  // Broadcast and gossip messages not sent because of send queue over watermark
+  uint64_t signalsSkipped;
+  // Failed connect attempts
+  uint64_t connectFailures;
+  // Fields below written by peer thread and read by peer selection in any thread
+  std::atomic<unsigned> inFlight;
+  // EWMA of response time in microseconds, failure counted as full request timeout
+  std::atomic<double> latency;
+  // EWMA of request outcomes and lost connections, 1 for peer without failures
+  std::atomic<double> health;
+};
+
+// Result of coroutine request, filled before coroutine resumed
+struct p2pRequestResult {
+  p2pPeer *peer;
+  AsyncOpStatus status;
+};
 
 struct p2pEventHandler {
   p2pNodeCb *callback;
   void *arg;
   coroutineTy *coroutine;
-  time_t endPoint;
+  p2pRequestResult *result;
+  // Connection wait deadline in microseconds of node wait time base, 0 if none
+  uint64_t endPoint;
   void *out;
   size_t outSize;
+  // Response buffer exchanged with connection buffer instead of copy
+  xmstream *outStream;
+  timeMark startPt;
+  uint64_t timeout;
+  p2pGroupRequest *groupRequest;
 };  
 
 __NO_PADDING_BEGIN
+// Pending requests of peer. Request id is slot index in low P2P_REQUEST_INDEX_BITS bits and slot
+// generation in high bits, so late response to reused slot not matched; free slots reused in
+// FIFO order. Requests with same timeout have growing deadlines, so every distinct timeout gets
+// deadline ordered list with O(1) insert and remove; single loop timer armed to nearest deadline
+#define P2P_REQUEST_INDEX_BITS 20
+#define P2P_REQUEST_GENERATION_BITS (32 - P2P_REQUEST_INDEX_BITS)
+// Requests with more distinct timeouts share last list, insert into it scans from tail
+#define P2P_REQUEST_TIMEOUT_CLASSES 8
+
+class p2pRequestTable {
+public:
+  typedef void TimeoutCb(uint32_t id, const p2pEventHandler &handler, void *arg);
+
+private:
+  struct Slot {
+    p2pEventHandler handler;
+    // Microseconds from table creation, 0 means no timeout
+    uint64_t deadline;
+    uint32_t generation;
+    // Deadline list links, next also links free slots
+    uint32_t prev;
+    uint32_t next;
+    uint32_t timeoutClass;
+    bool busy;
+  };
+
+  struct TimeoutClass {
+    uint64_t timeout;
+    uint32_t head;
+    uint32_t tail;
+  };
+
+  static constexpr uint32_t InvalidIndex = UINT32_MAX;
+  static constexpr uint32_t MaxSize = 1u << P2P_REQUEST_INDEX_BITS;
+
+  asyncBase *_base;
+  TimeoutCb *_callback;
+  void *_arg;
+  std::vector<Slot> _slots;
+  std::vector<TimeoutClass> _timeoutClasses;
+  uint32_t _freeHead;
+  uint32_t _freeTail;
+  size_t _size;
+  timeMark _timeBase;
+  aioUserEvent *_timer;
+  uint64_t _timerDeadline;
+
+  static void timerCb(aioUserEvent *event, void *arg);
+  void grow();
+  void freeSlot(uint32_t index);
+  void link(uint32_t index, uint64_t timeout);
+  void unlink(uint32_t index);
+  // Returns timeout class with nearest deadline or InvalidIndex
+  uint32_t nearestClass();
+  void armTimer(uint64_t now);
+  Slot *slotById(uint32_t id);
+
+public:
+  p2pRequestTable(asyncBase *base, TimeoutCb *callback, void *arg, size_t initialSize = 64);
+  ~p2pRequestTable();
+
+  // Returns request id, 0 if table full
+  uint32_t insert(const p2pEventHandler &handler, uint64_t timeout);
+  p2pEventHandler *find(uint32_t id);
+  // Returns false for unknown or expired id
+  bool remove(uint32_t id, p2pEventHandler *handler);
+  // Moves all pending requests to 'out'
+  void removeAll(std::vector<std::pair<uint32_t, p2pEventHandler>> &out);
+  size_t size() { return _size; }
+  uint64_t now() { return usDiff(_timeBase, getTimeMark()); }
+  // Calls timeout callback for expired requests; normally called by loop timer
+  void expire();
+};
+
 class p2pPeer {
 private:
   static void clientNetworkWaitEnd(aioUserEvent *event, void *arg);
   static void clientP2PConnectCb(AsyncOpStatus status, p2pConnection *connection, void *arg);
   static void clientReceiver(AsyncOpStatus status, p2pConnection *connection, p2pHeader header, p2pStream *stream, void *arg);
-  static void checkTimeout(aioUserEvent *event, void *arg) {
-    __UNUSED(event);
-    static_cast<p2pPeer*>(arg)->checkTimeout();
-  }
+  static void requestTimeoutCb(uint32_t id, const p2pEventHandler &handler, void *arg);
   static p2pErrorTy nodeAcceptCb(AsyncOpStatus status, p2pConnection *connection, p2pConnectData *data, void *arg);
   static void nodeMsgHandlerEP(void *peer) { static_cast<p2pPeer*>(peer)->nodeMsgHandler(); }
   
   void nodeMsgHandler();
+  void failHandlers();
+  // Next attempt after jittered exponential backoff
+  void connectFailed();
+  void connectionLost();
   
 public:
+  // Connection, timers and request table of peer used by thread of its event loop only
   asyncBase *_base;
+  p2pWorker *_worker;
   aioUserEvent *_event;
-  aioUserEvent *_checkTimeoutEvent;
   p2pNode *_node;  
   HostAddress _address;
-  bool _connected;
+  // Read by peer selection in any thread
+  std::atomic<bool> _connected;
+  bool _accepted;
+  // Peer list of node and broadcast sends queued to peer thread; accepted peer deleted by last one
+  unsigned _refs;
+  // Failed connect attempts since last connection
+  unsigned _connectFailures;
 
   p2pConnection *connection;
-  std::map<unsigned, p2pEventHandler> handlersMap;
+  p2pRequestTable handlers;
+  p2pPeerStats stats;
   
-  p2pPeer(asyncBase *base, p2pNode *node, const HostAddress *address) :
-    _base(base), _node(node), _address(*address), _connected(false), connection(nullptr) {
+  p2pPeer(asyncBase *base, p2pWorker *worker, p2pNode *node, const HostAddress *address) :
+    _base(base), _worker(worker), _node(node), _address(*address), _connected(false), _accepted(false), _refs(1), _connectFailures(0),
+    connection(nullptr), handlers(base, requestTimeoutCb, this), stats() {
+    stats.health.store(1.0, std::memory_order_relaxed);
     _event = newUserEvent(base, 0, clientNetworkWaitEnd, this);
-    _checkTimeoutEvent = newUserEvent(base, 0, checkTimeout, this);
-    userEventStartTimer(_checkTimeoutEvent, 1000000, -1);
   }
 
   ~p2pPeer() {
     if (connection)
       p2pConnectionDelete(connection);
-    deleteUserEvent(_checkTimeoutEvent);
     deleteUserEvent(_event);
   }
   
-  void checkTimeout();
   bool createConnection();
   void destroyConnection();
   void connect();
   void connectAfter(uint64_t timeout) { userEventStartTimer(_event, timeout, 1); }
   
   void accept(bool coroutineMode, p2pConnection *connectionArg);
+  // Connected client peer or accepted one
+  bool established() { return connection && (_connected.load(std::memory_order_relaxed) || _accepted); }
   
-  void addHandler(uint32_t id, p2pNodeCb *callback, void *arg, uint64_t timeout) {
+  // Handler registration returns request id, 0 if too many requests in flight
+  uint32_t addHandler(p2pNodeCb *callback, void *arg, uint64_t timeout, void *out, size_t outSize) {
     p2pEventHandler handler;
     handler.callback = callback;
     handler.arg = arg;
     handler.coroutine = nullptr;
-    handler.endPoint = timeout ? time(nullptr) + static_cast<time_t>(timeout/1000000) : static_cast<time_t>(0);
-    handlersMap[id] = handler;
+    handler.result = nullptr;
+    handler.groupRequest = nullptr;
+    handler.outStream = nullptr;
+    return addHandler(handler, timeout, out, outSize);
   }
   
-  void addHandler(uint32_t id, coroutineTy *coroutine, uint64_t timeout, void *out, size_t outSize) {
+  uint32_t addHandler(coroutineTy *coroutine, p2pRequestResult *result, uint64_t timeout, void *out, size_t outSize) {
+    p2pEventHandler handler;
+    handler.callback = nullptr;
+    handler.arg = nullptr;
+    handler.coroutine = coroutine;
+    handler.result = result;
+    handler.groupRequest = nullptr;
+    handler.outStream = nullptr;
+    return addHandler(handler, timeout, out, outSize);
+  }
+
+  uint32_t addHandler(coroutineTy *coroutine, p2pRequestResult *result, uint64_t timeout, xmstream *outStream) {
     p2pEventHandler handler;
     handler.callback = nullptr;
     handler.arg = nullptr;
     handler.coroutine = coroutine;
-    handler.endPoint = timeout ? time(nullptr) + static_cast<time_t>(timeout/1000000) : static_cast<time_t>(0);
+    handler.result = result;
+    handler.groupRequest = nullptr;
+    handler.outStream = outStream;
+    return addHandler(handler, timeout, nullptr, 0);
+  }
+
+  uint32_t addHandler(p2pGroupRequest *request, uint64_t timeout) {
+    p2pEventHandler handler;
+    handler.callback = nullptr;
+    handler.arg = nullptr;
+    handler.coroutine = nullptr;
+    handler.result = nullptr;
+    handler.groupRequest = request;
+    handler.outStream = nullptr;
+    return addHandler(handler, timeout, nullptr, 0);
+  }
+
+  uint32_t addHandler(p2pEventHandler &handler, uint64_t timeout, void *out, size_t outSize) {
+    handler.endPoint = 0;
     handler.out = out;
     handler.outSize = outSize;
-    handlersMap[id] = handler;
+    handler.startPt = getTimeMark();
+    handler.timeout = timeout;
+    uint32_t id = handlers.insert(handler, timeout);
+    if (id) {
+      stats.requests++;
+      stats.inFlight.store(stats.inFlight.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+    return id;
+  }
+
+  void requestFinished(const p2pEventHandler &handler, bool success);
+  void healthSample(bool success);
+  void requestCanceled() {
+    stats.canceled++;
+    stats.inFlight.store(stats.inFlight.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
   }
 };
 __NO_PADDING_END
@@ -95,12 +291,32 @@ class p2pNode {
 private:
   asyncBase *_base;
   const char *_clusterName;
+  // Event loop threads of node, first one runs listener, hedged and fanout requests
+  std::vector<p2pWorker*> _workers;
+  uintptr_t _workerCursor;
+  // All peers, guarded by _peersLock
   std::vector<p2pPeer*> _connections;
+  unsigned _peersLock;
+  // Peers of requests: replaced as a whole on connectPeer, read by request threads without locks.
+  // Replaced lists freed when no request uses any list, users counted by acquirePeers
+  std::atomic<p2pPeerList*> _requestPeers;
+  std::atomic<unsigned> _requestPeersUsers;
+  std::vector<p2pPeerList*> _retiredPeerLists;
 
   // client data
-  p2pPeer *_lastActivePeer;
-  volatile unsigned _lastId;
+  uint32_t _maxMsgSize;
+  uint32_t _compression;
+  uint32_t _compressionThreshold;
+  uint32_t _chunkSize;
+  p2pZstdDictionary *_dictionary;
+  uint64_t _reconnectMinDelay;
+  uint64_t _reconnectMaxDelay;
   std::list<p2pEventHandler> _connectionWaitHandlers;
+  unsigned _waitLock;
+  // Expires connection waits at nearest deadline, _waitTimerDeadline is 0 while not armed
+  aioUserEvent *_waitEvent;
+  timeMark _waitTimeBase;
+  uint64_t _waitTimerDeadline;
   
   // node data
   aioObject *_listenerSocket;  
@@ -109,69 +325,207 @@ private:
   p2pSignalCb *_signalHandler;  
   void *_signalHandlerArg;
   bool _coroutineMode;
+
+  // broadcast and gossip
+  size_t _broadcastWatermark;
+  std::unordered_set<uint64_t> _gossipSeen;
+  std::vector<uint64_t> _gossipHistory;
+  size_t _gossipHistoryPos;
+  unsigned _gossipLock;
+
+  // peer selection
+  p2pPeerSelectTy _selectStrategy;
+  uintptr_t _selectCursor;
+
+  // hedging; samples written by all peer threads, delay calculated by first thread
+  uint32_t _latencyWindow[P2P_LATENCY_WINDOW];
+  uintptr_t _latencySamplesNum;
+  uintptr_t _hedgeDelaySamplesNum;
+  uint64_t _hedgeDelay;
+  uint64_t _hedgeMinDelay;
+  double _hedgePercentile;
   
 private:  
   static void listener(AsyncOpStatus status, aioObject *listener, HostAddress client, socketTy socket, void *arg);
+  static void workerCb(aioUserEvent *event, void *arg);
+  static void waitTimerCb(aioUserEvent *event, void *arg);
 
-  p2pNode(asyncBase *base, const char *clusterName, bool coroutineMode) :
-    _base(base), _clusterName(clusterName),
-    _listenerSocket(nullptr), _requestHandler(nullptr), _requestHandlerArg(nullptr), _signalHandler(nullptr),
-    _coroutineMode(coroutineMode){}
-  
-  void addHandler(p2pNodeCb *callback, void *arg, uint64_t timeout) {
-    p2pEventHandler handler;
-    handler.callback = callback;
-    handler.arg = arg;
-    handler.coroutine = nullptr;
-    handler.endPoint = timeout ? time(nullptr) + static_cast<time_t>(timeout/1000000) : static_cast<time_t>(0);
-    _connectionWaitHandlers.push_back(handler);
-  }
-  
-  void addHandler(coroutineTy *coroutine, uint64_t timeout) {
-    p2pEventHandler handler;
-    handler.callback = nullptr;
-    handler.arg = nullptr;
-    handler.coroutine = coroutine;
-    handler.endPoint = timeout ? time(nullptr) + static_cast<time_t>(timeout/1000000) : static_cast<time_t>(0);
-    _connectionWaitHandlers.push_back(handler);
-  }
+  p2pNode(asyncBase **bases, size_t basesNum, const char *clusterName, bool coroutineMode);
+
+  bool multithreaded() { return _workers.size() > 1; }
+  p2pWorker *nextWorker();
+  // Task executed by event loop thread of worker
+  void post(p2pWorker *worker, p2pTask *task);
+  static void acceptTaskProc(p2pTask *task);
+  static void requestTaskProc(p2pTask *task);
+  static void groupStartTaskProc(p2pTask *task);
+  static void groupSendTaskProc(p2pTask *task);
+  static void groupCancelTaskProc(p2pTask *task);
+  static void groupEventTaskProc(p2pTask *task);
+  static void frameTaskProc(p2pTask *task);
+
+  void acceptConnection(p2pWorker *worker, socketTy socket, const HostAddress *address);
+  // Peer list stays valid until releasePeers
+  p2pPeerList *acquirePeers();
+  void releasePeers();
+  // Frees replaced peer lists if no request uses them, called with _peersLock held
+  void reclaimPeerLists();
+  // Established peers except 'exclude', every one referenced until releasePeer
+  void collectPeers(std::vector<p2pPeer*> &peers, p2pPeer *exclude);
+  p2pPeer *selectPeer(p2pPeerList *list, uint64_t key, p2pPeer *first, const std::vector<p2pPeer*> &failed);
+  p2pPeer *selectPeerImpl(p2pPeerList *list, uint64_t key, p2pPeer *first, const std::vector<p2pPeer*> &failed, bool healthyOnly);
+  uint64_t waitNow() { return usDiff(_waitTimeBase, getTimeMark()); }
+  // Called with _waitLock held
+  void armWaitTimer(uint64_t deadline, uint64_t now);
+  bool ioRequestImpl(uint64_t key, void *data, uint32_t size, uint64_t timeout, void *out, uint32_t outSize, xmstream *outStream);
+
+  uint64_t hedgeDelay();
+  static void groupHedgeCb(aioUserEvent *event, void *arg);
+  static void groupSendCb(AsyncOpStatus status, p2pConnection *connection, p2pHeader header, void *arg);
+  void aioRequestGroup(unsigned fanout, unsigned required, bool hedged, void *data, uint32_t size, uint64_t timeout, void *out, uint32_t outSize, p2pResponseCb *callback, void *arg);
+  bool ioRequestGroup(unsigned fanout, unsigned required, bool hedged, void *data, uint32_t size, uint64_t timeout, void *out, uint32_t outSize, unsigned *responsesNum);
+  void groupStart(p2pRequestGroup *group);
+  bool groupSend(p2pRequestGroup *group);
+  // Peer thread part of groupSend, returns false if request not sent
+  bool groupRequestStart(p2pGroupRequest *request);
+  void groupResponse(p2pGroupRequest *request, const void *data, size_t size);
+  void groupFailure(p2pGroupRequest *request, AsyncOpStatus status);
+  void groupFinish(p2pRequestGroup *group, AsyncOpStatus status);
+
+  // Sends frame from peer thread
+  bool writeFrame(p2pPeer *peer, p2pFrame *frame);
+  bool sendFrame(p2pPeer *peer, p2pFrame *frame);
+  unsigned gossipSend(p2pFrame *frame, p2pPeer *source);
+  // Returns false for message seen before
+  bool gossipRemember(uint64_t id);
   
 public:
+  // Client peers connect when event loop runs; poolSize connections made to every address, each
+  // of them is separate peer connecting and reconnecting independently
   static p2pNode *createClient(asyncBase *base,
                                const HostAddress *addresses,
                                size_t addressesNum,
-                               const char *clusterName);
+                               const char *clusterName,
+                               unsigned poolSize = 1);
   
   static p2pNode *createNode(asyncBase *base,
                              const HostAddress *listenAddress,
                              const char *clusterName,
                              bool coroutineMode);
+
+  // Node served by several event loop threads, one per base. Every peer bound to one base, its
+  // I/O and callbacks run by that thread only; requests from other threads passed to peer
+  // thread through lock-free queue. Coroutine making request resumed by peer thread, callbacks of
+  // hedged and fanout requests called by thread of first base
+  static p2pNode *createClient(asyncBase **bases,
+                               size_t basesNum,
+                               const HostAddress *addresses,
+                               size_t addressesNum,
+                               const char *clusterName,
+                               unsigned poolSize = 1);
+
+  static p2pNode *createNode(asyncBase **bases,
+                             size_t basesNum,
+                             const HostAddress *listenAddress,
+                             const char *clusterName,
+                             bool coroutineMode);
+
+  // Closes listener and client peer connections; node must not have requests in flight, accepted
+  // connections must be closed by remote side before
+  ~p2pNode();
   
-  void addPeer(p2pPeer *peer) { _connections.push_back(peer); }
-  void removePeer(p2pPeer *peer) {
-    auto It = std::find(_connections.begin(), _connections.end(), peer);
-    if (It != _connections.end())
-      _connections.erase(It);
-  }
+  // Adds or removes accepted peer
+  void addPeer(p2pPeer *peer);
+  void removePeer(p2pPeer *peer);
+  void releasePeer(p2pPeer *peer);
+
+  // Not synchronized with peer threads, stable while peers not connected or closed
+  const std::vector<p2pPeer*> &peers() { return _connections; }
+  // Outgoing connections of node to other node, peers connect when event loop runs. Requests
+  // sent to connected peers only, signals and gossip go both ways
+  void connectPeer(const HostAddress *address, unsigned poolSize = 1);
   
-  void setLastActivePeer(p2pPeer *peer) { _lastActivePeer = peer; }
+  void addLatencySample(uint64_t latency) {
+    uintptr_t index = __uintptr_atomic_fetch_and_add(&_latencySamplesNum, 1);
+    _latencyWindow[index % P2P_LATENCY_WINDOW] = latency < UINT32_MAX ? static_cast<uint32_t>(latency) : UINT32_MAX;
+  }
+  // Response or failure of hedged or fanout request in peer thread
+  void groupEvent(p2pGroupRequest *request, AsyncOpStatus status, const void *data, size_t size);
   void connectionEstablished(p2pPeer *peer);
   void connectionTimeout();
+  // Delay of next connect attempt after 'failures' failed ones, 0 after lost connection
+  uint64_t reconnectDelay(unsigned failures);
   
   void signal(p2pPeer *peer);
+  void gossipReceived(p2pPeer *peer, const void *data, size_t size);
 
  
   asyncBase *base() { return _base; }
+
+  // Largest message received from peers, announced to them on connect; larger messages close
+  // connection. Set before connecting or listening
+  void setMaxMessageSize(uint32_t size) { _maxMsgSize = size; }
+  uint32_t maxMessageSize() { return _maxMsgSize; }
+
+  // Compression offered to peers, see p2pConnectionSetCompression. Set before connecting or
+  // listening, dictionary must outlive node
+  void setCompression(uint32_t codecs, uint32_t threshold, p2pZstdDictionary *dictionary) {
+    _compression = codecs;
+    _compressionThreshold = threshold;
+    _dictionary = dictionary;
+  }
+  // Chunk size of large messages sent to peers, see p2pchunk.h; 0 sends messages as a whole
+  void setChunkSize(uint32_t size) { _chunkSize = size; }
+  void configureConnection(p2pConnection *connection) {
+    connection->maxMsgSize = _maxMsgSize;
+    p2pConnectionSetCompression(connection, _compression, _compressionThreshold, _dictionary);
+    p2pConnectionSetChunkSize(connection, _chunkSize);
+  }
   
   // client api
   bool connected();
+  // Failed connect attempt repeated after delay doubled every time from minDelay up to maxDelay,
+  // randomized between half and full value; lost connection restored after random delay up to
+  // minDelay. Microseconds
+  void setReconnectPolicy(uint64_t minDelay, uint64_t maxDelay) {
+    _reconnectMinDelay = minDelay;
+    _reconnectMaxDelay = std::max(minDelay, maxDelay);
+  }
   bool ioWaitForConnection(uint64_t timeout);
+  void setPeerSelectStrategy(p2pPeerSelectTy strategy) { _selectStrategy = strategy; }
+  // Consistent hashing uses hash of request data as key. Response larger than outSize fails
+  // request without retry. Request larger than peer message size limit not sent to that peer
   bool ioRequest(void *data, uint32_t size, uint64_t timeout, void *out, uint32_t outSize);
+  bool ioRequest(uint64_t key, void *data, uint32_t size, uint64_t timeout, void *out, uint32_t outSize);
+  // Response of any size up to message size limit; received buffer exchanged with buffer of
+  // 'out' without copy when 'out' owns its memory
+  bool ioRequest(void *data, uint32_t size, uint64_t timeout, xmstream &out);
+  bool ioRequest(uint64_t key, void *data, uint32_t size, uint64_t timeout, xmstream &out);
+
+  // Hedge delay is given percentile of recent response times, not less than minDelay microseconds
+  void setHedgePolicy(double percentile, uint64_t minDelay) {
+    _hedgePercentile = percentile;
+    _hedgeMinDelay = minDelay;
+    _hedgeDelaySamplesNum = 0;
+  }
+
+  // Request sent to second peer if first has not answered within hedge delay; first response
+  // wins, other request canceled. Request data copied
+  void aioRequestHedged(void *data, uint32_t size, uint64_t timeout, void *out, uint32_t outSize, p2pResponseCb *callback, void *arg);
+  bool ioRequestHedged(void *data, uint32_t size, uint64_t timeout, void *out, uint32_t outSize);
+  // Request sent to 'fanout' peers at once, first response wins
+  void aioRequestFirst(unsigned fanout, void *data, uint32_t size, uint64_t timeout, void *out, uint32_t outSize, p2pResponseCb *callback, void *arg);
+  bool ioRequestFirst(unsigned fanout, void *data, uint32_t size, uint64_t timeout, void *out, uint32_t outSize);
+  // Request sent to 'fanout' peers at once, completes after 'quorum' responses; response N
+  // copied to out + N*outSize in arrival order, out must have quorum*outSize bytes
+  void aioRequestQuorum(unsigned fanout, unsigned quorum, void *data, uint32_t size, uint64_t timeout, void *out, uint32_t outSize, p2pResponseCb *callback, void *arg);
+  bool ioRequestQuorum(unsigned fanout, unsigned quorum, void *data, uint32_t size, uint64_t timeout, void *out, uint32_t outSize);
 
   // node api
   p2pRequestCb *getRequestHandler() { return _requestHandler; }
   void *getRequestHandlerArg() { return _requestHandlerArg; }
   
+  // Handlers called by peer threads
   void setRequestHandler(p2pRequestCb *handler, void *arg) {
     _requestHandler = handler;
     _requestHandlerArg = arg;
@@ -181,6 +535,15 @@ public:
     _signalHandler = handler;
     _signalHandlerArg = arg;
   }
+  // Signal sent to every peer with one shared copy of payload (compressed once per codec);
+  // peers with more than watermark bytes waiting in send queue skipped. Returns number of peers
+  // signal sent to; with several threads sends made by peer threads, peers skipped there counted
+  // as sent
+  unsigned broadcast(const void *data, uint32_t size, uint64_t timeout);
+  void setBroadcastWatermark(size_t bytes) { _broadcastWatermark = bytes; }
+  // Signal delivered to whole cluster: sent to ceil(sqrt(N)) random peers of N, every node
+  // delivers it to signal handler once and forwards it same way excluding sender
+  unsigned gossip(const void *data, uint32_t size, uint64_t timeout);
   void sendSignal(void *data, uint32_t size);
 };
 
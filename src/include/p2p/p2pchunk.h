@@ -0,0 +1,52 @@
+#ifndef __P2PCHUNK_H_
+#define __P2PCHUNK_H_
+
+#include "p2pproto.h"
+
+// Default chunk size and largest chunk accepted by receiver
+#define P2P_DEFAULT_CHUNK_SIZE 65536
+#define P2P_MAX_CHUNK_SIZE (1u << 20)
+// Receiver limits: messages reassembled at a time, and bytes buffered by all of them in units of
+// largest accepted message (max of connection maxMsgSize and receive operation limit)
+#define P2P_MAX_CHUNK_STREAMS 16
+#define P2P_CHUNK_BUFFERED_MESSAGES 4
+
+// Message with payload larger than chunk size (after compression) sent as frames of chunk size
+// with same id and type. Every chunked message has one frame in connection send queue at a time,
+// so messages sent meanwhile and chunks of other messages go between its frames. Chunked
+// messages with same id and type sent one after another, timeout applied to every frame
+
+// Chunk size of messages sent by connection, 0 disables chunking
+void p2pConnectionSetChunkSize(p2pConnection *connection, uint32_t size);
+
+// Handler of chunks of uncompressed chunked messages called by receive operations as chunks
+// arrive: p2pChunkCb(connection, id, type, offset, data, size, last, arg). For first chunk
+// handler returns false to reassemble message and receive it by recv operation as usual, with
+// true this and next chunks of message go to handler only
+void p2pConnectionSetChunkHandler(p2pConnection *connection, p2pChunkCb *handler, void *arg);
+
+// Send side: message must be chunked if returns true (frames of chunked message never are).
+// Payload owned by chunked send when 'packed' (compressed copy) given, used without copy with
+// afNoCopy, copied otherwise
+bool p2pChunkNeeded(p2pConnection *connection, const p2pHeader &header);
+void p2pChunkSend(p2pConnection *connection,
+                  const void *data,
+                  void *packed,
+                  p2pHeader header,
+                  AsyncFlags flags,
+                  uint64_t timeout,
+                  p2pwriteCb *callback,
+                  void *arg);
+
+// Receive side: target of chunk payload, nullptr for invalid chunk with *status: p2pStFormatError
+// when receiver limits exceeded, aosBufferTooSmall for message larger than limit (partially
+// received message dropped)
+uint8_t *p2pChunkTarget(p2pConnection *connection, const p2pHeader &header, size_t limit, AsyncOpStatus *status);
+// Chunk payload received: returns true when message reassembled (header gets type and size of
+// message, payload placed into stream, connection compression buffer or buffer) or failed with
+// *status, false while message is incomplete
+bool p2pChunkReceived(p2pConnection *connection, p2pHeader *header, p2pStream *stream, void *buffer, size_t limit, AsyncOpStatus *status);
+// Drops partially received messages of pooled connection
+void p2pChunkReset(p2pConnection *connection);
+
+#endif //__P2PCHUNK_H_
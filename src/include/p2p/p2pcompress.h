@@ -0,0 +1,45 @@
+#ifndef __P2PCOMPRESS_H_
+#define __P2PCOMPRESS_H_
+
+#include "p2pformat.h"
+
+struct p2pConnection;
+struct p2pZstdDictionary;
+
+// Message payload codecs, bit mask in handshake. Available codecs depend on build options
+// (LZ4_ENABLED, ZSTD_ENABLED)
+enum p2pCompressionTy {
+  p2pCompressionLZ4 = 1,
+  p2pCompressionZstd = 2
+};
+
+uint32_t p2pCompressionSupported();
+
+// Zstd dictionary trained on typical messages (zstd --train), both sides must use same one;
+// shared by connections, must outlive them
+p2pZstdDictionary *p2pZstdDictionaryNew(const void *data, size_t size, int level);
+void p2pZstdDictionaryDelete(p2pZstdDictionary *dictionary);
+
+// Codecs offered in handshake by connection, must be set before connect or accept. Messages of
+// 'threshold' bytes and more compressed with zstd if negotiated, otherwise with LZ4, and sent
+// as is when compression does not reduce size. Zstd negotiated only with same dictionary (or
+// without one on both sides)
+void p2pConnectionSetCompression(p2pConnection *connection, uint32_t codecs, uint32_t threshold, p2pZstdDictionary *dictionary);
+
+// Handshake: codecs supported by both sides on accept side, dictionary id announced by connect
+// side
+uint32_t p2pCompressionAccept(p2pConnection *connection, const p2pConnectData *data);
+uint32_t p2pCompressionDictionaryId(p2pConnection *connection);
+
+// Compression flag of message of given size: negotiated codec used by p2pCompress, 0 if message
+// sent as is
+uint32_t p2pCompressionFlag(p2pConnection *connection, uint32_t size);
+// Returns malloc'ed payload with compression flag for header type, nullptr if message sent as is
+void *p2pCompress(p2pConnection *connection, const void *data, uint32_t size, uint32_t *packedSize, uint32_t *flag);
+// Returns uncompressed size of compressed payload, 0 for malformed one
+size_t p2pUncompressedSize(const void *data, size_t size);
+bool p2pDecompress(p2pConnection *connection, uint32_t flag, const void *data, size_t size, void *out, size_t outSize);
+// Temporary buffer of connection for compressed payload
+xmstream &p2pCompressionBuffer(p2pConnection *connection);
+
+#endif //__P2PCOMPRESS_H_
@@ -4,6 +4,9 @@
 #include "p2putils/coreTypes.h"
 #include "p2putils/xmstream.h"
 
+// Message size limit of peers not announcing own limit in handshake
+#define P2P_DEFAULT_MAX_MESSAGE_SIZE 65536
+
 enum p2pErrorTy {
   p2pOk = 0,
   p2pErrorAuthFailed,
@@ -15,7 +18,21 @@ enum p2pMsgTy {
   p2pMsgConnect,
   p2pMsgRequest,
   p2pMsgResponse,
-  p2pMsgSignal
+  p2pMsgSignal,
+  // Signal forwarded by receivers, payload starts with big-endian 64-bit message id
+  p2pMsgGossip
+};
+
+// Flags of p2pHeader::type: payload compressed by negotiated codec, starts with big-endian
+// uncompressed size. Chunk flags mark frames of message sent by chunks, see p2pchunk.h
+enum p2pMsgFlags {
+  p2pMsgFlagLZ4 = 0x10000,
+  p2pMsgFlagZstd = 0x20000,
+  p2pMsgFlagChunk = 0x40000,
+  p2pMsgFlagChunkLast = 0x80000,
+  p2pMsgFlagsCompression = 0x30000,
+  p2pMsgFlagsChunk = 0xC0000,
+  p2pMsgFlagsMask = 0xFFFF0000
 };
 
 #pragma pack(push, 1)
@@ -29,10 +46,33 @@ struct p2pHeader {
 };
 #pragma pack(pop)
 
+// Protocol features, bit mask in handshake
+enum p2pFeatureTy {
+  // Varint header instead of p2pHeader after handshake, see p2pEncodeCompactHeader
+  p2pFeatureCompactHeader = 1,
+  // Large messages sent by interleaved chunks, negotiated with compact header only
+  p2pFeatureChunks = 2
+};
+
+// Compact header: type byte (message type in low 6 bits, compression flag in high 2 bits), varint
+// id, varint size. Type byte 63 means whole 32-bit type follows as varint
+#define P2P_COMPACT_HEADER_MAX_SIZE 21
+
+size_t p2pEncodeCompactHeader(const p2pHeader &header, uint8_t *out);
+// Returns header size, 0 if data is incomplete, -1 for malformed header
+int p2pDecodeCompactHeader(const uint8_t *data, size_t size, p2pHeader *header);
+
 struct p2pConnectData {
   const char *login;
   const char *password;
   const char *application;
+  // Largest message accepted by connecting side
+  uint32_t maxMsgSize;
+  // Offered compression codecs (p2pCompressionTy mask) and zstd dictionary id
+  uint32_t compression;
+  uint32_t dictionaryId;
+  // Offered protocol features (p2pFeatureTy mask)
+  uint32_t features;
 };
 
 class p2pStream : public xmstream {
@@ -45,9 +85,10 @@ public:
   p2pStream(size_t size = 64) : xmstream(size) {}
   
   bool readConnectMessage(p2pConnectData *data);
-  bool readStatusMessage(p2pErrorTy *error);
+  // Message size limit, accepted codecs and features optional, older peers don't send them
+  bool readStatusMessage(p2pErrorTy *error, uint32_t *maxMsgSize, uint32_t *compression, uint32_t *features);
 
-  void writeStatusMessage(p2pErrorTy error);  
+  void writeStatusMessage(p2pErrorTy error, uint32_t maxMsgSize, uint32_t compression, uint32_t features);
   void writeConnectMessage(p2pConnectData data);
 };
 
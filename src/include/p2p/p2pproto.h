@@ -1,9 +1,15 @@
+#ifndef __P2PPROTO_H_
+#define __P2PPROTO_H_
+
 #include "asyncio/api.h"
 #include "asyncio/asyncio.h"
 #include "p2pformat.h"
 
 class xmstream;
 class p2pNode;
+struct p2pCodecState;
+struct p2pChunkState;
+struct p2pZstdDictionary;
 
 
 struct p2pConnection;
@@ -25,6 +31,7 @@ typedef void p2pConnectCb(AsyncOpStatus, p2pConnection*, void*);
 typedef void p2preadCb(AsyncOpStatus, p2pConnection*, p2pHeader, void*, void*);
 typedef void p2preadStreamCb(AsyncOpStatus, p2pConnection*, p2pHeader, p2pStream*, void*);
 typedef void p2pwriteCb(AsyncOpStatus, p2pConnection*, p2pHeader, void*);
+typedef bool p2pChunkCb(p2pConnection*, uint32_t, uint32_t, uint64_t, const void*, size_t, bool, void*);
 
 struct p2pOp {
   asyncOpRoot root;
@@ -36,6 +43,10 @@ struct p2pOp {
     p2pStream *stream;
   };
   size_t bufferSize;
+  // Compressed copy of sent message
+  void *packed;
+  // Bytes counted in connection send queue
+  size_t queuedBytes;
 
   HostAddress address;
   p2pHeader header;
@@ -46,6 +57,31 @@ struct p2pConnection {
   aioObjectRoot root;
   aioObject *socket;
   p2pStream stream;
+  // Message size limits exchanged in handshake: own one announced to remote side, remote one
+  // received from it
+  uint32_t maxMsgSize;
+  uint32_t remoteMaxMsgSize;
+  // Compression codecs offered in handshake and negotiated ones, see p2pcompress.h
+  uint32_t compressionOffer;
+  uint32_t compression;
+  uint32_t compressionThreshold;
+  p2pZstdDictionary *dictionary;
+  p2pCodecState *codecState;
+  // Protocol features offered in handshake (all supported by default) and negotiated ones
+  uint32_t featuresOffer;
+  uint32_t features;
+  // Receive buffer of compact header format: one socket read gets many small messages, parsed
+  // without further reads
+  uint8_t *readBuffer;
+  size_t readOffset;
+  size_t readSize;
+  // Payload bytes of send operations not finished yet
+  size_t sendQueueBytes;
+  // Chunked messages, see p2pchunk.h
+  uint32_t chunkSize;
+  p2pChunkCb *chunkHandler;
+  void *chunkHandlerArg;
+  p2pChunkState *chunkState;
 };
 
 p2pConnection *p2pConnectionNew(aioObject *socket);
@@ -79,6 +115,9 @@ void aiop2pRecv(p2pConnection *connection,
                 p2preadCb *callback,
                 void *arg);
 
+// With afNoCopy payload sent as is, without copy and compression: data must stay valid until
+// callback, type can contain compression flag of payload compressed by caller. Payload larger
+// than chunk size sent by chunks if peer supports them, see p2pchunk.h
 void aiop2pSend(p2pConnection *connection,
                 const void *data,
                 uint32_t id,
@@ -95,3 +134,4 @@ ssize_t iop2pSend(p2pConnection *connection, const void *data, uint32_t id, uint
 ssize_t iop2pRecvStream(p2pConnection *connection, p2pStream &stream, uint32_t maxMsgSize, AsyncFlags flags, uint64_t timeout, p2pHeader *header);
 ssize_t iop2pRecv(p2pConnection *connection, void *buffer, uint32_t bufferSize, AsyncFlags flags, uint64_t timeout, p2pHeader *header);
 
+#endif //__P2PPROTO_H_
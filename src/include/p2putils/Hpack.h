@@ -0,0 +1,58 @@
+#ifndef __LIBP2P_HPACK_H_
+#define __LIBP2P_HPACK_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include "CommonParse.h"
+
+// HPACK header compression (RFC 7541): static and dynamic tables, Huffman coding.
+// Encoder and decoder keep per-connection dynamic table state, so every header block must be
+// processed in order it sent or received
+typedef struct HpackEncoder HpackEncoder;
+typedef struct HpackDecoder HpackDecoder;
+
+typedef enum HpackIndexingTy {
+  // Field added to dynamic table
+  hpackIndexed = 0,
+  // Field not added to dynamic table
+  hpackNotIndexed,
+  // Sensitive field (credentials), intermediaries must not index it too
+  hpackNeverIndexed
+} HpackIndexingTy;
+
+// Called for every decoded field; name and value valid only during call. Returns 0 to cancel
+typedef int hpackHeaderCb(const Raw *name, const Raw *value, void *arg);
+
+HpackEncoder *hpackEncoderNew(size_t maxTableSize);
+void hpackEncoderDelete(HpackEncoder *encoder);
+// Peer decoder table limit (SETTINGS_HEADER_TABLE_SIZE), size update emitted at next block
+void hpackEncoderSetMaxTableSize(HpackEncoder *encoder, size_t maxTableSize);
+// Starts new header block, previous block data discarded
+void hpackEncodeBegin(HpackEncoder *encoder);
+// Names must be lowercase (HTTP/2 requirement)
+void hpackEncodeHeader(HpackEncoder *encoder, const char *name, size_t nameSize, const char *value, size_t valueSize, HpackIndexingTy indexing);
+const void *hpackEncodedData(HpackEncoder *encoder, size_t *size);
+
+HpackDecoder *hpackDecoderNew(size_t maxTableSize);
+void hpackDecoderDelete(HpackDecoder *decoder);
+// Decodes complete header block; ParserResultError means compression error, connection can't be
+// used after it
+ParserResultTy hpackDecode(HpackDecoder *decoder, const void *data, size_t size, hpackHeaderCb callback, void *arg);
+// Current dynamic table size in RFC 7541 units (entry size plus 32 bytes overhead)
+size_t hpackDecoderTableSize(HpackDecoder *decoder);
+
+// Huffman coding of string literals; encode returns encoded size, output buffer must have at
+// least hpackHuffmanEncodedSize bytes. Decode returns decoded size or (size_t)-1 on error,
+// output buffer must have at least size*8/5 bytes
+size_t hpackHuffmanEncodedSize(const void *data, size_t size);
+size_t hpackHuffmanEncode(const void *data, size_t size, void *out);
+size_t hpackHuffmanDecode(const void *data, size_t size, void *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //__LIBP2P_HPACK_H_
@@ -61,7 +61,8 @@ typedef struct HttpComponent {
   };
 } HttpComponent;
 
-typedef void httpParseCb(HttpComponent *component, void *arg);
+// Returns 0 to stop parsing, httpParse returns ParserResultCancelled then
+typedef int httpParseCb(HttpComponent *component, void *arg);
 
 void httpInit(HttpParserState *state);
 void httpSetBuffer(HttpParserState *state, const void *buffer, size_t size);
@@ -5,6 +5,8 @@
 extern "C" {
 #endif
 
+#include <stddef.h>
+
 enum {
   hhAccept = 1,
   hhConnection,
@@ -14,7 +16,35 @@ enum {
   hhHost,
   hhServer,
   hhTransferEncoding,
-  hhUserAgent
+  hhUserAgent,
+  hhAcceptEncoding,
+  hhAcceptLanguage,
+  hhAuthorization,
+  hhCacheControl,
+  hhContentEncoding,
+  hhCookie,
+  hhExpect,
+  hhKeepAlive,
+  hhLocation,
+  hhOrigin,
+  hhRange,
+  hhReferer,
+  hhSetCookie,
+  hhUpgrade,
+  hhIfModifiedSince,
+  hhIfNoneMatch,
+  hhETag,
+  hhLastModified,
+  hhVary,
+  hhXForwardedFor,
+  hhProxyConnection,
+  hhSecWebSocketKey,
+  hhSecWebSocketAccept,
+  hhSecWebSocketVersion,
+  hhTE,
+  hhTrailer,
+  hhContentRange,
+  hhLast
 };
 
 enum {
@@ -27,9 +57,16 @@ enum {
   hmConnect,
   hmOptions,
   hmTrace,
-  hmPatch
+  hmPatch,
+  hmLast
 };
 
+// Exact lookup with perfect hash, header names are case-insensitive; returns 0 for unknown name
+int httpHeaderId(const char *name, size_t size);
+int httpMethodId(const char *name, size_t size);
+// Canonical header name or 0
+const char *httpHeaderName(int id);
+
 #ifdef __cplusplus
 }
 #endif
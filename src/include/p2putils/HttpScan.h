@@ -0,0 +1,34 @@
+#ifndef __LIBP2P_HTTPSCAN_H_
+#define __LIBP2P_HTTPSCAN_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+// Vectorized scanners used by HTTP parsers. Best kernel supported by CPU selected at first use
+typedef enum HttpScanKernelTy {
+  httpScanScalar = 0,
+  httpScanSSE42,
+  httpScanAVX2,
+  httpScanNEON,
+  httpScanKernelLast
+} HttpScanKernelTy;
+
+// Returns pointer to CR of first CRLF pair in [ptr, end) or end if there is no such pair
+const char *httpScanCRLF(const char *ptr, const char *end);
+// Returns pointer to first byte in [ptr, end) which is not token character (RFC 7230) or end
+const char *httpScanToken(const char *ptr, const char *end);
+
+int httpScanKernelSupported(HttpScanKernelTy kernel);
+HttpScanKernelTy httpScanGetKernel();
+const char *httpScanKernelName(HttpScanKernelTy kernel);
+// For tests and benchmarks; returns 0 if kernel not supported by CPU
+int httpScanSetKernel(HttpScanKernelTy kernel);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //__LIBP2P_HTTPSCAN_H_
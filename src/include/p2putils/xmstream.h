@@ -4,6 +4,7 @@
 #include "p2putils/strExtras.h"
 #include <stdint.h>
 #include <string.h>
+#include <utility>
 #if defined(_MSC_VER)
 #include <BaseTsd.h>
 typedef SSIZE_T ssize_t;
@@ -67,6 +68,16 @@ public:
   template<typename T> T *data() const { return (T*)_m; }
   template<typename T> T *ptr() const { return (T*)_p; }
 
+  // Exchanges buffers without copy
+  void swap(xmstream &s) {
+    std::swap(_m, s._m);
+    std::swap(_p, s._p);
+    std::swap(_size, s._size);
+    std::swap(_msize, s._msize);
+    std::swap(_eof, s._eof);
+    std::swap(_own, s._own);
+  }
+
   void *capture() {
     void *data = _m;
     _m = nullptr;
@@ -6,27 +6,526 @@
 
 // Default p2p connection timeout = 1 second
 #define P2P_CONNECT_TIMEOUT 1000000
+// Default backoff of connect attempts
+#define P2P_RECONNECT_MIN_DELAY 100000
+#define P2P_RECONNECT_MAX_DELAY 30000000
+// Connection waits with timeout checked once per second
+// Weight of new sample in peer latency and health averages
+#define P2P_LATENCY_EWMA_ALPHA 0.2
+#define P2P_HEALTH_EWMA_ALPHA 0.2
+// One of this number of selections ignores health, so unhealthy peer can recover
+#define P2P_HEALTH_PROBE_INTERVAL 16
+// Points of every peer on consistent hashing ring
+#define P2P_HASH_RING_REPLICAS 128
+// Hedge delay used until enough response times collected
+#define P2P_HEDGE_MIN_SAMPLES 16
+#define P2P_HEDGE_DEFAULT_DELAY 10000
+// Hedge delay percentile recalculated after this number of new samples
+#define P2P_HEDGE_UPDATE_INTERVAL 32
+// Send timeout of sendSignal and forwarded gossip
+#define P2P_SIGNAL_TIMEOUT 3000000
 
-void p2pPeer::checkTimeout()
-{
-  // check requests
-  // TODO: use better timer grouping
-  time_t currentTime = time(nullptr);
-  for (auto I = handlersMap.begin(), IE = handlersMap.end(); I != IE;) {
-    p2pEventHandler &handler = I->second;      
-    if (handler.endPoint && currentTime >= handler.endPoint) {
-      if (handler.coroutine) {
-        _node->setLastActivePeer(nullptr);
-        coroutineCall(handler.coroutine);
-      } else if (handler.callback) {
-        reinterpret_cast<p2pNodeCb*>(handler.callback)(nullptr);
-      }
-      
-      handlersMap.erase(I++);
+struct p2pGroupRequest {
+  p2pRequestGroup *group;
+  p2pPeer *peer;
+  // Used by peer thread only
+  uint32_t id;
+  // Used by group thread only
+  bool pending;
+};
+
+// State of hedged, first-of-K or quorum request; released after completion, end of all sends and
+// handlers. Runs in thread of first node base
+struct p2pRequestGroup {
+  p2pNode *node;
+  p2pResponseCb *callback;
+  void *arg;
+  void *data;
+  uint32_t size;
+  uint8_t *out;
+  uint32_t outSize;
+  uint64_t key;
+  uint64_t timeout;
+  unsigned fanout;
+  unsigned required;
+  unsigned responses;
+  unsigned pending;
+  unsigned refs;
+  bool hedged;
+  bool finished;
+  aioUserEvent *hedgeEvent;
+  std::vector<p2pPeer*> tried;
+  std::vector<p2pGroupRequest*> requests;
+};
+
+// Broadcast payload shared by sends to all peers without copy, released after last send.
+// Compressed payload made once per codec, connections of node use same dictionary
+struct p2pFrame {
+  uint8_t *data;
+  uint32_t size;
+  uint32_t type;
+  uint64_t timeout;
+  unsigned refs;
+  unsigned packLock;
+  void *packed[2];
+  uint32_t packedSize[2];
+  bool packedReady[2];
+};
+
+// Peers of requests with their consistent hashing ring
+struct p2pPeerList {
+  std::vector<p2pPeer*> peers;
+  std::vector<std::pair<uint64_t, p2pPeer*>> hashRing;
+};
+
+typedef void p2pTaskProc(p2pTask*);
+
+struct p2pTask {
+  p2pTaskProc *proc;
+  p2pWorker *worker;
+  p2pPeer *peer;
+  p2pRequestGroup *group;
+  p2pGroupRequest *request;
+  p2pFrame *frame;
+  p2pEventHandler handler;
+  void *data;
+  size_t size;
+  uint64_t timeout;
+  AsyncOpStatus status;
+  socketTy socket;
+  HostAddress address;
+};
+
+// Event loop thread of node with queue of tasks from other threads
+struct p2pWorker {
+  p2pNode *node;
+  asyncBase *base;
+  aioUserEvent *event;
+  ConcurrentQueue tasks;
+};
+
+struct p2pCoroutineWait {
+  coroutineTy *coroutine;
+  AsyncOpStatus status;
+  unsigned responsesNum;
+};
+
+static __tls uint64_t threadRandomState;
+
+static void releaseGroup(p2pRequestGroup *group)
+{
+  if (__uint_atomic_fetch_and_add(&group->refs, static_cast<unsigned>(-1)) == 1) {
+    for (auto request: group->requests)
+      delete request;
+    free(group->data);
+    delete group;
+  }
+}
+
+static p2pFrame *newFrame(uint32_t type, size_t size, uint64_t timeout)
+{
+  p2pFrame *frame = new p2pFrame;
+  frame->data = static_cast<uint8_t*>(malloc(size ? size : 1));
+  frame->size = static_cast<uint32_t>(size);
+  frame->type = type;
+  frame->timeout = timeout;
+  frame->refs = 1;
+  frame->packLock = 0;
+  for (unsigned i = 0; i < 2; i++) {
+    frame->packed[i] = nullptr;
+    frame->packedSize[i] = 0;
+    frame->packedReady[i] = false;
+  }
+  return frame;
+}
+
+static void releaseFrame(p2pFrame *frame)
+{
+  if (__uint_atomic_fetch_and_add(&frame->refs, static_cast<unsigned>(-1)) == 1) {
+    free(frame->data);
+    free(frame->packed[0]);
+    free(frame->packed[1]);
+    delete frame;
+  }
+}
+
+static p2pTask *newTask(p2pTaskProc *proc)
+{
+  p2pTask *task = new p2pTask();
+  task->proc = proc;
+  return task;
+}
+
+static void frameSendCb(AsyncOpStatus status, p2pConnection *connection, p2pHeader header, void *arg)
+{
+  __UNUSED(status);
+  __UNUSED(connection);
+  __UNUSED(header);
+  releaseFrame(static_cast<p2pFrame*>(arg));
+}
+
+static void coroutineWaitCb(AsyncOpStatus status, p2pNode *node, unsigned responsesNum, void *arg)
+{
+  __UNUSED(node);
+  p2pCoroutineWait *wait = static_cast<p2pCoroutineWait*>(arg);
+  wait->status = status;
+  wait->responsesNum = responsesNum;
+  coroutineCall(wait->coroutine);
+}
+
+static inline uint64_t hashMix(uint64_t x)
+{
+  // splitmix64 finalizer
+  x ^= x >> 30;
+  x *= 0xBF58476D1CE4E5B9ULL;
+  x ^= x >> 27;
+  x *= 0x94D049BB133111EBULL;
+  x ^= x >> 31;
+  return x;
+}
+
+static inline uint64_t hashBytes(const void *data, size_t size)
+{
+  // FNV-1a
+  const uint8_t *p = static_cast<const uint8_t*>(data);
+  uint64_t hash = 0xCBF29CE484222325ULL;
+  for (size_t i = 0; i < size; i++) {
+    hash ^= p[i];
+    hash *= 0x100000001B3ULL;
+  }
+  return hash;
+}
+
+static inline uint64_t threadRandom()
+{
+  // xorshift64, state of every thread seeded on first use
+  uint64_t x = threadRandomState;
+  if (!x)
+    x = hashMix(reinterpret_cast<uintptr_t>(&threadRandomState) ^ static_cast<uint64_t>(time(nullptr))) | 1;
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  threadRandomState = x;
+  return x;
+}
+
+static void buildHashRing(p2pPeerList *list)
+{
+  list->hashRing.reserve(list->peers.size() * P2P_HASH_RING_REPLICAS);
+  for (auto peer: list->peers) {
+    // Ring points depend on peer address only, so they survive peer list reordering
+    const HostAddress &address = peer->_address;
+    uint64_t addressHash = address.family == AF_INET ?
+      hashBytes(&address.ipv4, sizeof(address.ipv4)) :
+      hashBytes(address.ipv6, sizeof(address.ipv6));
+    addressHash = hashMix(addressHash ^ address.port);
+    for (uint64_t i = 0; i < P2P_HASH_RING_REPLICAS; i++)
+      list->hashRing.push_back(std::make_pair(hashMix(addressHash + i*0x9E3779B97F4A7C15ULL), peer));
+  }
+
+  std::sort(list->hashRing.begin(), list->hashRing.end());
+}
+
+// Coroutine can be resumed before it yields, even from other thread: yield returns at once then
+static void resumeRequest(const p2pEventHandler &handler, p2pPeer *peer, AsyncOpStatus status)
+{
+  handler.result->peer = peer;
+  handler.result->status = status;
+  coroutineCall(handler.coroutine);
+}
+
+// Handler of group request keeps group until its end
+static void groupHandlerEvent(p2pNode *node, p2pGroupRequest *request, AsyncOpStatus status, const void *data, size_t size)
+{
+  p2pRequestGroup *group = request->group;
+  node->groupEvent(request, status, data, size);
+  releaseGroup(group);
+}
+
+void p2pPeer::requestFinished(const p2pEventHandler &handler, bool success)
+{
+  double sample = success ? static_cast<double>(usDiff(handler.startPt, getTimeMark())) : static_cast<double>(handler.timeout);
+  if (success)
+    stats.responses++;
+  else
+    stats.failures++;
+  stats.inFlight.store(stats.inFlight.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+  if (success)
+    _node->addLatencySample(static_cast<uint64_t>(sample));
+  double latency = stats.latency.load(std::memory_order_relaxed);
+  if (stats.responses + stats.failures == 1)
+    latency = sample;
+  else
+    latency += (sample - latency) * P2P_LATENCY_EWMA_ALPHA;
+  stats.latency.store(latency, std::memory_order_relaxed);
+  healthSample(success);
+}
+
+void p2pPeer::healthSample(bool success)
+{
+  double health = stats.health.load(std::memory_order_relaxed);
+  stats.health.store(health + ((success ? 1.0 : 0.0) - health) * P2P_HEALTH_EWMA_ALPHA, std::memory_order_relaxed);
+}
+
+constexpr uint32_t p2pRequestTable::InvalidIndex;
+constexpr uint32_t p2pRequestTable::MaxSize;
+
+p2pRequestTable::p2pRequestTable(asyncBase *base, TimeoutCb *callback, void *arg, size_t initialSize) :
+  _base(base), _callback(callback), _arg(arg), _freeHead(InvalidIndex), _freeTail(InvalidIndex), _size(0),
+  _timeBase(getTimeMark()), _timer(nullptr), _timerDeadline(0)
+{
+  _slots.reserve(initialSize);
+}
+
+p2pRequestTable::~p2pRequestTable()
+{
+  if (_timer)
+    deleteUserEvent(_timer);
+}
+
+void p2pRequestTable::timerCb(aioUserEvent *event, void *arg)
+{
+  __UNUSED(event);
+  p2pRequestTable *table = static_cast<p2pRequestTable*>(arg);
+  table->_timerDeadline = 0;
+  table->expire();
+}
+
+void p2pRequestTable::grow()
+{
+  uint32_t oldSize = static_cast<uint32_t>(_slots.size());
+  uint32_t newSize = std::min<uint32_t>(std::max<uint32_t>(oldSize*2, 64), MaxSize);
+  _slots.resize(newSize);
+  for (uint32_t i = oldSize; i < newSize; i++) {
+    Slot &slot = _slots[i];
+    slot.generation = 1;
+    slot.timeoutClass = InvalidIndex;
+    slot.busy = false;
+    slot.next = InvalidIndex;
+    if (_freeTail != InvalidIndex)
+      _slots[_freeTail].next = i;
+    else
+      _freeHead = i;
+    _freeTail = i;
+  }
+}
+
+void p2pRequestTable::freeSlot(uint32_t index)
+{
+  Slot &slot = _slots[index];
+  if (slot.timeoutClass != InvalidIndex)
+    unlink(index);
+  slot.busy = false;
+  // Generation 0 not used, so request id never 0
+  slot.generation = (slot.generation + 1) & ((1u << P2P_REQUEST_GENERATION_BITS) - 1);
+  if (!slot.generation)
+    slot.generation = 1;
+  slot.next = InvalidIndex;
+  if (_freeTail != InvalidIndex)
+    _slots[_freeTail].next = index;
+  else
+    _freeHead = index;
+  _freeTail = index;
+  _size--;
+}
+
+void p2pRequestTable::link(uint32_t index, uint64_t timeout)
+{
+  uint32_t classIndex = 0;
+  uint32_t classesNum = static_cast<uint32_t>(_timeoutClasses.size());
+  while (classIndex < classesNum && _timeoutClasses[classIndex].timeout != timeout)
+    classIndex++;
+  if (classIndex == classesNum) {
+    if (classesNum < P2P_REQUEST_TIMEOUT_CLASSES) {
+      TimeoutClass timeoutClass;
+      timeoutClass.timeout = timeout;
+      timeoutClass.head = InvalidIndex;
+      timeoutClass.tail = InvalidIndex;
+      _timeoutClasses.push_back(timeoutClass);
     } else {
-      ++I;
+      classIndex = classesNum - 1;
+    }
+  }
+
+  // Usually new deadline is latest one of its class
+  TimeoutClass &timeoutClass = _timeoutClasses[classIndex];
+  Slot &slot = _slots[index];
+  uint32_t prev = timeoutClass.tail;
+  while (prev != InvalidIndex && _slots[prev].deadline > slot.deadline)
+    prev = _slots[prev].prev;
+
+  uint32_t next = prev != InvalidIndex ? _slots[prev].next : timeoutClass.head;
+  slot.timeoutClass = classIndex;
+  slot.prev = prev;
+  slot.next = next;
+  if (prev != InvalidIndex)
+    _slots[prev].next = index;
+  else
+    timeoutClass.head = index;
+  if (next != InvalidIndex)
+    _slots[next].prev = index;
+  else
+    timeoutClass.tail = index;
+}
+
+void p2pRequestTable::unlink(uint32_t index)
+{
+  Slot &slot = _slots[index];
+  TimeoutClass &timeoutClass = _timeoutClasses[slot.timeoutClass];
+  if (slot.prev != InvalidIndex)
+    _slots[slot.prev].next = slot.next;
+  else
+    timeoutClass.head = slot.next;
+  if (slot.next != InvalidIndex)
+    _slots[slot.next].prev = slot.prev;
+  else
+    timeoutClass.tail = slot.prev;
+  slot.timeoutClass = InvalidIndex;
+}
+
+uint32_t p2pRequestTable::nearestClass()
+{
+  uint32_t result = InvalidIndex;
+  for (uint32_t i = 0, ie = static_cast<uint32_t>(_timeoutClasses.size()); i < ie; i++) {
+    uint32_t head = _timeoutClasses[i].head;
+    if (head != InvalidIndex && (result == InvalidIndex || _slots[head].deadline < _slots[_timeoutClasses[result].head].deadline))
+      result = i;
+  }
+
+  return result;
+}
+
+void p2pRequestTable::armTimer(uint64_t now)
+{
+  // Timer not rearmed when earlier requests removed, such wakeup only rearms it to actual deadline
+  uint32_t classIndex = nearestClass();
+  if (classIndex == InvalidIndex)
+    return;
+  uint64_t deadline = _slots[_timeoutClasses[classIndex].head].deadline;
+  if (_timerDeadline && _timerDeadline <= deadline)
+    return;
+  if (!_timer)
+    _timer = newUserEvent(_base, 0, timerCb, this);
+  _timerDeadline = deadline;
+  userEventStartTimer(_timer, deadline > now ? deadline - now : 1, 1);
+}
+
+p2pRequestTable::Slot *p2pRequestTable::slotById(uint32_t id)
+{
+  uint32_t index = id & (MaxSize - 1);
+  if (index >= _slots.size())
+    return nullptr;
+  Slot &slot = _slots[index];
+  return slot.busy && slot.generation == (id >> P2P_REQUEST_INDEX_BITS) ? &slot : nullptr;
+}
+
+uint32_t p2pRequestTable::insert(const p2pEventHandler &handler, uint64_t timeout)
+{
+  if (_freeHead == InvalidIndex) {
+    if (_slots.size() == MaxSize)
+      return 0;
+    grow();
+  }
+
+  uint32_t index = _freeHead;
+  Slot &slot = _slots[index];
+  _freeHead = slot.next;
+  if (_freeHead == InvalidIndex)
+    _freeTail = InvalidIndex;
+
+  slot.handler = handler;
+  slot.busy = true;
+  slot.timeoutClass = InvalidIndex;
+  slot.deadline = 0;
+  _size++;
+  if (timeout) {
+    uint64_t currentTime = now();
+    slot.deadline = currentTime + timeout;
+    link(index, timeout);
+    if (!_timerDeadline || slot.deadline < _timerDeadline)
+      armTimer(currentTime);
+  }
+
+  return (slot.generation << P2P_REQUEST_INDEX_BITS) | index;
+}
+
+p2pEventHandler *p2pRequestTable::find(uint32_t id)
+{
+  Slot *slot = slotById(id);
+  return slot ? &slot->handler : nullptr;
+}
+
+bool p2pRequestTable::remove(uint32_t id, p2pEventHandler *handler)
+{
+  Slot *slot = slotById(id);
+  if (!slot)
+    return false;
+  if (handler)
+    *handler = slot->handler;
+  freeSlot(id & (MaxSize - 1));
+  return true;
+}
+
+void p2pRequestTable::removeAll(std::vector<std::pair<uint32_t, p2pEventHandler>> &out)
+{
+  for (uint32_t i = 0, ie = static_cast<uint32_t>(_slots.size()); i < ie && _size; i++) {
+    Slot &slot = _slots[i];
+    if (slot.busy) {
+      out.push_back(std::make_pair((slot.generation << P2P_REQUEST_INDEX_BITS) | i, slot.handler));
+      freeSlot(i);
     }
-  }  
+  }
+}
+
+void p2pRequestTable::expire()
+{
+  // Expired request removed before callback, callback can start new requests
+  uint64_t currentTime = now();
+  uint32_t classIndex;
+  while ((classIndex = nearestClass()) != InvalidIndex) {
+    uint32_t index = _timeoutClasses[classIndex].head;
+    Slot &slot = _slots[index];
+    if (slot.deadline > currentTime)
+      break;
+    uint32_t id = (slot.generation << P2P_REQUEST_INDEX_BITS) | index;
+    p2pEventHandler handler = slot.handler;
+    freeSlot(index);
+    _callback(id, handler, _arg);
+  }
+
+  armTimer(currentTime);
+}
+
+void p2pPeer::failHandlers()
+{
+  // Handlers can start new requests to other peers
+  std::vector<std::pair<uint32_t, p2pEventHandler>> pending;
+  handlers.removeAll(pending);
+  for (auto &I: pending) {
+    p2pEventHandler &handler = I.second;
+    requestFinished(handler, false);
+    if (handler.groupRequest) {
+      groupHandlerEvent(_node, handler.groupRequest, aosDisconnected, nullptr, 0);
+    } else if (handler.coroutine) {
+      resumeRequest(handler, nullptr, aosDisconnected);
+    } else if (handler.callback) {
+      handler.callback(nullptr);
+    }
+  }
+}
+
+void p2pPeer::requestTimeoutCb(uint32_t id, const p2pEventHandler &handler, void *arg)
+{
+  __UNUSED(id);
+  p2pPeer *peer = static_cast<p2pPeer*>(arg);
+  peer->requestFinished(handler, false);
+  if (handler.groupRequest) {
+    groupHandlerEvent(peer->_node, handler.groupRequest, aosTimeout, nullptr, 0);
+  } else if (handler.coroutine) {
+    resumeRequest(handler, nullptr, aosTimeout);
+  } else if (handler.callback) {
+    handler.callback(nullptr);
+  }
 }
 
 void p2pPeer::clientReceiver(AsyncOpStatus status, p2pConnection *connection, p2pHeader header, p2pStream *stream, void *arg)
@@ -38,20 +537,35 @@ void p2pPeer::clientReceiver(AsyncOpStatus status, p2pConnection *connection, p2
   if (status == aosSuccess) {
     switch (header.type) {
       case p2pMsgResponse : {
-        auto It = peer->handlersMap.find(header.id);
-        if (It != peer->handlersMap.end()) {
-          p2pEventHandler &handler = It->second;
-          if (header.size > handler.outSize)
+        p2pEventHandler handler;
+        if (peer->handlers.remove(header.id, &handler)) {
+          xmstream &stream = peer->connection->stream;
+          peer->requestFinished(handler, true);
+          if (handler.groupRequest) {
+            groupHandlerEvent(peer->_node, handler.groupRequest, aosSuccess, stream.data(), stream.sizeOf());
             break;
-          
-          memcpy(handler.out, peer->connection->stream.data(), peer->connection->stream.sizeOf());
+          }
+
+          // Response not fitting output buffer fails request without retry, other peers would
+          // send same response
+          bool fits = handler.outStream || header.size <= handler.outSize;
+          if (handler.outStream) {
+            if (handler.outStream->own()) {
+              handler.outStream->swap(stream);
+            } else {
+              handler.outStream->reset();
+              handler.outStream->write(stream.data(), stream.sizeOf());
+              handler.outStream->seekSet(0);
+            }
+          } else if (fits) {
+            memcpy(handler.out, stream.data(), stream.sizeOf());
+          }
+
           if (handler.coroutine) {
-            peer->_node->setLastActivePeer(peer);
-            coroutineCall(handler.coroutine);
+            resumeRequest(handler, fits ? peer : nullptr, fits ? aosSuccess : aosBufferTooSmall);
           } else if (handler.callback) {
-            handler.callback(peer);
+            handler.callback(fits ? peer : nullptr);
           }
-          peer->handlersMap.erase(It);
         }
         break;
         
@@ -59,12 +573,16 @@ void p2pPeer::clientReceiver(AsyncOpStatus status, p2pConnection *connection, p2
       case p2pMsgSignal :
         peer->_node->signal(peer);
         break;
+      case p2pMsgGossip : {
+        xmstream &stream = peer->connection->stream;
+        peer->_node->gossipReceived(peer, stream.data(), stream.sizeOf());
+        break;
+      }
     }
     
-    aiop2pRecvStream(peer->connection, peer->connection->stream, 65536, afNone, 0, clientReceiver, peer);
-  } else {
-    // try reconnect
-    peer->connect();
+    aiop2pRecvStream(peer->connection, peer->connection->stream, peer->_node->maxMessageSize(), afNone, 0, clientReceiver, peer);
+  } else if (status != aosCanceled) {
+    peer->connectionLost();
   }
 }
 
@@ -73,13 +591,12 @@ void p2pPeer::clientP2PConnectCb(AsyncOpStatus status, p2pConnection *connection
   __UNUSED(connection);
   p2pPeer *peer = static_cast<p2pPeer*>(arg);
   if (status == aosSuccess) {
-    peer->_connected = true;
+    peer->_connected.store(true, std::memory_order_relaxed);
+    peer->_connectFailures = 0;
     peer->_node->connectionEstablished(peer);   
-    aiop2pRecvStream(peer->connection, peer->connection->stream, 65536, afNone, 0, clientReceiver, peer);
-  } else if (status == aosTimeout) {
-    peer->connect();
-  } else {
-    peer->connectAfter(P2P_CONNECT_TIMEOUT);
+    aiop2pRecvStream(peer->connection, peer->connection->stream, peer->_node->maxMessageSize(), afNone, 0, clientReceiver, peer);
+  } else if (status != aosCanceled) {
+    peer->connectFailed();
   }
 }
 
@@ -109,7 +626,7 @@ void p2pPeer::nodeMsgHandler()
   bool valid = true;
   p2pHeader header;
   ssize_t status;
-  while (valid && (status = iop2pRecvStream(connection, connection->stream, 65536, afNone, 0, &header)) > 0) {
+  while (valid && (status = iop2pRecvStream(connection, connection->stream, _node->maxMessageSize(), afNone, 0, &header)) > 0) {
     switch (header.type) {
       case p2pMsgRequest : {
         if (p2pRequestCb *handler = _node->getRequestHandler()) {
@@ -119,6 +636,12 @@ void p2pPeer::nodeMsgHandler()
         }
         break;
       }
+      case p2pMsgSignal :
+        _node->signal(this);
+        break;
+      case p2pMsgGossip :
+        _node->gossipReceived(this, connection->stream.data(), connection->stream.sizeOf());
+        break;
       default :
         valid = false;
         break;
@@ -126,7 +649,7 @@ void p2pPeer::nodeMsgHandler()
   }
   
   _node->removePeer(this);
-  delete this;
+  _node->releasePeer(this);
 }
 
 
@@ -144,6 +667,7 @@ bool p2pPeer::createConnection()
   
   aioObject *socketOp = newSocketIo(_base, hSocket);
   connection = p2pConnectionNew(socketOp);
+  _node->configureConnection(connection);
   return true;
 }
 
@@ -157,25 +681,42 @@ void p2pPeer::destroyConnection()
 
 void p2pPeer::connect()
 {
-  _connected = false;
-  // TODO: don't call first time
-  _node->connectionTimeout();
+  _connected.store(false, std::memory_order_relaxed);
   destroyConnection();
   if (createConnection()) {
     p2pConnectData data;
     data.login = "pool";
     data.password = "pool";
     data.application = "pool_rpc";
+    data.maxMsgSize = _node->maxMessageSize();
     aiop2pConnect(connection, &_address, &data, P2P_CONNECT_TIMEOUT, clientP2PConnectCb, this);
   } else {
-    userEventStartTimer(_event, 1000000, 1);
+    connectFailed();
   }
 }
 
+void p2pPeer::connectFailed()
+{
+  destroyConnection();
+  stats.connectFailures++;
+  connectAfter(_node->reconnectDelay(++_connectFailures));
+}
+
+void p2pPeer::connectionLost()
+{
+  // fail waiting requests without timeout, clients of restarted node reconnect at different times
+  _connected.store(false, std::memory_order_relaxed);
+  failHandlers();
+  destroyConnection();
+  healthSample(false);
+  connectAfter(_node->reconnectDelay(0));
+}
+
 
 void p2pPeer::accept(bool coroutineMode, p2pConnection *connectionArg)
 {
   connection = connectionArg;
+  _accepted = true;
   if (coroutineMode) {
     coroutineTy *handlerProc = coroutineNew(nodeMsgHandlerEP, this, 0x100000);
     coroutineCall(handlerProc);
@@ -183,54 +724,278 @@ void p2pPeer::accept(bool coroutineMode, p2pConnection *connectionArg)
 }
 
 
+p2pNode::p2pNode(asyncBase **bases, size_t basesNum, const char *clusterName, bool coroutineMode) :
+  _base(bases[0]), _clusterName(clusterName), _workerCursor(0), _peersLock(0), _requestPeers(new p2pPeerList), _requestPeersUsers(0),
+  _maxMsgSize(P2P_DEFAULT_MAX_MESSAGE_SIZE), _compression(0), _compressionThreshold(0), _chunkSize(P2P_DEFAULT_CHUNK_SIZE),
+  _dictionary(nullptr), _reconnectMinDelay(P2P_RECONNECT_MIN_DELAY), _reconnectMaxDelay(P2P_RECONNECT_MAX_DELAY), _waitLock(0),
+  _waitEvent(newUserEvent(bases[0], 0, waitTimerCb, this)), _waitTimeBase(getTimeMark()), _waitTimerDeadline(0),
+  _listenerSocket(nullptr), _requestHandler(nullptr), _requestHandlerArg(nullptr), _signalHandler(nullptr), _signalHandlerArg(nullptr),
+  _coroutineMode(coroutineMode), _broadcastWatermark(1u << 20), _gossipHistoryPos(0), _gossipLock(0),
+  _selectStrategy(p2pSelectRoundRobin), _selectCursor(0),
+  _latencySamplesNum(0), _hedgeDelaySamplesNum(0), _hedgeDelay(0), _hedgeMinDelay(1000), _hedgePercentile(0.95)
+{
+  for (size_t i = 0; i < basesNum; i++) {
+    p2pWorker *worker = new p2pWorker;
+    memset(&worker->tasks, 0, sizeof(worker->tasks));
+    worker->node = this;
+    worker->base = bases[i];
+    worker->event = newUserEvent(bases[i], 0, workerCb, worker);
+    _workers.push_back(worker);
+  }
+}
+
+p2pNode::~p2pNode()
+{
+  if (_listenerSocket)
+    deleteAioObject(_listenerSocket);
+
+  // Node without requests in flight can have broadcast sends and accepted sockets in queues
+  for (auto worker: _workers) {
+    void *data;
+    while (concurrentQueuePop(&worker->tasks, &data)) {
+      p2pTask *task = static_cast<p2pTask*>(data);
+      if (task->frame) {
+        releaseFrame(task->frame);
+        releasePeer(task->peer);
+      }
+      if (task->proc == acceptTaskProc)
+        socketClose(task->socket);
+      delete task;
+    }
+
+    deleteUserEvent(worker->event);
+    for (auto &partition: worker->tasks.Partitions)
+      free(partition.queue);
+    delete worker;
+  }
+
+  for (auto peer: _connections)
+    delete peer;
+  deleteUserEvent(_waitEvent);
+  delete _requestPeers.load(std::memory_order_relaxed);
+  for (auto list: _retiredPeerLists)
+    delete list;
+}
+
+void p2pNode::workerCb(aioUserEvent *event, void *arg)
+{
+  __UNUSED(event);
+  // Event deactivated before callback, task pushed while queue drained activates it again
+  p2pWorker *worker = static_cast<p2pWorker*>(arg);
+  void *data;
+  while (concurrentQueuePop(&worker->tasks, &data)) {
+    p2pTask *task = static_cast<p2pTask*>(data);
+    task->proc(task);
+    delete task;
+  }
+}
+
+p2pWorker *p2pNode::nextWorker()
+{
+  return _workers[__uintptr_atomic_fetch_and_add(&_workerCursor, 1) % _workers.size()];
+}
+
+void p2pNode::post(p2pWorker *worker, p2pTask *task)
+{
+  concurrentQueuePush(&worker->tasks, task);
+  userEventActivate(worker->event);
+}
+
+void p2pNode::acceptTaskProc(p2pTask *task)
+{
+  task->worker->node->acceptConnection(task->worker, task->socket, &task->address);
+}
+
+void p2pNode::acceptConnection(p2pWorker *worker, socketTy socket, const HostAddress *address)
+{
+  aioObject *object = newSocketIo(worker->base, socket);
+  p2pConnection *connection = p2pConnectionNew(object);
+  configureConnection(connection);
+  p2pPeer *peer = new p2pPeer(worker->base, worker, this, address);
+  peer->accept(_coroutineMode, connection);
+}
+
 p2pNode *p2pNode::createClient(asyncBase *base,
                                const HostAddress *addresses,
                                size_t addressesNum,
-                               const char *clusterName)
+                               const char *clusterName,
+                               unsigned poolSize)
 {
-  p2pNode *node = new p2pNode(base, clusterName, false);
-  for (size_t i = 0; i < addressesNum; i++) {
-    p2pPeer *peer = new p2pPeer(base, node, &addresses[i]);
-    node->addPeer(peer);
-    peer->connect();
-  }
-  
+  return createClient(&base, 1, addresses, addressesNum, clusterName, poolSize);
+}
+
+p2pNode *p2pNode::createClient(asyncBase **bases,
+                               size_t basesNum,
+                               const HostAddress *addresses,
+                               size_t addressesNum,
+                               const char *clusterName,
+                               unsigned poolSize)
+{
+  p2pNode *node = new p2pNode(bases, basesNum, clusterName, false);
+  for (size_t i = 0; i < addressesNum; i++)
+    node->connectPeer(&addresses[i], poolSize);
   return node;
 }
 
+void p2pNode::connectPeer(const HostAddress *address, unsigned poolSize)
+{
+  // Connections of pool spread over event loop threads
+  std::vector<p2pPeer*> pool;
+  for (unsigned i = 0; i < std::max(poolSize, 1u); i++) {
+    p2pWorker *worker = nextWorker();
+    pool.push_back(new p2pPeer(worker->base, worker, this, address));
+  }
+
+  p2pPeerList *list = new p2pPeerList;
+  __spinlock_acquire(&_peersLock);
+  _connections.insert(_connections.end(), pool.begin(), pool.end());
+  // Running requests keep using old list
+  p2pPeerList *oldList = _requestPeers.load(std::memory_order_relaxed);
+  list->peers = oldList->peers;
+  list->peers.insert(list->peers.end(), pool.begin(), pool.end());
+  buildHashRing(list);
+  _retiredPeerLists.push_back(oldList);
+  _requestPeers.store(list, std::memory_order_seq_cst);
+  reclaimPeerLists();
+  __spinlock_release(&_peersLock);
+
+  // Connections started by event loop, so node can be configured after creation; all of them
+  // connect at once
+  for (auto peer: pool)
+    userEventActivate(peer->_event);
+}
+
+p2pPeerList *p2pNode::acquirePeers()
+{
+  // User counted before list loaded: list replaced after that is not freed until releasePeers
+  _requestPeersUsers.fetch_add(1, std::memory_order_seq_cst);
+  return _requestPeers.load(std::memory_order_seq_cst);
+}
+
+void p2pNode::releasePeers()
+{
+  if (_requestPeersUsers.fetch_sub(1, std::memory_order_seq_cst) == 1) {
+    __spinlock_acquire(&_peersLock);
+    reclaimPeerLists();
+    __spinlock_release(&_peersLock);
+  }
+}
+
+void p2pNode::reclaimPeerLists()
+{
+  // New user loads current list, which is never retired while lock held
+  if (_retiredPeerLists.empty() || _requestPeersUsers.load(std::memory_order_seq_cst) != 0)
+    return;
+  for (auto list: _retiredPeerLists)
+    delete list;
+  _retiredPeerLists.clear();
+}
+
+void p2pNode::addPeer(p2pPeer *peer)
+{
+  __spinlock_acquire(&_peersLock);
+  _connections.push_back(peer);
+  __spinlock_release(&_peersLock);
+}
+
+void p2pNode::removePeer(p2pPeer *peer)
+{
+  __spinlock_acquire(&_peersLock);
+  auto It = std::find(_connections.begin(), _connections.end(), peer);
+  if (It != _connections.end())
+    _connections.erase(It);
+  __spinlock_release(&_peersLock);
+}
+
+void p2pNode::releasePeer(p2pPeer *peer)
+{
+  if (__uint_atomic_fetch_and_add(&peer->_refs, static_cast<unsigned>(-1)) == 1)
+    delete peer;
+}
+
+void p2pNode::collectPeers(std::vector<p2pPeer*> &peers, p2pPeer *exclude)
+{
+  __spinlock_acquire(&_peersLock);
+  for (auto peer: _connections) {
+    if (peer != exclude && peer->established()) {
+      __uint_atomic_fetch_and_add(&peer->_refs, 1);
+      peers.push_back(peer);
+    }
+  }
+  __spinlock_release(&_peersLock);
+}
+
 void p2pNode::connectionEstablished(p2pPeer *peer)
 {
-  setLastActivePeer(peer);  
-  for (auto I = _connectionWaitHandlers.begin(), IE = _connectionWaitHandlers.end(); I != IE; ++I) {
-    p2pEventHandler &handler = *I;  
+  // Waiting requests resumed outside of lock
+  std::list<p2pEventHandler> handlers;
+  __spinlock_acquire(&_waitLock);
+  handlers.swap(_connectionWaitHandlers);
+  __spinlock_release(&_waitLock);
+  for (auto &handler: handlers) {
     if (handler.coroutine) {
-      coroutineCall(handler.coroutine);
+      resumeRequest(handler, peer, aosSuccess);
     } else if (handler.callback) {
       handler.callback(peer);
     }
   }
-  
-  _connectionWaitHandlers.clear();
 }
 
 void p2pNode::connectionTimeout()
 {
-  time_t currentTime = time(nullptr);
+  std::list<p2pEventHandler> expired;
+  uint64_t now = waitNow();
+  uint64_t nearest = 0;
+  __spinlock_acquire(&_waitLock);
+  _waitTimerDeadline = 0;
   for (auto I = _connectionWaitHandlers.begin(), IE = _connectionWaitHandlers.end(); I != IE;) {
-    p2pEventHandler &handler = *I;      
-    if (handler.endPoint && currentTime >= handler.endPoint) {
-      if (handler.coroutine) {
-        setLastActivePeer(nullptr);
-        coroutineCall(handler.coroutine);
-      } else if (handler.callback) {
-        handler.callback(nullptr);
-      }
-    
-      _connectionWaitHandlers.erase(I++);
+    if (I->endPoint && I->endPoint <= now) {
+      expired.splice(expired.end(), _connectionWaitHandlers, I++);
     } else {
+      if (I->endPoint && (!nearest || I->endPoint < nearest))
+        nearest = I->endPoint;
       ++I;
     }
   }
+  if (nearest)
+    armWaitTimer(nearest, now);
+  __spinlock_release(&_waitLock);
+
+  for (auto &handler: expired) {
+    if (handler.coroutine) {
+      resumeRequest(handler, nullptr, aosTimeout);
+    } else if (handler.callback) {
+      handler.callback(nullptr);
+    }
+  }
+}
+
+uint64_t p2pNode::reconnectDelay(unsigned failures)
+{
+  // Random part spreads attempts of many clients of same node
+  if (!failures)
+    return threadRandom() % (_reconnectMinDelay + 1);
+
+  uint64_t delay = _reconnectMinDelay;
+  for (unsigned i = 1; i < failures && delay < _reconnectMaxDelay; i++)
+    delay *= 2;
+  delay = std::min(delay, _reconnectMaxDelay);
+  return delay/2 + threadRandom() % (delay/2 + 1);
+}
+
+void p2pNode::armWaitTimer(uint64_t deadline, uint64_t now)
+{
+  // Timer moved only to earlier deadline, later ones found by connectionTimeout
+  if (_waitTimerDeadline && _waitTimerDeadline <= deadline)
+    return;
+  _waitTimerDeadline = deadline;
+  userEventStartTimer(_waitEvent, deadline > now ? deadline - now : 1, 1);
+}
+
+void p2pNode::waitTimerCb(aioUserEvent *event, void *arg)
+{
+  __UNUSED(event);
+  static_cast<p2pNode*>(arg)->connectionTimeout();
 }
 
 void p2pNode::signal(p2pPeer *peer)
@@ -243,64 +1008,556 @@ void p2pNode::signal(p2pPeer *peer)
 
 bool p2pNode::connected()
 {
-  if (_connections.empty())
-    return false;
-  
-  for (auto c: _connections) {
-    if (c->_connected)
-      return true;
-  }
-  
-  return false;
+  bool result = false;
+  for (auto c: acquirePeers()->peers)
+    result |= c->_connected.load(std::memory_order_relaxed);
+  releasePeers();
+  return result;
 }
 
 
 bool p2pNode::ioWaitForConnection(uint64_t timeout)
 {
-  for (size_t i = 0; i < _connections.size(); i++) {
-    if (_connections[i]->_connected)
-      return true;
+  p2pRequestResult result;
+  result.peer = nullptr;
+  result.status = aosPending;
+  p2pEventHandler handler;
+  memset(&handler, 0, sizeof(handler));
+  handler.coroutine = coroutineCurrent();
+  handler.result = &result;
+  uint64_t now = waitNow();
+  handler.endPoint = timeout ? now + timeout : 0;
+
+  // Peer connected after check under lock finds this handler
+  __spinlock_acquire(&_waitLock);
+  if (connected()) {
+    __spinlock_release(&_waitLock);
+    return true;
   }
+  _connectionWaitHandlers.push_back(handler);
+  if (handler.endPoint)
+    armWaitTimer(handler.endPoint, now);
+  __spinlock_release(&_waitLock);
 
-  addHandler(coroutineCurrent(), timeout);
   coroutineYield();
-  return _lastActivePeer != nullptr;
+  return result.peer != nullptr;
+}
+
+
+p2pPeer *p2pNode::selectPeer(p2pPeerList *list, uint64_t key, p2pPeer *first, const std::vector<p2pPeer*> &failed)
+{
+  if (threadRandom() % P2P_HEALTH_PROBE_INTERVAL != 0) {
+    if (p2pPeer *peer = selectPeerImpl(list, key, first, failed, true))
+      return peer;
+  }
+
+  return selectPeerImpl(list, key, first, failed, false);
 }
 
+p2pPeer *p2pNode::selectPeerImpl(p2pPeerList *list, uint64_t key, p2pPeer *first, const std::vector<p2pPeer*> &failed, bool healthyOnly)
+{
+  // Statistics of peers in other threads may be slightly stale
+  auto available = [first, &failed, healthyOnly](p2pPeer *peer) -> bool {
+    return peer->_connected.load(std::memory_order_relaxed) &&
+           peer != first &&
+           (!healthyOnly || peer->stats.health.load(std::memory_order_relaxed) >= P2P_HEALTH_MIN) &&
+           std::find(failed.begin(), failed.end(), peer) == failed.end();
+  };
+
+  const std::vector<p2pPeer*> &peers = list->peers;
+  size_t peersNum = peers.size();
+  if (!peersNum)
+    return nullptr;
+
+  switch (_selectStrategy) {
+    case p2pSelectRoundRobin : {
+      for (size_t i = 0; i < peersNum; i++) {
+        p2pPeer *peer = peers[__uintptr_atomic_fetch_and_add(&_selectCursor, 1) % peersNum];
+        if (available(peer))
+          return peer;
+      }
+      break;
+    }
+
+    case p2pSelectLeastOutstanding : {
+      p2pPeer *best = nullptr;
+      unsigned bestInFlight = 0;
+      size_t start = __uintptr_atomic_fetch_and_add(&_selectCursor, 1);
+      for (size_t i = 0; i < peersNum; i++) {
+        p2pPeer *peer = peers[(start + i) % peersNum];
+        if (!available(peer))
+          continue;
+        unsigned inFlight = peer->stats.inFlight.load(std::memory_order_relaxed);
+        if (!best || inFlight < bestInFlight) {
+          best = peer;
+          bestInFlight = inFlight;
+        }
+      }
+      return best;
+    }
+
+    case p2pSelectPowerOfTwo : {
+      size_t availableNum = 0;
+      for (auto peer: peers)
+        availableNum += available(peer);
+      if (availableNum <= 1) {
+        for (auto peer: peers) {
+          if (available(peer))
+            return peer;
+        }
+        break;
+      }
+
+      size_t index1 = threadRandom() % availableNum;
+      size_t index2 = threadRandom() % (availableNum - 1);
+      if (index2 >= index1)
+        index2++;
+
+      p2pPeer *peer1 = nullptr;
+      p2pPeer *peer2 = nullptr;
+      size_t index = 0;
+      for (auto peer: peers) {
+        if (!available(peer))
+          continue;
+        if (index == index1)
+          peer1 = peer;
+        if (index == index2)
+          peer2 = peer;
+        index++;
+      }
+
+      // Peer without samples has zero latency and gets probed first
+      auto score = [](p2pPeer *peer) -> double {
+        return peer->stats.latency.load(std::memory_order_relaxed) *
+               (peer->stats.inFlight.load(std::memory_order_relaxed) + 1) /
+               std::max(peer->stats.health.load(std::memory_order_relaxed), 0.01);
+      };
+      return score(peer1) <= score(peer2) ? peer1 : peer2;
+    }
+
+    case p2pSelectConsistentHash : {
+      const std::vector<std::pair<uint64_t, p2pPeer*>> &hashRing = list->hashRing;
+      uint64_t point = hashMix(key);
+      auto It = std::lower_bound(hashRing.begin(), hashRing.end(), std::make_pair(point, static_cast<p2pPeer*>(nullptr)));
+      for (size_t i = 0, ie = hashRing.size(); i < ie; i++, ++It) {
+        if (It == hashRing.end())
+          It = hashRing.begin();
+        if (available(It->second))
+          return It->second;
+      }
+      break;
+    }
+  }
+
+  return nullptr;
+}
 
 bool p2pNode::ioRequest(void *data, uint32_t size, uint64_t timeout, void *out, uint32_t outSize)
 {
-  // TODO: implement strategy for peer select
-  if (_connections.empty())
-    return 0;
+  uint64_t key = _selectStrategy == p2pSelectConsistentHash ? hashBytes(data, size) : 0;
+  return ioRequest(key, data, size, timeout, out, outSize);
+}
+
+bool p2pNode::ioRequest(uint64_t key, void *data, uint32_t size, uint64_t timeout, void *out, uint32_t outSize)
+{
+  return ioRequestImpl(key, data, size, timeout, out, outSize, nullptr);
+}
+
+bool p2pNode::ioRequest(void *data, uint32_t size, uint64_t timeout, xmstream &out)
+{
+  uint64_t key = _selectStrategy == p2pSelectConsistentHash ? hashBytes(data, size) : 0;
+  return ioRequestImpl(key, data, size, timeout, nullptr, 0, &out);
+}
+
+bool p2pNode::ioRequest(uint64_t key, void *data, uint32_t size, uint64_t timeout, xmstream &out)
+{
+  return ioRequestImpl(key, data, size, timeout, nullptr, 0, &out);
+}
+
+bool p2pNode::ioRequestImpl(uint64_t key, void *data, uint32_t size, uint64_t timeout, void *out, uint32_t outSize, xmstream *outStream)
+{
+  // List kept by coroutine while it retries on other peers
+  p2pPeerList *list = acquirePeers();
+  p2pPeer *first = nullptr;
+  std::vector<p2pPeer*> failed;
+  bool success = false;
+  while (p2pPeer *peer = selectPeer(list, key, first, failed)) {
+    p2pRequestResult result;
+    result.peer = nullptr;
+    result.status = aosPending;
+    p2pEventHandler handler;
+    memset(&handler, 0, sizeof(handler));
+    handler.coroutine = coroutineCurrent();
+    handler.result = &result;
+    handler.outStream = outStream;
+
+    if (multithreaded()) {
+      p2pTask *task = newTask(requestTaskProc);
+      task->peer = peer;
+      task->handler = handler;
+      task->handler.out = out;
+      task->handler.outSize = outSize;
+      task->data = data;
+      task->size = size;
+      task->timeout = timeout;
+      post(peer->_worker, task);
+      coroutineYield();
+    } else {
+      uint32_t id = size <= peer->connection->remoteMaxMsgSize ? peer->addHandler(handler, timeout, out, outSize) : 0;
+      if (id) {
+        aiop2pSend(peer->connection, data, id, p2pMsgRequest, size, afNone, timeout, nullptr, nullptr);
+        coroutineYield();
+      }
+    }
+
+    if (result.peer) {
+      success = true;
+      break;
+    }
+    if (result.status == aosBufferTooSmall)
+      break;
+
+    if (!first)
+      first = peer;
+    else
+      failed.push_back(peer);
+  }
+
+  releasePeers();
+  return success;
+}
+
+void p2pNode::requestTaskProc(p2pTask *task)
+{
+  // Request not sent resumes coroutine at once and goes to next peer
+  p2pPeer *peer = task->peer;
+  p2pEventHandler &handler = task->handler;
+  uint32_t id = 0;
+  if (peer->_connected.load(std::memory_order_relaxed) && task->size <= peer->connection->remoteMaxMsgSize)
+    id = peer->addHandler(handler, task->timeout, handler.out, handler.outSize);
+  if (id)
+    aiop2pSend(peer->connection, task->data, id, p2pMsgRequest, static_cast<uint32_t>(task->size), afNone, task->timeout, nullptr, nullptr);
+  else
+    resumeRequest(handler, nullptr, aosDisconnected);
+}
+
+
+uint64_t p2pNode::hedgeDelay()
+{
+  if (_latencySamplesNum < P2P_HEDGE_MIN_SAMPLES)
+    return std::max<uint64_t>(P2P_HEDGE_DEFAULT_DELAY, _hedgeMinDelay);
+
+  if (!_hedgeDelaySamplesNum || _latencySamplesNum - _hedgeDelaySamplesNum >= P2P_HEDGE_UPDATE_INTERVAL) {
+    uint32_t samples[P2P_LATENCY_WINDOW];
+    size_t samplesNum = std::min<uint64_t>(_latencySamplesNum, P2P_LATENCY_WINDOW);
+    memcpy(samples, _latencyWindow, samplesNum*sizeof(uint32_t));
+    size_t index = std::min(static_cast<size_t>(samplesNum * _hedgePercentile), samplesNum - 1);
+    std::nth_element(samples, samples + index, samples + samplesNum);
+    _hedgeDelay = samples[index];
+    _hedgeDelaySamplesNum = _latencySamplesNum;
+  }
+
+  return std::max(_hedgeDelay, _hedgeMinDelay);
+}
+
+void p2pNode::groupHedgeCb(aioUserEvent *event, void *arg)
+{
+  __UNUSED(event);
+  p2pRequestGroup *group = static_cast<p2pRequestGroup*>(arg);
+  if (!group->finished && group->responses < group->required)
+    group->node->groupSend(group);
+}
+
+void p2pNode::groupSendCb(AsyncOpStatus status, p2pConnection *connection, p2pHeader header, void *arg)
+{
+  __UNUSED(status);
+  __UNUSED(connection);
+  __UNUSED(header);
+  releaseGroup(static_cast<p2pRequestGroup*>(arg));
+}
+
+bool p2pNode::groupRequestStart(p2pGroupRequest *request)
+{
+  p2pPeer *peer = request->peer;
+  p2pRequestGroup *group = request->group;
+  if (!peer->_connected.load(std::memory_order_relaxed) || group->size > peer->connection->remoteMaxMsgSize)
+    return false;
+  request->id = peer->addHandler(request, group->timeout);
+  if (!request->id)
+    return false;
 
-  for (size_t i = 0; i < _connections.size(); i++) {
-    p2pPeer *peer = _connections[i];
-    if (!peer->_connected)
+  // Group kept by handler and send
+  __uint_atomic_fetch_and_add(&group->refs, 2);
+  aiop2pSend(peer->connection, group->data, request->id, p2pMsgRequest, group->size, afNone, group->timeout, groupSendCb, group);
+  return true;
+}
+
+bool p2pNode::groupSend(p2pRequestGroup *group)
+{
+  p2pPeerList *list = acquirePeers();
+  bool sent = false;
+  while (p2pPeer *peer = selectPeer(list, group->key, nullptr, group->tried)) {
+    group->tried.push_back(peer);
+    p2pGroupRequest *request = new p2pGroupRequest;
+    request->group = group;
+    request->peer = peer;
+    request->id = 0;
+    request->pending = true;
+    if (multithreaded()) {
+      // Request not sent by peer thread comes back as failure
+      __uint_atomic_fetch_and_add(&group->refs, 1);
+      p2pTask *task = newTask(groupSendTaskProc);
+      task->request = request;
+      post(peer->_worker, task);
+    } else if (!groupRequestStart(request)) {
+      delete request;
       continue;
-    
-    uint32_t id = _lastId++;
-    aiop2pSend(peer->connection, data, id, p2pMsgRequest, size, afNone, timeout, nullptr, nullptr);
-    peer->addHandler(id, coroutineCurrent(), timeout, out, outSize);
-    coroutineYield();    
-    if (_lastActivePeer)
-      return true;
+    }
+
+    group->requests.push_back(request);
+    group->pending++;
+    sent = true;
+    break;
   }
-  
-  return false;
+
+  releasePeers();
+  return sent;
 }
 
+void p2pNode::groupSendTaskProc(p2pTask *task)
+{
+  p2pGroupRequest *request = task->request;
+  p2pRequestGroup *group = request->group;
+  if (!group->node->groupRequestStart(request))
+    group->node->groupEvent(request, aosDisconnected, nullptr, 0);
+  releaseGroup(group);
+}
 
+void p2pNode::groupCancelTaskProc(p2pTask *task)
+{
+  p2pGroupRequest *request = task->request;
+  p2pRequestGroup *group = request->group;
+  if (request->peer->handlers.remove(request->id, nullptr)) {
+    request->peer->requestCanceled();
+    releaseGroup(group);
+  }
+  releaseGroup(group);
+}
+
+void p2pNode::groupEvent(p2pGroupRequest *request, AsyncOpStatus status, const void *data, size_t size)
+{
+  if (!multithreaded()) {
+    if (status == aosSuccess)
+      groupResponse(request, data, size);
+    else
+      groupFailure(request, status);
+    return;
+  }
+
+  // Response copied, connection reuses its buffer for next message
+  p2pRequestGroup *group = request->group;
+  p2pTask *task = newTask(groupEventTaskProc);
+  task->request = request;
+  task->status = status;
+  task->size = size;
+  if (status == aosSuccess && size <= group->outSize) {
+    task->data = malloc(size ? size : 1);
+    memcpy(task->data, data, size);
+  }
+
+  __uint_atomic_fetch_and_add(&group->refs, 1);
+  post(_workers[0], task);
+}
+
+void p2pNode::groupEventTaskProc(p2pTask *task)
+{
+  p2pGroupRequest *request = task->request;
+  p2pRequestGroup *group = request->group;
+  if (task->status == aosSuccess)
+    group->node->groupResponse(request, task->data, task->size);
+  else
+    group->node->groupFailure(request, task->status);
+  free(task->data);
+  releaseGroup(group);
+}
+
+void p2pNode::groupFinish(p2pRequestGroup *group, AsyncOpStatus status)
+{
+  group->finished = true;
+  for (auto request: group->requests) {
+    if (!request->pending)
+      continue;
+    request->pending = false;
+    if (multithreaded()) {
+      __uint_atomic_fetch_and_add(&group->refs, 1);
+      p2pTask *task = newTask(groupCancelTaskProc);
+      task->request = request;
+      post(request->peer->_worker, task);
+    } else if (request->peer->handlers.remove(request->id, nullptr)) {
+      // Late responses of canceled requests dropped by receiver
+      request->peer->requestCanceled();
+      releaseGroup(group);
+    }
+  }
+
+  group->pending = 0;
+  if (group->hedgeEvent)
+    deleteUserEvent(group->hedgeEvent);
+  group->callback(status, this, group->responses, group->arg);
+  releaseGroup(group);
+}
+
+void p2pNode::groupResponse(p2pGroupRequest *request, const void *data, size_t size)
+{
+  // Response to request canceled by finished group
+  p2pRequestGroup *group = request->group;
+  if (!request->pending)
+    return;
+
+  if (size > group->outSize) {
+    groupFailure(request, aosBufferTooSmall);
+    return;
+  }
+
+  request->pending = false;
+  group->pending--;
+  memcpy(group->out + group->responses*group->outSize, data, size);
+  if (++group->responses == group->required)
+    groupFinish(group, aosSuccess);
+}
+
+void p2pNode::groupFailure(p2pGroupRequest *request, AsyncOpStatus status)
+{
+  p2pRequestGroup *group = request->group;
+  if (!request->pending)
+    return;
+
+  // Replace failed request with request to untried peer
+  request->pending = false;
+  group->pending--;
+  while (group->responses + group->pending < group->required && groupSend(group))
+    continue;
+  if (group->responses + group->pending < group->required)
+    groupFinish(group, status);
+}
+
+void p2pNode::groupStart(p2pRequestGroup *group)
+{
+  unsigned initial = group->hedged ? 1 : group->fanout;
+  for (unsigned i = 0; i < initial; i++) {
+    if (!groupSend(group))
+      break;
+  }
+
+  if (group->pending < group->required) {
+    groupFinish(group, aosDisconnected);
+    return;
+  }
+
+  if (group->hedged) {
+    group->hedgeEvent = newUserEvent(_base, 0, groupHedgeCb, group);
+    userEventStartTimer(group->hedgeEvent, hedgeDelay(), 1);
+  }
+}
+
+void p2pNode::groupStartTaskProc(p2pTask *task)
+{
+  task->group->node->groupStart(task->group);
+}
+
+void p2pNode::aioRequestGroup(unsigned fanout, unsigned required, bool hedged, void *data, uint32_t size, uint64_t timeout, void *out, uint32_t outSize, p2pResponseCb *callback, void *arg)
+{
+  p2pRequestGroup *group = new p2pRequestGroup;
+  group->node = this;
+  group->callback = callback;
+  group->arg = arg;
+  group->data = malloc(size ? size : 1);
+  memcpy(group->data, data, size);
+  group->size = size;
+  group->out = static_cast<uint8_t*>(out);
+  group->outSize = outSize;
+  group->key = _selectStrategy == p2pSelectConsistentHash ? hashBytes(data, size) : 0;
+  group->timeout = timeout;
+  group->fanout = fanout;
+  group->required = required;
+  group->responses = 0;
+  group->pending = 0;
+  group->refs = 1;
+  group->hedged = hedged;
+  group->finished = false;
+  group->hedgeEvent = nullptr;
+
+  if (multithreaded()) {
+    p2pTask *task = newTask(groupStartTaskProc);
+    task->group = group;
+    post(_workers[0], task);
+  } else {
+    groupStart(group);
+  }
+}
+
+bool p2pNode::ioRequestGroup(unsigned fanout, unsigned required, bool hedged, void *data, uint32_t size, uint64_t timeout, void *out, uint32_t outSize, unsigned *responsesNum)
+{
+  p2pCoroutineWait wait;
+  wait.coroutine = coroutineCurrent();
+  wait.status = aosPending;
+  wait.responsesNum = 0;
+  aioRequestGroup(fanout, required, hedged, data, size, timeout, out, outSize, coroutineWaitCb, &wait);
+  // Yield returns immediately if group already finished
+  coroutineYield();
+
+  if (responsesNum)
+    *responsesNum = wait.responsesNum;
+  return wait.status == aosSuccess;
+}
+
+void p2pNode::aioRequestHedged(void *data, uint32_t size, uint64_t timeout, void *out, uint32_t outSize, p2pResponseCb *callback, void *arg)
+{
+  aioRequestGroup(2, 1, true, data, size, timeout, out, outSize, callback, arg);
+}
+
+bool p2pNode::ioRequestHedged(void *data, uint32_t size, uint64_t timeout, void *out, uint32_t outSize)
+{
+  return ioRequestGroup(2, 1, true, data, size, timeout, out, outSize, nullptr);
+}
+
+void p2pNode::aioRequestFirst(unsigned fanout, void *data, uint32_t size, uint64_t timeout, void *out, uint32_t outSize, p2pResponseCb *callback, void *arg)
+{
+  aioRequestGroup(fanout, 1, false, data, size, timeout, out, outSize, callback, arg);
+}
+
+bool p2pNode::ioRequestFirst(unsigned fanout, void *data, uint32_t size, uint64_t timeout, void *out, uint32_t outSize)
+{
+  return ioRequestGroup(fanout, 1, false, data, size, timeout, out, outSize, nullptr);
+}
+
+void p2pNode::aioRequestQuorum(unsigned fanout, unsigned quorum, void *data, uint32_t size, uint64_t timeout, void *out, uint32_t outSize, p2pResponseCb *callback, void *arg)
+{
+  aioRequestGroup(std::max(fanout, quorum), quorum, false, data, size, timeout, out, outSize, callback, arg);
+}
+
+bool p2pNode::ioRequestQuorum(unsigned fanout, unsigned quorum, void *data, uint32_t size, uint64_t timeout, void *out, uint32_t outSize)
+{
+  return ioRequestGroup(std::max(fanout, quorum), quorum, false, data, size, timeout, out, outSize, nullptr);
+}
 
 void p2pNode::listener(AsyncOpStatus status, aioObject *listenSocket, HostAddress client, socketTy clientSocket, void *arg)
 {
   p2pNode *node = static_cast<p2pNode*>(arg);
+  if (status == aosCanceled)
+    return;
   
   if (status == aosSuccess) {
-    aioObject *object = newSocketIo(node->_base, clientSocket);
-    p2pConnection *connection = p2pConnectionNew(object);
-    p2pPeer *peer = new p2pPeer(node->_base, node, &client);
-    peer->accept(node->_coroutineMode, connection);
+    if (node->multithreaded()) {
+      // Connection created by thread of its peer
+      p2pTask *task = newTask(acceptTaskProc);
+      task->worker = node->nextWorker();
+      task->socket = clientSocket;
+      task->address = client;
+      node->post(task->worker, task);
+    } else {
+      node->acceptConnection(node->_workers[0], clientSocket, &client);
+    }
   }
   
   aioAccept(listenSocket, 0, listener, node);
@@ -311,23 +1568,183 @@ p2pNode* p2pNode::createNode(asyncBase *base,
                              const HostAddress *listenAddress,
                              const char *clusterName,
                              bool coroutineMode)
+{
+  return createNode(&base, 1, listenAddress, clusterName, coroutineMode);
+}
+
+p2pNode* p2pNode::createNode(asyncBase **bases,
+                             size_t basesNum,
+                             const HostAddress *listenAddress,
+                             const char *clusterName,
+                             bool coroutineMode)
 {
   socketTy hSocket = socketCreate(AF_INET, SOCK_STREAM, IPPROTO_TCP, 1);
   socketReuseAddr(hSocket);
-  aioObject *socketOp = newSocketIo(base, hSocket);
+  aioObject *socketOp = newSocketIo(bases[0], hSocket);
   if (socketBind(hSocket, listenAddress) != 0)
     return nullptr;
   if (socketListen(hSocket) != 0)
     return nullptr;
 
-  p2pNode *node = new p2pNode(base, clusterName, coroutineMode);
+  p2pNode *node = new p2pNode(bases, basesNum, clusterName, coroutineMode);
   node->_listenerSocket = socketOp;
   aioAccept(socketOp, 0, listener, node);
   return node;
 }
 
+bool p2pNode::writeFrame(p2pPeer *peer, p2pFrame *frame)
+{
+  p2pConnection *connection = peer->connection;
+  if (frame->size > connection->remoteMaxMsgSize)
+    return false;
+  if (connection->sendQueueBytes > _broadcastWatermark) {
+    peer->stats.signalsSkipped++;
+    return false;
+  }
+
+  const void *data = frame->data;
+  uint32_t size = frame->size;
+  uint32_t type = frame->type;
+  if (uint32_t flag = p2pCompressionFlag(connection, frame->size)) {
+    // Payload compressed by first sending thread
+    unsigned index = (flag >> 16) - 1;
+    __spinlock_acquire(&frame->packLock);
+    if (!frame->packedReady[index]) {
+      uint32_t packedFlag;
+      frame->packed[index] = p2pCompress(connection, frame->data, frame->size, &frame->packedSize[index], &packedFlag);
+      frame->packedReady[index] = true;
+    }
+    __spinlock_release(&frame->packLock);
+
+    if (frame->packed[index]) {
+      data = frame->packed[index];
+      size = frame->packedSize[index];
+      type |= flag;
+    }
+  }
+
+  __uint_atomic_fetch_and_add(&frame->refs, 1);
+  aiop2pSend(connection, data, 0, type, size, afNoCopy, frame->timeout, frameSendCb, frame);
+  return true;
+}
+
+void p2pNode::frameTaskProc(p2pTask *task)
+{
+  p2pNode *node = task->worker->node;
+  if (task->peer->established())
+    node->writeFrame(task->peer, task->frame);
+  releaseFrame(task->frame);
+  node->releasePeer(task->peer);
+}
+
+bool p2pNode::sendFrame(p2pPeer *peer, p2pFrame *frame)
+{
+  if (!multithreaded())
+    return writeFrame(peer, frame);
+
+  // Connection used by its thread only
+  __uint_atomic_fetch_and_add(&peer->_refs, 1);
+  __uint_atomic_fetch_and_add(&frame->refs, 1);
+  p2pTask *task = newTask(frameTaskProc);
+  task->worker = peer->_worker;
+  task->peer = peer;
+  task->frame = frame;
+  post(peer->_worker, task);
+  return true;
+}
+
+unsigned p2pNode::broadcast(const void *data, uint32_t size, uint64_t timeout)
+{
+  p2pFrame *frame = newFrame(p2pMsgSignal, size, timeout);
+  memcpy(frame->data, data, size);
+  std::vector<p2pPeer*> peers;
+  collectPeers(peers, nullptr);
+  unsigned sent = 0;
+  for (auto peer: peers) {
+    if (sendFrame(peer, frame))
+      sent++;
+    releasePeer(peer);
+  }
+
+  releaseFrame(frame);
+  return sent;
+}
+
 void p2pNode::sendSignal(void *data, uint32_t size)
 {
-  for (auto c: _connections)
-    aiop2pSend(c->connection, data, 0, p2pMsgSignal, size, afNone, 3000000, nullptr, nullptr);
+  broadcast(data, size, P2P_SIGNAL_TIMEOUT);
+}
+
+bool p2pNode::gossipRemember(uint64_t id)
+{
+  __spinlock_acquire(&_gossipLock);
+  if (!_gossipSeen.insert(id).second) {
+    __spinlock_release(&_gossipLock);
+    return false;
+  }
+
+  // Oldest id forgotten
+  if (_gossipHistory.size() < P2P_GOSSIP_HISTORY) {
+    _gossipHistory.push_back(id);
+  } else {
+    _gossipSeen.erase(_gossipHistory[_gossipHistoryPos]);
+    _gossipHistory[_gossipHistoryPos] = id;
+    _gossipHistoryPos = (_gossipHistoryPos + 1) % P2P_GOSSIP_HISTORY;
+  }
+
+  __spinlock_release(&_gossipLock);
+  return true;
+}
+
+unsigned p2pNode::gossipSend(p2pFrame *frame, p2pPeer *source)
+{
+  std::vector<p2pPeer*> candidates;
+  collectPeers(candidates, source);
+  size_t peersNum = candidates.size() + (source ? 1 : 0);
+  size_t fanout = 0;
+  while (fanout*fanout < peersNum)
+    fanout++;
+
+  // Random peers by partial shuffle, skipped slow peer replaced with next one
+  unsigned sent = 0;
+  for (size_t i = 0; i < candidates.size() && sent < fanout; i++) {
+    std::swap(candidates[i], candidates[i + threadRandom() % (candidates.size() - i)]);
+    if (sendFrame(candidates[i], frame))
+      sent++;
+  }
+
+  for (auto peer: candidates)
+    releasePeer(peer);
+  return sent;
+}
+
+unsigned p2pNode::gossip(const void *data, uint32_t size, uint64_t timeout)
+{
+  uint64_t id = threadRandom();
+  gossipRemember(id);
+  p2pFrame *frame = newFrame(p2pMsgGossip, sizeof(uint64_t) + size, timeout);
+  uint64_t idBe = xhtobe(id);
+  memcpy(frame->data, &idBe, sizeof(uint64_t));
+  memcpy(frame->data + sizeof(uint64_t), data, size);
+  unsigned sent = gossipSend(frame, nullptr);
+  releaseFrame(frame);
+  return sent;
+}
+
+void p2pNode::gossipReceived(p2pPeer *peer, const void *data, size_t size)
+{
+  uint64_t id;
+  if (size < sizeof(uint64_t))
+    return;
+  memcpy(&id, data, sizeof(uint64_t));
+  if (!gossipRemember(xbetoh(id)))
+    return;
+
+  // Forwarded message keeps its id
+  p2pFrame *frame = newFrame(p2pMsgGossip, size, P2P_SIGNAL_TIMEOUT);
+  memcpy(frame->data, data, size);
+  gossipSend(frame, peer);
+  releaseFrame(frame);
+  if (_signalHandler)
+    _signalHandler(peer, static_cast<uint8_t*>(const_cast<void*>(data)) + sizeof(uint64_t), size - sizeof(uint64_t), _signalHandlerArg);
 }
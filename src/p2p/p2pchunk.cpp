@@ -0,0 +1,288 @@
+#include "p2p/p2pchunk.h"
+#include "p2p/p2pcompress.h"
+#include <algorithm>
+#include <stdlib.h>
+#include <vector>
+
+struct p2pChunkedSend {
+  p2pConnection *connection;
+  const uint8_t *data;
+  // Payload copy or compressed payload, freed after last frame
+  void *owned;
+  p2pHeader header;
+  uint32_t chunkSize;
+  uint32_t offset;
+  uint64_t timeout;
+  p2pwriteCb *callback;
+  void *arg;
+};
+
+struct p2pChunkStream {
+  uint32_t id;
+  uint32_t type;
+  // Bytes received
+  uint64_t size;
+  // Bytes held by data, counted in connection total
+  uint64_t buffered;
+  // Chunks passed to handler, data contains current chunk only
+  bool streamed;
+  xmstream data;
+};
+
+// Lazily created on first chunked message, kept in pooled connection
+struct p2pChunkState {
+  // Messages with frame in send queue and messages waiting for them (same id and type)
+  std::vector<p2pChunkedSend*> sends;
+  std::vector<p2pChunkedSend*> waiting;
+  std::vector<p2pChunkStream*> streams;
+  uint64_t bufferedBytes = 0;
+};
+
+static p2pChunkState *chunkState(p2pConnection *connection)
+{
+  if (!connection->chunkState)
+    connection->chunkState = new p2pChunkState;
+  return connection->chunkState;
+}
+
+static inline bool sameMessage(const p2pChunkedSend *send, const p2pHeader &header)
+{
+  return send->header.id == header.id && send->header.type == header.type;
+}
+
+static void sendNextChunk(p2pChunkedSend *send);
+
+static void finishSend(p2pChunkedSend *send, AsyncOpStatus status)
+{
+  p2pConnection *connection = send->connection;
+  p2pChunkState *state = connection->chunkState;
+  connection->sendQueueBytes -= send->header.size - send->offset;
+  state->sends.erase(std::find(state->sends.begin(), state->sends.end(), send));
+
+  // Next message with same id and type started or failed too
+  auto It = std::find_if(state->waiting.begin(), state->waiting.end(), [send](p2pChunkedSend *waiting) { return sameMessage(waiting, send->header); });
+  if (It != state->waiting.end()) {
+    p2pChunkedSend *next = *It;
+    state->waiting.erase(It);
+    state->sends.push_back(next);
+    if (status == aosSuccess)
+      sendNextChunk(next);
+    else
+      finishSend(next, status);
+  }
+
+  if (send->callback)
+    send->callback(status, connection, send->header, send->arg);
+  free(send->owned);
+  delete send;
+}
+
+static void chunkSendCb(AsyncOpStatus status, p2pConnection *connection, p2pHeader header, void *arg)
+{
+  __UNUSED(connection);
+  __UNUSED(header);
+  p2pChunkedSend *send = static_cast<p2pChunkedSend*>(arg);
+  if (status == aosSuccess && send->offset < send->header.size)
+    sendNextChunk(send);
+  else
+    finishSend(send, status);
+}
+
+static void sendNextChunk(p2pChunkedSend *send)
+{
+  uint32_t size = std::min(send->chunkSize, static_cast<uint32_t>(send->header.size) - send->offset);
+  uint32_t flags = p2pMsgFlagChunk;
+  if (send->offset + size == send->header.size)
+    flags |= p2pMsgFlagChunkLast;
+  const uint8_t *data = send->data + send->offset;
+  send->offset += size;
+  // Frame bytes counted by its send operation
+  send->connection->sendQueueBytes -= size;
+  aiop2pSend(send->connection, data, send->header.id, send->header.type | flags, size, afNoCopy, send->timeout, chunkSendCb, send);
+}
+
+void p2pConnectionSetChunkSize(p2pConnection *connection, uint32_t size)
+{
+  connection->chunkSize = std::min(size, P2P_MAX_CHUNK_SIZE);
+}
+
+void p2pConnectionSetChunkHandler(p2pConnection *connection, p2pChunkCb *handler, void *arg)
+{
+  connection->chunkHandler = handler;
+  connection->chunkHandlerArg = arg;
+}
+
+bool p2pChunkNeeded(p2pConnection *connection, const p2pHeader &header)
+{
+  return (connection->features & p2pFeatureChunks) &&
+         connection->chunkSize &&
+         header.size > connection->chunkSize &&
+         !(header.type & p2pMsgFlagsChunk);
+}
+
+void p2pChunkSend(p2pConnection *connection,
+                  const void *data,
+                  void *packed,
+                  p2pHeader header,
+                  AsyncFlags flags,
+                  uint64_t timeout,
+                  p2pwriteCb *callback,
+                  void *arg)
+{
+  p2pChunkState *state = chunkState(connection);
+  p2pChunkedSend *send = new p2pChunkedSend;
+  send->connection = connection;
+  if (packed) {
+    send->owned = packed;
+  } else if (flags & afNoCopy) {
+    send->owned = nullptr;
+  } else {
+    send->owned = malloc(header.size);
+    memcpy(send->owned, data, header.size);
+  }
+
+  send->data = static_cast<const uint8_t*>(send->owned ? send->owned : data);
+  send->header = header;
+  send->chunkSize = connection->chunkSize;
+  send->offset = 0;
+  send->timeout = timeout;
+  send->callback = callback;
+  send->arg = arg;
+  connection->sendQueueBytes += header.size;
+
+  // Receiver tells messages apart by id and type
+  if (std::any_of(state->sends.begin(), state->sends.end(), [&header](p2pChunkedSend *active) { return sameMessage(active, header); })) {
+    state->waiting.push_back(send);
+  } else {
+    state->sends.push_back(send);
+    sendNextChunk(send);
+  }
+}
+
+static std::vector<p2pChunkStream*>::iterator findStream(p2pChunkState *state, uint32_t id, uint32_t type)
+{
+  return std::find_if(state->streams.begin(), state->streams.end(), [id, type](p2pChunkStream *stream) {
+    return stream->id == id && stream->type == type;
+  });
+}
+
+static void dropStream(p2pChunkState *state, std::vector<p2pChunkStream*>::iterator It)
+{
+  p2pChunkStream *stream = *It;
+  state->bufferedBytes -= stream->buffered;
+  state->streams.erase(It);
+  delete stream;
+}
+
+uint8_t *p2pChunkTarget(p2pConnection *connection, const p2pHeader &header, size_t limit, AsyncOpStatus *status)
+{
+  p2pChunkState *state = chunkState(connection);
+  uint32_t type = header.type & ~static_cast<uint32_t>(p2pMsgFlagsChunk);
+  if (header.size > P2P_MAX_CHUNK_SIZE) {
+    *status = p2pMakeStatus(p2pStFormatError);
+    return nullptr;
+  }
+
+  p2pChunkStream *stream;
+  auto It = findStream(state, header.id, type);
+  if (It != state->streams.end()) {
+    stream = *It;
+  } else {
+    if (state->streams.size() >= P2P_MAX_CHUNK_STREAMS) {
+      *status = p2pMakeStatus(p2pStFormatError);
+      return nullptr;
+    }
+
+    stream = new p2pChunkStream;
+    stream->id = header.id;
+    stream->type = type;
+    stream->size = 0;
+    stream->buffered = 0;
+    stream->streamed = false;
+    It = state->streams.insert(state->streams.end(), stream);
+  }
+
+  // Size of message checked after handler refused first chunk
+  bool handlerChunk = stream->streamed || (stream->size == 0 && connection->chunkHandler && !(type & p2pMsgFlagsCompression));
+  if (stream->streamed) {
+    stream->data.reset();
+    state->bufferedBytes -= stream->buffered;
+    stream->buffered = 0;
+  } else if (!handlerChunk && stream->size + header.size > limit) {
+    dropStream(state, It);
+    *status = aosBufferTooSmall;
+    return nullptr;
+  }
+
+  // Peer can't hold more memory than few largest messages by starting messages it never finishes
+  uint64_t bufferedLimit = static_cast<uint64_t>(std::max(static_cast<size_t>(connection->maxMsgSize), limit)) * P2P_CHUNK_BUFFERED_MESSAGES;
+  if (state->bufferedBytes + header.size > bufferedLimit) {
+    dropStream(state, It);
+    *status = p2pMakeStatus(p2pStFormatError);
+    return nullptr;
+  }
+
+  stream->buffered += header.size;
+  state->bufferedBytes += header.size;
+  return static_cast<uint8_t*>(stream->data.reserve(header.size));
+}
+
+bool p2pChunkReceived(p2pConnection *connection, p2pHeader *header, p2pStream *stream, void *buffer, size_t limit, AsyncOpStatus *status)
+{
+  p2pChunkState *state = connection->chunkState;
+  uint32_t type = header->type & ~static_cast<uint32_t>(p2pMsgFlagsChunk);
+  bool last = header->type & p2pMsgFlagChunkLast;
+  auto It = findStream(state, header->id, type);
+  p2pChunkStream *message = *It;
+  uint64_t offset = message->size;
+  message->size += header->size;
+
+  if (message->streamed || (offset == 0 && connection->chunkHandler && !(type & p2pMsgFlagsCompression))) {
+    // Chunk passed to handler is only data of stream
+    bool accepted = connection->chunkHandler(connection, header->id, type, offset, message->data.data(), header->size, last, connection->chunkHandlerArg);
+    if (message->streamed || accepted) {
+      message->streamed = true;
+      if (last)
+        dropStream(state, It);
+      return false;
+    }
+
+    if (message->size > limit) {
+      dropStream(state, It);
+      *status = aosBufferTooSmall;
+      return true;
+    }
+  }
+
+  if (!last)
+    return false;
+
+  header->type = type;
+  header->size = message->size;
+  if (stream) {
+    if (stream->own()) {
+      stream->swap(message->data);
+    } else {
+      stream->reset();
+      stream->write(message->data.data(), message->data.sizeOf());
+    }
+  } else if (type & p2pMsgFlagsCompression) {
+    // Compressed message unpacked from connection buffer
+    p2pCompressionBuffer(connection).swap(message->data);
+  } else {
+    memcpy(buffer, message->data.data(), message->data.sizeOf());
+  }
+
+  dropStream(state, It);
+  return true;
+}
+
+void p2pChunkReset(p2pConnection *connection)
+{
+  if (p2pChunkState *state = connection->chunkState) {
+    for (auto stream: state->streams)
+      delete stream;
+    state->streams.clear();
+    state->bufferedBytes = 0;
+  }
+}
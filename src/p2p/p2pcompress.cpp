@@ -0,0 +1,220 @@
+#include "p2p/p2pcompress.h"
+#include "p2p/p2pproto.h"
+#include <stdlib.h>
+#ifdef P2P_LZ4_ENABLED
+#include <lz4.h>
+#endif
+#ifdef P2P_ZSTD_ENABLED
+#include <zstd.h>
+#endif
+
+// Compression level of zstd without dictionary
+#define P2P_ZSTD_DEFAULT_LEVEL 3
+
+struct p2pZstdDictionary {
+#ifdef P2P_ZSTD_ENABLED
+  ZSTD_CDict *cdict;
+  ZSTD_DDict *ddict;
+#endif
+  uint32_t id;
+};
+
+// Lazily created on first compressed message, kept in pooled connection
+struct p2pCodecState {
+  xmstream buffer;
+#ifdef P2P_ZSTD_ENABLED
+  ZSTD_CCtx *cctx;
+  ZSTD_DCtx *dctx;
+#endif
+};
+
+static p2pCodecState *codecState(p2pConnection *connection)
+{
+  if (!connection->codecState) {
+    p2pCodecState *state = new p2pCodecState;
+#ifdef P2P_ZSTD_ENABLED
+    state->cctx = ZSTD_createCCtx();
+    state->dctx = ZSTD_createDCtx();
+#endif
+    connection->codecState = state;
+  }
+
+  return connection->codecState;
+}
+
+uint32_t p2pCompressionSupported()
+{
+  uint32_t codecs = 0;
+#ifdef P2P_LZ4_ENABLED
+  codecs |= p2pCompressionLZ4;
+#endif
+#ifdef P2P_ZSTD_ENABLED
+  codecs |= p2pCompressionZstd;
+#endif
+  return codecs;
+}
+
+p2pZstdDictionary *p2pZstdDictionaryNew(const void *data, size_t size, int level)
+{
+#ifdef P2P_ZSTD_ENABLED
+  p2pZstdDictionary *dictionary = new p2pZstdDictionary;
+  dictionary->cdict = ZSTD_createCDict(data, size, level);
+  dictionary->ddict = ZSTD_createDDict(data, size);
+  dictionary->id = ZSTD_getDictID_fromDict(data, size);
+  if (!dictionary->cdict || !dictionary->ddict) {
+    p2pZstdDictionaryDelete(dictionary);
+    return nullptr;
+  }
+
+  return dictionary;
+#else
+  __UNUSED(data);
+  __UNUSED(size);
+  __UNUSED(level);
+  return nullptr;
+#endif
+}
+
+void p2pZstdDictionaryDelete(p2pZstdDictionary *dictionary)
+{
+#ifdef P2P_ZSTD_ENABLED
+  ZSTD_freeCDict(dictionary->cdict);
+  ZSTD_freeDDict(dictionary->ddict);
+#endif
+  delete dictionary;
+}
+
+void p2pConnectionSetCompression(p2pConnection *connection, uint32_t codecs, uint32_t threshold, p2pZstdDictionary *dictionary)
+{
+  connection->compressionOffer = codecs & p2pCompressionSupported();
+  connection->compressionThreshold = threshold;
+  connection->dictionary = dictionary;
+}
+
+uint32_t p2pCompressionAccept(p2pConnection *connection, const p2pConnectData *data)
+{
+  uint32_t codecs = connection->compressionOffer & data->compression;
+  uint32_t dictionaryId = connection->dictionary ? connection->dictionary->id : 0;
+  if (dictionaryId != data->dictionaryId)
+    codecs &= ~static_cast<uint32_t>(p2pCompressionZstd);
+  return codecs;
+}
+
+uint32_t p2pCompressionDictionaryId(p2pConnection *connection)
+{
+  return connection->dictionary ? connection->dictionary->id : 0;
+}
+
+uint32_t p2pCompressionFlag(p2pConnection *connection, uint32_t size)
+{
+  uint32_t codecs = connection->compression;
+  if (!codecs || size < connection->compressionThreshold)
+    return 0;
+#ifdef P2P_ZSTD_ENABLED
+  if (codecs & p2pCompressionZstd)
+    return p2pMsgFlagZstd;
+#endif
+#ifdef P2P_LZ4_ENABLED
+  if ((codecs & p2pCompressionLZ4) && size <= LZ4_MAX_INPUT_SIZE)
+    return p2pMsgFlagLZ4;
+#endif
+  return 0;
+}
+
+void *p2pCompress(p2pConnection *connection, const void *data, uint32_t size, uint32_t *packedSize, uint32_t *flag)
+{
+  uint32_t codec = p2pCompressionFlag(connection, size);
+  if (!codec)
+    return nullptr;
+#if !defined(P2P_LZ4_ENABLED) && !defined(P2P_ZSTD_ENABLED)
+  __UNUSED(data);
+  __UNUSED(packedSize);
+  __UNUSED(flag);
+  return nullptr;
+#else
+  uint8_t *packed = nullptr;
+  size_t result = 0;
+#ifdef P2P_ZSTD_ENABLED
+  if (codec == p2pMsgFlagZstd) {
+    p2pCodecState *state = codecState(connection);
+    size_t bound = ZSTD_compressBound(size);
+    packed = static_cast<uint8_t*>(malloc(sizeof(uint32_t) + bound));
+    result = connection->dictionary ?
+      ZSTD_compress_usingCDict(state->cctx, packed + sizeof(uint32_t), bound, data, size, connection->dictionary->cdict) :
+      ZSTD_compressCCtx(state->cctx, packed + sizeof(uint32_t), bound, data, size, P2P_ZSTD_DEFAULT_LEVEL);
+    if (ZSTD_isError(result))
+      result = 0;
+  }
+#endif
+#ifdef P2P_LZ4_ENABLED
+  if (codec == p2pMsgFlagLZ4) {
+    int bound = LZ4_compressBound(static_cast<int>(size));
+    packed = static_cast<uint8_t*>(malloc(sizeof(uint32_t) + bound));
+    result = static_cast<size_t>(LZ4_compress_default(static_cast<const char*>(data),
+                                                      reinterpret_cast<char*>(packed + sizeof(uint32_t)),
+                                                      static_cast<int>(size),
+                                                      bound));
+  }
+#endif
+
+  // Incompressible data sent as is
+  if (!result || result + sizeof(uint32_t) >= size) {
+    free(packed);
+    return nullptr;
+  }
+
+  uint32_t originalSize = xhtobe(size);
+  memcpy(packed, &originalSize, sizeof(uint32_t));
+  *packedSize = static_cast<uint32_t>(result + sizeof(uint32_t));
+  *flag = codec;
+  return packed;
+#endif
+}
+
+size_t p2pUncompressedSize(const void *data, size_t size)
+{
+  if (size <= sizeof(uint32_t))
+    return 0;
+  uint32_t originalSize;
+  memcpy(&originalSize, data, sizeof(uint32_t));
+  return xbetoh(originalSize);
+}
+
+bool p2pDecompress(p2pConnection *connection, uint32_t flag, const void *data, size_t size, void *out, size_t outSize)
+{
+  // Codec must be negotiated, other flags are protocol errors
+  const uint8_t *payload = static_cast<const uint8_t*>(data) + sizeof(uint32_t);
+  size_t payloadSize = size - sizeof(uint32_t);
+#if !defined(P2P_LZ4_ENABLED) && !defined(P2P_ZSTD_ENABLED)
+  __UNUSED(connection);
+  __UNUSED(flag);
+  __UNUSED(payload);
+  __UNUSED(payloadSize);
+  __UNUSED(out);
+  __UNUSED(outSize);
+#endif
+#ifdef P2P_LZ4_ENABLED
+  if (flag == p2pMsgFlagLZ4 && (connection->compression & p2pCompressionLZ4)) {
+    int result = LZ4_decompress_safe(reinterpret_cast<const char*>(payload),
+                                     static_cast<char*>(out),
+                                     static_cast<int>(payloadSize),
+                                     static_cast<int>(outSize));
+    return result >= 0 && static_cast<size_t>(result) == outSize;
+  }
+#endif
+#ifdef P2P_ZSTD_ENABLED
+  if (flag == p2pMsgFlagZstd && (connection->compression & p2pCompressionZstd)) {
+    p2pCodecState *state = codecState(connection);
+    size_t result = connection->dictionary ?
+      ZSTD_decompress_usingDDict(state->dctx, out, outSize, payload, payloadSize, connection->dictionary->ddict) :
+      ZSTD_decompressDCtx(state->dctx, out, outSize, payload, payloadSize);
+    return !ZSTD_isError(result) && result == outSize;
+  }
+#endif
+  return false;
+}
+
+xmstream &p2pCompressionBuffer(p2pConnection *connection)
+{
+  return codecState(connection)->buffer;
+}
@@ -18,10 +18,15 @@ void p2pStream::writeString(const char *s)
   write<uint8_t>(0);
 }
 
-bool p2pStream::readStatusMessage(p2pErrorTy *error)
+bool p2pStream::readStatusMessage(p2pErrorTy *error, uint32_t *maxMsgSize, uint32_t *compression, uint32_t *features)
 {
   *error = static_cast<p2pErrorTy>(read<uint8_t>());
-  return !eof();
+  if (eof())
+    return false;
+  *maxMsgSize = remaining() >= sizeof(uint32_t) ? readbe<uint32_t>() : P2P_DEFAULT_MAX_MESSAGE_SIZE;
+  *compression = remaining() >= sizeof(uint32_t) ? readbe<uint32_t>() : 0;
+  *features = remaining() >= sizeof(uint32_t) ? readbe<uint32_t>() : 0;
+  return true;
 }
 
 
@@ -30,12 +35,23 @@ bool p2pStream::readConnectMessage(p2pConnectData *data)
   data->login = jumpOverString();
   data->password = jumpOverString();
   data->application = jumpOverString();
+  data->maxMsgSize = remaining() >= sizeof(uint32_t) ? readbe<uint32_t>() : P2P_DEFAULT_MAX_MESSAGE_SIZE;
+  data->compression = 0;
+  data->dictionaryId = 0;
+  if (remaining() >= 2*sizeof(uint32_t)) {
+    data->compression = readbe<uint32_t>();
+    data->dictionaryId = readbe<uint32_t>();
+  }
+  data->features = remaining() >= sizeof(uint32_t) ? readbe<uint32_t>() : 0;
   return data->application != nullptr;
 }
 
-void p2pStream::writeStatusMessage(p2pErrorTy error)
+void p2pStream::writeStatusMessage(p2pErrorTy error, uint32_t maxMsgSize, uint32_t compression, uint32_t features)
 {
   write<uint8_t>(error);
+  writebe<uint32_t>(maxMsgSize);
+  writebe<uint32_t>(compression);
+  writebe<uint32_t>(features);
 }
 
 
@@ -44,4 +60,87 @@ void p2pStream::writeConnectMessage(p2pConnectData data)
   writeString(data.login);
   writeString(data.password);
   writeString(data.application);
+  writebe<uint32_t>(data.maxMsgSize);
+  writebe<uint32_t>(data.compression);
+  writebe<uint32_t>(data.dictionaryId);
+  writebe<uint32_t>(data.features);
+}
+
+static inline uint8_t *writeVarint(uint8_t *out, uint64_t value)
+{
+  while (value >= 0x80) {
+    *out++ = static_cast<uint8_t>(value) | 0x80;
+    value >>= 7;
+  }
+  *out++ = static_cast<uint8_t>(value);
+  return out;
+}
+
+// Returns 0 if data is incomplete, -1 if varint is longer than maxBytes
+static inline int readVarint(const uint8_t *data, const uint8_t *end, unsigned maxBytes, uint64_t *value)
+{
+  uint64_t result = 0;
+  for (unsigned i = 0; i < maxBytes; i++) {
+    if (data + i == end)
+      return 0;
+    result |= static_cast<uint64_t>(data[i] & 0x7F) << (7*i);
+    if (!(data[i] & 0x80)) {
+      *value = result;
+      return static_cast<int>(i + 1);
+    }
+  }
+
+  return -1;
+}
+
+size_t p2pEncodeCompactHeader(const p2pHeader &header, uint8_t *out)
+{
+  uint8_t *p = out;
+  uint32_t type = header.type & ~static_cast<uint32_t>(p2pMsgFlagsMask);
+  uint32_t flags = header.type >> 16;
+  if (type < 63 && flags < 4) {
+    *p++ = static_cast<uint8_t>(flags << 6 | type);
+  } else {
+    *p++ = 63;
+    p = writeVarint(p, header.type);
+  }
+
+  p = writeVarint(p, header.id);
+  p = writeVarint(p, header.size);
+  return static_cast<size_t>(p - out);
+}
+
+int p2pDecodeCompactHeader(const uint8_t *data, size_t size, p2pHeader *header)
+{
+  const uint8_t *p = data;
+  const uint8_t *end = data + size;
+  uint64_t value;
+  int result;
+  if (p == end)
+    return 0;
+
+  uint8_t typeByte = *p++;
+  if ((typeByte & 0x3F) != 63) {
+    header->type = static_cast<uint32_t>(typeByte >> 6) << 16 | (typeByte & 0x3F);
+  } else {
+    if ((result = readVarint(p, end, 5, &value)) <= 0)
+      return result;
+    if (value > UINT32_MAX)
+      return -1;
+    header->type = static_cast<uint32_t>(value);
+    p += result;
+  }
+
+  if ((result = readVarint(p, end, 5, &value)) <= 0)
+    return result;
+  if (value > UINT32_MAX)
+    return -1;
+  header->id = static_cast<uint32_t>(value);
+  p += result;
+
+  if ((result = readVarint(p, end, 10, &value)) <= 0)
+    return result;
+  header->size = value;
+  p += result;
+  return static_cast<int>(p - data);
 }
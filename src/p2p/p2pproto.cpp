@@ -1,8 +1,14 @@
 #include "asyncio/coroutine.h"
 #include "p2p/p2pproto.h"
+#include "p2p/p2pchunk.h"
+#include "p2p/p2pcompress.h"
 #include "p2p/p2pformat.h"
+#include <algorithm>
 #include <stdlib.h>
 
+// Receive buffer of compact header format
+#define P2P_READ_BUFFER_SIZE 16384
+
 static ConcurrentQueue opPool;
 static ConcurrentQueue opTimerPool;
 static ConcurrentQueue objectPool;
@@ -14,6 +20,10 @@ struct Context {
   void *Buffer;
   size_t TransactionSize;
   p2pHeader Header;
+  // Compressed payload, owned by send operation
+  void *Packed;
+  // Send finished synchronously, operation created only for callback
+  bool Finished;
   Context(aioExecuteProc *startProc,
           aioFinishProc *finishProc,
           p2pStream *stream,
@@ -25,7 +35,9 @@ struct Context {
     Stream(stream),
     Buffer(buffer),
     TransactionSize(transactionSize),
-    Header(header) {}
+    Header(header),
+    Packed(nullptr),
+    Finished(false) {}
 };
 
 enum p2pOpTy {
@@ -67,6 +79,15 @@ static inline AsyncOpStatus p2pStatusFromError(p2pErrorTy error)
   return aosUnknownError;
 }
 
+// Chunks sent with compact header only
+static inline uint32_t negotiateFeatures(uint32_t offer, uint32_t remote)
+{
+  uint32_t features = offer & remote;
+  if (!(features & p2pFeatureCompactHeader))
+    features &= ~static_cast<uint32_t>(p2pFeatureChunks);
+  return features;
+}
+
 static void resumeRwCb(AsyncOpStatus status, aioObject*, size_t, void *arg)
 {
   resumeParent(static_cast<asyncOpRoot*>(arg), status);
@@ -123,8 +144,149 @@ static void sendFinish(asyncOpRoot *opptr)
                                                  opptr->arg);
 }
 
-static void releaseProc(asyncOpRoot*)
+static void releaseProc(asyncOpRoot *opptr)
+{
+  p2pOp *op = reinterpret_cast<p2pOp*>(opptr);
+  reinterpret_cast<p2pConnection*>(opptr->object)->sendQueueBytes -= op->queuedBytes;
+  op->queuedBytes = 0;
+  free(op->packed);
+  op->packed = nullptr;
+}
+
+static AsyncOpStatus unpackStream(p2pConnection *connection, p2pHeader *header, p2pStream &stream, size_t maxMsgSize)
+{
+  size_t size = p2pUncompressedSize(stream.data(), stream.sizeOf());
+  if (!size)
+    return p2pMakeStatus(p2pStFormatError);
+  if (size > maxMsgSize)
+    return aosBufferTooSmall;
+
+  // Compressed payload moved to connection buffer, stream receives uncompressed message
+  xmstream &buffer = p2pCompressionBuffer(connection);
+  if (stream.own()) {
+    buffer.swap(stream);
+  } else {
+    buffer.reset();
+    buffer.write(stream.data(), stream.sizeOf());
+  }
+
+  stream.reset();
+  if (!p2pDecompress(connection, header->type & p2pMsgFlagsMask, buffer.data(), buffer.sizeOf(), stream.reserve(size), size))
+    return p2pMakeStatus(p2pStFormatError);
+  stream.seekSet(0);
+  header->type &= ~static_cast<uint32_t>(p2pMsgFlagsMask);
+  header->size = size;
+  return aosSuccess;
+}
+
+static AsyncOpStatus unpackBuffer(p2pConnection *connection, p2pHeader *header, void *buffer, size_t bufferSize)
+{
+  xmstream &packed = p2pCompressionBuffer(connection);
+  size_t size = p2pUncompressedSize(packed.data(), packed.sizeOf());
+  if (!size)
+    return p2pMakeStatus(p2pStFormatError);
+  if (size > bufferSize)
+    return aosBufferTooSmall;
+  if (!p2pDecompress(connection, header->type & p2pMsgFlagsMask, packed.data(), packed.sizeOf(), buffer, size))
+    return p2pMakeStatus(p2pStFormatError);
+  header->type &= ~static_cast<uint32_t>(p2pMsgFlagsMask);
+  header->size = size;
+  return aosSuccess;
+}
+
+// Compressed message received into connection buffer first
+static void *recvBufferTarget(p2pConnection *connection, const p2pHeader &header, void *buffer)
+{
+  if (!(header.type & p2pMsgFlagsMask))
+    return buffer;
+  xmstream &packed = p2pCompressionBuffer(connection);
+  packed.reset();
+  return packed.reserve(header.size);
+}
+
+static void readBufferCb(AsyncOpStatus status, aioObject*, size_t transferred, void *arg)
 {
+  asyncOpRoot *opptr = static_cast<asyncOpRoot*>(arg);
+  reinterpret_cast<p2pConnection*>(opptr->object)->readSize += transferred;
+  resumeParent(opptr, status);
+}
+
+// Compact header format: header and message body taken from connection read buffer, socket read
+// only when buffer has no complete header, or directly into target for message tail. Frames of
+// chunked messages consumed until one of them completes message. Returns pending child
+// operation, nullptr when message received or failed with *status
+static asyncOpRoot *compactRecv(p2pConnection *connection,
+                                int *state,
+                                p2pHeader *header,
+                                p2pStream *stream,
+                                void *buffer,
+                                size_t limit,
+                                void *arg,
+                                AsyncOpStatus *status)
+{
+  size_t bytes;
+  *status = aosSuccess;
+  for (;;) {
+    if (*state == stFinished) {
+      if (!(header->type & p2pMsgFlagChunk) || p2pChunkReceived(connection, header, stream, buffer, limit, status))
+        return nullptr;
+      *state = stInitialize;
+    }
+
+    int headerSize = p2pDecodeCompactHeader(connection->readBuffer + connection->readOffset, connection->readSize - connection->readOffset, header);
+    if (headerSize < 0) {
+      *status = p2pMakeStatus(p2pStFormatError);
+      return nullptr;
+    }
+
+    if (headerSize == 0) {
+      // Incomplete header moved to buffer start, read appends all available data
+      if (!connection->readBuffer)
+        connection->readBuffer = static_cast<uint8_t*>(malloc(P2P_READ_BUFFER_SIZE));
+      size_t tail = connection->readSize - connection->readOffset;
+      memmove(connection->readBuffer, connection->readBuffer + connection->readOffset, tail);
+      connection->readOffset = 0;
+      connection->readSize = tail;
+      asyncOpRoot *childOp = implRead(connection->socket, connection->readBuffer + tail, P2P_READ_BUFFER_SIZE - tail, afNone, 0, readBufferCb, arg, &bytes);
+      if (childOp)
+        return childOp;
+      connection->readSize += bytes;
+      continue;
+    }
+
+    connection->readOffset += static_cast<size_t>(headerSize);
+    uint8_t *target;
+    if (header->type & p2pMsgFlagChunk) {
+      if (!(target = p2pChunkTarget(connection, *header, limit, status)))
+        return nullptr;
+    } else if (header->size > limit) {
+      *status = aosBufferTooSmall;
+      return nullptr;
+    } else if (stream) {
+      stream->reset();
+      target = static_cast<uint8_t*>(stream->reserve(header->size));
+    } else {
+      target = static_cast<uint8_t*>(recvBufferTarget(connection, *header, buffer));
+    }
+
+    size_t available = std::min(connection->readSize - connection->readOffset, static_cast<size_t>(header->size));
+    memcpy(target, connection->readBuffer + connection->readOffset, available);
+    connection->readOffset += available;
+    *state = stFinished;
+    if (available < header->size) {
+      if (asyncOpRoot *childOp = implRead(connection->socket, target + available, header->size - available, afWaitAll, 0, resumeRwCb, arg, &bytes))
+        return childOp;
+    }
+  }
+}
+
+static AsyncOpStatus compactRecvFinish(p2pConnection *connection, p2pHeader *header, p2pStream *stream, void *buffer, size_t limit)
+{
+  if (stream)
+    stream->seekSet(0);
+  if (!(header->type & p2pMsgFlagsMask))
+    return aosSuccess;
+  return stream ? unpackStream(connection, header, *stream, limit) : unpackBuffer(connection, header, buffer, limit);
 }
 
 static asyncOpRoot *newAsyncOp(aioObjectRoot *object,
@@ -146,10 +308,18 @@ static asyncOpRoot *newAsyncOp(aioObjectRoot *object,
   else
     op->buffer = context->Buffer;
   op->bufferSize = context->TransactionSize;
+  op->packed = context->Packed;
+  op->queuedBytes = 0;
   op->state = stInitialize;
   op->rwState = stInitialize;
-  if (opCode == p2pOpSend)
+  if (opCode == p2pOpSend) {
     op->header = context->Header;
+    // Operations finished synchronously not released by combiner, so not counted
+    if (!context->Finished) {
+      op->queuedBytes = op->header.size;
+      reinterpret_cast<p2pConnection*>(object)->sendQueueBytes += op->queuedBytes;
+    }
+  }
   return &op->root;
 }
 
@@ -167,10 +337,29 @@ p2pConnection *p2pConnectionNew(aioObject *socket)
   if (!concurrentQueuePop(&objectPool, (void**)&connection)) {
     connection = static_cast<p2pConnection*>(malloc(sizeof(p2pConnection)));
     new(&connection->stream) xmstream;
+    connection->codecState = nullptr;
+    connection->chunkState = nullptr;
+    connection->readBuffer = nullptr;
+  } else {
+    p2pChunkReset(connection);
   }
 
   initObjectRoot(&connection->root, aioGetBase(socket), ioObjectUserDefined, destructor);
   connection->socket = socket;
+  connection->maxMsgSize = P2P_DEFAULT_MAX_MESSAGE_SIZE;
+  connection->remoteMaxMsgSize = P2P_DEFAULT_MAX_MESSAGE_SIZE;
+  connection->compressionOffer = 0;
+  connection->compression = 0;
+  connection->compressionThreshold = 0;
+  connection->dictionary = nullptr;
+  connection->featuresOffer = p2pFeatureCompactHeader | p2pFeatureChunks;
+  connection->features = 0;
+  connection->readOffset = 0;
+  connection->readSize = 0;
+  connection->sendQueueBytes = 0;
+  connection->chunkSize = P2P_DEFAULT_CHUNK_SIZE;
+  connection->chunkHandler = nullptr;
+  connection->chunkHandlerArg = nullptr;
   setSocketBuffer(socket, 256);
   return connection;
 }
@@ -204,8 +393,10 @@ static AsyncOpStatus acceptProc(asyncOpRoot *opptr)
         if (connection->stream.readConnectMessage(&op->connectMsg)) {
           op->state = stAcceptWaitAnswerSend;
           p2pErrorTy authStatus = reinterpret_cast<p2pAcceptCb*>(op->root.callback)(aosPending, connection, &op->connectMsg, op->root.arg);
+          connection->remoteMaxMsgSize = op->connectMsg.maxMsgSize;
+          connection->compression = p2pCompressionAccept(connection, &op->connectMsg);
           connection->stream.reset();
-          connection->stream.writeStatusMessage(authStatus);
+          connection->stream.writeStatusMessage(authStatus, connection->maxMsgSize, connection->compression, negotiateFeatures(connection->featuresOffer, op->connectMsg.features));
           op->lastError = p2pStatusFromError(authStatus);
           op->rwState = stInitialize;
           op->buffer = connection->stream.data();
@@ -221,6 +412,8 @@ static AsyncOpStatus acceptProc(asyncOpRoot *opptr)
         AsyncOpStatus sendResult = sendProc(opptr);
         if (sendResult != aosSuccess)
           return sendResult;
+        // Status message sent with old header, features used from next message
+        connection->features = negotiateFeatures(connection->featuresOffer, op->connectMsg.features);
         result = op->lastError;
         finish = true;
         break;
@@ -286,9 +479,13 @@ static AsyncOpStatus connectProc(asyncOpRoot *opptr)
           return recvResult;
 
 
-        if (connection->stream.readStatusMessage(&error))
+        uint32_t compression;
+        uint32_t features;
+        if (connection->stream.readStatusMessage(&error, &connection->remoteMaxMsgSize, &compression, &features)) {
+          connection->compression = compression & connection->compressionOffer;
+          connection->features = negotiateFeatures(connection->featuresOffer, features);
           result = p2pStatusFromError(error);
-        else
+        } else
           result = p2pMakeStatus(p2pStFormatError);
         finish = true;
         break;
@@ -302,8 +499,13 @@ static AsyncOpStatus connectProc(asyncOpRoot *opptr)
 void aiop2pConnect(p2pConnection *connection, const HostAddress *address, p2pConnectData *data, uint64_t timeout, p2pConnectCb *callback, void *arg)
 {
   Context context(connectProc, connectFinish, nullptr, nullptr, 0, p2pHeader());
+  p2pConnectData connectData = *data;
+  connectData.maxMsgSize = connection->maxMsgSize;
+  connectData.compression = connection->compressionOffer;
+  connectData.dictionaryId = p2pCompressionDictionaryId(connection);
+  connectData.features = connection->featuresOffer;
   connection->stream.reset();
-  connection->stream.writeConnectMessage(*data);
+  connection->stream.writeConnectMessage(connectData);
   p2pOp *op = reinterpret_cast<p2pOp*>(newAsyncOp(&connection->root, afNone, timeout, reinterpret_cast<void*>(callback), arg, p2pOpConnect, &context));
   op->address = *address;
   combinerPushOperation(&op->root, aaStart);
@@ -315,6 +517,13 @@ static AsyncOpStatus recvBufferProc(asyncOpRoot *opptr)
   p2pConnection *connection = reinterpret_cast<p2pConnection*>(opptr->object);
   asyncOpRoot *childOp = nullptr;
   size_t bytes;
+  if (connection->features & p2pFeatureCompactHeader) {
+    AsyncOpStatus status;
+    childOp = compactRecv(connection, &op->rwState, &op->header, nullptr, op->buffer, op->bufferSize, opptr, &status);
+    if (!childOp)
+      return status == aosSuccess ? compactRecvFinish(connection, &op->header, nullptr, op->buffer, op->bufferSize) : status;
+  }
+
   while (!childOp) {
     switch (op->rwState) {
       case stInitialize : {
@@ -326,7 +535,7 @@ static AsyncOpStatus recvBufferProc(asyncOpRoot *opptr)
       case stTransferring : {
         op->rwState = stFinished;
         if (op->header.size <= op->bufferSize)  {
-          childOp = implRead(connection->socket, op->buffer, op->header.size, afWaitAll, 0, resumeRwCb, opptr, &bytes);
+          childOp = implRead(connection->socket, recvBufferTarget(connection, op->header, op->buffer), op->header.size, afWaitAll, 0, resumeRwCb, opptr, &bytes);
         } else {
           return aosBufferTooSmall;
         }
@@ -335,16 +544,42 @@ static AsyncOpStatus recvBufferProc(asyncOpRoot *opptr)
       }
 
       case stFinished :
-        return aosSuccess;
+        return (op->header.type & p2pMsgFlagsMask) ? unpackBuffer(connection, &op->header, op->buffer, op->bufferSize) : aosSuccess;
     }
   }
 
-  combinerPushOperation(&op->root, aaStart);
+  combinerPushOperation(childOp, aaStart);
   return aosPending;
 }
 
+// Operation created only when socket read is pending or message is failed
+static asyncOpRoot *implCompactRecv(p2pConnection *connection, p2pStream *stream, void *buffer, size_t limit, AsyncFlags flags, uint64_t timeout, void *callback, void *arg, p2pHeader *header)
+{
+  int state = stInitialize;
+  AsyncOpStatus status;
+  asyncOpRoot *childOp = compactRecv(connection, &state, header, stream, buffer, limit, nullptr, &status);
+  if (!childOp && status == aosSuccess && (status = compactRecvFinish(connection, header, stream, buffer, limit)) == aosSuccess)
+    return nullptr;
+
+  Context context(stream ? recvStreamProc : recvBufferProc, stream ? recvStreamFinish : recvFinish, stream, buffer, limit, p2pHeader());
+  p2pOp *op = reinterpret_cast<p2pOp*>(newAsyncOp(&connection->root, childOp ? flags|afRunning : flags, timeout, callback, arg, stream ? p2pOpRecvStream : p2pOpRecv, &context));
+  op->header = *header;
+  op->rwState = state;
+  if (childOp) {
+    childOp->arg = op;
+    combinerPushOperation(childOp, aaStart);
+  } else {
+    opForceStatus(&op->root, status);
+  }
+
+  return &op->root;
+}
+
 asyncOpRoot *implp2pRecv(p2pConnection *connection, void *buffer, uint32_t bufferSize, AsyncFlags flags, uint64_t timeout, void *callback, void *arg, p2pHeader *header)
 {
+  if (connection->features & p2pFeatureCompactHeader)
+    return implCompactRecv(connection, nullptr, buffer, bufferSize, flags, timeout, callback, arg, header);
+
   size_t bytes;
   asyncOpRoot *childOp = nullptr;
   int state = stInitialize;
@@ -357,14 +592,22 @@ asyncOpRoot *implp2pRecv(p2pConnection *connection, void *buffer, uint32_t buffe
     }
 
     if (header->size <= bufferSize) {
-      childOp = implRead(connection->socket, buffer, header->size, afWaitAll, 0, resumeRwCb, nullptr, &bytes);
+      childOp = implRead(connection->socket, recvBufferTarget(connection, *header, buffer), header->size, afWaitAll, 0, resumeRwCb, nullptr, &bytes);
       if (childOp) {
         state = stFinished;
         break;
       }
+
+      AsyncOpStatus status = (header->type & p2pMsgFlagsMask) ? unpackBuffer(connection, header, buffer, bufferSize) : aosSuccess;
+      if (status != aosSuccess) {
+        Context context(recvBufferProc, recvFinish, nullptr, buffer, bufferSize, p2pHeader());
+        p2pOp *op = reinterpret_cast<p2pOp*>(newAsyncOp(&connection->root, flags, timeout, callback, arg, p2pOpRecv, &context));
+        opForceStatus(&op->root, status);
+        return &op->root;
+      }
     } else {
       Context context(recvBufferProc, recvFinish, nullptr, buffer, bufferSize, p2pHeader());
-      p2pOp *op = reinterpret_cast<p2pOp*>(newAsyncOp(&connection->root, afNone, timeout, callback, arg, p2pOpRecv, &context));
+      p2pOp *op = reinterpret_cast<p2pOp*>(newAsyncOp(&connection->root, flags, timeout, callback, arg, p2pOpRecv, &context));
       opForceStatus(&op->root, aosBufferTooSmall);
       return &op->root;
     }
@@ -407,6 +650,13 @@ static AsyncOpStatus recvStreamProc(asyncOpRoot *opptr)
   p2pConnection *connection = reinterpret_cast<p2pConnection*>(opptr->object);
   asyncOpRoot *childOp = nullptr;
   size_t bytes;
+  if (connection->features & p2pFeatureCompactHeader) {
+    AsyncOpStatus status;
+    childOp = compactRecv(connection, &op->rwState, &op->header, op->stream, nullptr, op->bufferSize, opptr, &status);
+    if (!childOp)
+      return status == aosSuccess ? compactRecvFinish(connection, &op->header, op->stream, nullptr, op->bufferSize) : status;
+  }
+
   while (!childOp) {
     switch (op->rwState) {
       case stInitialize : {
@@ -429,7 +679,7 @@ static AsyncOpStatus recvStreamProc(asyncOpRoot *opptr)
 
       case stFinished :
         op->stream->seekSet(0);
-        return aosSuccess;
+        return (op->header.type & p2pMsgFlagsMask) ? unpackStream(connection, &op->header, *op->stream, op->bufferSize) : aosSuccess;
     }
   }
 
@@ -439,6 +689,9 @@ static AsyncOpStatus recvStreamProc(asyncOpRoot *opptr)
 
 asyncOpRoot *implp2pRecvStream(p2pConnection *connection, p2pStream &stream, size_t maxMsgSize, AsyncFlags flags, uint64_t timeout, void *callback, void *arg, p2pHeader *header)
 {
+  if (connection->features & p2pFeatureCompactHeader)
+    return implCompactRecv(connection, &stream, nullptr, maxMsgSize, flags, timeout, callback, arg, header);
+
   size_t bytes;
   asyncOpRoot *childOp = nullptr;
   int state = stInitialize;
@@ -457,9 +710,17 @@ asyncOpRoot *implp2pRecvStream(p2pConnection *connection, p2pStream &stream, siz
         state = stFinished;
         break;
       }
+
+      AsyncOpStatus status = (header->type & p2pMsgFlagsMask) ? unpackStream(connection, header, stream, maxMsgSize) : aosSuccess;
+      if (status != aosSuccess) {
+        Context context(recvStreamProc, recvStreamFinish, &stream, nullptr, maxMsgSize, p2pHeader());
+        p2pOp *op = reinterpret_cast<p2pOp*>(newAsyncOp(&connection->root, flags, timeout, callback, arg, p2pOpRecvStream, &context));
+        opForceStatus(&op->root, status);
+        return &op->root;
+      }
     } else {
       Context context(recvStreamProc, recvStreamFinish, &stream, nullptr, maxMsgSize, p2pHeader());
-      p2pOp *op = reinterpret_cast<p2pOp*>(newAsyncOp(&connection->root, afNone, timeout, callback, arg, p2pOpRecvStream, &context));
+      p2pOp *op = reinterpret_cast<p2pOp*>(newAsyncOp(&connection->root, flags, timeout, callback, arg, p2pOpRecvStream, &context));
       opForceStatus(&op->root, aosBufferTooSmall);
       return &op->root;
     }
@@ -496,6 +757,14 @@ void aiop2pRecvStream(p2pConnection *connection, p2pStream &stream, size_t maxMs
   runAioOperation(&connection->root, newAsyncOp, implp2pRecvStreamProxy, makeResult, initOp, flags, timeout, reinterpret_cast<void*>(callback), arg, p2pOpRecvStream, &context);
 }
 
+static inline size_t encodeHeader(p2pConnection *connection, const p2pHeader &header, uint8_t *out)
+{
+  if (connection->features & p2pFeatureCompactHeader)
+    return p2pEncodeCompactHeader(header, out);
+  memcpy(out, &header, sizeof(p2pHeader));
+  return sizeof(p2pHeader);
+}
+
 static AsyncOpStatus sendProc(asyncOpRoot *opptr)
 {
   p2pOp *op = reinterpret_cast<p2pOp*>(opptr);
@@ -508,12 +777,14 @@ static AsyncOpStatus sendProc(asyncOpRoot *opptr)
         if (op->header.size < 256) {
           op->rwState = stFinished;
           uint8_t sendBuffer[320];
-          memcpy(sendBuffer, &op->header, sizeof(p2pHeader));
-          memcpy(sendBuffer+sizeof(p2pHeader), op->buffer, op->header.size);
-          childOp = implWrite(connection->socket, sendBuffer, sizeof(p2pHeader)+op->header.size, afWaitAll, 0, resumeRwCb, opptr, &bytes);
+          size_t headerSize = encodeHeader(connection, op->header, sendBuffer);
+          memcpy(sendBuffer+headerSize, op->buffer, op->header.size);
+          childOp = implWrite(connection->socket, sendBuffer, headerSize+op->header.size, afWaitAll, 0, resumeRwCb, opptr, &bytes);
         } else {
           op->rwState = stTransferring;
-          childOp = implWrite(connection->socket, &op->header, sizeof(p2pHeader), afWaitAll, 0, resumeRwCb, opptr, &bytes);
+          uint8_t headerData[P2P_COMPACT_HEADER_MAX_SIZE];
+          size_t headerSize = encodeHeader(connection, op->header, headerData);
+          childOp = implWrite(connection->socket, headerData, headerSize, afWaitAll, 0, resumeRwCb, opptr, &bytes);
         }
 
         break;
@@ -521,7 +792,7 @@ static AsyncOpStatus sendProc(asyncOpRoot *opptr)
 
       case stTransferring : {
         op->rwState = stFinished;
-        childOp = implWrite(connection->socket, op->buffer, op->header.size, afWaitAll, 0, resumeRwCb, opptr, &bytes);
+        childOp = implWrite(connection->socket, op->buffer, op->header.size, afWaitAll | static_cast<AsyncFlags>(opptr->flags & afNoCopy), 0, resumeRwCb, opptr, &bytes);
         break;
       }
 
@@ -537,7 +808,7 @@ static AsyncOpStatus sendProc(asyncOpRoot *opptr)
   return aosPending;
 }
 
-asyncOpRoot *implp2pSend(p2pConnection *connection, const void *data, p2pHeader header, AsyncFlags flags, uint64_t timeout, void *callback, void *arg)
+asyncOpRoot *implp2pSend(p2pConnection *connection, const void *data, p2pHeader header, void *packed, AsyncFlags flags, uint64_t timeout, void *callback, void *arg)
 {
   int state;
   size_t bytes;
@@ -546,20 +817,23 @@ asyncOpRoot *implp2pSend(p2pConnection *connection, const void *data, p2pHeader
   if (header.size < 256) {
     state = stFinished;
     uint8_t sendBuffer[320];
-    memcpy(sendBuffer, &header, sizeof(p2pHeader));
-    memcpy(sendBuffer+sizeof(p2pHeader), data, header.size);
-    childOp = implWrite(connection->socket, sendBuffer, sizeof(p2pHeader)+header.size, afWaitAll, 0, resumeRwCb, nullptr, &bytes);
+    size_t headerSize = encodeHeader(connection, header, sendBuffer);
+    memcpy(sendBuffer+headerSize, data, header.size);
+    childOp = implWrite(connection->socket, sendBuffer, headerSize+header.size, afWaitAll, 0, resumeRwCb, nullptr, &bytes);
   } else {
     state = stTransferring;
-    childOp = implWrite(connection->socket, &header, sizeof(p2pHeader), afWaitAll, 0, resumeRwCb, nullptr, &bytes);
+    uint8_t headerData[P2P_COMPACT_HEADER_MAX_SIZE];
+    size_t headerSize = encodeHeader(connection, header, headerData);
+    childOp = implWrite(connection->socket, headerData, headerSize, afWaitAll, 0, resumeRwCb, nullptr, &bytes);
     if (!childOp) {
       state = stFinished;
-      childOp = implWrite(connection->socket, data, header.size, afWaitAll, 0, resumeRwCb, nullptr, &bytes);
+      childOp = implWrite(connection->socket, data, header.size, afWaitAll | static_cast<AsyncFlags>(flags & afNoCopy), 0, resumeRwCb, nullptr, &bytes);
     }
   }
 
   if (childOp) {
     Context context(sendProc, sendFinish, nullptr, const_cast<void*>(data), 0, header);
+    context.Packed = packed;
     p2pOp *op = reinterpret_cast<p2pOp*>(newAsyncOp(&connection->root, flags | afRunning, timeout, callback, arg, p2pOpSend, &context));
 
     op->rwState = state;
@@ -574,17 +848,55 @@ asyncOpRoot *implp2pSend(p2pConnection *connection, const void *data, p2pHeader
 static asyncOpRoot *implp2pSendProxy(aioObjectRoot *object, AsyncFlags flags, uint64_t usTimeout, void *callback, void *arg, void *contextPtr)
 {
   struct Context *context = (struct Context*)contextPtr;
-  return implp2pSend(reinterpret_cast<p2pConnection*>(object), context->Buffer, context->Header, flags, usTimeout, callback, arg);
+  asyncOpRoot *op = implp2pSend(reinterpret_cast<p2pConnection*>(object), context->Buffer, context->Header, context->Packed, flags, usTimeout, callback, arg);
+  // Compressed payload owned by created operation or not needed after synchronous send
+  if (!op) {
+    free(context->Packed);
+    context->Finished = true;
+  }
+  context->Packed = nullptr;
+  return op;
+}
+
+// Compressed copy replaces message payload, header type gets compression flag
+static void packMessage(p2pConnection *connection, Context &context, const void *data, uint32_t size)
+{
+  uint32_t packedSize;
+  uint32_t flag;
+  if (void *packed = p2pCompress(connection, data, size, &packedSize, &flag)) {
+    context.Buffer = packed;
+    context.Packed = packed;
+    context.Header.type |= flag;
+    context.Header.size = packedSize;
+  }
 }
 
 void aiop2pSend(p2pConnection *connection, const void *data, uint32_t id, uint32_t type, uint32_t size, AsyncFlags flags, uint64_t timeout, p2pwriteCb *callback, void *arg)
 {
   Context context(sendProc, sendFinish, nullptr, const_cast<void*>(data), 0, p2pHeader(id, type, size));
+  if (!(flags & afNoCopy))
+    packMessage(connection, context, data, size);
+  if (p2pChunkNeeded(connection, context.Header)) {
+    p2pChunkSend(connection, context.Buffer, context.Packed, context.Header, flags, timeout, callback, arg);
+    return;
+  }
   auto makeResult = [](void*){};
   auto initOp = [](asyncOpRoot*, void*) {};
   runAioOperation(&connection->root, newAsyncOp, implp2pSendProxy, makeResult, initOp, flags, timeout, reinterpret_cast<void*>(callback), arg, p2pOpSend, &context);
 }
 
+struct ChunkWait {
+  coroutineTy *coroutine;
+  AsyncOpStatus status;
+};
+
+static void chunkWaitCb(AsyncOpStatus status, p2pConnection*, p2pHeader, void *arg)
+{
+  ChunkWait *wait = static_cast<ChunkWait*>(arg);
+  wait->status = status;
+  coroutineCall(wait->coroutine);
+}
+
 int iop2pAccept(p2pConnection *connection, uint64_t timeout, p2pAcceptCb *callback, void *arg)
 { 
   Context context(acceptProc, 0, nullptr, nullptr, 0, p2pHeader());
@@ -599,8 +911,13 @@ int iop2pAccept(p2pConnection *connection, uint64_t timeout, p2pAcceptCb *callba
 int iop2pConnect(p2pConnection *connection, const HostAddress *address, uint64_t timeout, p2pConnectData *data)
 {
   Context context(connectProc, 0, nullptr, nullptr, 0, p2pHeader());
+  p2pConnectData connectData = *data;
+  connectData.maxMsgSize = connection->maxMsgSize;
+  connectData.compression = connection->compressionOffer;
+  connectData.dictionaryId = p2pCompressionDictionaryId(connection);
+  connectData.features = connection->featuresOffer;
   connection->stream.reset();
-  connection->stream.writeConnectMessage(*data);
+  connection->stream.writeConnectMessage(connectData);
   p2pOp *op = reinterpret_cast<p2pOp*>(newAsyncOp(&connection->root, afCoroutine, timeout, nullptr, nullptr, p2pOpConnect, &context));
   op->address = *address;
   combinerPushOperation(&op->root, aaStart);
@@ -613,6 +930,16 @@ int iop2pConnect(p2pConnection *connection, const HostAddress *address, uint64_t
 ssize_t iop2pSend(p2pConnection *connection, const void *data, uint32_t id, uint32_t type, uint32_t size, AsyncFlags flags, uint64_t timeout)
 {
   Context context(sendProc, 0, nullptr, const_cast<void*>(data), 0, p2pHeader(id, type, size));
+  packMessage(connection, context, data, size);
+  if (p2pChunkNeeded(connection, context.Header)) {
+    // Payload used by chunks without copy until coroutine resumed
+    ChunkWait wait;
+    wait.coroutine = coroutineCurrent();
+    wait.status = aosPending;
+    p2pChunkSend(connection, context.Buffer, context.Packed, context.Header, flags | afNoCopy, timeout, chunkWaitCb, &wait);
+    coroutineYield();
+    return wait.status == aosSuccess ? static_cast<ssize_t>(size) : -wait.status;
+  }
   auto initOp = [](asyncOpRoot*, void*) {};
   asyncOpRoot *op = runIoOperation(&connection->root, newAsyncOp, implp2pSendProxy, initOp, flags, timeout, p2pOpSend, &context);
 
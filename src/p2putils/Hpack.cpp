@@ -0,0 +1,520 @@
+#include "p2putils/Hpack.h"
+#include <stdint.h>
+#include <string.h>
+#include <deque>
+#include <string>
+#include <vector>
+
+// Size of every table entry includes 32 bytes overhead (RFC 7541 4.1)
+static constexpr size_t entryOverhead = 32;
+static constexpr unsigned staticTableSize = 61;
+static constexpr unsigned huffmanEOS = 256;
+
+struct HpackStaticEntry {
+  Raw name;
+  Raw value;
+};
+
+#define HPACK_STATIC_ENTRY(name, value) {{name, sizeof(name)-1}, {value, sizeof(value)-1}}
+
+static const HpackStaticEntry staticTable[staticTableSize] = {
+  HPACK_STATIC_ENTRY(":authority", ""),
+  HPACK_STATIC_ENTRY(":method", "GET"),
+  HPACK_STATIC_ENTRY(":method", "POST"),
+  HPACK_STATIC_ENTRY(":path", "/"),
+  HPACK_STATIC_ENTRY(":path", "/index.html"),
+  HPACK_STATIC_ENTRY(":scheme", "http"),
+  HPACK_STATIC_ENTRY(":scheme", "https"),
+  HPACK_STATIC_ENTRY(":status", "200"),
+  HPACK_STATIC_ENTRY(":status", "204"),
+  HPACK_STATIC_ENTRY(":status", "206"),
+  HPACK_STATIC_ENTRY(":status", "304"),
+  HPACK_STATIC_ENTRY(":status", "400"),
+  HPACK_STATIC_ENTRY(":status", "404"),
+  HPACK_STATIC_ENTRY(":status", "500"),
+  HPACK_STATIC_ENTRY("accept-charset", ""),
+  HPACK_STATIC_ENTRY("accept-encoding", "gzip, deflate"),
+  HPACK_STATIC_ENTRY("accept-language", ""),
+  HPACK_STATIC_ENTRY("accept-ranges", ""),
+  HPACK_STATIC_ENTRY("accept", ""),
+  HPACK_STATIC_ENTRY("access-control-allow-origin", ""),
+  HPACK_STATIC_ENTRY("age", ""),
+  HPACK_STATIC_ENTRY("allow", ""),
+  HPACK_STATIC_ENTRY("authorization", ""),
+  HPACK_STATIC_ENTRY("cache-control", ""),
+  HPACK_STATIC_ENTRY("content-disposition", ""),
+  HPACK_STATIC_ENTRY("content-encoding", ""),
+  HPACK_STATIC_ENTRY("content-language", ""),
+  HPACK_STATIC_ENTRY("content-length", ""),
+  HPACK_STATIC_ENTRY("content-location", ""),
+  HPACK_STATIC_ENTRY("content-range", ""),
+  HPACK_STATIC_ENTRY("content-type", ""),
+  HPACK_STATIC_ENTRY("cookie", ""),
+  HPACK_STATIC_ENTRY("date", ""),
+  HPACK_STATIC_ENTRY("etag", ""),
+  HPACK_STATIC_ENTRY("expect", ""),
+  HPACK_STATIC_ENTRY("expires", ""),
+  HPACK_STATIC_ENTRY("from", ""),
+  HPACK_STATIC_ENTRY("host", ""),
+  HPACK_STATIC_ENTRY("if-match", ""),
+  HPACK_STATIC_ENTRY("if-modified-since", ""),
+  HPACK_STATIC_ENTRY("if-none-match", ""),
+  HPACK_STATIC_ENTRY("if-range", ""),
+  HPACK_STATIC_ENTRY("if-unmodified-since", ""),
+  HPACK_STATIC_ENTRY("last-modified", ""),
+  HPACK_STATIC_ENTRY("link", ""),
+  HPACK_STATIC_ENTRY("location", ""),
+  HPACK_STATIC_ENTRY("max-forwards", ""),
+  HPACK_STATIC_ENTRY("proxy-authenticate", ""),
+  HPACK_STATIC_ENTRY("proxy-authorization", ""),
+  HPACK_STATIC_ENTRY("range", ""),
+  HPACK_STATIC_ENTRY("referer", ""),
+  HPACK_STATIC_ENTRY("refresh", ""),
+  HPACK_STATIC_ENTRY("retry-after", ""),
+  HPACK_STATIC_ENTRY("server", ""),
+  HPACK_STATIC_ENTRY("set-cookie", ""),
+  HPACK_STATIC_ENTRY("strict-transport-security", ""),
+  HPACK_STATIC_ENTRY("transfer-encoding", ""),
+  HPACK_STATIC_ENTRY("user-agent", ""),
+  HPACK_STATIC_ENTRY("vary", ""),
+  HPACK_STATIC_ENTRY("via", ""),
+  HPACK_STATIC_ENTRY("www-authenticate", "")
+};
+
+// Huffman code is canonical (RFC 7541 Appendix B): codes of same length are consecutive in
+// symbol order, so code lengths define whole code
+static const uint8_t huffmanLength[257] = {
+  13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+  28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+   6, 10, 10, 12, 13,  6,  8, 11, 10, 10,  8, 11,  8,  6,  6,  6,
+   5,  5,  5,  6,  6,  6,  6,  6,  6,  6,  7,  8, 15,  6, 12, 10,
+  13,  6,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,
+   7,  7,  7,  7,  7,  7,  7,  7,  8,  7,  8, 13, 19, 13, 14,  6,
+  15,  5,  6,  5,  6,  5,  6,  6,  6,  5,  7,  7,  6,  6,  6,  5,
+   6,  7,  6,  5,  5,  6,  7,  7,  7,  7,  7, 15, 11, 14, 13, 28,
+  20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+  24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+  22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+  21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+  26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+  19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+  20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+  26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+  30
+};
+
+static constexpr unsigned huffmanMaxLength = 30;
+
+struct HuffmanTables {
+  uint32_t code[257];
+  // Canonical decoding: first code of every length, number of codes and position of first
+  // symbol of this length in 'symbols'
+  uint32_t firstCode[huffmanMaxLength+1];
+  uint32_t count[huffmanMaxLength+1];
+  uint32_t offset[huffmanMaxLength+1];
+  uint16_t symbols[257];
+
+  HuffmanTables() {
+    memset(count, 0, sizeof(count));
+    for (unsigned symbol = 0; symbol <= huffmanEOS; symbol++)
+      count[huffmanLength[symbol]]++;
+
+    uint32_t nextCode = 0;
+    uint32_t nextOffset = 0;
+    for (unsigned length = 1; length <= huffmanMaxLength; length++) {
+      nextCode <<= 1;
+      firstCode[length] = nextCode;
+      offset[length] = nextOffset;
+      nextCode += count[length];
+      nextOffset += count[length];
+    }
+
+    uint32_t position[huffmanMaxLength+1];
+    memcpy(position, offset, sizeof(position));
+    for (unsigned symbol = 0; symbol <= huffmanEOS; symbol++) {
+      unsigned length = huffmanLength[symbol];
+      code[symbol] = firstCode[length] + (position[length] - offset[length]);
+      symbols[position[length]++] = static_cast<uint16_t>(symbol);
+    }
+  }
+};
+
+static const HuffmanTables &huffman()
+{
+  static const HuffmanTables tables;
+  return tables;
+}
+
+size_t hpackHuffmanEncodedSize(const void *data, size_t size)
+{
+  const uint8_t *p = static_cast<const uint8_t*>(data);
+  size_t bits = 0;
+  for (size_t i = 0; i < size; i++)
+    bits += huffmanLength[p[i]];
+  return (bits + 7) / 8;
+}
+
+size_t hpackHuffmanEncode(const void *data, size_t size, void *out)
+{
+  const HuffmanTables &tables = huffman();
+  const uint8_t *p = static_cast<const uint8_t*>(data);
+  uint8_t *o = static_cast<uint8_t*>(out);
+  uint64_t accumulator = 0;
+  unsigned bits = 0;
+  for (size_t i = 0; i < size; i++) {
+    accumulator = (accumulator << huffmanLength[p[i]]) | tables.code[p[i]];
+    bits += huffmanLength[p[i]];
+    while (bits >= 8) {
+      bits -= 8;
+      *o++ = static_cast<uint8_t>(accumulator >> bits);
+    }
+  }
+
+  // Padding with most significant bits of EOS (all ones)
+  if (bits)
+    *o++ = static_cast<uint8_t>((accumulator << (8 - bits)) | (0xFFu >> bits));
+  return static_cast<size_t>(o - static_cast<uint8_t*>(out));
+}
+
+size_t hpackHuffmanDecode(const void *data, size_t size, void *out)
+{
+  const HuffmanTables &tables = huffman();
+  const uint8_t *p = static_cast<const uint8_t*>(data);
+  uint8_t *o = static_cast<uint8_t*>(out);
+  uint32_t code = 0;
+  unsigned length = 0;
+  for (size_t i = 0; i < size; i++) {
+    for (int bit = 7; bit >= 0; bit--) {
+      code = (code << 1) | ((p[i] >> bit) & 1);
+      length++;
+      uint32_t index = code - tables.firstCode[length];
+      if (index < tables.count[length]) {
+        uint16_t symbol = tables.symbols[tables.offset[length] + index];
+        if (symbol == huffmanEOS)
+          return static_cast<size_t>(-1);
+        *o++ = static_cast<uint8_t>(symbol);
+        code = 0;
+        length = 0;
+      } else if (length == huffmanMaxLength) {
+        return static_cast<size_t>(-1);
+      }
+    }
+  }
+
+  // Padding must be shorter than 8 bits and consist of ones
+  if (length > 7 || code != (1u << length) - 1)
+    return static_cast<size_t>(-1);
+  return static_cast<size_t>(o - static_cast<uint8_t*>(out));
+}
+
+struct HpackEntry {
+  std::string name;
+  std::string value;
+};
+
+// Dynamic table, newest entry first
+struct HpackTable {
+  std::deque<HpackEntry> entries;
+  size_t size;
+  size_t maxSize;
+
+  explicit HpackTable(size_t maxSizeArg) : size(0), maxSize(maxSizeArg) {}
+
+  void evict(size_t limit) {
+    while (size > limit) {
+      const HpackEntry &entry = entries.back();
+      size -= entry.name.size() + entry.value.size() + entryOverhead;
+      entries.pop_back();
+    }
+  }
+
+  void setMaxSize(size_t maxSizeArg) {
+    maxSize = maxSizeArg;
+    evict(maxSize);
+  }
+
+  void add(const char *name, size_t nameSize, const char *value, size_t valueSize) {
+    size_t entrySize = nameSize + valueSize + entryOverhead;
+    if (entrySize > maxSize) {
+      // Not an error, table just becomes empty
+      evict(0);
+      return;
+    }
+
+    // Name may point into entry which is evicted now
+    HpackEntry entry;
+    entry.name.assign(name, nameSize);
+    entry.value.assign(value, valueSize);
+    evict(maxSize - entrySize);
+    entries.push_front(std::move(entry));
+    size += entrySize;
+  }
+};
+
+struct HpackEncoder {
+  HpackTable table;
+  std::vector<uint8_t> out;
+  // Table size updates waiting for next header block: minimum and final values
+  bool sizeUpdate;
+  size_t sizeUpdateMin;
+  explicit HpackEncoder(size_t maxTableSize) : table(maxTableSize), sizeUpdate(false), sizeUpdateMin(0) {}
+};
+
+struct HpackDecoder {
+  HpackTable table;
+  // Limit announced to peer, table size updates can't exceed it
+  size_t maxTableSize;
+  std::string name;
+  std::string value;
+  explicit HpackDecoder(size_t maxTableSizeArg) : table(maxTableSizeArg), maxTableSize(maxTableSizeArg) {}
+};
+
+static void encodeInteger(std::vector<uint8_t> &out, uint8_t flags, unsigned prefixBits, size_t value)
+{
+  size_t limit = (1u << prefixBits) - 1;
+  if (value < limit) {
+    out.push_back(static_cast<uint8_t>(flags | value));
+    return;
+  }
+
+  out.push_back(static_cast<uint8_t>(flags | limit));
+  value -= limit;
+  while (value >= 0x80) {
+    out.push_back(static_cast<uint8_t>(0x80 | (value & 0x7F)));
+    value >>= 7;
+  }
+  out.push_back(static_cast<uint8_t>(value));
+}
+
+static void encodeString(std::vector<uint8_t> &out, const char *data, size_t size)
+{
+  size_t huffmanSize = hpackHuffmanEncodedSize(data, size);
+  if (huffmanSize < size) {
+    encodeInteger(out, 0x80, 7, huffmanSize);
+    size_t offset = out.size();
+    out.resize(offset + huffmanSize);
+    hpackHuffmanEncode(data, size, out.data() + offset);
+  } else {
+    encodeInteger(out, 0, 7, size);
+    out.insert(out.end(), data, data + size);
+  }
+}
+
+HpackEncoder *hpackEncoderNew(size_t maxTableSize)
+{
+  return new HpackEncoder(maxTableSize);
+}
+
+void hpackEncoderDelete(HpackEncoder *encoder)
+{
+  delete encoder;
+}
+
+void hpackEncoderSetMaxTableSize(HpackEncoder *encoder, size_t maxTableSize)
+{
+  if (!encoder->sizeUpdate || maxTableSize < encoder->sizeUpdateMin)
+    encoder->sizeUpdateMin = maxTableSize;
+  encoder->sizeUpdate = true;
+  encoder->table.setMaxSize(maxTableSize);
+}
+
+void hpackEncodeBegin(HpackEncoder *encoder)
+{
+  encoder->out.clear();
+  if (encoder->sizeUpdate) {
+    if (encoder->sizeUpdateMin < encoder->table.maxSize)
+      encodeInteger(encoder->out, 0x20, 5, encoder->sizeUpdateMin);
+    encodeInteger(encoder->out, 0x20, 5, encoder->table.maxSize);
+    encoder->sizeUpdate = false;
+  }
+}
+
+void hpackEncodeHeader(HpackEncoder *encoder, const char *name, size_t nameSize, const char *value, size_t valueSize, HpackIndexingTy indexing)
+{
+  // Search full match, otherwise name match: static table first, then dynamic
+  size_t nameIndex = 0;
+  for (unsigned i = 0; i < staticTableSize; i++) {
+    const HpackStaticEntry &entry = staticTable[i];
+    if (entry.name.size != nameSize || memcmp(entry.name.data, name, nameSize) != 0)
+      continue;
+    if (!nameIndex)
+      nameIndex = i + 1;
+    if (indexing != hpackNeverIndexed && entry.value.size == valueSize && memcmp(entry.value.data, value, valueSize) == 0) {
+      encodeInteger(encoder->out, 0x80, 7, i + 1);
+      return;
+    }
+  }
+
+  const std::deque<HpackEntry> &entries = encoder->table.entries;
+  for (size_t i = 0, ie = entries.size(); i < ie; i++) {
+    const HpackEntry &entry = entries[i];
+    if (entry.name.size() != nameSize || memcmp(entry.name.data(), name, nameSize) != 0)
+      continue;
+    if (!nameIndex)
+      nameIndex = staticTableSize + 1 + i;
+    if (indexing != hpackNeverIndexed && entry.value.size() == valueSize && memcmp(entry.value.data(), value, valueSize) == 0) {
+      encodeInteger(encoder->out, 0x80, 7, staticTableSize + 1 + i);
+      return;
+    }
+  }
+
+  switch (indexing) {
+    case hpackIndexed :
+      encodeInteger(encoder->out, 0x40, 6, nameIndex);
+      break;
+    case hpackNotIndexed :
+      encodeInteger(encoder->out, 0x00, 4, nameIndex);
+      break;
+    case hpackNeverIndexed :
+      encodeInteger(encoder->out, 0x10, 4, nameIndex);
+      break;
+  }
+
+  if (!nameIndex)
+    encodeString(encoder->out, name, nameSize);
+  encodeString(encoder->out, value, valueSize);
+  if (indexing == hpackIndexed)
+    encoder->table.add(name, nameSize, value, valueSize);
+}
+
+const void *hpackEncodedData(HpackEncoder *encoder, size_t *size)
+{
+  *size = encoder->out.size();
+  return encoder->out.data();
+}
+
+HpackDecoder *hpackDecoderNew(size_t maxTableSize)
+{
+  return new HpackDecoder(maxTableSize);
+}
+
+void hpackDecoderDelete(HpackDecoder *decoder)
+{
+  delete decoder;
+}
+
+size_t hpackDecoderTableSize(HpackDecoder *decoder)
+{
+  return decoder->table.size;
+}
+
+static bool decodeInteger(const uint8_t **ptr, const uint8_t *end, unsigned prefixBits, size_t *value)
+{
+  const uint8_t *p = *ptr;
+  size_t limit = (1u << prefixBits) - 1;
+  size_t result = *p++ & limit;
+  if (result == limit) {
+    unsigned shift = 0;
+    for (;;) {
+      // Values above 2^28 are not used by HTTP/2 and would overflow on 32-bit platforms
+      if (p == end || shift > 21)
+        return false;
+      uint8_t b = *p++;
+      result += static_cast<size_t>(b & 0x7F) << shift;
+      shift += 7;
+      if (!(b & 0x80))
+        break;
+    }
+  }
+
+  *value = result;
+  *ptr = p;
+  return true;
+}
+
+// Literal points into header block or, for Huffman-coded one, into scratch string
+static bool decodeString(const uint8_t **ptr, const uint8_t *end, std::string &scratch, Raw *out)
+{
+  if (*ptr == end)
+    return false;
+  bool isHuffman = (**ptr & 0x80) != 0;
+  size_t size;
+  if (!decodeInteger(ptr, end, 7, &size) || size > static_cast<size_t>(end - *ptr))
+    return false;
+
+  if (isHuffman) {
+    scratch.resize(size * 8 / 5 + 1);
+    size_t decodedSize = hpackHuffmanDecode(*ptr, size, &scratch[0]);
+    if (decodedSize == static_cast<size_t>(-1))
+      return false;
+    out->data = scratch.data();
+    out->size = decodedSize;
+  } else {
+    out->data = reinterpret_cast<const char*>(*ptr);
+    out->size = size;
+  }
+
+  *ptr += size;
+  return true;
+}
+
+static bool tableEntry(HpackDecoder *decoder, size_t index, Raw *name, Raw *value)
+{
+  if (index == 0) {
+    return false;
+  } else if (index <= staticTableSize) {
+    *name = staticTable[index-1].name;
+    *value = staticTable[index-1].value;
+  } else if (index - staticTableSize - 1 < decoder->table.entries.size()) {
+    const HpackEntry &entry = decoder->table.entries[index - staticTableSize - 1];
+    name->data = entry.name.data();
+    name->size = entry.name.size();
+    value->data = entry.value.data();
+    value->size = entry.value.size();
+  } else {
+    return false;
+  }
+
+  return true;
+}
+
+ParserResultTy hpackDecode(HpackDecoder *decoder, const void *data, size_t size, hpackHeaderCb callback, void *arg)
+{
+  const uint8_t *p = static_cast<const uint8_t*>(data);
+  const uint8_t *end = p + size;
+  bool fieldDecoded = false;
+  while (p < end) {
+    uint8_t b = *p;
+    size_t index;
+    Raw name;
+    Raw value;
+    if (b & 0x80) {
+      // Indexed field
+      if (!decodeInteger(&p, end, 7, &index) || !tableEntry(decoder, index, &name, &value))
+        return ParserResultError;
+      if (!callback(&name, &value, arg))
+        return ParserResultCancelled;
+      fieldDecoded = true;
+      continue;
+    }
+
+    if ((b & 0xE0) == 0x20) {
+      // Dynamic table size update, allowed only at block begin
+      if (fieldDecoded || !decodeInteger(&p, end, 5, &index) || index > decoder->maxTableSize)
+        return ParserResultError;
+      decoder->table.setMaxSize(index);
+      continue;
+    }
+
+    bool addToTable = (b & 0xC0) == 0x40;
+    if (!decodeInteger(&p, end, addToTable ? 6 : 4, &index))
+      return ParserResultError;
+    if (index) {
+      Raw unused;
+      if (!tableEntry(decoder, index, &name, &unused))
+        return ParserResultError;
+    } else if (!decodeString(&p, end, decoder->name, &name)) {
+      return ParserResultError;
+    }
+
+    if (!decodeString(&p, end, decoder->value, &value))
+      return ParserResultError;
+    if (!callback(&name, &value, arg))
+      return ParserResultCancelled;
+    if (addToTable)
+      decoder->table.add(name.data, name.size, value.data, value.size);
+    fieldDecoded = true;
+  }
+
+  return ParserResultOk;
+}
@@ -1,22 +1,11 @@
 #include "macro.h"
 #include "p2putils/HttpParse.h"
-#include "LiteFlatHashTable.h"
+#include "p2putils/HttpScan.h"
 #include <stdlib.h>
 #include <string.h>
 #include <algorithm>
 #include <vector>
 
-static LiteFlatHashTable *headerNames = nullptr;
-
-static Terminal httpHeaders[] = {
-  {"Content-Length", hhContentLength},
-  {"Content-Type", hhContentType},
-  {"Connection", hhConnection},
-  {"Date", hhDate},
-  {"Server", hhServer},
-  {"Transfer-Encoding", hhTransferEncoding}
-};
-
 static int isDigit(char s)
 {
   return (s >= '0' && s <= '9');
@@ -55,17 +44,26 @@ static ParserResultTy readUntilCRLF(const char **ptr, const char *end)
 {
   if (*ptr >= end-2)
     return ParserResultNeedMoreData;
-  
-  while (*ptr < end-1) {
-    if (**ptr == 0x0D && *(*ptr + 1) == 0x0A)
-      break;
-    (*ptr)++;
-  }
-  
-  if (*ptr >= end-2)
+
+  // At least one byte after CRLF required for next header check
+  const char *p = httpScanCRLF(*ptr, end);
+  if (p >= end-2)
     return ParserResultNeedMoreData;
 
-  (*ptr) += 2;
+  *ptr = p + 2;
+  return ParserResultOk;
+}
+
+// Header name is token followed by colon
+static ParserResultTy readHeaderName(const char **ptr, const char *end, int *token)
+{
+  const char *p = httpScanToken(*ptr, end);
+  if (p == end)
+    return ParserResultNeedMoreData;
+  if (*p != ':')
+    return ParserResultError;
+  *token = httpHeaderId(*ptr, static_cast<size_t>(p - *ptr));
+  *ptr = p;
   return ParserResultOk;
 }
 
@@ -150,7 +148,8 @@ static ParserResultTy httpParseStartLine(HttpParserState *state, httpParseCb cal
     return result;
   component.startLine.description.size = static_cast<size_t>(ptr-component.startLine.description.data-2);
   component.type = httpDtStartLine;
-  callback(&component, arg);
+  if (!callback(&component, arg))
+    return ParserResultCancelled;
   
   state->ptr = ptr;
   return ParserResultOk;
@@ -162,8 +161,6 @@ void httpInit(HttpParserState *state)
   state->chunked = false;
   state->dataRemaining = 0;
   state->firstFragment = true;
-  if (!headerNames)
-    headerNames = buildLiteFlatHashTable(httpHeaders, sizeof(httpHeaders)/sizeof(Terminal));
 }
 
 void httpSetBuffer(HttpParserState *state, const void *buffer, size_t size)
@@ -195,8 +192,7 @@ ParserResultTy httpParse(HttpParserState *state, httpParseCb callback, void *arg
           int token;
           component.header.entryName.data = state->ptr;
           const char *p = state->ptr;
-          char colon = ':';
-          ParserResultTy result = searchLiteFlatHashTable(&p, state->end, &colon, 1, headerNames, &token);
+          ParserResultTy result = readHeaderName(&p, state->end, &token);
           if (result == ParserResultOk) {
             component.header.entryName.size = p - component.header.entryName.data;
             component.header.entryType = token;
@@ -210,7 +206,8 @@ ParserResultTy httpParse(HttpParserState *state, httpParseCb callback, void *arg
                   return result;
                 component.header.sizeValue = contentSize;
                 state->dataRemaining = contentSize;
-                callback(&component, arg);
+                if (!callback(&component, arg))
+                  return ParserResultCancelled;
                 break;
               }
 
@@ -219,7 +216,8 @@ ParserResultTy httpParse(HttpParserState *state, httpParseCb callback, void *arg
                 if ( ( result = readUntilCRLF(&p, state->end)) != ParserResultOk )
                   return result;
                 component.header.stringValue.size = static_cast<size_t>(p-component.header.stringValue.data-2);
-                callback(&component, arg);
+                if (!callback(&component, arg))
+                  return ParserResultCancelled;
 
                 state->chunked = (component.header.stringValue.size == 7) &&
                                  (memcmp(component.header.stringValue.data, "chunked", 7) == 0);
@@ -234,7 +232,8 @@ ParserResultTy httpParse(HttpParserState *state, httpParseCb callback, void *arg
                 if ( ( result = readUntilCRLF(&p, state->end)) != ParserResultOk )
                   return result;
                 component.header.stringValue.size = static_cast<size_t>(p-component.header.stringValue.data-2);
-                callback(&component, arg);
+                if (!callback(&component, arg))
+                  return ParserResultCancelled;
                 break;
               }
 
@@ -243,7 +242,8 @@ ParserResultTy httpParse(HttpParserState *state, httpParseCb callback, void *arg
                 if ( ( result = readUntilCRLF(&p, state->end)) != ParserResultOk )
                   return result;
                 component.header.stringValue.size = static_cast<size_t>(p-component.header.stringValue.data-2);
-                callback(&component, arg);
+                if (!callback(&component, arg))
+                  return ParserResultCancelled;
                 break;
               }
             }
@@ -255,7 +255,7 @@ ParserResultTy httpParse(HttpParserState *state, httpParseCb callback, void *arg
             component.header.entryType = 0;
             component.header.entryName.data = p;
             const char *entryNameEnd = nullptr;
-            while (p < state->end) {
+            while (p < state->end && *p != '\r') {
               if (*p == ':') {
                 entryNameEnd = p;
                 p++;
@@ -264,13 +264,17 @@ ParserResultTy httpParse(HttpParserState *state, httpParseCb callback, void *arg
               p++;
             }
 
+            if (!entryNameEnd)
+              return p == state->end ? ParserResultNeedMoreData : ParserResultError;
+
             component.header.entryName.size = static_cast<size_t>(entryNameEnd-component.header.entryName.data);
             skipSPCharacters(&p, state->end);
             component.header.stringValue.data = p;
             if ( ( result = readUntilCRLF(&p, state->end)) != ParserResultOk )
               return result;
             component.header.stringValue.size = static_cast<size_t>(p-component.header.stringValue.data-2);
-            callback(&component, arg);
+            if (!callback(&component, arg))
+              return ParserResultCancelled;
 
             state->ptr = p;
           }
@@ -309,7 +313,8 @@ ParserResultTy httpParse(HttpParserState *state, httpParseCb callback, void *arg
             component.type = httpDtDataFragment;
             component.data.data = readyChunk;
             component.data.size = readyChunkSize;
-            callback(&component, arg);
+            if (!callback(&component, arg))
+              return ParserResultCancelled;
             state->ptr = p;
           }
 
@@ -332,7 +337,8 @@ ParserResultTy httpParse(HttpParserState *state, httpParseCb callback, void *arg
             component.type = httpDtData;
             component.data.data = p;
             component.data.size = 0;
-            callback(&component, arg);
+            if (!callback(&component, arg))
+              return ParserResultCancelled;
             state->state = httpStLast;
             state->ptr = p+2;
             break;
@@ -347,7 +353,8 @@ ParserResultTy httpParse(HttpParserState *state, httpParseCb callback, void *arg
         component.type = state->firstFragment ? httpDtData : httpDtDataFragment;
         component.data.data = p;
         component.data.size = state->dataRemaining;
-        callback(&component, arg);
+        if (!callback(&component, arg))
+          return ParserResultCancelled;
         state->ptr = p + state->dataRemaining;
         state->state = httpStLast;
       } else {
@@ -356,7 +363,8 @@ ParserResultTy httpParse(HttpParserState *state, httpParseCb callback, void *arg
           component.type = httpDtDataFragment;
           component.data.data = p;
           component.data.size = size;
-          callback(&component, arg);
+          if (!callback(&component, arg))
+            return ParserResultCancelled;
           state->ptr = p + size;
           state->firstFragment = false;
           state->dataRemaining -= size;
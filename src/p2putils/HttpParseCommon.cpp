@@ -0,0 +1,154 @@
+#include "p2putils/HttpParseCommon.h"
+#include <string.h>
+
+// Perfect hash tables generated for known names; slot tables map hash to id, all keys verified
+// at compile time, so lookup is one table access and one final comparison
+
+struct HttpToken {
+  const char *name;
+  const char *lowerName;
+  size_t size;
+};
+
+static constexpr HttpToken headerNames[hhLast] = {
+  {nullptr, "", 0},
+  {"Accept", "accept", 6},
+  {"Connection", "connection", 10},
+  {"Content-Length", "content-length", 14},
+  {"Content-Type", "content-type", 12},
+  {"Date", "date", 4},
+  {"Host", "host", 4},
+  {"Server", "server", 6},
+  {"Transfer-Encoding", "transfer-encoding", 17},
+  {"User-Agent", "user-agent", 10},
+  {"Accept-Encoding", "accept-encoding", 15},
+  {"Accept-Language", "accept-language", 15},
+  {"Authorization", "authorization", 13},
+  {"Cache-Control", "cache-control", 13},
+  {"Content-Encoding", "content-encoding", 16},
+  {"Cookie", "cookie", 6},
+  {"Expect", "expect", 6},
+  {"Keep-Alive", "keep-alive", 10},
+  {"Location", "location", 8},
+  {"Origin", "origin", 6},
+  {"Range", "range", 5},
+  {"Referer", "referer", 7},
+  {"Set-Cookie", "set-cookie", 10},
+  {"Upgrade", "upgrade", 7},
+  {"If-Modified-Since", "if-modified-since", 17},
+  {"If-None-Match", "if-none-match", 13},
+  {"ETag", "etag", 4},
+  {"Last-Modified", "last-modified", 13},
+  {"Vary", "vary", 4},
+  {"X-Forwarded-For", "x-forwarded-for", 15},
+  {"Proxy-Connection", "proxy-connection", 16},
+  {"Sec-WebSocket-Key", "sec-websocket-key", 17},
+  {"Sec-WebSocket-Accept", "sec-websocket-accept", 20},
+  {"Sec-WebSocket-Version", "sec-websocket-version", 21},
+  {"TE", "te", 2},
+  {"Trailer", "trailer", 7},
+  {"Content-Range", "content-range", 13}
+};
+
+static constexpr unsigned char headerSlots[128] = {
+  30,  0, 13,  0,  0,  0, 11,  0,  0, 16, 23, 15,  0,  0,  0,  0,
+   5,  4, 36,  0, 12,  0,  0,  0,  0,  0, 33,  0,  6,  0,  0,  2,
+   0,  0,  0,  0,  0,  0, 10,  0,  0,  0,  0,  0,  0,  8,  0,  0,
+   0,  0,  0,  0,  0, 14,  0, 26,  0,  0,  0,  0,  0,  0,  0,  0,
+  24, 27,  0,  3,  0, 21, 31, 17,  0,  0,  0,  7,  0,  0, 28,  0,
+   0,  0,  0, 35,  0,  0,  0,  0,  0,  0,  0,  0, 18,  0,  0,  0,
+   0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0, 25,  1,  0, 19,
+   0,  0,  0, 20,  0,  0,  0, 29,  0, 32,  0,  0,  0,  9, 34, 22
+};
+
+static constexpr HttpToken methodNames[hmLast] = {
+  {nullptr, "", 0},
+  {"GET", "GET", 3},
+  {"HEAD", "HEAD", 4},
+  {"POST", "POST", 4},
+  {"PUT", "PUT", 3},
+  {"DELETE", "DELETE", 6},
+  {"CONNECT", "CONNECT", 7},
+  {"OPTIONS", "OPTIONS", 7},
+  {"TRACE", "TRACE", 5},
+  {"PATCH", "PATCH", 5}
+};
+
+static constexpr unsigned char methodSlots[16] = {
+  2, 0, 0, 7, 6, 0, 0, 4, 3, 0, 8, 5, 1, 9, 0, 0
+};
+
+static constexpr unsigned lowerChar(char c)
+{
+  return c >= 'A' && c <= 'Z' ? static_cast<unsigned>(c - 'A' + 'a') : static_cast<unsigned char>(c);
+}
+
+static constexpr unsigned headerSlot(const char *name, size_t size)
+{
+  return (lowerChar(name[0])*7 + lowerChar(name[size-1])*16 + static_cast<unsigned>(size)) & 127;
+}
+
+static constexpr unsigned methodSlot(const char *name, size_t size)
+{
+  return (static_cast<unsigned char>(name[0])*3 + static_cast<unsigned char>(name[size-1])*5 + static_cast<unsigned>(size)) & 15;
+}
+
+static constexpr size_t length(const char *s)
+{
+  return *s ? 1 + length(s + 1) : 0;
+}
+
+static constexpr bool equalLowerCase(const char *name, const char *lowerName)
+{
+  return lowerChar(*name) == static_cast<unsigned char>(*lowerName) && (*name == 0 || equalLowerCase(name + 1, lowerName + 1));
+}
+
+static constexpr bool verifyHeaders(int id)
+{
+  return id == hhLast ||
+         (length(headerNames[id].name) == headerNames[id].size &&
+          equalLowerCase(headerNames[id].name, headerNames[id].lowerName) &&
+          headerSlots[headerSlot(headerNames[id].lowerName, headerNames[id].size)] == id &&
+          verifyHeaders(id + 1));
+}
+
+static constexpr bool verifyMethods(int id)
+{
+  return id == hmLast ||
+         (length(methodNames[id].name) == methodNames[id].size &&
+          methodSlots[methodSlot(methodNames[id].name, methodNames[id].size)] == id &&
+          verifyMethods(id + 1));
+}
+
+static_assert(verifyHeaders(1), "header names perfect hash table is inconsistent");
+static_assert(verifyMethods(1), "method names perfect hash table is inconsistent");
+
+int httpHeaderId(const char *name, size_t size)
+{
+  if (size == 0)
+    return 0;
+  int id = headerSlots[headerSlot(name, size)];
+  const HttpToken &token = headerNames[id];
+  if (token.size != size)
+    return 0;
+  for (size_t i = 0; i < size; i++) {
+    if (lowerChar(name[i]) != static_cast<unsigned char>(token.lowerName[i]))
+      return 0;
+  }
+
+  return id;
+}
+
+int httpMethodId(const char *name, size_t size)
+{
+  if (size == 0)
+    return hmUnknown;
+  int id = methodSlots[methodSlot(name, size)];
+  const HttpToken &token = methodNames[id];
+  return token.size == size && memcmp(name, token.name, size) == 0 ? id : hmUnknown;
+}
+
+const char *httpHeaderName(int id)
+{
+  return id > 0 && id < hhLast ? headerNames[id].name : nullptr;
+}
@@ -1,33 +1,10 @@
 #include "macro.h"
-#include "LiteFlatHashTable.h"
 #include "p2putils/HttpRequestParse.h"
+#include "p2putils/HttpScan.h"
 #include "p2putils/uriParse.h"
 #include <string.h>
 #include <algorithm>
 
-static LiteFlatHashTable *methodNames = nullptr;
-static LiteFlatHashTable *headerNames = nullptr;
-
-static Terminal httpMethods[] = {
-  {"GET", hmGet},
-  {"HEAD", hmHead},
-  {"POST", hmPost},
-  {"PUT", hmPut},
-  {"DELETE", hmDelete},
-  {"CONNECT", hmConnect},
-  {"OPTIONS", hmOptions},
-  {"TRACE", hmTrace},
-  {"PATCH", hmPatch}
-};
-
-static Terminal httpHeaders[] = {
-  {"Host", hhHost},
-  {"User-Agent", hhUserAgent},
-  {"Accept", hhAccept},
-  {"Transfer-Encoding", hhTransferEncoding},
-  {"Content-Length", hhContentLength}
-};
-
 struct UriArg {
   httpRequestParseCb *callback;
   void *arg;
@@ -72,13 +49,24 @@ static ParserResultTy readUntilCRLF(const char **ptr, const char *end)
   if (*ptr >= end-2)
     return ParserResultNeedMoreData;
 
-  while (*ptr < end-1) {
-    if (**ptr == 0x0D && *(*ptr + 1) == 0x0A)
-      break;
-    (*ptr)++;
-  }
+  const char *p = httpScanCRLF(*ptr, end);
+  if (p == end)
+    return ParserResultNeedMoreData;
 
-  (*ptr) += 2;
+  *ptr = p + 2;
+  return ParserResultOk;
+}
+
+// Header name is token followed by colon
+static ParserResultTy readHeaderName(const char **ptr, const char *end, int *token)
+{
+  const char *p = httpScanToken(*ptr, end);
+  if (p == end)
+    return ParserResultNeedMoreData;
+  if (*p != ':')
+    return ParserResultError;
+  *token = httpHeaderId(*ptr, static_cast<size_t>(p - *ptr));
+  *ptr = p;
   return ParserResultOk;
 }
 
@@ -137,10 +125,6 @@ void httpRequestParserInit(HttpRequestParserState *state)
   state->chunked = 0;
   state->dataRemaining = 0;
   state->firstFragment = true;
-  if (!headerNames)
-    headerNames = buildLiteFlatHashTable(httpHeaders, sizeof(httpHeaders) / sizeof(Terminal));
-  if (!methodNames)
-    methodNames = buildLiteFlatHashTable(httpMethods, sizeof(httpMethods)/ sizeof(Terminal));
 }
 
 void httpRequestSetBuffer(HttpRequestParserState *state, const void *buffer, size_t size)
@@ -158,20 +142,21 @@ ParserResultTy httpRequestParse(HttpRequestParserState *state, httpRequestParseC
   uriArg.arg = arg;
 
   if (state->state == httpRequestMethod) {
-    int token;
-    char space = ' ';
-    ParserResultTy result = searchLiteFlatHashTable(&state->ptr, state->end, &space, 1, methodNames, &token);
-    if (result == ParserResultOk) {
-      if (token == hmPost)
-        state->haveBody = 1;
-
-      component.type = httpRequestDtMethod;
-      component.method = token;
-      if (!callback(&component, arg))
-        return ParserResultCancelled;
-    } else {
-      return result;
-    }
+    const char *methodEnd = httpScanToken(state->ptr, state->end);
+    if (methodEnd == state->end)
+      return ParserResultNeedMoreData;
+    if (*methodEnd != ' ')
+      return ParserResultError;
+
+    int token = httpMethodId(state->ptr, static_cast<size_t>(methodEnd - state->ptr));
+    state->ptr = methodEnd;
+    if (token == hmPost)
+      state->haveBody = 1;
+
+    component.type = httpRequestDtMethod;
+    component.method = token;
+    if (!callback(&component, arg))
+      return ParserResultCancelled;
 
     state->state = httpRequestUriPath;
   }
@@ -303,8 +288,7 @@ ParserResultTy httpRequestParse(HttpRequestParserState *state, httpRequestParseC
       int token;
       component.header.entryName.data = state->ptr;
       const char *p = state->ptr;
-      char colon = ':';
-      ParserResultTy result = searchLiteFlatHashTable(&p, state->end, &colon, 1, headerNames, &token);
+      ParserResultTy result = readHeaderName(&p, state->end, &token);
       if (result == ParserResultOk) {
         component.header.entryName.size = p - component.header.entryName.data;
         component.header.entryType = token;
@@ -322,6 +306,8 @@ ParserResultTy httpRequestParse(HttpRequestParserState *state, httpRequestParseC
 
             state->chunked = (component.header.stringValue.size == 7) &&
                              (memcmp(component.header.stringValue.data, "chunked", 7) == 0);
+            if (state->chunked)
+              state->haveBody = 1;
             break;
           }
 
@@ -331,6 +317,8 @@ ParserResultTy httpRequestParse(HttpRequestParserState *state, httpRequestParseC
               return result;
             component.header.sizeValue = contentSize;
             state->dataRemaining = contentSize;
+            if (contentSize)
+              state->haveBody = 1;
             if (!callback(&component, arg))
               return ParserResultCancelled;
             break;
@@ -354,7 +342,7 @@ ParserResultTy httpRequestParse(HttpRequestParserState *state, httpRequestParseC
         component.header.entryType = 0;
         component.header.entryName.data = p;
         const char *entryNameEnd = nullptr;
-        while (p < state->end) {
+        while (p < state->end && *p != '\r') {
           if (*p == ':') {
             entryNameEnd = p;
             p++;
@@ -363,6 +351,9 @@ ParserResultTy httpRequestParse(HttpRequestParserState *state, httpRequestParseC
           p++;
         }
 
+        if (!entryNameEnd)
+          return p == state->end ? ParserResultNeedMoreData : ParserResultError;
+
         component.header.entryName.size = static_cast<size_t>(entryNameEnd-component.header.entryName.data);
         skipSPCharacters(&p, state->end);
         component.header.stringValue.data = p;
@@ -407,9 +398,11 @@ ParserResultTy httpRequestParse(HttpRequestParserState *state, httpRequestParseC
             component.data.size = readyChunkSize;
             if (!callback(&component, arg))
               return ParserResultCancelled;
-            state->ptr = p;
           }
 
+          // Chunk size line already consumed, don't parse it again on next call
+          state->ptr = p;
+
           if (needMoreData)
             return ParserResultNeedMoreData;
         } else {
@@ -0,0 +1,307 @@
+#include "p2putils/HttpScan.h"
+#include <atomic>
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define HTTPSCAN_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define HTTPSCAN_TARGET(x)
+#else
+#define HTTPSCAN_TARGET(x) __attribute__((target(x)))
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define HTTPSCAN_NEON
+#include <arm_neon.h>
+#endif
+
+typedef const char *scanProcTy(const char*, const char*);
+
+struct HttpScanKernels {
+  scanProcTy *crlf;
+  scanProcTy *token;
+};
+
+// Token characters bitmap indexed by low nibble, bit number is high nibble
+static const uint8_t tokenLowNibble[16] = {
+  0xE8, 0xFC, 0xF8, 0xFC, 0xFC, 0xFC, 0xFC, 0xFC, 0xF8, 0xF8, 0xF4, 0x54, 0xD0, 0x54, 0xF4, 0x70
+};
+
+static const uint8_t tokenHighNibble[16] = {
+  0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0, 0, 0, 0, 0, 0, 0, 0
+};
+
+static inline bool isToken(char c)
+{
+  uint8_t b = static_cast<uint8_t>(c);
+  return (tokenLowNibble[b & 0xF] & tokenHighNibble[b >> 4]) != 0;
+}
+
+static inline unsigned ctz32(uint32_t x)
+{
+#if defined(_MSC_VER)
+  unsigned long index;
+  _BitScanForward(&index, x);
+  return index;
+#else
+  return static_cast<unsigned>(__builtin_ctz(x));
+#endif
+}
+
+static const char *scalarCRLF(const char *ptr, const char *end)
+{
+  for (const char *p = ptr; p + 1 < end; p++) {
+    if (p[0] == '\r' && p[1] == '\n')
+      return p;
+  }
+
+  return end;
+}
+
+static const char *scalarToken(const char *ptr, const char *end)
+{
+  const char *p = ptr;
+  while (p < end && isToken(*p))
+    p++;
+  return p;
+}
+
+#ifdef HTTPSCAN_X86
+// SSE4.2: string compare instruction with character ranges for tokens
+HTTPSCAN_TARGET("sse4.2") static const char *sse42CRLF(const char *ptr, const char *end)
+{
+  const __m128i cr = _mm_set1_epi8('\r');
+  const __m128i lf = _mm_set1_epi8('\n');
+  const char *p = ptr;
+  while (end - p >= 17) {
+    __m128i first = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    __m128i second = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 1));
+    int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(first, cr), _mm_cmpeq_epi8(second, lf)));
+    if (mask)
+      return p + ctz32(static_cast<uint32_t>(mask));
+    p += 16;
+  }
+
+  return scalarCRLF(p, end);
+}
+
+HTTPSCAN_TARGET("sse4.2") static const char *sse42Token(const char *ptr, const char *end)
+{
+  // All token characters except '~', it not fits into 8 ranges
+  const __m128i ranges = _mm_loadu_si128(reinterpret_cast<const __m128i*>("!!#'*+-.09AZ^z||"));
+  const char *p = ptr;
+  while (end - p >= 16) {
+    __m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    int index = _mm_cmpestri(ranges, 16, data, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_MASKED_NEGATIVE_POLARITY | _SIDD_LEAST_SIGNIFICANT);
+    if (index != 16) {
+      if (p[index] != '~')
+        return p + index;
+      p += index + 1;
+    } else {
+      p += 16;
+    }
+  }
+
+  return scalarToken(p, end);
+}
+
+// AVX2: nibble lookup tables for token characters
+HTTPSCAN_TARGET("avx2") static const char *avx2CRLF(const char *ptr, const char *end)
+{
+  const __m256i cr = _mm256_set1_epi8('\r');
+  const __m256i lf = _mm256_set1_epi8('\n');
+  const char *p = ptr;
+  while (end - p >= 33) {
+    __m256i first = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    __m256i second = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 1));
+    uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(first, cr), _mm256_cmpeq_epi8(second, lf))));
+    if (mask)
+      return p + ctz32(mask);
+    p += 32;
+  }
+
+  return scalarCRLF(p, end);
+}
+
+HTTPSCAN_TARGET("avx2") static const char *avx2Token(const char *ptr, const char *end)
+{
+  const __m256i lowTable = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(tokenLowNibble)));
+  const __m256i highTable = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(tokenHighNibble)));
+  const __m256i nibbleMask = _mm256_set1_epi8(0x0F);
+  const __m256i zero = _mm256_setzero_si256();
+  const char *p = ptr;
+  while (end - p >= 32) {
+    __m256i data = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    __m256i low = _mm256_shuffle_epi8(lowTable, _mm256_and_si256(data, nibbleMask));
+    __m256i high = _mm256_shuffle_epi8(highTable, _mm256_and_si256(_mm256_srli_epi16(data, 4), nibbleMask));
+    uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_and_si256(low, high), zero)));
+    if (mask)
+      return p + ctz32(mask);
+    p += 32;
+  }
+
+  return scalarToken(p, end);
+}
+
+static bool cpuSupports(HttpScanKernelTy kernel)
+{
+#if defined(_MSC_VER)
+  int info[4];
+  __cpuid(info, 1);
+  bool sse42 = (info[2] & (1 << 20)) != 0;
+  bool osxsave = (info[2] & (1 << 27)) != 0;
+  if (kernel == httpScanSSE42)
+    return sse42;
+  if (!osxsave || (_xgetbv(0) & 6) != 6)
+    return false;
+  __cpuidex(info, 7, 0);
+  return (info[1] & (1 << 5)) != 0;
+#else
+  __builtin_cpu_init();
+  return kernel == httpScanSSE42 ? __builtin_cpu_supports("sse4.2") != 0 : __builtin_cpu_supports("avx2") != 0;
+#endif
+}
+#endif
+
+#ifdef HTTPSCAN_NEON
+static inline uint64_t neonMask(uint8x16_t mask)
+{
+  // 4 bits per byte
+  return vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(mask), 4)), 0);
+}
+
+static inline unsigned ctz64(uint64_t x)
+{
+#if defined(_MSC_VER)
+  unsigned long index;
+  _BitScanForward64(&index, x);
+  return index;
+#else
+  return static_cast<unsigned>(__builtin_ctzll(x));
+#endif
+}
+
+static const char *neonCRLF(const char *ptr, const char *end)
+{
+  const uint8x16_t cr = vdupq_n_u8('\r');
+  const uint8x16_t lf = vdupq_n_u8('\n');
+  const char *p = ptr;
+  while (end - p >= 17) {
+    uint8x16_t first = vld1q_u8(reinterpret_cast<const uint8_t*>(p));
+    uint8x16_t second = vld1q_u8(reinterpret_cast<const uint8_t*>(p + 1));
+    uint64_t mask = neonMask(vandq_u8(vceqq_u8(first, cr), vceqq_u8(second, lf)));
+    if (mask)
+      return p + (ctz64(mask) >> 2);
+    p += 16;
+  }
+
+  return scalarCRLF(p, end);
+}
+
+static const char *neonToken(const char *ptr, const char *end)
+{
+  const uint8x16_t lowTable = vld1q_u8(tokenLowNibble);
+  const uint8x16_t highTable = vld1q_u8(tokenHighNibble);
+  const uint8x16_t nibbleMask = vdupq_n_u8(0x0F);
+  const char *p = ptr;
+  while (end - p >= 16) {
+    uint8x16_t data = vld1q_u8(reinterpret_cast<const uint8_t*>(p));
+    uint8x16_t low = vqtbl1q_u8(lowTable, vandq_u8(data, nibbleMask));
+    uint8x16_t high = vqtbl1q_u8(highTable, vshrq_n_u8(data, 4));
+    uint64_t mask = neonMask(vceqq_u8(vandq_u8(low, high), vdupq_n_u8(0)));
+    if (mask)
+      return p + (ctz64(mask) >> 2);
+    p += 16;
+  }
+
+  return scalarToken(p, end);
+}
+#endif
+
+static const HttpScanKernels kernelTable[httpScanKernelLast] = {
+  {scalarCRLF, scalarToken},
+#ifdef HTTPSCAN_X86
+  {sse42CRLF, sse42Token},
+  {avx2CRLF, avx2Token},
+#else
+  {scalarCRLF, scalarToken},
+  {scalarCRLF, scalarToken},
+#endif
+#ifdef HTTPSCAN_NEON
+  {neonCRLF, neonToken}
+#else
+  {scalarCRLF, scalarToken}
+#endif
+};
+
+static std::atomic<const HttpScanKernels*> currentKernels(nullptr);
+
+static HttpScanKernelTy bestKernel()
+{
+  for (int kernel = httpScanKernelLast-1; kernel > httpScanScalar; kernel--) {
+    if (httpScanKernelSupported(static_cast<HttpScanKernelTy>(kernel)))
+      return static_cast<HttpScanKernelTy>(kernel);
+  }
+
+  return httpScanScalar;
+}
+
+static inline const HttpScanKernels *kernels()
+{
+  const HttpScanKernels *result = currentKernels.load(std::memory_order_relaxed);
+  if (!result) {
+    result = &kernelTable[bestKernel()];
+    currentKernels.store(result, std::memory_order_relaxed);
+  }
+
+  return result;
+}
+
+const char *httpScanCRLF(const char *ptr, const char *end)
+{
+  return kernels()->crlf(ptr, end);
+}
+
+const char *httpScanToken(const char *ptr, const char *end)
+{
+  return kernels()->token(ptr, end);
+}
+
+int httpScanKernelSupported(HttpScanKernelTy kernel)
+{
+  switch (kernel) {
+    case httpScanScalar :
+      return 1;
+#ifdef HTTPSCAN_X86
+    case httpScanSSE42 :
+    case httpScanAVX2 :
+      return cpuSupports(kernel);
+#endif
+#ifdef HTTPSCAN_NEON
+    case httpScanNEON :
+      return 1;
+#endif
+    default :
+      return 0;
+  }
+}
+
+HttpScanKernelTy httpScanGetKernel()
+{
+  return static_cast<HttpScanKernelTy>(kernels() - kernelTable);
+}
+
+const char *httpScanKernelName(HttpScanKernelTy kernel)
+{
+  static const char *names[httpScanKernelLast] = {"scalar", "sse4.2", "avx2", "neon"};
+  return kernel < httpScanKernelLast ? names[kernel] : "unknown";
+}
+
+int httpScanSetKernel(HttpScanKernelTy kernel)
+{
+  if (!httpScanKernelSupported(kernel))
+    return 0;
+  currentKernels.store(&kernelTable[kernel], std::memory_order_relaxed);
+  return 1;
+}
@@ -0,0 +1,262 @@
+#include "asyncio/asyncio.h"
+#include "asyncio/http.h"
+#include "asyncio/http2.h"
+#include "asyncio/httpServer.h"
+#include "asyncio/socket.h"
+#include "asyncio/timer.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if !defined(OS_WINDOWS)
+#include <sys/resource.h>
+#endif
+
+// Loopback comparison of K concurrent requests: HTTP/2 streams over one connection against
+// keep-alive HTTP/1.1 pool with K connections
+
+static uint16_t gPort = 63700;
+static uint64_t gTotalRequests = 200000;
+
+static const char gRequest[] = "GET /index HTTP/1.1\r\nHost: localhost\r\n\r\n";
+
+struct BenchContext;
+
+__NO_PADDING_BEGIN
+struct BenchSlot {
+  BenchContext *ctx;
+  HTTPParseDefaultContext parseContext;
+};
+
+struct BenchContext {
+  asyncBase *base;
+  HostAddress address;
+  aioObject *listener;
+  HTTP2Connection *server;
+  HTTP2Connection *client;
+  HTTPServer *httpServer;
+  HTTPClientPool *pool;
+  BenchSlot *slots;
+  unsigned concurrency;
+  unsigned slotsFinished;
+  uint64_t requestsStarted;
+  uint64_t requestsFinished;
+  timeMark beginPt;
+};
+__NO_PADDING_END
+
+static void benchFinish(BenchContext *ctx)
+{
+  if (++ctx->slotsFinished == ctx->concurrency)
+    postQuitOperation(ctx->base);
+}
+
+static void h2Handler(HTTP2Stream *stream, const HTTP2Message *request, void *arg)
+{
+  __UNUSED(request);
+  __UNUSED(arg);
+  HTTP2Header header;
+  header.name.data = "content-type";
+  header.name.size = 12;
+  header.value.data = "text/plain";
+  header.value.size = 10;
+  http2Respond(stream, 200, &header, 1, "ok", 2);
+}
+
+static void h2AcceptCb(AsyncOpStatus status, aioObject *listener, HostAddress client, socketTy acceptSocket, void *arg)
+{
+  __UNUSED(listener);
+  __UNUSED(client);
+  BenchContext *ctx = static_cast<BenchContext*>(arg);
+  if (status == aosSuccess)
+    ctx->server = http2ServerNew(ctx->base, newSocketIo(ctx->base, acceptSocket), h2Handler, ctx);
+}
+
+static void h2Request(BenchContext *ctx);
+
+static void h2ResponseCb(AsyncOpStatus status, HTTP2Connection *connection, const HTTP2Message *response, void *arg)
+{
+  __UNUSED(connection);
+  BenchContext *ctx = static_cast<BenchContext*>(arg);
+  if (status != aosSuccess || response->status != 200 || response->bodySize != 2) {
+    fprintf(stderr, "http2 request error %i\n", static_cast<int>(status));
+    exit(1);
+  }
+
+  ctx->requestsFinished++;
+  h2Request(ctx);
+}
+
+static void h2Request(BenchContext *ctx)
+{
+  if (ctx->requestsStarted == gTotalRequests) {
+    benchFinish(ctx);
+    return;
+  }
+
+  ctx->requestsStarted++;
+  aioHttp2Request(ctx->client, "GET", "localhost", "/index", nullptr, 0, nullptr, 0, 3, 0, h2ResponseCb, ctx);
+}
+
+static void h2ConnectCb(AsyncOpStatus status, HTTP2Connection *connection, void *arg)
+{
+  __UNUSED(connection);
+  BenchContext *ctx = static_cast<BenchContext*>(arg);
+  if (status != aosSuccess) {
+    fprintf(stderr, "http2 connect error %i\n", static_cast<int>(status));
+    exit(1);
+  }
+
+  ctx->beginPt = getTimeMark();
+  for (unsigned i = 0; i < ctx->concurrency; i++)
+    h2Request(ctx);
+}
+
+static void http1Handler(HTTPServerConnection *connection, HttpRequestComponent *component, void *arg)
+{
+  __UNUSED(arg);
+  if (component->type == httpRequestDtDataLast)
+    httpServerResponse(connection, 200, "text/plain", "ok", 2);
+}
+
+static void http1Request(BenchSlot *slot);
+
+static void http1ResponseCb(AsyncOpStatus status, HTTPClientPool *pool, void *arg)
+{
+  __UNUSED(pool);
+  BenchSlot *slot = static_cast<BenchSlot*>(arg);
+  if (status != aosSuccess || slot->parseContext.resultCode != 200 || slot->parseContext.body.size != 2) {
+    fprintf(stderr, "http/1.1 request error %i\n", static_cast<int>(status));
+    exit(1);
+  }
+
+  slot->ctx->requestsFinished++;
+  http1Request(slot);
+}
+
+static void http1Request(BenchSlot *slot)
+{
+  BenchContext *ctx = slot->ctx;
+  if (ctx->requestsStarted == gTotalRequests) {
+    benchFinish(ctx);
+    return;
+  }
+
+  ctx->requestsStarted++;
+  aioHttpPoolRequest(ctx->pool, &ctx->address, 0, nullptr, gRequest, sizeof(gRequest)-1, 0, httpParseDefault, &slot->parseContext, http1ResponseCb, slot);
+}
+
+static void printResult(const char *protocol, const char *methodName, BenchContext *ctx, unsigned connections, timeMark endPt)
+{
+  double totalSeconds = usDiff(ctx->beginPt, endPt) / 1000000.0;
+  printf("%s method=%s concurrency=%u connections=%u requests: %" PRIu64 ", elapsed time: %.3lf, rate: %.0lf req/s\n",
+         protocol,
+         methodName,
+         ctx->concurrency,
+         connections,
+         ctx->requestsFinished,
+         totalSeconds,
+         ctx->requestsFinished / totalSeconds);
+}
+
+static void initContext(BenchContext *ctx, AsyncMethod method, unsigned concurrency, uint16_t port)
+{
+  memset(ctx, 0, sizeof(BenchContext));
+  ctx->base = createAsyncBase(method);
+  ctx->concurrency = concurrency;
+  ctx->address.family = AF_INET;
+  ctx->address.ipv4 = INADDR_ANY;
+  ctx->address.port = htons(port);
+}
+
+static void runHttp2(AsyncMethod method, const char *methodName, unsigned concurrency, uint16_t port)
+{
+  BenchContext ctx;
+  initContext(&ctx, method, concurrency, port);
+
+  socketTy acceptSocket = socketCreate(AF_INET, SOCK_STREAM, IPPROTO_TCP, 1);
+  socketReuseAddr(acceptSocket);
+  if (socketBind(acceptSocket, &ctx.address) != 0 || socketListen(acceptSocket) != 0) {
+    fprintf(stderr, "can't listen port %u\n", static_cast<unsigned>(port));
+    exit(1);
+  }
+
+  ctx.listener = newSocketIo(ctx.base, acceptSocket);
+  aioAccept(ctx.listener, 0, h2AcceptCb, &ctx);
+
+  ctx.address.ipv4 = inet_addr("127.0.0.1");
+  socketTy connectSocket = socketCreate(AF_INET, SOCK_STREAM, IPPROTO_TCP, 1);
+  ctx.client = http2ClientNew(ctx.base, newSocketIo(ctx.base, connectSocket));
+  aioHttp2Connect(ctx.client, &ctx.address, nullptr, 3000000, h2ConnectCb, &ctx);
+  asyncLoop(ctx.base);
+  timeMark endPt = getTimeMark();
+
+  HTTP2Stats stats;
+  http2ConnectionGetStats(ctx.client, &stats);
+  printResult("h2", methodName, &ctx, 1, endPt);
+  printf("  frames out: %" PRIu64 ", frames in: %" PRIu64 ", peak streams: %u\n", stats.framesOut, stats.framesIn, stats.peakStreams);
+
+  http2ConnectionDelete(ctx.client);
+  if (ctx.server)
+    http2ConnectionDelete(ctx.server);
+  deleteAioObject(ctx.listener);
+}
+
+static void runHttp1(AsyncMethod method, const char *methodName, unsigned concurrency, uint16_t port)
+{
+  BenchContext ctx;
+  initContext(&ctx, method, concurrency, port);
+  ctx.httpServer = httpServerNew(ctx.base, &ctx.address, nullptr, http1Handler, &ctx);
+  if (!ctx.httpServer) {
+    fprintf(stderr, "can't listen port %u\n", static_cast<unsigned>(port));
+    exit(1);
+  }
+
+  ctx.address.ipv4 = inet_addr("127.0.0.1");
+  ctx.pool = httpClientPoolNew(ctx.base, concurrency, 1, 0);
+  ctx.slots = new BenchSlot[concurrency];
+  ctx.beginPt = getTimeMark();
+  for (unsigned i = 0; i < concurrency; i++) {
+    ctx.slots[i].ctx = &ctx;
+    httpParseDefaultInit(&ctx.slots[i].parseContext);
+    http1Request(&ctx.slots[i]);
+  }
+
+  asyncLoop(ctx.base);
+  timeMark endPt = getTimeMark();
+
+  HTTPClientPoolStats stats;
+  httpClientPoolGetStats(ctx.pool, &stats);
+  printResult("http/1.1", methodName, &ctx, static_cast<unsigned>(stats.connects), endPt);
+
+  httpClientPoolDelete(ctx.pool);
+  httpServerDelete(ctx.httpServer);
+  for (unsigned i = 0; i < concurrency; i++)
+    dynamicBufferFree(&ctx.slots[i].parseContext.buffer);
+  delete[] ctx.slots;
+}
+
+int main(int argc, char **argv)
+{
+  if (argc >= 2)
+    gTotalRequests = strtoull(argv[1], nullptr, 10);
+
+#if !defined(OS_WINDOWS)
+  // 1024 client and 1024 server sockets of HTTP/1.1 pool in one process
+  struct rlimit limit;
+  if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < 4096) {
+    limit.rlim_cur = limit.rlim_max < 4096 ? limit.rlim_max : 4096;
+    setrlimit(RLIMIT_NOFILE, &limit);
+  }
+#endif
+
+  initializeSocketSubsystem();
+  uint16_t port = gPort;
+  const unsigned concurrency[] = {1, 64, 1000};
+  for (unsigned i = 0; i < sizeof(concurrency)/sizeof(concurrency[0]); i++) {
+    runHttp1(amOSDefault, "default", concurrency[i], port++);
+    runHttp2(amOSDefault, "default", concurrency[i], port++);
+  }
+
+  return 0;
+}
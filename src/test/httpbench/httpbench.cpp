@@ -0,0 +1,181 @@
+#include "asyncio/asyncio.h"
+#include "asyncio/httpServer.h"
+#include "asyncio/socket.h"
+#include "asyncio/timer.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if !defined(OS_WINDOWS)
+#include <sys/resource.h>
+#endif
+
+static uint16_t gPort = 63600;
+static uint64_t gTotalRequests = 200000;
+
+static const char gRequest[] = "GET /index HTTP/1.1\r\nHost: localhost\r\n\r\n";
+static const char gResponse[] = "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Length: 2\r\n\r\nok";
+
+struct BenchContext;
+
+__NO_PADDING_BEGIN
+struct BenchClient {
+  BenchContext *ctx;
+  aioObject *socket;
+  char buffer[sizeof(gResponse)];
+};
+
+struct BenchContext {
+  asyncBase *base;
+  HTTPServer *server;
+  BenchClient *clients;
+  unsigned clientsNum;
+  unsigned clientsFinished;
+  uint64_t requestsStarted;
+  uint64_t requestsFinished;
+  timeMark beginPt;
+};
+__NO_PADDING_END
+
+static void clientRequest(BenchClient *client);
+
+static void handler(HTTPServerConnection *connection, HttpRequestComponent *component, void *arg)
+{
+  __UNUSED(arg);
+  if (component->type == httpRequestDtDataLast)
+    httpServerResponse(connection, 200, "text/plain", "ok", 2);
+}
+
+static void clientFinish(BenchClient *client)
+{
+  BenchContext *ctx = client->ctx;
+  if (++ctx->clientsFinished == ctx->clientsNum)
+    postQuitOperation(ctx->base);
+}
+
+static void readcb(AsyncOpStatus status, aioObject *socket, size_t transferred, void *arg)
+{
+  __UNUSED(socket);
+  BenchClient *client = static_cast<BenchClient*>(arg);
+  if (status != aosSuccess || transferred != sizeof(gResponse)-1 || memcmp(client->buffer, gResponse, sizeof(gResponse)-1) != 0) {
+    fprintf(stderr, "read error %i, transferred %zu\n", static_cast<int>(status), transferred);
+    exit(1);
+  }
+
+  client->ctx->requestsFinished++;
+  clientRequest(client);
+}
+
+static void clientRequest(BenchClient *client)
+{
+  BenchContext *ctx = client->ctx;
+  if (ctx->requestsStarted == gTotalRequests) {
+    clientFinish(client);
+    return;
+  }
+
+  ctx->requestsStarted++;
+  aioWrite(client->socket, gRequest, sizeof(gRequest)-1, afWaitAll, 0, nullptr, nullptr);
+  aioRead(client->socket, client->buffer, sizeof(gResponse)-1, afWaitAll, 0, readcb, client);
+}
+
+static void connectcb(AsyncOpStatus status, aioObject *socket, void *arg)
+{
+  __UNUSED(socket);
+  BenchClient *client = static_cast<BenchClient*>(arg);
+  if (status != aosSuccess) {
+    fprintf(stderr, "connect error %i\n", static_cast<int>(status));
+    exit(1);
+  }
+
+  // Measurement starts when all connections established
+  BenchContext *ctx = client->ctx;
+  if (++ctx->clientsFinished == ctx->clientsNum) {
+    ctx->clientsFinished = 0;
+    ctx->beginPt = getTimeMark();
+    for (unsigned i = 0; i < ctx->clientsNum; i++)
+      clientRequest(&ctx->clients[i]);
+  }
+}
+
+static void run(AsyncMethod method, const char *methodName, unsigned connections, uint16_t port)
+{
+  BenchContext ctx;
+  ctx.base = createAsyncBase(method);
+  ctx.clientsNum = connections;
+  ctx.clientsFinished = 0;
+  ctx.requestsStarted = 0;
+  ctx.requestsFinished = 0;
+
+  HostAddress address;
+  address.family = AF_INET;
+  address.ipv4 = INADDR_ANY;
+  address.port = htons(port);
+  ctx.server = httpServerNew(ctx.base, &address, nullptr, handler, &ctx);
+  if (!ctx.server) {
+    fprintf(stderr, "can't listen port %u\n", static_cast<unsigned>(port));
+    exit(1);
+  }
+
+  ctx.clients = new BenchClient[connections];
+  for (unsigned i = 0; i < connections; i++) {
+    BenchClient *client = &ctx.clients[i];
+    HostAddress localAddress;
+    localAddress.family = AF_INET;
+    localAddress.ipv4 = INADDR_ANY;
+    localAddress.port = 0;
+    socketTy connectSocket = socketCreate(AF_INET, SOCK_STREAM, IPPROTO_TCP, 1);
+    socketBind(connectSocket, &localAddress);
+    client->ctx = &ctx;
+    client->socket = newSocketIo(ctx.base, connectSocket);
+
+    address.ipv4 = inet_addr("127.0.0.1");
+    aioConnect(client->socket, &address, 3000000, connectcb, client);
+  }
+
+  asyncLoop(ctx.base);
+  timeMark endPt = getTimeMark();
+
+  HTTPServerStats stats;
+  httpServerGetStats(ctx.server, &stats);
+  double totalSeconds = usDiff(ctx.beginPt, endPt) / 1000000.0;
+  printf("method=%s connections=%u requests: %" PRIu64 ", keep-alive reuses: %" PRIu64 ", elapsed time: %.3lf, rate: %.0lf req/s\n",
+         methodName,
+         connections,
+         ctx.requestsFinished,
+         stats.keepAliveReuses,
+         totalSeconds,
+         ctx.requestsFinished / totalSeconds);
+
+  for (unsigned i = 0; i < connections; i++)
+    deleteAioObject(ctx.clients[i].socket);
+  httpServerDelete(ctx.server);
+  delete[] ctx.clients;
+}
+
+int main(int argc, char **argv)
+{
+  if (argc >= 2)
+    gTotalRequests = strtoull(argv[1], nullptr, 10);
+
+#if !defined(OS_WINDOWS)
+  // 1024 client and 1024 server sockets in one process
+  struct rlimit limit;
+  if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < 4096) {
+    limit.rlim_cur = limit.rlim_max < 4096 ? limit.rlim_max : 4096;
+    setrlimit(RLIMIT_NOFILE, &limit);
+  }
+#endif
+
+  initializeSocketSubsystem();
+  uint16_t port = gPort;
+  const unsigned connections[] = {1, 64, 1024};
+  for (unsigned i = 0; i < sizeof(connections)/sizeof(connections[0]); i++) {
+    run(amOSDefault, "default", connections[i], port++);
+#if !defined(OS_WINDOWS)
+    run(amPoll, "poll", connections[i], port++);
+#endif
+  }
+
+  return 0;
+}
@@ -0,0 +1,163 @@
+#include "p2putils/HttpParse.h"
+#include "p2putils/HttpRequestParse.h"
+#include "p2putils/HttpScan.h"
+#include <chrono>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define HAVE_RDTSC
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#endif
+
+static unsigned gIterations = 200000;
+
+// Browser-like request and typical web server response
+static const char gRequest[] =
+  "GET /static/js/app.3f9c2b1e.js?version=20240101&lang=en HTTP/1.1\r\n"
+  "Host: www.example.com\r\n"
+  "Connection: keep-alive\r\n"
+  "sec-ch-ua: \"Chromium\";v=\"124\", \"Google Chrome\";v=\"124\", \"Not-A.Brand\";v=\"99\"\r\n"
+  "sec-ch-ua-mobile: ?0\r\n"
+  "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/124.0.0.0 Safari/537.36\r\n"
+  "sec-ch-ua-platform: \"Linux\"\r\n"
+  "Accept: */*\r\n"
+  "Sec-Fetch-Site: same-origin\r\n"
+  "Sec-Fetch-Mode: no-cors\r\n"
+  "Sec-Fetch-Dest: script\r\n"
+  "Referer: https://www.example.com/dashboard/overview?tab=statistics\r\n"
+  "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+  "Accept-Language: en-US,en;q=0.9,de;q=0.8\r\n"
+  "Cookie: session=4f2a9c81d7e34b6a8e1f0c2d3b4a5968; theme=dark; _ga=GA1.2.1234567890.1700000000; _gid=GA1.2.987654321.1700000000\r\n"
+  "If-None-Match: \"65a1b2c3-1f4e2\"\r\n"
+  "If-Modified-Since: Mon, 01 Jan 2024 00:00:00 GMT\r\n"
+  "\r\n";
+
+static const char gResponse[] =
+  "HTTP/1.1 200 OK\r\n"
+  "Server: nginx/1.24.0\r\n"
+  "Date: Tue, 02 Jan 2024 10:00:00 GMT\r\n"
+  "Content-Type: application/javascript; charset=utf-8\r\n"
+  "Content-Length: 31\r\n"
+  "Last-Modified: Mon, 01 Jan 2024 00:00:00 GMT\r\n"
+  "Connection: keep-alive\r\n"
+  "Vary: Accept-Encoding\r\n"
+  "ETag: \"65a1b2c3-1f4e2\"\r\n"
+  "Cache-Control: public, max-age=31536000, immutable\r\n"
+  "Strict-Transport-Security: max-age=63072000; includeSubDomains; preload\r\n"
+  "X-Content-Type-Options: nosniff\r\n"
+  "Access-Control-Allow-Origin: *\r\n"
+  "Accept-Ranges: bytes\r\n"
+  "\r\n"
+  "console.log(\"hello, world!\");\r\n";
+
+struct Measure {
+  double seconds;
+  uint64_t cycles;
+};
+
+template<typename Proc> static Measure measure(Proc proc)
+{
+  auto begin = std::chrono::steady_clock::now();
+#ifdef HAVE_RDTSC
+  uint64_t beginCycles = __rdtsc();
+#endif
+  for (unsigned i = 0; i < gIterations; i++)
+    proc();
+  Measure result;
+#ifdef HAVE_RDTSC
+  result.cycles = __rdtsc() - beginCycles;
+#else
+  result.cycles = 0;
+#endif
+  result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+  return result;
+}
+
+static void report(const char *name, HttpScanKernelTy kernel, size_t size, Measure m)
+{
+  double bytes = static_cast<double>(size) * gIterations;
+  if (m.cycles)
+    printf("%-8s kernel=%-7s %8.1lf MB/s  %.3lf bytes/cycle\n", name, httpScanKernelName(kernel), bytes / m.seconds / 1048576.0, bytes / static_cast<double>(m.cycles));
+  else
+    printf("%-8s kernel=%-7s %8.1lf MB/s\n", name, httpScanKernelName(kernel), bytes / m.seconds / 1048576.0);
+}
+
+static int requestCb(HttpRequestComponent *component, void *arg)
+{
+  (*static_cast<unsigned*>(arg)) += component->type;
+  return 1;
+}
+
+static int responseCb(HttpComponent *component, void *arg)
+{
+  (*static_cast<unsigned*>(arg)) += static_cast<unsigned>(component->type);
+  return 1;
+}
+
+int main(int argc, char **argv)
+{
+  if (argc >= 2)
+    gIterations = static_cast<unsigned>(strtoul(argv[1], nullptr, 10));
+
+  // Long header-like text for raw scanner throughput, 64 lines of 128 bytes
+  static char lines[8192];
+  for (size_t i = 0; i < sizeof(lines); i++)
+    lines[i] = "abcdefghijklmnopqrstuvwxyz-ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789"[i % 63];
+  for (size_t i = 126; i < sizeof(lines); i += 128) {
+    lines[i] = '\r';
+    lines[i+1] = '\n';
+  }
+
+  unsigned checksum = 0;
+  for (int k = httpScanScalar; k < httpScanKernelLast; k++) {
+    HttpScanKernelTy kernel = static_cast<HttpScanKernelTy>(k);
+    if (!httpScanSetKernel(kernel))
+      continue;
+
+    report("crlf", kernel, sizeof(lines), measure([&]() {
+      const char *end = lines + sizeof(lines);
+      for (const char *p = lines; p != end; p += 2) {
+        p = httpScanCRLF(p, end);
+        if (p == end)
+          break;
+        checksum++;
+      }
+    }));
+
+    report("token", kernel, sizeof(lines), measure([&]() {
+      const char *end = lines + sizeof(lines);
+      for (const char *p = lines; p < end; p++)
+        p = httpScanToken(p, end);
+      checksum++;
+    }));
+
+    report("request", kernel, sizeof(gRequest)-1, measure([&]() {
+      HttpRequestParserState state;
+      httpRequestParserInit(&state);
+      httpRequestSetBuffer(&state, gRequest, sizeof(gRequest)-1);
+      if (httpRequestParse(&state, requestCb, &checksum) != ParserResultOk) {
+        fprintf(stderr, "request parse error\n");
+        exit(1);
+      }
+    }));
+
+    report("response", kernel, sizeof(gResponse)-1, measure([&]() {
+      HttpParserState state;
+      httpInit(&state);
+      httpSetBuffer(&state, gResponse, sizeof(gResponse)-1);
+      if (httpParse(&state, responseCb, &checksum) != ParserResultOk) {
+        fprintf(stderr, "response parse error\n");
+        exit(1);
+      }
+    }));
+  }
+
+  printf("checksum: %u\n", checksum);
+  return 0;
+}
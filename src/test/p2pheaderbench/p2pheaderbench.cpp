@@ -0,0 +1,159 @@
+#include "p2p/p2pproto.h"
+#include "asyncio/asyncio.h"
+#include "asyncio/coroutine.h"
+#include "asyncio/socket.h"
+#include "asyncio/timer.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+// Loopback stream of small p2p signals (16-byte payload): compact varint header with batched
+// parsing from connection read buffer against fixed 16-byte p2pHeader. Sender writes encoded
+// messages to socket in large chunks, so receive side is measured
+
+static uint16_t gPort = 63800;
+static unsigned gMessagesNum = 2000000;
+static constexpr unsigned gPayloadSize = 16;
+static constexpr unsigned gChunkMessages = 2048;
+
+__NO_PADDING_BEGIN
+struct BenchContext {
+  asyncBase *base;
+  aioObject *listener;
+  aioObject *clientSocket;
+  HostAddress address;
+  uint32_t features;
+  unsigned received;
+  timeMark beginPt;
+  timeMark endPt;
+};
+__NO_PADDING_END
+
+static p2pErrorTy acceptCb(AsyncOpStatus status, p2pConnection *connection, p2pConnectData *data, void *arg)
+{
+  __UNUSED(status);
+  __UNUSED(connection);
+  __UNUSED(data);
+  __UNUSED(arg);
+  return p2pOk;
+}
+
+static void serverProc(void *arg)
+{
+  BenchContext *ctx = static_cast<BenchContext*>(arg);
+  socketTy socket = ioAccept(ctx->listener, 3000000);
+  if (socket == INVALID_SOCKET) {
+    fprintf(stderr, "accept error\n");
+    exit(1);
+  }
+
+  p2pConnection *connection = p2pConnectionNew(newSocketIo(ctx->base, socket));
+  if (iop2pAccept(connection, 3000000, acceptCb, ctx) != 0) {
+    fprintf(stderr, "p2p accept error\n");
+    exit(1);
+  }
+
+  uint8_t buffer[gPayloadSize];
+  p2pHeader header;
+  for (unsigned i = 0; i < gMessagesNum; i++) {
+    if (iop2pRecv(connection, buffer, sizeof(buffer), afNone, 3000000, &header) != gPayloadSize || header.id != i) {
+      fprintf(stderr, "receive error at message %u\n", i);
+      exit(1);
+    }
+    ctx->received++;
+  }
+
+  ctx->endPt = getTimeMark();
+  p2pConnectionDelete(connection);
+  postQuitOperation(ctx->base);
+}
+
+static void clientProc(void *arg)
+{
+  BenchContext *ctx = static_cast<BenchContext*>(arg);
+  p2pConnectData data;
+  data.login = "bench";
+  data.password = "bench";
+  data.application = "bench";
+  p2pConnection *connection = p2pConnectionNew(ctx->clientSocket);
+  connection->featuresOffer = ctx->features;
+  if (iop2pConnect(connection, &ctx->address, 3000000, &data) != 0 || connection->features != ctx->features) {
+    fprintf(stderr, "p2p connect error\n");
+    exit(1);
+  }
+
+  std::vector<uint8_t> chunk(gChunkMessages * (P2P_COMPACT_HEADER_MAX_SIZE + gPayloadSize));
+  uint8_t payload[gPayloadSize] = {0};
+  ctx->beginPt = getTimeMark();
+  for (unsigned i = 0; i < gMessagesNum; ) {
+    uint8_t *p = chunk.data();
+    for (unsigned j = 0; j < gChunkMessages && i < gMessagesNum; j++, i++) {
+      p2pHeader header(i, p2pMsgSignal, gPayloadSize);
+      if (ctx->features & p2pFeatureCompactHeader) {
+        p += p2pEncodeCompactHeader(header, p);
+      } else {
+        memcpy(p, &header, sizeof(p2pHeader));
+        p += sizeof(p2pHeader);
+      }
+      memcpy(p, payload, gPayloadSize);
+      p += gPayloadSize;
+    }
+
+    size_t size = static_cast<size_t>(p - chunk.data());
+    if (ioWrite(connection->socket, chunk.data(), size, afWaitAll, 3000000) != static_cast<ssize_t>(size)) {
+      fprintf(stderr, "send error at message %u\n", i);
+      exit(1);
+    }
+  }
+}
+
+static void run(const char *name, uint32_t features, uint16_t port)
+{
+  BenchContext ctx;
+  ctx.base = createAsyncBase(amOSDefault);
+  ctx.features = features;
+  ctx.received = 0;
+  ctx.address.family = AF_INET;
+  ctx.address.ipv4 = INADDR_ANY;
+  ctx.address.port = htons(port);
+
+  socketTy acceptSocket = socketCreate(AF_INET, SOCK_STREAM, IPPROTO_TCP, 1);
+  socketReuseAddr(acceptSocket);
+  if (socketBind(acceptSocket, &ctx.address) != 0 || socketListen(acceptSocket) != 0) {
+    fprintf(stderr, "can't listen port %u\n", static_cast<unsigned>(port));
+    exit(1);
+  }
+
+  ctx.listener = newSocketIo(ctx.base, acceptSocket);
+  ctx.address.ipv4 = inet_addr("127.0.0.1");
+  ctx.clientSocket = newSocketIo(ctx.base, socketCreate(AF_INET, SOCK_STREAM, IPPROTO_TCP, 1));
+  coroutineCall(coroutineNew(serverProc, &ctx, 0x10000));
+  coroutineCall(coroutineNew(clientProc, &ctx, 0x10000));
+  asyncLoop(ctx.base);
+
+  uint8_t header[P2P_COMPACT_HEADER_MAX_SIZE];
+  size_t headerSize = features & p2pFeatureCompactHeader ?
+    p2pEncodeCompactHeader(p2pHeader(gMessagesNum / 2, p2pMsgSignal, gPayloadSize), header) :
+    sizeof(p2pHeader);
+  double seconds = usDiff(ctx.beginPt, ctx.endPt) / 1000000.0;
+  printf("%-8s messages: %u, header: %u bytes, elapsed time: %.3lf, rate: %.0lf msg/s\n",
+         name,
+         ctx.received,
+         static_cast<unsigned>(headerSize),
+         seconds,
+         ctx.received / seconds);
+  deleteAioObject(ctx.listener);
+}
+
+int main(int argc, char **argv)
+{
+  if (argc >= 2)
+    gMessagesNum = static_cast<unsigned>(strtoul(argv[1], nullptr, 10));
+
+  initializeSocketSubsystem();
+  run("p2pHeader", 0, gPort);
+  run("compact", p2pFeatureCompactHeader, gPort + 1);
+  return 0;
+}
@@ -0,0 +1,157 @@
+#include "p2p/p2p.h"
+#include "asyncio/asyncio.h"
+#include "asyncio/socket.h"
+#include <algorithm>
+#include <chrono>
+#include <inttypes.h>
+#include <map>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+// Pending request bookkeeping of p2p client with N requests in flight: p2pRequestTable slot
+// array with loop timer deadlines against std::map with periodic full scan used before
+
+static unsigned gRequestsNum = 1000000;
+
+__NO_PADDING_BEGIN
+struct ExpireContext {
+  asyncBase *base;
+  p2pRequestTable *table;
+  uint64_t expired;
+  uint64_t maxLateness;
+};
+__NO_PADDING_END
+
+static double secondsSince(std::chrono::steady_clock::time_point begin)
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+}
+
+static void report(const char *container, const char *operation, double seconds)
+{
+  printf("%-6s %-20s requests: %u, elapsed time: %.3lf, %.1lf ns/request\n",
+         container,
+         operation,
+         gRequestsNum,
+         seconds,
+         seconds * 1000000000.0 / gRequestsNum);
+}
+
+static void expireCb(uint32_t id, const p2pEventHandler &handler, void *arg)
+{
+  __UNUSED(id);
+  ExpireContext *ctx = static_cast<ExpireContext*>(arg);
+  // Deadline of benchmark requests is start time plus timeout
+  uint64_t elapsed = usDiff(handler.startPt, getTimeMark());
+  if (elapsed > handler.timeout)
+    ctx->maxLateness = std::max(ctx->maxLateness, elapsed - handler.timeout);
+  if (++ctx->expired == gRequestsNum)
+    postQuitOperation(ctx->base);
+}
+
+static void benchTable(asyncBase *base, const std::vector<uint32_t> &order)
+{
+  ExpireContext ctx;
+  ctx.base = base;
+  ctx.expired = 0;
+  ctx.maxLateness = 0;
+  p2pRequestTable table(base, expireCb, &ctx);
+  ctx.table = &table;
+
+  p2pEventHandler handler;
+  memset(&handler, 0, sizeof(handler));
+  std::vector<uint32_t> ids(gRequestsNum);
+
+  auto begin = std::chrono::steady_clock::now();
+  for (unsigned i = 0; i < gRequestsNum; i++)
+    ids[i] = table.insert(handler, 10000000);
+  report("table", "insert", secondsSince(begin));
+
+  begin = std::chrono::steady_clock::now();
+  for (unsigned i = 0; i < gRequestsNum; i++) {
+    if (!table.remove(ids[order[i]], nullptr)) {
+      fprintf(stderr, "request %u not found\n", order[i]);
+      exit(1);
+    }
+  }
+  report("table", "response (random)", secondsSince(begin));
+
+  // All requests expire in 100ms
+  begin = std::chrono::steady_clock::now();
+  handler.timeout = 100000;
+  for (unsigned i = 0; i < gRequestsNum; i++) {
+    handler.startPt = getTimeMark();
+    table.insert(handler, handler.timeout);
+  }
+  double insertTime = secondsSince(begin);
+  asyncLoop(base);
+  double totalTime = secondsSince(begin);
+  report("table", "insert with timeout", insertTime);
+  printf("table  expire               requests: %" PRIu64 ", max lateness: %.3lf ms, total time: %.3lf\n",
+         ctx.expired,
+         ctx.maxLateness / 1000.0,
+         totalTime);
+}
+
+static void benchMap(const std::vector<uint32_t> &order)
+{
+  std::map<unsigned, p2pEventHandler> handlersMap;
+  p2pEventHandler handler;
+  memset(&handler, 0, sizeof(handler));
+
+  timeMark timeBase = getTimeMark();
+  auto begin = std::chrono::steady_clock::now();
+  for (unsigned i = 0; i < gRequestsNum; i++) {
+    handler.endPoint = usDiff(timeBase, getTimeMark()) + 10000000;
+    handlersMap[i] = handler;
+  }
+  report("map", "insert", secondsSince(begin));
+
+  // One pass of periodic timeout check, nothing expired
+  begin = std::chrono::steady_clock::now();
+  uint64_t currentTime = usDiff(timeBase, getTimeMark());
+  unsigned expired = 0;
+  for (auto &I: handlersMap)
+    expired += I.second.endPoint && I.second.endPoint <= currentTime;
+  double scanTime = secondsSince(begin);
+  printf("map    timeout scan         requests: %u, elapsed time: %.3lf per second of run time (expired %u)\n",
+         gRequestsNum,
+         scanTime,
+         expired);
+
+  begin = std::chrono::steady_clock::now();
+  for (unsigned i = 0; i < gRequestsNum; i++) {
+    auto It = handlersMap.find(order[i]);
+    if (It == handlersMap.end()) {
+      fprintf(stderr, "request %u not found\n", order[i]);
+      exit(1);
+    }
+    handlersMap.erase(It);
+  }
+  report("map", "response (random)", secondsSince(begin));
+}
+
+int main(int argc, char **argv)
+{
+  if (argc >= 2)
+    gRequestsNum = static_cast<unsigned>(strtoul(argv[1], nullptr, 10));
+  if (gRequestsNum == 0 || gRequestsNum > (1u << P2P_REQUEST_INDEX_BITS)) {
+    fprintf(stderr, "requests number must be in range 1-%u\n", 1u << P2P_REQUEST_INDEX_BITS);
+    return 1;
+  }
+
+  initializeSocketSubsystem();
+  asyncBase *base = createAsyncBase(amOSDefault);
+
+  // Responses arrive in random order
+  std::vector<uint32_t> order(gRequestsNum);
+  for (unsigned i = 0; i < gRequestsNum; i++)
+    order[i] = i;
+  std::shuffle(order.begin(), order.end(), std::mt19937(1));
+
+  benchTable(base, order);
+  benchMap(order);
+  return 0;
+}
@@ -0,0 +1,229 @@
+#include "asyncio/asyncio.h"
+#include "asyncio/socket.h"
+#include "asyncio/socketSSL.h"
+#include "asyncio/timer.h"
+#include <openssl/evp.h>
+#include <openssl/ec.h>
+#include <openssl/x509.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static uint16_t gPort = 63500;
+static uint64_t gTotalBytes = 2ULL << 30;
+static size_t gBlockSize = 65536;
+static unsigned gWritesInFlight = 4;
+
+__NO_PADDING_BEGIN
+struct BenchContext {
+  asyncBase *base;
+  SSLContext *serverContext;
+  SSLContext *clientContext;
+  aioObject *listener;
+  SSLSocket *server;
+  SSLSocket *client;
+  uint64_t bytesStarted;
+  uint64_t bytesWritten;
+  uint64_t bytesReceived;
+  timeMark beginPt;
+  uint8_t *message;
+  uint8_t *readBuffer;
+  BenchContext() : listener(nullptr), server(nullptr), client(nullptr), bytesStarted(0), bytesWritten(0), bytesReceived(0) {
+    message = static_cast<uint8_t*>(malloc(gBlockSize));
+    readBuffer = static_cast<uint8_t*>(malloc(gBlockSize));
+    memset(message, 'm', gBlockSize);
+  }
+  ~BenchContext() {
+    free(message);
+    free(readBuffer);
+  }
+};
+__NO_PADDING_END
+
+static bool generateCertificate(X509 **certificate, EVP_PKEY **key)
+{
+  *key = nullptr;
+  EVP_PKEY_CTX *keyContext = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, nullptr);
+  if (!keyContext ||
+      EVP_PKEY_keygen_init(keyContext) <= 0 ||
+      EVP_PKEY_CTX_set_ec_paramgen_curve_nid(keyContext, NID_X9_62_prime256v1) <= 0 ||
+      EVP_PKEY_keygen(keyContext, key) <= 0) {
+    EVP_PKEY_CTX_free(keyContext);
+    return false;
+  }
+  EVP_PKEY_CTX_free(keyContext);
+
+  X509 *x509 = X509_new();
+  ASN1_INTEGER_set(X509_get_serialNumber(x509), 1);
+  X509_gmtime_adj(X509_getm_notBefore(x509), 0);
+  X509_gmtime_adj(X509_getm_notAfter(x509), 3600);
+  X509_set_pubkey(x509, *key);
+  X509_NAME *name = X509_get_subject_name(x509);
+  X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, reinterpret_cast<const unsigned char*>("localhost"), -1, -1, 0);
+  X509_set_issuer_name(x509, name);
+  if (!X509_sign(x509, *key, EVP_sha256())) {
+    X509_free(x509);
+    EVP_PKEY_free(*key);
+    return false;
+  }
+
+  *certificate = x509;
+  return true;
+}
+
+static void writecb(AsyncOpStatus status, SSLSocket *socket, size_t transferred, void *arg);
+
+static void startWrite(BenchContext *ctx)
+{
+  if (ctx->bytesStarted >= gTotalBytes)
+    return;
+  size_t size = static_cast<size_t>(gTotalBytes - ctx->bytesStarted) < gBlockSize ? static_cast<size_t>(gTotalBytes - ctx->bytesStarted) : gBlockSize;
+  ctx->bytesStarted += size;
+  aioSslWrite(ctx->client, ctx->message, size, afNoCopy, 0, writecb, ctx);
+}
+
+static void writecb(AsyncOpStatus status, SSLSocket *socket, size_t transferred, void *arg)
+{
+  __UNUSED(socket);
+  BenchContext *ctx = static_cast<BenchContext*>(arg);
+  if (status != aosSuccess) {
+    fprintf(stderr, "write error %i\n", static_cast<int>(status));
+    exit(1);
+  }
+
+  ctx->bytesWritten += transferred;
+  startWrite(ctx);
+}
+
+static void readcb(AsyncOpStatus status, SSLSocket *socket, size_t transferred, void *arg)
+{
+  BenchContext *ctx = static_cast<BenchContext*>(arg);
+  if (status != aosSuccess) {
+    fprintf(stderr, "read error %i\n", static_cast<int>(status));
+    exit(1);
+  }
+
+  ctx->bytesReceived += transferred;
+  if (ctx->bytesReceived >= gTotalBytes)
+    postQuitOperation(ctx->base);
+  else
+    aioSslRead(socket, ctx->readBuffer, gBlockSize, afNone, 0, readcb, ctx);
+}
+
+static void sslAcceptCb(AsyncOpStatus status, SSLSocket *socket, void *arg)
+{
+  BenchContext *ctx = static_cast<BenchContext*>(arg);
+  if (status != aosSuccess) {
+    fprintf(stderr, "ssl accept error %i\n", static_cast<int>(status));
+    exit(1);
+  }
+
+  aioSslRead(socket, ctx->readBuffer, gBlockSize, afNone, 0, readcb, ctx);
+}
+
+static void acceptcb(AsyncOpStatus status, aioObject *listener, HostAddress client, socketTy acceptSocket, void *arg)
+{
+  __UNUSED(listener);
+  __UNUSED(client);
+  BenchContext *ctx = static_cast<BenchContext*>(arg);
+  if (status != aosSuccess) {
+    fprintf(stderr, "accept error %i\n", static_cast<int>(status));
+    exit(1);
+  }
+
+  ctx->server = sslSocketNewWithContext(ctx->base, newSocketIo(ctx->base, acceptSocket), ctx->serverContext);
+  aioSslAccept(ctx->server, 0, sslAcceptCb, ctx);
+}
+
+static void connectcb(AsyncOpStatus status, SSLSocket *socket, void *arg)
+{
+  __UNUSED(socket);
+  BenchContext *ctx = static_cast<BenchContext*>(arg);
+  if (status != aosSuccess) {
+    fprintf(stderr, "ssl connect error %i\n", static_cast<int>(status));
+    exit(1);
+  }
+
+  ctx->beginPt = getTimeMark();
+  for (unsigned i = 0; i < gWritesInFlight; i++)
+    startWrite(ctx);
+}
+
+static void run(AsyncMethod method, const char *methodName, X509 *certificate, EVP_PKEY *key, uint16_t port)
+{
+  BenchContext ctx;
+  ctx.base = createAsyncBase(method);
+  ctx.serverContext = sslContextNew(1);
+  ctx.clientContext = sslContextNew(0);
+  if (!sslContextUseCertificate(ctx.serverContext, certificate, key)) {
+    fprintf(stderr, "can't use certificate\n");
+    exit(1);
+  }
+
+  HostAddress address;
+  address.family = AF_INET;
+  address.ipv4 = INADDR_ANY;
+  address.port = htons(port);
+  socketTy acceptSocket = socketCreate(AF_INET, SOCK_STREAM, IPPROTO_TCP, 1);
+  socketReuseAddr(acceptSocket);
+  if (socketBind(acceptSocket, &address) != 0 || socketListen(acceptSocket) != 0) {
+    fprintf(stderr, "can't listen port %u\n", static_cast<unsigned>(port));
+    exit(1);
+  }
+
+  ctx.listener = newSocketIo(ctx.base, acceptSocket);
+  aioAccept(ctx.listener, 0, acceptcb, &ctx);
+
+  address.port = 0;
+  socketTy connectSocket = socketCreate(AF_INET, SOCK_STREAM, IPPROTO_TCP, 1);
+  socketBind(connectSocket, &address);
+  ctx.client = sslSocketNewWithContext(ctx.base, newSocketIo(ctx.base, connectSocket), ctx.clientContext);
+
+  address.ipv4 = inet_addr("127.0.0.1");
+  address.port = htons(port);
+  aioSslConnect(ctx.client, &address, "localhost", 1000000, connectcb, &ctx);
+
+  asyncLoop(ctx.base);
+  timeMark endPt = getTimeMark();
+
+  double totalSeconds = usDiff(ctx.beginPt, endPt) / 1000000.0;
+  printf("method=%s block=%zu received: %" PRIu64 " bytes, elapsed time: %.3lf, throughput: %.1lf MB/s\n",
+         methodName,
+         gBlockSize,
+         ctx.bytesReceived,
+         totalSeconds,
+         ctx.bytesReceived / totalSeconds / 1048576.0);
+
+  sslSocketDelete(ctx.client);
+  sslSocketDelete(ctx.server);
+  deleteAioObject(ctx.listener);
+  sslContextDecrementReference(ctx.serverContext);
+  sslContextDecrementReference(ctx.clientContext);
+}
+
+int main(int argc, char **argv)
+{
+  if (argc >= 2)
+    gTotalBytes = strtoull(argv[1], nullptr, 10) << 20;
+  if (argc >= 3)
+    gBlockSize = strtoull(argv[2], nullptr, 10);
+
+  X509 *certificate = nullptr;
+  EVP_PKEY *key = nullptr;
+  if (!generateCertificate(&certificate, &key)) {
+    fprintf(stderr, "can't generate certificate\n");
+    return 1;
+  }
+
+  initializeSocketSubsystem();
+  uint16_t port = gPort;
+  run(amOSDefault, "default", certificate, key, port++);
+#if !defined(OS_WINDOWS)
+  run(amPoll, "poll", certificate, key, port++);
+#endif
+
+  X509_free(certificate);
+  EVP_PKEY_free(key);
+  return 0;
+}
@@ -0,0 +1,1074 @@
+#include "unittest.h"
+#include "asyncio/http.h"
+#include "asyncio/http2.h"
+#include "asyncio/httpServer.h"
+#include "asyncio/socket.h"
+#include <string.h>
+#include <string>
+#include <vector>
+
+static const char gHttpRequest[] = "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n";
+static constexpr unsigned gHttpPoolRequestsMax = 16;
+
+__NO_PADDING_BEGIN
+struct HttpPoolTestContext;
+
+struct HttpPoolServerConnection {
+  HttpPoolTestContext *ctx;
+  aioObject *socket;
+  unsigned matched;
+  unsigned served;
+  char buffer[1024];
+};
+
+struct HttpPoolRequestContext {
+  HttpPoolTestContext *ctx;
+  HTTPParseDefaultContext parseContext;
+};
+
+struct HttpPoolTestContext {
+  asyncBase *base;
+  aioObject *listener;
+  HTTPServer *server;
+  HTTPClientPool *pool;
+  const char *request;
+  // HTTPServer handler: chunked response after sleep in coroutine
+  bool chunked;
+  uint64_t serverBodyBytes;
+  // Server sends 'Connection: close' and closes socket after every closeEvery responses
+  unsigned closeEvery;
+  unsigned accepted;
+  unsigned requestsNum;
+  unsigned responses;
+  unsigned failures;
+  bool sequential;
+  HttpPoolRequestContext requests[gHttpPoolRequestsMax];
+  HttpPoolTestContext(asyncBase *baseArg, unsigned closeEveryArg) :
+    base(baseArg), listener(nullptr), server(nullptr), pool(nullptr), request(gHttpRequest), chunked(false), serverBodyBytes(0), closeEvery(closeEveryArg), accepted(0), requestsNum(0), responses(0), failures(0), sequential(false) {
+    for (unsigned i = 0; i < gHttpPoolRequestsMax; i++) {
+      requests[i].ctx = this;
+      httpParseDefaultInit(&requests[i].parseContext);
+    }
+  }
+  ~HttpPoolTestContext() {
+    for (unsigned i = 0; i < gHttpPoolRequestsMax; i++)
+      dynamicBufferFree(&requests[i].parseContext.buffer);
+  }
+};
+__NO_PADDING_END
+
+static void httpPoolServerRead(HttpPoolServerConnection *connection);
+
+static void httpPoolServerCloseCb(AsyncOpStatus status, aioObject *socket, size_t transferred, void *arg)
+{
+  __UNUSED(status);
+  __UNUSED(transferred);
+  deleteAioObject(socket);
+  delete static_cast<HttpPoolServerConnection*>(arg);
+}
+
+static void httpPoolServerReadCb(AsyncOpStatus status, aioObject *socket, size_t transferred, void *arg)
+{
+  HttpPoolServerConnection *connection = static_cast<HttpPoolServerConnection*>(arg);
+  if (status != aosSuccess) {
+    deleteAioObject(socket);
+    delete connection;
+    return;
+  }
+
+  // Answer every complete request (terminated by empty line)
+  static const char terminator[] = "\r\n\r\n";
+  for (size_t i = 0; i < transferred; i++) {
+    char c = connection->buffer[i];
+    connection->matched = c == terminator[connection->matched] ? connection->matched + 1 : (c == '\r' ? 1u : 0u);
+    if (connection->matched == 4) {
+      connection->matched = 0;
+      if (connection->ctx->closeEvery && ++connection->served % connection->ctx->closeEvery == 0) {
+        // Rest of pipelined requests dropped, client must send them again
+        static const char response[] = "HTTP/1.1 200 OK\r\nConnection: close\r\nContent-Length: 2\r\n\r\nok";
+        aioWrite(socket, response, sizeof(response)-1, afWaitAll, 0, httpPoolServerCloseCb, connection);
+        return;
+      }
+
+      static const char response[] = "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok";
+      aioWrite(socket, response, sizeof(response)-1, afWaitAll, 0, nullptr, nullptr);
+    }
+  }
+
+  httpPoolServerRead(connection);
+}
+
+static void httpPoolServerRead(HttpPoolServerConnection *connection)
+{
+  aioRead(connection->socket, connection->buffer, sizeof(connection->buffer), afNone, 0, httpPoolServerReadCb, connection);
+}
+
+static void httpPoolAcceptCb(AsyncOpStatus status, aioObject *listener, HostAddress client, socketTy acceptSocket, void *arg)
+{
+  __UNUSED(client);
+  HttpPoolTestContext *ctx = static_cast<HttpPoolTestContext*>(arg);
+  if (status == aosSuccess) {
+    HttpPoolServerConnection *connection = new HttpPoolServerConnection;
+    connection->ctx = ctx;
+    connection->socket = newSocketIo(ctx->base, acceptSocket);
+    connection->matched = 0;
+    connection->served = 0;
+    ctx->accepted++;
+    httpPoolServerRead(connection);
+  }
+
+  if (status == aosSuccess || status == aosTimeout)
+    aioAccept(listener, 0, httpPoolAcceptCb, ctx);
+}
+
+static void httpPoolSend(HttpPoolTestContext *ctx);
+
+static void httpPoolResponseCb(AsyncOpStatus status, HTTPClientPool *pool, void *arg)
+{
+  __UNUSED(pool);
+  HttpPoolRequestContext *request = static_cast<HttpPoolRequestContext*>(arg);
+  HttpPoolTestContext *ctx = request->ctx;
+  if (status == aosSuccess &&
+      request->parseContext.resultCode == 200 &&
+      request->parseContext.body.size == 2 &&
+      memcmp(request->parseContext.body.data, "ok", 2) == 0)
+    ctx->responses++;
+  else
+    ctx->failures++;
+
+  if (ctx->responses + ctx->failures == ctx->requestsNum)
+    postQuitOperation(ctx->base);
+  else if (ctx->sequential)
+    httpPoolSend(ctx);
+}
+
+static void httpPoolSend(HttpPoolTestContext *ctx)
+{
+  HostAddress address;
+  address.family = AF_INET;
+  address.ipv4 = inet_addr("127.0.0.1");
+  address.port = htons(gPort);
+  HttpPoolRequestContext *request = &ctx->requests[ctx->responses + ctx->failures];
+  aioHttpPoolRequest(ctx->pool, &address, 0, nullptr, ctx->request, strlen(ctx->request), 1000000, httpParseDefault, &request->parseContext, httpPoolResponseCb, request);
+}
+
+static void httpPoolDrainCb(aioUserEvent *event, void *arg)
+{
+  __UNUSED(event);
+  postQuitOperation(static_cast<asyncBase*>(arg));
+}
+
+static void httpPoolFinish(HttpPoolTestContext *ctx, HTTPClientPoolStats *stats)
+{
+  httpClientPoolGetStats(ctx->pool, stats);
+  httpClientPoolDelete(ctx->pool);
+  if (ctx->server)
+    httpServerDelete(ctx->server);
+  else
+    deleteAioObject(ctx->listener);
+
+  // Let cancelled accept and connection operations complete before next test binds same port
+  aioUserEvent *event = newUserEvent(ctx->base, 0, httpPoolDrainCb, ctx->base);
+  userEventStartTimer(event, 20000, 1);
+  asyncLoop(ctx->base);
+  deleteUserEvent(event);
+}
+
+static void httpPoolRun(HttpPoolTestContext *ctx, unsigned requestsNum)
+{
+  ctx->requestsNum = requestsNum;
+  if (!ctx->server) {
+    ctx->listener = startTCPServer(ctx->base, httpPoolAcceptCb, ctx, gPort);
+    ASSERT_NE(ctx->listener, nullptr);
+  }
+  if (ctx->sequential) {
+    httpPoolSend(ctx);
+  } else {
+    HostAddress address;
+    address.family = AF_INET;
+    address.ipv4 = inet_addr("127.0.0.1");
+    address.port = htons(gPort);
+    for (unsigned i = 0; i < requestsNum; i++)
+      aioHttpPoolRequest(ctx->pool, &address, 0, nullptr, ctx->request, strlen(ctx->request), 1000000, httpParseDefault, &ctx->requests[i].parseContext, httpPoolResponseCb, &ctx->requests[i]);
+  }
+
+  asyncLoop(ctx->base);
+}
+
+TEST(http, test_http_parse_default_content_length)
+{
+  HTTPParseDefaultContext context;
+  httpParseDefaultInit(&context);
+  HttpComponent component;
+  component.type = httpDtInitialize;
+  httpParseDefault(&component, &context);
+
+  // Announced size not reserved up front
+  component.type = httpDtHeaderEntry;
+  component.header.entryType = hhContentLength;
+  component.header.sizeValue = SIZE_MAX;
+  httpParseDefault(&component, &context);
+  EXPECT_LE(context.buffer.allocatedSize, 2u << 20);
+
+  static const char body[] = "body";
+  component.type = httpDtData;
+  component.data.data = const_cast<char*>(body);
+  component.data.size = 4;
+  EXPECT_EQ(httpParseDefault(&component, &context), 1);
+  component.type = httpDtFinalize;
+  EXPECT_EQ(httpParseDefault(&component, &context), 1);
+  ASSERT_EQ(context.body.size, 4u);
+  EXPECT_EQ(memcmp(context.body.data, body, 4), 0);
+
+  // Body which can't be stored stops parsing instead of being truncated
+  component.type = httpDtDataFragment;
+  component.data.size = SIZE_MAX;
+  EXPECT_EQ(httpParseDefault(&component, &context), 0);
+
+  // Size overflow rejected, buffer kept
+  void *data = context.buffer.data;
+  EXPECT_EQ(dynamicBufferGrow(&context.buffer, SIZE_MAX), 0);
+  EXPECT_EQ(dynamicBufferAlloc(&context.buffer, SIZE_MAX - 1), nullptr);
+  EXPECT_EQ(context.buffer.data, data);
+  dynamicBufferFree(&context.buffer);
+
+  // Empty buffer grows
+  dynamicBuffer empty;
+  dynamicBufferInit(&empty, 0);
+  EXPECT_EQ(dynamicBufferWrite(&empty, body, 4), 1);
+  EXPECT_EQ(memcmp(empty.data, body, 4), 0);
+  dynamicBufferFree(&empty);
+}
+
+TEST(http, test_http_pool_keepalive)
+{
+  HttpPoolTestContext context(gBase, 0);
+  context.sequential = true;
+  context.pool = httpClientPoolNew(gBase, 4, 1, 0);
+  httpPoolRun(&context, 8);
+
+  HTTPClientPoolStats stats;
+  httpPoolFinish(&context, &stats);
+  EXPECT_EQ(context.responses, 8u);
+  EXPECT_EQ(context.failures, 0u);
+  // Sequential requests reuse one connection
+  EXPECT_EQ(stats.connects, 1u);
+  EXPECT_EQ(stats.requests, 8u);
+}
+
+TEST(http, test_http_pool_pipelining)
+{
+  HttpPoolTestContext context(gBase, 0);
+  context.pool = httpClientPoolNew(gBase, 1, gHttpPoolRequestsMax, 0);
+  httpPoolRun(&context, gHttpPoolRequestsMax);
+
+  HTTPClientPoolStats stats;
+  httpPoolFinish(&context, &stats);
+  EXPECT_EQ(context.responses, gHttpPoolRequestsMax);
+  EXPECT_EQ(context.failures, 0u);
+  EXPECT_EQ(stats.connects, 1u);
+  EXPECT_EQ(stats.pipelined, gHttpPoolRequestsMax - 1);
+}
+
+TEST(http, test_http_pool_connection_close)
+{
+  HttpPoolTestContext context(gBase, 3);
+  context.pool = httpClientPoolNew(gBase, 2, 4, 0);
+  httpPoolRun(&context, gHttpPoolRequestsMax);
+
+  HTTPClientPoolStats stats;
+  httpPoolFinish(&context, &stats);
+  // Requests dropped by server with 'Connection: close' sent again over new connections
+  EXPECT_EQ(context.responses, gHttpPoolRequestsMax);
+  EXPECT_EQ(context.failures, 0u);
+  EXPECT_GE(stats.connects, gHttpPoolRequestsMax / 3);
+  EXPECT_EQ(stats.connects, context.accepted);
+}
+
+TEST(http, test_http_pool_connection_close_post)
+{
+  HttpPoolTestContext context(gBase, 3);
+  context.request = "POST / HTTP/1.1\r\nHost: localhost\r\nContent-Length: 0\r\n\r\n";
+  context.pool = httpClientPoolNew(gBase, 1, 4, 0);
+  httpPoolRun(&context, gHttpPoolRequestsMax);
+
+  HTTPClientPoolStats stats;
+  httpPoolFinish(&context, &stats);
+  // Written requests dropped by server could be processed, not sent again
+  EXPECT_EQ(context.responses + context.failures, gHttpPoolRequestsMax);
+  EXPECT_GT(context.failures, 0u);
+  EXPECT_EQ(stats.retries, 0u);
+}
+
+TEST(http, test_http_pool_idle_eviction)
+{
+  HttpPoolTestContext context(gBase, 0);
+  context.sequential = true;
+  context.pool = httpClientPoolNew(gBase, 1, 1, 10000);
+  httpPoolRun(&context, 2);
+
+  // Wait for several idle timer periods
+  aioUserEvent *event = newUserEvent(gBase, 0, httpPoolDrainCb, gBase);
+  userEventStartTimer(event, 50000, 1);
+  asyncLoop(gBase);
+  deleteUserEvent(event);
+
+  HTTPClientPoolStats stats;
+  httpPoolFinish(&context, &stats);
+  EXPECT_EQ(context.responses, 2u);
+  EXPECT_EQ(context.failures, 0u);
+  EXPECT_EQ(stats.connects, 1u);
+  EXPECT_EQ(stats.idleEvictions, 1u);
+}
+
+static void httpServerHandlerCoro(HTTPServerConnection *connection, HttpPoolTestContext *ctx)
+{
+  // Blocking operations allowed in coroutine handler
+  aioUserEvent *event = newUserEvent(ctx->base, 0, nullptr, nullptr);
+  ioSleep(event, 1000);
+  deleteUserEvent(event);
+  httpServerChunkedBegin(connection, 200, "text/plain");
+  httpServerChunk(connection, "o", 1);
+  httpServerChunk(connection, "k", 1);
+  httpServerChunkedEnd(connection);
+}
+
+static void httpServerHandler(HTTPServerConnection *connection, HttpRequestComponent *component, void *arg)
+{
+  HttpPoolTestContext *ctx = static_cast<HttpPoolTestContext*>(arg);
+  if (component->type == httpRequestDtData || component->type == httpRequestDtDataLast)
+    ctx->serverBodyBytes += component->data.size;
+  if (component->type == httpRequestDtDataLast) {
+    if (ctx->chunked)
+      httpServerHandlerCoro(connection, ctx);
+    else
+      httpServerResponse(connection, 200, "text/plain", "ok", 2);
+  }
+}
+
+static HTTPServer *httpServerStart(HttpPoolTestContext *ctx, unsigned coroutineStackSize)
+{
+  HostAddress address;
+  address.family = AF_INET;
+  address.ipv4 = INADDR_ANY;
+  address.port = htons(gPort);
+  HTTPServerConfig config;
+  httpServerConfigInit(&config);
+  config.inBufferSize = 1024;
+  config.coroutineStackSize = coroutineStackSize;
+  return httpServerNew(ctx->base, &address, &config, httpServerHandler, ctx);
+}
+
+TEST(http, test_http_server_keepalive)
+{
+  HttpPoolTestContext context(gBase, 0);
+  context.sequential = true;
+  context.server = httpServerStart(&context, 0);
+  ASSERT_NE(context.server, nullptr);
+  context.pool = httpClientPoolNew(gBase, 4, 1, 0);
+  httpPoolRun(&context, 8);
+
+  HTTPServerStats serverStats;
+  httpServerGetStats(context.server, &serverStats);
+  HTTPClientPoolStats stats;
+  httpPoolFinish(&context, &stats);
+  EXPECT_EQ(context.responses, 8u);
+  EXPECT_EQ(context.failures, 0u);
+  EXPECT_EQ(serverStats.connections, 1u);
+  EXPECT_EQ(serverStats.requests, 8u);
+  EXPECT_EQ(serverStats.keepAliveReuses, 7u);
+}
+
+TEST(http, test_http_server_pipelining)
+{
+  HttpPoolTestContext context(gBase, 0);
+  context.server = httpServerStart(&context, 0);
+  ASSERT_NE(context.server, nullptr);
+  context.pool = httpClientPoolNew(gBase, 1, gHttpPoolRequestsMax, 0);
+  httpPoolRun(&context, gHttpPoolRequestsMax);
+
+  HTTPServerStats serverStats;
+  httpServerGetStats(context.server, &serverStats);
+  HTTPClientPoolStats stats;
+  httpPoolFinish(&context, &stats);
+  EXPECT_EQ(context.responses, gHttpPoolRequestsMax);
+  EXPECT_EQ(context.failures, 0u);
+  EXPECT_EQ(stats.pipelined, gHttpPoolRequestsMax - 1);
+  EXPECT_EQ(serverStats.connections, 1u);
+  EXPECT_EQ(serverStats.requests, gHttpPoolRequestsMax);
+}
+
+TEST(http, test_http_server_chunked_coroutine)
+{
+  HttpPoolTestContext context(gBase, 0);
+  context.request = "POST /upload HTTP/1.1\r\nHost: localhost\r\nTransfer-Encoding: chunked\r\n\r\n3\r\nabc\r\n4\r\ndefg\r\n0\r\n\r\n";
+  context.chunked = true;
+  context.server = httpServerStart(&context, 0x10000);
+  ASSERT_NE(context.server, nullptr);
+  context.pool = httpClientPoolNew(gBase, 2, 4, 0);
+  httpPoolRun(&context, gHttpPoolRequestsMax);
+
+  HTTPServerStats serverStats;
+  httpServerGetStats(context.server, &serverStats);
+  HTTPClientPoolStats stats;
+  httpPoolFinish(&context, &stats);
+  EXPECT_EQ(context.responses, gHttpPoolRequestsMax);
+  EXPECT_EQ(context.failures, 0u);
+  EXPECT_EQ(context.serverBodyBytes, gHttpPoolRequestsMax * 7);
+  EXPECT_EQ(serverStats.requests, gHttpPoolRequestsMax);
+}
+
+TEST(http, test_http_server_bad_request)
+{
+  HttpPoolTestContext context(gBase, 0);
+  context.request = "GET / HTTP/x.y\r\n\r\n";
+  context.sequential = true;
+  context.server = httpServerStart(&context, 0);
+  ASSERT_NE(context.server, nullptr);
+  context.pool = httpClientPoolNew(gBase, 1, 1, 0);
+  httpPoolRun(&context, 1);
+
+  HTTPServerStats serverStats;
+  httpServerGetStats(context.server, &serverStats);
+  HTTPClientPoolStats stats;
+  httpPoolFinish(&context, &stats);
+  EXPECT_EQ(context.requests[0].parseContext.resultCode, 400u);
+  EXPECT_EQ(context.failures, 1u);
+  EXPECT_EQ(serverStats.badRequests, 1u);
+  EXPECT_EQ(serverStats.requests, 0u);
+}
+
+__NO_PADDING_BEGIN
+struct HttpStreamTestContext {
+  asyncBase *base;
+  aioObject *listener;
+  aioObject *serverSocket;
+  HTTPClient *client;
+  aioUserEvent *resumeEvent;
+  HTTPParseStreamContext stream;
+  std::string responses;
+  uint64_t received;
+  unsigned fragments;
+  unsigned pauses;
+  unsigned completed;
+  bool mismatch;
+  AsyncOpStatus status[2];
+  unsigned resultCode[2];
+  int chunked[2];
+  uint64_t contentLength[2];
+  uint64_t bodySize[2];
+};
+__NO_PADDING_END
+
+static constexpr size_t gHttpStreamBodySize = 3 << 20;
+static constexpr size_t gHttpStreamChunkSize = 10000;
+static constexpr unsigned gHttpStreamChunksNum = 100;
+
+static char httpStreamPattern(uint64_t offset)
+{
+  return static_cast<char>('a' + offset % 26);
+}
+
+static void httpStreamAcceptCb(AsyncOpStatus status, aioObject *listener, HostAddress client, socketTy acceptSocket, void *arg)
+{
+  __UNUSED(listener);
+  __UNUSED(client);
+  HttpStreamTestContext *ctx = static_cast<HttpStreamTestContext*>(arg);
+  if (status != aosSuccess)
+    return;
+
+  // Both responses sent at once, second one starts inside client read buffer
+  ctx->serverSocket = newSocketIo(ctx->base, acceptSocket);
+  aioWrite(ctx->serverSocket, ctx->responses.data(), ctx->responses.size(), afWaitAll, 0, nullptr, nullptr);
+}
+
+static void httpStreamBodyCb(const void *data, size_t size, void *arg)
+{
+  HttpStreamTestContext *ctx = static_cast<HttpStreamTestContext*>(arg);
+  const char *p = static_cast<const char*>(data);
+  for (size_t i = 0; i < size; i++) {
+    if (p[i] != httpStreamPattern(ctx->received + i))
+      ctx->mismatch = true;
+  }
+
+  ctx->received += size;
+  if (++ctx->fragments % 8 == 0) {
+    ctx->pauses++;
+    httpClientPause(ctx->client);
+    userEventStartTimer(ctx->resumeEvent, 500, 1);
+  }
+}
+
+static void httpStreamResumeCb(aioUserEvent *event, void *arg)
+{
+  __UNUSED(event);
+  httpClientResume(static_cast<HttpStreamTestContext*>(arg)->client);
+}
+
+static void httpStreamRequestCb(AsyncOpStatus status, HTTPClient *client, void *arg)
+{
+  HttpStreamTestContext *ctx = static_cast<HttpStreamTestContext*>(arg);
+  unsigned index = ctx->completed++;
+  ctx->status[index] = status;
+  ctx->resultCode[index] = ctx->stream.resultCode;
+  ctx->chunked[index] = ctx->stream.chunked;
+  ctx->contentLength[index] = ctx->stream.contentLength;
+  ctx->bodySize[index] = ctx->stream.bodySize;
+  ctx->received = 0;
+  if (status == aosSuccess && ctx->completed == 1)
+    aioHttpRequest(client, gHttpRequest, sizeof(gHttpRequest)-1, 5000000, httpParseStream, &ctx->stream, httpStreamRequestCb, ctx);
+  else
+    postQuitOperation(ctx->base);
+}
+
+static void httpStreamConnectCb(AsyncOpStatus status, HTTPClient *client, void *arg)
+{
+  HttpStreamTestContext *ctx = static_cast<HttpStreamTestContext*>(arg);
+  if (status == aosSuccess)
+    aioHttpRequest(client, gHttpRequest, sizeof(gHttpRequest)-1, 5000000, httpParseStream, &ctx->stream, httpStreamRequestCb, ctx);
+  else
+    postQuitOperation(ctx->base);
+}
+
+TEST(http, test_http_stream_pause_resume)
+{
+  HttpStreamTestContext context;
+  context.base = gBase;
+  context.serverSocket = nullptr;
+  context.received = 0;
+  context.fragments = 0;
+  context.pauses = 0;
+  context.completed = 0;
+  context.mismatch = false;
+  httpParseStreamInit(&context.stream, httpStreamBodyCb, &context);
+
+  char header[128];
+  snprintf(header, sizeof(header), "HTTP/1.1 200 OK\r\nContent-Length: %zu\r\n\r\n", gHttpStreamBodySize);
+  context.responses = header;
+  for (size_t i = 0; i < gHttpStreamBodySize; i++)
+    context.responses.push_back(httpStreamPattern(i));
+  context.responses.append("HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n");
+  for (unsigned chunk = 0; chunk < gHttpStreamChunksNum; chunk++) {
+    snprintf(header, sizeof(header), "%zx\r\n", gHttpStreamChunkSize);
+    context.responses.append(header);
+    for (size_t i = 0; i < gHttpStreamChunkSize; i++)
+      context.responses.push_back(httpStreamPattern(chunk*gHttpStreamChunkSize + i));
+    context.responses.append("\r\n");
+  }
+  context.responses.append("0\r\n\r\n");
+
+  context.listener = startTCPServer(gBase, httpStreamAcceptCb, &context, gPort);
+  ASSERT_NE(context.listener, nullptr);
+  context.resumeEvent = newUserEvent(gBase, 0, httpStreamResumeCb, &context);
+
+  HostAddress address;
+  address.family = AF_INET;
+  address.ipv4 = inet_addr("127.0.0.1");
+  address.port = htons(gPort);
+  socketTy fd = socketCreate(AF_INET, SOCK_STREAM, IPPROTO_TCP, 1);
+  context.client = httpClientNew(gBase, newSocketIo(gBase, fd));
+  aioHttpConnect(context.client, &address, nullptr, 1000000, httpStreamConnectCb, &context);
+  asyncLoop(gBase);
+
+  httpClientDelete(context.client);
+  deleteAioObject(context.listener);
+  if (context.serverSocket)
+    deleteAioObject(context.serverSocket);
+  aioUserEvent *event = newUserEvent(gBase, 0, httpPoolDrainCb, gBase);
+  userEventStartTimer(event, 20000, 1);
+  asyncLoop(gBase);
+  deleteUserEvent(event);
+  deleteUserEvent(context.resumeEvent);
+
+  ASSERT_EQ(context.completed, 2u);
+  EXPECT_FALSE(context.mismatch);
+  EXPECT_GT(context.pauses, 0u);
+  EXPECT_EQ(context.status[0], aosSuccess);
+  EXPECT_EQ(context.resultCode[0], 200u);
+  EXPECT_EQ(context.chunked[0], 0);
+  EXPECT_EQ(context.contentLength[0], gHttpStreamBodySize);
+  EXPECT_EQ(context.bodySize[0], gHttpStreamBodySize);
+  EXPECT_EQ(context.status[1], aosSuccess);
+  EXPECT_EQ(context.resultCode[1], 200u);
+  EXPECT_EQ(context.chunked[1], 1);
+  EXPECT_EQ(context.bodySize[1], gHttpStreamChunkSize * gHttpStreamChunksNum);
+}
+
+static constexpr unsigned gHttp2SmallRequests = 200;
+static constexpr size_t gHttp2UploadSize = 3 << 20;
+static constexpr size_t gHttp2PriorityBodySize = 512 << 10;
+
+__NO_PADDING_BEGIN
+struct Http2TestContext {
+  asyncBase *base;
+  aioObject *listener;
+  HTTP2Connection *server;
+  HTTP2Connection *client;
+  std::string upload;
+  std::string priorityBody;
+  unsigned expected;
+  unsigned completed;
+  unsigned failures;
+  unsigned mismatches;
+  // Completion order of urgency 7 and urgency 0 requests
+  unsigned lowCompleted;
+  unsigned highCompleted;
+  Http2TestContext(asyncBase *baseArg) :
+    base(baseArg), listener(nullptr), server(nullptr), client(nullptr), expected(0), completed(0), failures(0), mismatches(0), lowCompleted(0), highCompleted(0) {}
+};
+
+struct Http2RequestContext {
+  Http2TestContext *ctx;
+  std::string expectedBody;
+  unsigned *completedAt;
+};
+__NO_PADDING_END
+
+static void http2ServerRequestCb(HTTP2Stream *stream, const HTTP2Message *request, void *arg)
+{
+  Http2TestContext *ctx = static_cast<Http2TestContext*>(arg);
+  std::string path(request->path.data, request->path.size);
+  std::string body;
+  if (path == "/upload") {
+    // Upload checked by server, size returned
+    const char *p = static_cast<const char*>(request->body);
+    body = (request->bodySize == ctx->upload.size() && memcmp(p, ctx->upload.data(), request->bodySize) == 0) ? std::to_string(request->bodySize) : "mismatch";
+  } else if (path == "/priority") {
+    body = ctx->priorityBody;
+  } else {
+    body = "response " + path;
+  }
+
+  HTTP2Header header;
+  header.name.data = "content-type";
+  header.name.size = 12;
+  header.value.data = "text/plain";
+  header.value.size = 10;
+  http2Respond(stream, 200, &header, 1, body.data(), body.size());
+}
+
+static void http2AcceptCb(AsyncOpStatus status, aioObject *listener, HostAddress client, socketTy acceptSocket, void *arg)
+{
+  __UNUSED(listener);
+  __UNUSED(client);
+  Http2TestContext *ctx = static_cast<Http2TestContext*>(arg);
+  if (status == aosSuccess)
+    ctx->server = http2ServerNew(ctx->base, newSocketIo(ctx->base, acceptSocket), http2ServerRequestCb, ctx);
+}
+
+static void http2TestResponseCb(AsyncOpStatus status, HTTP2Connection *connection, const HTTP2Message *response, void *arg)
+{
+  __UNUSED(connection);
+  Http2RequestContext *request = static_cast<Http2RequestContext*>(arg);
+  Http2TestContext *ctx = request->ctx;
+  ctx->completed++;
+  if (status != aosSuccess || response->status != 200) {
+    ctx->failures++;
+  } else {
+    bool contentType = response->headersNum > 0 && response->headers[0].name.size == 12 && memcmp(response->headers[0].name.data, "content-type", 12) == 0;
+    if (!contentType || response->bodySize != request->expectedBody.size() || memcmp(response->body, request->expectedBody.data(), response->bodySize) != 0)
+      ctx->mismatches++;
+  }
+
+  if (request->completedAt)
+    *request->completedAt = ctx->completed;
+  if (ctx->completed == ctx->expected)
+    postQuitOperation(ctx->base);
+}
+
+static void http2TestConnectCb(AsyncOpStatus status, HTTP2Connection *connection, void *arg)
+{
+  Http2RequestContext *requests = static_cast<Http2RequestContext*>(arg);
+  Http2TestContext *ctx = requests[0].ctx;
+  if (status != aosSuccess) {
+    ctx->failures++;
+    postQuitOperation(ctx->base);
+    return;
+  }
+
+  // Less urgent request sent first, but its response must complete last
+  aioHttp2Request(connection, "GET", "localhost", "/priority", nullptr, 0, nullptr, 0, 7, 5000000, http2TestResponseCb, &requests[0]);
+  aioHttp2Request(connection, "GET", "localhost", "/priority", nullptr, 0, nullptr, 0, 0, 5000000, http2TestResponseCb, &requests[1]);
+  for (unsigned i = 0; i < gHttp2SmallRequests; i++) {
+    std::string path = "/" + std::to_string(i);
+    aioHttp2Request(connection, "GET", "localhost", path.c_str(), nullptr, 0, nullptr, 0, 3, 5000000, http2TestResponseCb, &requests[3+i]);
+  }
+
+  aioHttp2Request(connection, "POST", "localhost", "/upload", nullptr, 0, ctx->upload.data(), ctx->upload.size(), 3, 5000000, http2TestResponseCb, &requests[2]);
+}
+
+TEST(http, test_http2_multiplexing)
+{
+  Http2TestContext context(gBase);
+  for (size_t i = 0; i < gHttp2UploadSize; i++)
+    context.upload.push_back(static_cast<char>('a' + i % 26));
+  for (size_t i = 0; i < gHttp2PriorityBodySize; i++)
+    context.priorityBody.push_back(static_cast<char>('A' + i % 26));
+
+  std::vector<Http2RequestContext> requests(3 + gHttp2SmallRequests);
+  for (auto &request: requests) {
+    request.ctx = &context;
+    request.completedAt = nullptr;
+  }
+  requests[0].expectedBody = context.priorityBody;
+  requests[0].completedAt = &context.lowCompleted;
+  requests[1].expectedBody = context.priorityBody;
+  requests[1].completedAt = &context.highCompleted;
+  requests[2].expectedBody = std::to_string(gHttp2UploadSize);
+  for (unsigned i = 0; i < gHttp2SmallRequests; i++)
+    requests[3+i].expectedBody = "response /" + std::to_string(i);
+  context.expected = static_cast<unsigned>(requests.size());
+
+  context.listener = startTCPServer(gBase, http2AcceptCb, &context, gPort);
+  ASSERT_NE(context.listener, nullptr);
+  HostAddress address;
+  address.family = AF_INET;
+  address.ipv4 = inet_addr("127.0.0.1");
+  address.port = htons(gPort);
+  socketTy fd = socketCreate(AF_INET, SOCK_STREAM, IPPROTO_TCP, 1);
+  context.client = http2ClientNew(gBase, newSocketIo(gBase, fd));
+  aioHttp2Connect(context.client, &address, nullptr, 1000000, http2TestConnectCb, requests.data());
+  asyncLoop(gBase);
+
+  HTTP2Stats clientStats;
+  HTTP2Stats serverStats;
+  memset(&serverStats, 0, sizeof(serverStats));
+  http2ConnectionGetStats(context.client, &clientStats);
+  if (context.server)
+    http2ConnectionGetStats(context.server, &serverStats);
+
+  http2ConnectionDelete(context.client);
+  if (context.server)
+    http2ConnectionDelete(context.server);
+  deleteAioObject(context.listener);
+  aioUserEvent *event = newUserEvent(gBase, 0, httpPoolDrainCb, gBase);
+  userEventStartTimer(event, 20000, 1);
+  asyncLoop(gBase);
+  deleteUserEvent(event);
+
+  EXPECT_EQ(context.completed, context.expected);
+  EXPECT_EQ(context.failures, 0u);
+  EXPECT_EQ(context.mismatches, 0u);
+  EXPECT_LT(context.highCompleted, context.lowCompleted);
+  // All requests multiplexed over one connection
+  EXPECT_EQ(clientStats.streams, static_cast<uint64_t>(context.expected));
+  EXPECT_EQ(serverStats.streams, static_cast<uint64_t>(context.expected));
+  EXPECT_GT(clientStats.peakStreams, 100u);
+  // Upload larger than initial connection window, so DATA waits WINDOW_UPDATE
+  EXPECT_GT(clientStats.flowControlStalls, 0u);
+}
+
+static void http2HeaderLimitConnectCb(AsyncOpStatus status, HTTP2Connection *connection, void *arg)
+{
+  Http2RequestContext *requests = static_cast<Http2RequestContext*>(arg);
+  Http2TestContext *ctx = requests[0].ctx;
+  if (status != aosSuccess) {
+    ctx->failures++;
+    postQuitOperation(ctx->base);
+    return;
+  }
+
+  // Header list over SETTINGS_MAX_HEADER_LIST_SIZE, Huffman coded block still fits limit of encoded block
+  std::string value(70000, 'a');
+  HTTP2Header header;
+  header.name.data = "x-large";
+  header.name.size = 7;
+  header.value.data = value.data();
+  header.value.size = value.size();
+  aioHttp2Request(connection, "GET", "localhost", "/large", &header, 1, nullptr, 0, 3, 5000000, http2TestResponseCb, &requests[0]);
+  aioHttp2Request(connection, "GET", "localhost", "/0", nullptr, 0, nullptr, 0, 3, 5000000, http2TestResponseCb, &requests[1]);
+}
+
+TEST(http, test_http2_header_list_limit)
+{
+  Http2TestContext context(gBase);
+  std::vector<Http2RequestContext> requests(2);
+  for (auto &request: requests) {
+    request.ctx = &context;
+    request.completedAt = nullptr;
+  }
+  requests[1].expectedBody = "response /0";
+  context.expected = static_cast<unsigned>(requests.size());
+
+  context.listener = startTCPServer(gBase, http2AcceptCb, &context, gPort);
+  ASSERT_NE(context.listener, nullptr);
+  HostAddress address;
+  address.family = AF_INET;
+  address.ipv4 = inet_addr("127.0.0.1");
+  address.port = htons(gPort);
+  socketTy fd = socketCreate(AF_INET, SOCK_STREAM, IPPROTO_TCP, 1);
+  context.client = http2ClientNew(gBase, newSocketIo(gBase, fd));
+  aioHttp2Connect(context.client, &address, nullptr, 1000000, http2HeaderLimitConnectCb, requests.data());
+  asyncLoop(gBase);
+
+  http2ConnectionDelete(context.client);
+  if (context.server)
+    http2ConnectionDelete(context.server);
+  deleteAioObject(context.listener);
+  aioUserEvent *event = newUserEvent(gBase, 0, httpPoolDrainCb, gBase);
+  userEventStartTimer(event, 20000, 1);
+  asyncLoop(gBase);
+  deleteUserEvent(event);
+
+  // Only oversized stream reset, connection still serves other requests
+  EXPECT_EQ(context.completed, context.expected);
+  EXPECT_EQ(context.failures, 1u);
+  EXPECT_EQ(context.mismatches, 0u);
+}
+
+__NO_PADDING_BEGIN
+struct Http2RawTestContext {
+  asyncBase *base;
+  aioObject *listener;
+  HTTP2Connection *server;
+  aioObject *client;
+  std::string frames;
+  // Server frames received by raw client
+  std::string received;
+  uint8_t buffer[4096];
+  unsigned requests;
+  int serverClosed;
+};
+__NO_PADDING_END
+
+// Client preface followed by empty SETTINGS
+static void http2RawAppendPreface(std::string &out)
+{
+  static const char preface[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+  out.append(preface, sizeof(preface)-1);
+  out.append(std::string("\x00\x00\x00\x04\x00\x00\x00\x00\x00", 9));
+}
+
+// Error code of first received RST_STREAM or GOAWAY frame with given stream id, UINT32_MAX if none
+static uint32_t http2RawErrorCode(const std::string &in, uint8_t type, uint32_t streamId)
+{
+  const uint8_t *p = reinterpret_cast<const uint8_t*>(in.data());
+  size_t offset = 0;
+  while (in.size() - offset >= 9) {
+    size_t length = (static_cast<size_t>(p[offset]) << 16) | (static_cast<size_t>(p[offset+1]) << 8) | p[offset+2];
+    uint32_t id = (static_cast<uint32_t>(p[offset+5] & 0x7F) << 24) | (static_cast<uint32_t>(p[offset+6]) << 16) |
+                  (static_cast<uint32_t>(p[offset+7]) << 8) | p[offset+8];
+    if (in.size() - offset - 9 < length)
+      break;
+    // Error code follows last stream id in GOAWAY
+    size_t codeOffset = offset + 9 + (type == 7 ? 4 : 0);
+    if (p[offset+3] == type && id == streamId && offset + 9 + length >= codeOffset + 4)
+      return (static_cast<uint32_t>(p[codeOffset]) << 24) | (static_cast<uint32_t>(p[codeOffset+1]) << 16) |
+             (static_cast<uint32_t>(p[codeOffset+2]) << 8) | p[codeOffset+3];
+    offset += 9 + length;
+  }
+
+  return UINT32_MAX;
+}
+
+static void http2RawAppendFrame(std::string &out, uint8_t type, uint8_t flags, uint32_t streamId, const std::string &payload)
+{
+  uint8_t header[9] = {
+    static_cast<uint8_t>(payload.size() >> 16), static_cast<uint8_t>(payload.size() >> 8), static_cast<uint8_t>(payload.size()),
+    type, flags,
+    static_cast<uint8_t>(streamId >> 24), static_cast<uint8_t>(streamId >> 16), static_cast<uint8_t>(streamId >> 8), static_cast<uint8_t>(streamId)
+  };
+  out.append(reinterpret_cast<const char*>(header), sizeof(header));
+  out.append(payload);
+}
+
+static void http2RawRequestCb(HTTP2Stream *stream, const HTTP2Message *request, void *arg)
+{
+  __UNUSED(request);
+  Http2RawTestContext *ctx = static_cast<Http2RawTestContext*>(arg);
+  ctx->requests++;
+  http2Respond(stream, 200, nullptr, 0, nullptr, 0);
+}
+
+static void http2RawCloseCb(HTTP2Connection *connection, void *arg)
+{
+  __UNUSED(connection);
+  static_cast<Http2RawTestContext*>(arg)->serverClosed = 1;
+}
+
+static void http2RawAcceptCb(AsyncOpStatus status, aioObject *listener, HostAddress client, socketTy acceptSocket, void *arg)
+{
+  __UNUSED(listener);
+  __UNUSED(client);
+  Http2RawTestContext *ctx = static_cast<Http2RawTestContext*>(arg);
+  if (status == aosSuccess) {
+    ctx->server = http2ServerNew(ctx->base, newSocketIo(ctx->base, acceptSocket), http2RawRequestCb, ctx);
+    http2ConnectionSetCloseCallback(ctx->server, http2RawCloseCb, ctx);
+  }
+}
+
+static void http2RawReadCb(AsyncOpStatus status, aioObject *socket, size_t transferred, void *arg)
+{
+  Http2RawTestContext *ctx = static_cast<Http2RawTestContext*>(arg);
+  // Read finished by disconnect or timeout
+  if (status == aosSuccess) {
+    ctx->received.append(reinterpret_cast<const char*>(ctx->buffer), transferred);
+    aioRead(socket, ctx->buffer, sizeof(ctx->buffer), afNone, 3000000, http2RawReadCb, ctx);
+  } else {
+    postQuitOperation(ctx->base);
+  }
+}
+
+static void http2RawConnectCb(AsyncOpStatus status, aioObject *socket, void *arg)
+{
+  Http2RawTestContext *ctx = static_cast<Http2RawTestContext*>(arg);
+  if (status != aosSuccess) {
+    postQuitOperation(ctx->base);
+    return;
+  }
+
+  aioWrite(socket, ctx->frames.data(), ctx->frames.size(), afWaitAll, 0, nullptr, nullptr);
+  aioRead(socket, ctx->buffer, sizeof(ctx->buffer), afNone, 3000000, http2RawReadCb, ctx);
+}
+
+// Sends prepared frames to HTTP/2 server and collects its answer until disconnect
+static void http2RawExchange(Http2RawTestContext &context)
+{
+  context.base = gBase;
+  context.server = nullptr;
+  context.requests = 0;
+  context.serverClosed = 0;
+  context.listener = startTCPServer(gBase, http2RawAcceptCb, &context, gPort);
+  ASSERT_NE(context.listener, nullptr);
+  context.client = initializeTCPClient(gBase, http2RawConnectCb, &context, gPort);
+  asyncLoop(gBase);
+
+  deleteAioObject(context.client);
+  if (context.server)
+    http2ConnectionDelete(context.server);
+  deleteAioObject(context.listener);
+  aioUserEvent *event = newUserEvent(gBase, 0, httpPoolDrainCb, gBase);
+  userEventStartTimer(event, 20000, 1);
+  asyncLoop(gBase);
+  deleteUserEvent(event);
+}
+
+// :method POST, :scheme http, :path /, :authority literal without indexing
+static const std::string gHttp2RawHeaderBlock("\x83\x86\x84\x01\x09localhost", 14);
+
+TEST(http, test_http2_flow_control_overrun)
+{
+  Http2RawTestContext context;
+
+  // Three streams with incomplete bodies, each under body limit, together over connection window;
+  // client ignores flow control and never gets connection WINDOW_UPDATE
+  http2RawAppendPreface(context.frames);
+  const std::string data(16384, 'a');
+  for (uint32_t streamId = 1; streamId <= 5; streamId += 2) {
+    http2RawAppendFrame(context.frames, 1, 0x4, streamId, gHttp2RawHeaderBlock);
+    for (unsigned i = 0; i < 400; i++)
+      http2RawAppendFrame(context.frames, 0, 0, streamId, data);
+  }
+
+  http2RawExchange(context);
+
+  // Server closed connection by FLOW_CONTROL_ERROR instead of buffering all DATA
+  EXPECT_NE(context.server, nullptr);
+  EXPECT_EQ(context.serverClosed, 1);
+  EXPECT_EQ(context.requests, 0u);
+}
+
+TEST(http, test_http2_window_update_stream_errors)
+{
+  Http2RawTestContext context;
+
+  // Zero increment on stream 1, stream 3 window over 2^31-1; empty PING closes connection at end
+  http2RawAppendPreface(context.frames);
+  http2RawAppendFrame(context.frames, 1, 0x4, 1, gHttp2RawHeaderBlock);
+  http2RawAppendFrame(context.frames, 8, 0, 1, std::string("\x00\x00\x00\x00", 4));
+  http2RawAppendFrame(context.frames, 1, 0x4, 3, gHttp2RawHeaderBlock);
+  http2RawAppendFrame(context.frames, 8, 0, 3, std::string("\x7F\xFF\xFF\xFF", 4));
+  http2RawAppendFrame(context.frames, 6, 0, 0, std::string());
+  http2RawExchange(context);
+
+  EXPECT_EQ(http2RawErrorCode(context.received, 3, 1), 1u);
+  EXPECT_EQ(http2RawErrorCode(context.received, 3, 3), 3u);
+  EXPECT_EQ(http2RawErrorCode(context.received, 7, 0), 6u);
+  EXPECT_EQ(context.serverClosed, 1);
+  EXPECT_EQ(context.requests, 0u);
+}
+
+TEST(http, test_http2_settings_errors)
+{
+  const std::string initialWindow("\x00\x04\x00\x01\x00\x00", 6);
+  {
+    // SETTINGS on stream 1
+    Http2RawTestContext context;
+    http2RawAppendPreface(context.frames);
+    http2RawAppendFrame(context.frames, 4, 0, 1, std::string());
+    http2RawExchange(context);
+    EXPECT_EQ(http2RawErrorCode(context.received, 7, 0), 1u);
+  }
+  {
+    // SETTINGS ACK with payload
+    Http2RawTestContext context;
+    http2RawAppendPreface(context.frames);
+    http2RawAppendFrame(context.frames, 4, 0x1, 0, initialWindow);
+    http2RawExchange(context);
+    EXPECT_EQ(http2RawErrorCode(context.received, 7, 0), 6u);
+  }
+  {
+    // Stream window raised to 2^31-1, then INITIAL_WINDOW_SIZE 65536 adds one more byte
+    Http2RawTestContext context;
+    http2RawAppendPreface(context.frames);
+    http2RawAppendFrame(context.frames, 1, 0x4, 1, gHttp2RawHeaderBlock);
+    http2RawAppendFrame(context.frames, 8, 0, 1, std::string("\x7F\xFF\x00\x00", 4));
+    http2RawAppendFrame(context.frames, 4, 0, 0, initialWindow);
+    http2RawExchange(context);
+    EXPECT_EQ(http2RawErrorCode(context.received, 7, 0), 3u);
+    EXPECT_EQ(context.serverClosed, 1);
+  }
+}
+
+TEST(http, test_http2_stream_state_errors)
+{
+  {
+    // HEADERS on even stream id
+    Http2RawTestContext context;
+    http2RawAppendPreface(context.frames);
+    http2RawAppendFrame(context.frames, 1, 0x5, 2, gHttp2RawHeaderBlock);
+    http2RawExchange(context);
+    EXPECT_EQ(http2RawErrorCode(context.received, 7, 0), 1u);
+    EXPECT_EQ(context.requests, 0u);
+  }
+  {
+    // HEADERS on stream id lower than already used one
+    Http2RawTestContext context;
+    http2RawAppendPreface(context.frames);
+    http2RawAppendFrame(context.frames, 1, 0x5, 3, gHttp2RawHeaderBlock);
+    http2RawAppendFrame(context.frames, 1, 0x5, 1, gHttp2RawHeaderBlock);
+    http2RawExchange(context);
+    EXPECT_EQ(http2RawErrorCode(context.received, 7, 0), 1u);
+    EXPECT_EQ(context.requests, 1u);
+  }
+  {
+    // HEADERS on closed stream
+    Http2RawTestContext context;
+    http2RawAppendPreface(context.frames);
+    http2RawAppendFrame(context.frames, 1, 0x5, 1, gHttp2RawHeaderBlock);
+    http2RawAppendFrame(context.frames, 1, 0x5, 1, gHttp2RawHeaderBlock);
+    http2RawExchange(context);
+    EXPECT_EQ(http2RawErrorCode(context.received, 7, 0), 1u);
+    EXPECT_EQ(context.requests, 1u);
+  }
+  {
+    // DATA on closed stream resets it, empty PING closes connection at end
+    Http2RawTestContext context;
+    http2RawAppendPreface(context.frames);
+    http2RawAppendFrame(context.frames, 1, 0x5, 1, gHttp2RawHeaderBlock);
+    http2RawAppendFrame(context.frames, 0, 0, 1, std::string("abc"));
+    http2RawAppendFrame(context.frames, 6, 0, 0, std::string());
+    http2RawExchange(context);
+    EXPECT_EQ(http2RawErrorCode(context.received, 3, 1), 5u);
+    EXPECT_EQ(http2RawErrorCode(context.received, 7, 0), 6u);
+    EXPECT_EQ(context.requests, 1u);
+  }
+  {
+    // DATA on idle stream
+    Http2RawTestContext context;
+    http2RawAppendPreface(context.frames);
+    http2RawAppendFrame(context.frames, 0, 0, 5, std::string("abc"));
+    http2RawExchange(context);
+    EXPECT_EQ(http2RawErrorCode(context.received, 7, 0), 1u);
+  }
+}
@@ -0,0 +1,1500 @@
+#include "unittest.h"
+#include "asyncio/coroutine.h"
+#include "asyncio/socket.h"
+#include <string.h>
+#include <thread>
+#include <vector>
+
+static constexpr unsigned gP2PNodesNum = 3;
+
+__NO_PADDING_BEGIN
+struct P2PTestServer {
+  p2pNode *node;
+  aioUserEvent *sleepEvent;
+  // Response delay
+  uint64_t delay;
+  // Requests left without response
+  bool drop;
+  unsigned requests;
+  unsigned responses;
+  // Signals received and their total size
+  unsigned signals;
+  size_t signalBytes;
+};
+
+struct P2PTestContext {
+  asyncBase *base;
+  P2PTestServer servers[gP2PNodesNum];
+  p2pNode *client;
+  aioUserEvent *sleepEvent;
+  // Peer requests before concurrent phase
+  uint64_t workersBefore[gP2PNodesNum];
+  unsigned workersRunning;
+  unsigned failures;
+  bool connected;
+  // Callback requests
+  AsyncOpStatus callbackStatus;
+  unsigned callbackResponses;
+  char callbackOut[32];
+};
+__NO_PADDING_END
+
+static void p2pDrainCb(aioUserEvent *event, void *arg)
+{
+  __UNUSED(event);
+  postQuitOperation(static_cast<asyncBase*>(arg));
+}
+
+static void p2pDrain(asyncBase *base, uint64_t timeout)
+{
+  aioUserEvent *event = newUserEvent(base, 0, p2pDrainCb, base);
+  userEventStartTimer(event, timeout, 1);
+  asyncLoop(base);
+  deleteUserEvent(event);
+}
+
+static void p2pEchoHandler(p2pPeer *peer, uint32_t id, void *data, size_t size, void *arg)
+{
+  P2PTestServer *server = static_cast<P2PTestServer*>(arg);
+  server->requests++;
+  if (server->drop) {
+    server->responses++;
+    return;
+  }
+  if (server->delay)
+    ioSleep(server->sleepEvent, server->delay);
+  iop2pSend(peer->connection, data, id, p2pMsgResponse, static_cast<uint32_t>(size), afNone, 1000000);
+  server->responses++;
+}
+
+static void p2pStartNodes(P2PTestContext *ctx)
+{
+  HostAddress addresses[gP2PNodesNum];
+  memset(ctx, 0, sizeof(P2PTestContext));
+  ctx->base = gBase;
+  ctx->sleepEvent = newUserEvent(gBase, 0, nullptr, nullptr);
+  for (unsigned i = 0; i < gP2PNodesNum; i++) {
+    HostAddress listenAddress;
+    listenAddress.family = AF_INET;
+    listenAddress.ipv4 = INADDR_ANY;
+    listenAddress.port = htons(static_cast<uint16_t>(gPort + 1 + i));
+    P2PTestServer &server = ctx->servers[i];
+    server.node = p2pNode::createNode(gBase, &listenAddress, "p2ptest", true);
+    ASSERT_NE(server.node, nullptr);
+    server.node->setRequestHandler(p2pEchoHandler, &server);
+    server.sleepEvent = newUserEvent(gBase, 0, nullptr, nullptr);
+    addresses[i].family = AF_INET;
+    addresses[i].ipv4 = inet_addr("127.0.0.1");
+    addresses[i].port = listenAddress.port;
+  }
+
+  ctx->client = p2pNode::createClient(gBase, addresses, gP2PNodesNum, "p2ptest");
+}
+
+static void p2pStopNodes(P2PTestContext *ctx)
+{
+  // Server peers finish after client connections closed
+  delete ctx->client;
+  p2pDrain(ctx->base, 50000);
+  // Peers accepted from node closed before next node deleted
+  for (unsigned i = 0; i < gP2PNodesNum; i++) {
+    delete ctx->servers[i].node;
+    deleteUserEvent(ctx->servers[i].sleepEvent);
+    p2pDrain(ctx->base, 20000);
+  }
+  deleteUserEvent(ctx->sleepEvent);
+}
+
+static bool p2pWaitAllConnected(P2PTestContext *ctx)
+{
+  for (unsigned attempt = 0; attempt < 300; attempt++) {
+    unsigned connected = 0;
+    for (auto peer: ctx->client->peers())
+      connected += peer->_connected;
+    if (connected == gP2PNodesNum)
+      return true;
+    ioSleep(ctx->sleepEvent, 10000);
+  }
+
+  return false;
+}
+
+static void p2pWaitServersIdle(P2PTestContext *ctx)
+{
+  for (unsigned i = 0; i < gP2PNodesNum; i++) {
+    while (ctx->servers[i].responses != ctx->servers[i].requests)
+      ioSleep(ctx->sleepEvent, 10000);
+  }
+}
+
+static bool p2pEchoRequest(P2PTestContext *ctx, uint64_t key, bool keyed)
+{
+  char request[32];
+  char response[32];
+  snprintf(request, sizeof(request), "request %llu", static_cast<unsigned long long>(key));
+  uint32_t size = static_cast<uint32_t>(strlen(request) + 1);
+  bool result = keyed ?
+    ctx->client->ioRequest(key, request, size, 3000000, response, sizeof(response)) :
+    ctx->client->ioRequest(request, size, 3000000, response, sizeof(response));
+  return result && strcmp(request, response) == 0;
+}
+
+static void p2pPeerRequests(P2PTestContext *ctx, uint64_t *requests)
+{
+  for (unsigned i = 0; i < gP2PNodesNum; i++)
+    requests[i] = ctx->client->peers()[i]->stats.requests;
+}
+
+static void p2pWorker(void *arg)
+{
+  P2PTestContext *ctx = static_cast<P2PTestContext*>(arg);
+  for (unsigned i = 0; i < 20; i++) {
+    if (!p2pEchoRequest(ctx, i, false))
+      ctx->failures++;
+  }
+
+  if (--ctx->workersRunning == 0)
+    postQuitOperation(ctx->base);
+}
+
+static void p2pSelectProc(void *arg)
+{
+  P2PTestContext *ctx = static_cast<P2PTestContext*>(arg);
+  p2pNode *client = ctx->client;
+  ctx->connected = p2pWaitAllConnected(ctx);
+  if (!ctx->connected) {
+    postQuitOperation(ctx->base);
+    return;
+  }
+
+  uint64_t before[gP2PNodesNum];
+  uint64_t after[gP2PNodesNum];
+
+  // Round-robin: equal share
+  client->setPeerSelectStrategy(p2pSelectRoundRobin);
+  p2pPeerRequests(ctx, before);
+  for (unsigned i = 0; i < 30; i++)
+    EXPECT_TRUE(p2pEchoRequest(ctx, i, false));
+  p2pPeerRequests(ctx, after);
+  for (unsigned i = 0; i < gP2PNodesNum; i++)
+    EXPECT_EQ(after[i] - before[i], 10u);
+
+  // Consistent hashing: same key always on same peer, different keys spread over all peers
+  client->setPeerSelectStrategy(p2pSelectConsistentHash);
+  p2pPeerRequests(ctx, before);
+  for (unsigned i = 0; i < 20; i++)
+    EXPECT_TRUE(p2pEchoRequest(ctx, 12345, true));
+  p2pPeerRequests(ctx, after);
+  unsigned owners = 0;
+  for (unsigned i = 0; i < gP2PNodesNum; i++) {
+    if (after[i] != before[i]) {
+      owners++;
+      EXPECT_EQ(after[i] - before[i], 20u);
+    }
+  }
+  EXPECT_EQ(owners, 1u);
+
+  p2pPeerRequests(ctx, before);
+  for (unsigned i = 0; i < 300; i++)
+    EXPECT_TRUE(p2pEchoRequest(ctx, i, true));
+  p2pPeerRequests(ctx, after);
+  for (unsigned i = 0; i < gP2PNodesNum; i++)
+    EXPECT_GT(after[i] - before[i], 40u);
+
+  // Power of two choices: slow peer loses every comparison after first response
+  ctx->servers[2].delay = 10000;
+  client->setPeerSelectStrategy(p2pSelectPowerOfTwo);
+  p2pPeerRequests(ctx, before);
+  for (unsigned i = 0; i < 60; i++)
+    EXPECT_TRUE(p2pEchoRequest(ctx, i, false));
+  p2pPeerRequests(ctx, after);
+  EXPECT_LE(after[2] - before[2], 2u);
+
+  // Least outstanding: concurrent requests pile up on slow peer, new ones go to fast peers
+  client->setPeerSelectStrategy(p2pSelectLeastOutstanding);
+  p2pPeerRequests(ctx, ctx->workersBefore);
+  ctx->workersRunning = 4;
+  for (unsigned i = 0; i < 4; i++)
+    coroutineCall(coroutineNew(p2pWorker, ctx, 0x10000));
+}
+
+TEST(p2p, peer_select_strategies)
+{
+  P2PTestContext context;
+  p2pStartNodes(&context);
+  if (HasFatalFailure())
+    return;
+
+  coroutineCall(coroutineNew(p2pSelectProc, &context, 0x10000));
+  asyncLoop(gBase);
+  EXPECT_TRUE(context.connected);
+
+  if (context.connected) {
+    EXPECT_EQ(context.failures, 0u);
+    uint64_t total = 0;
+    for (auto peer: context.client->peers()) {
+      EXPECT_EQ(peer->stats.inFlight, 0u);
+      EXPECT_EQ(peer->stats.failures, 0u);
+      EXPECT_EQ(peer->stats.requests, peer->stats.responses);
+      total += peer->stats.requests;
+    }
+
+    EXPECT_EQ(total, 30u + 20u + 300u + 60u + 80u);
+    // EWMA reflects response delay
+    EXPECT_GT(context.client->peers()[2]->stats.latency, 5000.0);
+    EXPECT_LT(context.client->peers()[0]->stats.latency, 5000.0);
+    // Fast peers take most of concurrent requests
+    uint64_t slowRequests = context.client->peers()[2]->stats.requests - context.workersBefore[2];
+    EXPECT_LT(slowRequests, 80u/4);
+  }
+
+  p2pStopNodes(&context);
+}
+
+static void p2pFanoutCb(AsyncOpStatus status, p2pNode *node, unsigned responsesNum, void *arg)
+{
+  __UNUSED(node);
+  P2PTestContext *ctx = static_cast<P2PTestContext*>(arg);
+  ctx->callbackStatus = status;
+  ctx->callbackResponses = responsesNum;
+  postQuitOperation(ctx->base);
+}
+
+static void p2pFanoutProc(void *arg)
+{
+  P2PTestContext *ctx = static_cast<P2PTestContext*>(arg);
+  p2pNode *client = ctx->client;
+  ctx->connected = p2pWaitAllConnected(ctx);
+  if (!ctx->connected) {
+    postQuitOperation(ctx->base);
+    return;
+  }
+
+  char request[] = "fanout";
+  char out[gP2PNodesNum][32];
+
+  // Quorum of all peers waits slow one
+  ctx->servers[2].delay = 50000;
+  timeMark beginPt = getTimeMark();
+  EXPECT_TRUE(client->ioRequestQuorum(3, 3, request, sizeof(request), 3000000, out, sizeof(out[0])));
+  EXPECT_GE(usDiff(beginPt, getTimeMark()), 40000u);
+  for (unsigned i = 0; i < gP2PNodesNum; i++)
+    EXPECT_STREQ(out[i], "fanout");
+
+  // Quorum of two fast peers
+  beginPt = getTimeMark();
+  memset(out, 0, sizeof(out));
+  EXPECT_TRUE(client->ioRequestQuorum(3, 2, request, sizeof(request), 3000000, out, sizeof(out[0])));
+  EXPECT_LT(usDiff(beginPt, getTimeMark()), 40000u);
+  EXPECT_STREQ(out[0], "fanout");
+  EXPECT_STREQ(out[1], "fanout");
+  EXPECT_EQ(out[2][0], 0);
+
+  // First of three
+  for (unsigned i = 0; i < 10; i++) {
+    beginPt = getTimeMark();
+    EXPECT_TRUE(client->ioRequestFirst(3, request, sizeof(request), 3000000, out[0], sizeof(out[0])));
+    EXPECT_LT(usDiff(beginPt, getTimeMark()), 40000u);
+  }
+
+  // Hedged: request of slow peer duplicated to fast peer after hedge delay
+  client->setPeerSelectStrategy(p2pSelectRoundRobin);
+  client->setHedgePolicy(0.95, 1000);
+  ctx->servers[2].delay = 0;
+  p2pWaitServersIdle(ctx);
+  for (unsigned i = 0; i < 30; i++)
+    EXPECT_TRUE(client->ioRequest(request, sizeof(request), 3000000, out[0], sizeof(out[0])));
+  ctx->servers[2].delay = 50000;
+  for (unsigned i = 0; i < 30; i++) {
+    beginPt = getTimeMark();
+    EXPECT_TRUE(client->ioRequestHedged(request, sizeof(request), 3000000, out[0], sizeof(out[0])));
+    EXPECT_STREQ(out[0], "fanout");
+    EXPECT_LT(usDiff(beginPt, getTimeMark()), 40000u);
+  }
+
+  // Not enough peers for quorum
+  EXPECT_FALSE(client->ioRequestQuorum(5, 4, request, sizeof(request), 3000000, out, sizeof(out[0])));
+
+  ctx->servers[2].delay = 0;
+  p2pWaitServersIdle(ctx);
+  postQuitOperation(ctx->base);
+}
+
+TEST(p2p, hedged_and_fanout_requests)
+{
+  P2PTestContext context;
+  p2pStartNodes(&context);
+  if (HasFatalFailure())
+    return;
+
+  coroutineCall(coroutineNew(p2pFanoutProc, &context, 0x10000));
+  asyncLoop(gBase);
+  EXPECT_TRUE(context.connected);
+
+  if (context.connected) {
+    p2pPeer *slowPeer = context.client->peers()[2];
+    EXPECT_GT(slowPeer->stats.canceled, 10u);
+    for (auto peer: context.client->peers()) {
+      EXPECT_EQ(peer->stats.inFlight, 0u);
+      EXPECT_EQ(peer->stats.failures, 0u);
+    }
+
+    // Callback API outside of coroutine
+    char request[] = "callback";
+    context.client->aioRequestFirst(2, request, sizeof(request), 3000000, context.callbackOut, sizeof(context.callbackOut), p2pFanoutCb, &context);
+    asyncLoop(gBase);
+    EXPECT_EQ(context.callbackStatus, aosSuccess);
+    EXPECT_EQ(context.callbackResponses, 1u);
+    EXPECT_STREQ(context.callbackOut, "callback");
+  }
+
+  p2pStopNodes(&context);
+}
+
+__NO_PADDING_BEGIN
+struct P2PTableTestContext {
+  asyncBase *base;
+  p2pRequestTable *table;
+  std::vector<uint32_t> expired;
+  timeMark beginPt;
+  uint64_t lastExpireTime;
+};
+__NO_PADDING_END
+
+static void p2pTableTimeoutCb(uint32_t id, const p2pEventHandler &handler, void *arg)
+{
+  __UNUSED(handler);
+  P2PTableTestContext *ctx = static_cast<P2PTableTestContext*>(arg);
+  ctx->expired.push_back(id);
+  ctx->lastExpireTime = usDiff(ctx->beginPt, getTimeMark());
+  if (ctx->table->size() == 1)
+    postQuitOperation(ctx->base);
+}
+
+TEST(p2p, request_table)
+{
+  P2PTableTestContext context;
+  context.base = gBase;
+  context.lastExpireTime = 0;
+  p2pRequestTable table(gBase, p2pTableTimeoutCb, &context, 4);
+  context.table = &table;
+
+  p2pEventHandler handler;
+  memset(&handler, 0, sizeof(handler));
+
+  // Ids unique and not zero, table grows beyond initial size
+  std::vector<uint32_t> ids;
+  for (unsigned i = 0; i < 1000; i++) {
+    handler.outSize = i;
+    uint32_t id = table.insert(handler, 0);
+    EXPECT_NE(id, 0u);
+    ids.push_back(id);
+  }
+  EXPECT_EQ(table.size(), 1000u);
+  for (unsigned i = 0; i < 1000; i++) {
+    p2pEventHandler *found = table.find(ids[i]);
+    ASSERT_NE(found, nullptr);
+    EXPECT_EQ(found->outSize, i);
+  }
+
+  // Reused slot gets new generation, old id not matched
+  p2pEventHandler removed;
+  EXPECT_TRUE(table.remove(ids[10], &removed));
+  EXPECT_EQ(removed.outSize, 10u);
+  EXPECT_FALSE(table.remove(ids[10], nullptr));
+  std::vector<std::pair<uint32_t, p2pEventHandler>> all;
+  table.removeAll(all);
+  EXPECT_EQ(all.size(), 999u);
+  EXPECT_EQ(table.size(), 0u);
+  for (unsigned i = 0; i < 1000; i++) {
+    uint32_t id = table.insert(handler, 0);
+    EXPECT_EQ(table.find(ids[i]), nullptr);
+    EXPECT_NE(id, ids[i]);
+  }
+  all.clear();
+  table.removeAll(all);
+
+  // Sub-second deadlines expire in deadline order, removed requests never expire
+  context.beginPt = getTimeMark();
+  uint32_t late = table.insert(handler, 60000);
+  uint32_t early = table.insert(handler, 20000);
+  uint32_t canceled = table.insert(handler, 10000);
+  uint32_t persistent = table.insert(handler, 0);
+  EXPECT_TRUE(table.remove(canceled, nullptr));
+  asyncLoop(gBase);
+  ASSERT_EQ(context.expired.size(), 2u);
+  EXPECT_EQ(context.expired[0], early);
+  EXPECT_EQ(context.expired[1], late);
+  EXPECT_GE(context.lastExpireTime, 55000u);
+  EXPECT_LT(context.lastExpireTime, 500000u);
+  EXPECT_NE(table.find(persistent), nullptr);
+}
+
+static void p2pTimeoutProc(void *arg)
+{
+  P2PTestContext *ctx = static_cast<P2PTestContext*>(arg);
+  p2pNode *client = ctx->client;
+  ctx->connected = p2pWaitAllConnected(ctx);
+  if (!ctx->connected) {
+    postQuitOperation(ctx->base);
+    return;
+  }
+
+  // First peer does not answer, request retried on second one after 50ms timeout
+  char request[] = "timeout";
+  char out[32];
+  ctx->servers[0].drop = true;
+  client->setPeerSelectStrategy(p2pSelectRoundRobin);
+  timeMark beginPt = getTimeMark();
+  EXPECT_TRUE(client->ioRequest(request, sizeof(request), 50000, out, sizeof(out)));
+  uint64_t elapsed = usDiff(beginPt, getTimeMark());
+  EXPECT_GE(elapsed, 45000u);
+  EXPECT_LT(elapsed, 500000u);
+  EXPECT_STREQ(out, "timeout");
+  EXPECT_EQ(client->peers()[0]->stats.failures, 1u);
+  EXPECT_EQ(client->peers()[1]->stats.responses, 1u);
+  postQuitOperation(ctx->base);
+}
+
+TEST(p2p, request_timeout_failover)
+{
+  P2PTestContext context;
+  p2pStartNodes(&context);
+  if (HasFatalFailure())
+    return;
+
+  coroutineCall(coroutineNew(p2pTimeoutProc, &context, 0x10000));
+  asyncLoop(gBase);
+  EXPECT_TRUE(context.connected);
+  p2pStopNodes(&context);
+}
+
+static void p2pHealthProc(void *arg)
+{
+  P2PTestContext *ctx = static_cast<P2PTestContext*>(arg);
+  p2pNode *client = ctx->client;
+  ctx->connected = p2pWaitAllConnected(ctx);
+  if (!ctx->connected) {
+    postQuitOperation(ctx->base);
+    return;
+  }
+
+  // Peer without responses loses health after few timeouts and gets probe requests only
+  char request[] = "health";
+  char out[32];
+  p2pPeer *sick = client->peers()[0];
+  ctx->servers[0].drop = true;
+  client->setPeerSelectStrategy(p2pSelectRoundRobin);
+  for (unsigned i = 0; i < 60; i++)
+    EXPECT_TRUE(client->ioRequest(request, sizeof(request), 20000, out, sizeof(out)));
+  EXPECT_LT(sick->stats.health, P2P_HEALTH_MIN);
+  EXPECT_EQ(sick->stats.responses, 0u);
+  EXPECT_LT(sick->stats.requests, 12u);
+  EXPECT_DOUBLE_EQ(client->peers()[1]->stats.health, 1.0);
+  EXPECT_DOUBLE_EQ(client->peers()[2]->stats.health, 1.0);
+
+  // Probes restore health of answering peer
+  ctx->servers[0].drop = false;
+  for (unsigned i = 0; i < 2000 && sick->stats.health < P2P_HEALTH_MIN; i++)
+    EXPECT_TRUE(client->ioRequest(request, sizeof(request), 1000000, out, sizeof(out)));
+  EXPECT_GE(sick->stats.health, P2P_HEALTH_MIN);
+  EXPECT_GT(sick->stats.responses, 0u);
+  p2pWaitServersIdle(ctx);
+  postQuitOperation(ctx->base);
+}
+
+TEST(p2p, peer_health)
+{
+  P2PTestContext context;
+  p2pStartNodes(&context);
+  if (HasFatalFailure())
+    return;
+
+  coroutineCall(coroutineNew(p2pHealthProc, &context, 0x10000));
+  asyncLoop(gBase);
+  EXPECT_TRUE(context.connected);
+  p2pStopNodes(&context);
+}
+
+static constexpr unsigned gP2PPoolSize = 2;
+
+struct P2PPoolContext {
+  p2pNode *client;
+  HostAddress address;
+  P2PTestServer server;
+  aioUserEvent *sleepEvent;
+};
+
+static void p2pPoolProc(void *arg)
+{
+  P2PPoolContext *ctx = static_cast<P2PPoolContext*>(arg);
+  p2pNode *client = ctx->client;
+
+  // No node at address: attempts of every pool connection repeated with growing delay, wait
+  // for connection expires by node timer at its own deadline, sub-second one included
+  timeMark beginPt = getTimeMark();
+  EXPECT_FALSE(client->ioWaitForConnection(200000));
+  uint64_t elapsed = usDiff(beginPt, getTimeMark());
+  EXPECT_GE(elapsed, 190000u);
+  EXPECT_LT(elapsed, 600000u);
+  timeMark waitPt = getTimeMark();
+  EXPECT_FALSE(client->ioWaitForConnection(1000000));
+  uint64_t waitElapsed = usDiff(waitPt, getTimeMark());
+  EXPECT_GE(waitElapsed, 990000u);
+  EXPECT_LT(waitElapsed, 1500000u);
+  elapsed = usDiff(beginPt, getTimeMark());
+  for (auto peer: client->peers()) {
+    EXPECT_FALSE(peer->_connected);
+    EXPECT_GE(peer->stats.connectFailures, 10u);
+    EXPECT_LE(peer->stats.connectFailures, elapsed/20000 + 4);
+  }
+
+  // All connections of pool established after node started
+  HostAddress listenAddress = ctx->address;
+  listenAddress.ipv4 = INADDR_ANY;
+  ctx->server.node = p2pNode::createNode(gBase, &listenAddress, "p2ptest", true);
+  ASSERT_NE(ctx->server.node, nullptr);
+  ctx->server.node->setRequestHandler(p2pEchoHandler, &ctx->server);
+  EXPECT_TRUE(client->ioWaitForConnection(3000000));
+  for (unsigned attempt = 0; attempt < 100; attempt++) {
+    unsigned connected = 0;
+    for (auto peer: client->peers())
+      connected += peer->_connected;
+    if (connected == gP2PPoolSize)
+      break;
+    ioSleep(ctx->sleepEvent, 10000);
+  }
+
+  char request[] = "pool";
+  char out[32];
+  client->setPeerSelectStrategy(p2pSelectRoundRobin);
+  for (unsigned i = 0; i < 20; i++)
+    EXPECT_TRUE(client->ioRequest(request, sizeof(request), 1000000, out, sizeof(out)));
+  for (auto peer: client->peers()) {
+    EXPECT_TRUE(peer->_connected);
+    EXPECT_EQ(peer->stats.responses, 20u/gP2PPoolSize);
+  }
+  EXPECT_EQ(ctx->server.node->peers().size(), gP2PPoolSize);
+  postQuitOperation(gBase);
+}
+
+TEST(p2p, connection_pool_and_backoff)
+{
+  P2PPoolContext context;
+  memset(&context, 0, sizeof(context));
+  context.address.family = AF_INET;
+  context.address.ipv4 = inet_addr("127.0.0.1");
+  context.address.port = htons(static_cast<uint16_t>(gPort + 1));
+  context.sleepEvent = newUserEvent(gBase, 0, nullptr, nullptr);
+  context.client = p2pNode::createClient(gBase, &context.address, 1, "p2ptest", gP2PPoolSize);
+  context.client->setReconnectPolicy(10000, 40000);
+  ASSERT_EQ(context.client->peers().size(), gP2PPoolSize);
+
+  coroutineCall(coroutineNew(p2pPoolProc, &context, 0x10000));
+  asyncLoop(gBase);
+
+  delete context.client;
+  p2pDrain(gBase, 50000);
+  delete context.server.node;
+  p2pDrain(gBase, 20000);
+  deleteUserEvent(context.sleepEvent);
+}
+
+static unsigned p2pServerRequests(P2PTestContext *ctx)
+{
+  unsigned requests = 0;
+  for (unsigned i = 0; i < gP2PNodesNum; i++)
+    requests += ctx->servers[i].requests;
+  return requests;
+}
+
+static void p2pMessageSizeProc(void *arg)
+{
+  P2PTestContext *ctx = static_cast<P2PTestContext*>(arg);
+  p2pNode *client = ctx->client;
+  ctx->connected = p2pWaitAllConnected(ctx);
+  if (!ctx->connected) {
+    postQuitOperation(ctx->base);
+    return;
+  }
+
+  // Limit of servers received in handshake
+  for (auto peer: client->peers())
+    EXPECT_EQ(peer->connection->remoteMaxMsgSize, 4u << 20);
+
+  // Response over default 64Kb limit received into stream
+  std::vector<uint8_t> request(1u << 20);
+  for (size_t i = 0; i < request.size(); i++)
+    request[i] = static_cast<uint8_t>(i * 7);
+  xmstream out;
+  for (unsigned i = 0; i < 3; i++) {
+    ASSERT_TRUE(client->ioRequest(request.data(), static_cast<uint32_t>(request.size()), 3000000, out));
+    ASSERT_EQ(out.sizeOf(), request.size());
+    EXPECT_EQ(memcmp(out.data(), request.data(), request.size()), 0);
+  }
+
+  // Small response into stream with external buffer
+  char external[8];
+  xmstream externalOut(external, sizeof(external));
+  char small[] = "small";
+  EXPECT_TRUE(client->ioRequest(small, sizeof(small), 3000000, externalOut));
+  EXPECT_EQ(externalOut.sizeOf(), sizeof(small));
+  EXPECT_STREQ(externalOut.data<char>(), "small");
+
+  // Response larger than output buffer fails at once without retry
+  char shortOut[16];
+  unsigned requestsBefore = p2pServerRequests(ctx);
+  timeMark beginPt = getTimeMark();
+  EXPECT_FALSE(client->ioRequest(request.data(), 1000, 1000000, shortOut, sizeof(shortOut)));
+  EXPECT_LT(usDiff(beginPt, getTimeMark()), 500000u);
+  p2pWaitServersIdle(ctx);
+  EXPECT_EQ(p2pServerRequests(ctx), requestsBefore + 1);
+
+  // Request over server limit not sent
+  std::vector<uint8_t> huge((4u << 20) + 1);
+  requestsBefore = p2pServerRequests(ctx);
+  EXPECT_FALSE(client->ioRequest(huge.data(), static_cast<uint32_t>(huge.size()), 1000000, out));
+  EXPECT_EQ(p2pServerRequests(ctx), requestsBefore);
+  for (auto peer: client->peers())
+    EXPECT_TRUE(peer->_connected);
+  postQuitOperation(ctx->base);
+}
+
+TEST(p2p, message_size_and_response_buffers)
+{
+  P2PTestContext context;
+  p2pStartNodes(&context);
+  if (HasFatalFailure())
+    return;
+
+  for (unsigned i = 0; i < gP2PNodesNum; i++)
+    context.servers[i].node->setMaxMessageSize(4u << 20);
+  context.client->setMaxMessageSize(4u << 20);
+  coroutineCall(coroutineNew(p2pMessageSizeProc, &context, 0x10000));
+  asyncLoop(gBase);
+  EXPECT_TRUE(context.connected);
+  p2pStopNodes(&context);
+}
+
+static void p2pCompressionProc(void *arg)
+{
+  P2PTestContext *ctx = static_cast<P2PTestContext*>(arg);
+  p2pNode *client = ctx->client;
+  ctx->connected = p2pWaitAllConnected(ctx);
+  if (!ctx->connected) {
+    postQuitOperation(ctx->base);
+    return;
+  }
+
+  // Third server does not offer compression
+  uint32_t supported = p2pCompressionSupported();
+  EXPECT_EQ(client->peers()[0]->connection->compression, supported);
+  EXPECT_EQ(client->peers()[1]->connection->compression, supported);
+  EXPECT_EQ(client->peers()[2]->connection->compression, 0u);
+
+  std::vector<uint8_t> text(100000);
+  for (size_t i = 0; i < text.size(); i++)
+    text[i] = static_cast<uint8_t>("compressible message "[i % 21]);
+  std::vector<uint8_t> noise(text.size());
+  uint64_t random = 88172645463325252ULL;
+  for (size_t i = 0; i < noise.size(); i++) {
+    random ^= random << 13;
+    random ^= random >> 7;
+    random ^= random << 17;
+    noise[i] = static_cast<uint8_t>(random);
+  }
+
+  uint32_t packedSize;
+  uint32_t flag;
+  p2pConnection *connection = client->peers()[0]->connection;
+  void *packed = p2pCompress(connection, text.data(), static_cast<uint32_t>(text.size()), &packedSize, &flag);
+  if (supported) {
+    ASSERT_NE(packed, nullptr);
+    EXPECT_LT(packedSize, text.size() / 10);
+    free(packed);
+  } else {
+    EXPECT_EQ(packed, nullptr);
+  }
+  EXPECT_EQ(p2pCompress(connection, noise.data(), static_cast<uint32_t>(noise.size()), &packedSize, &flag), nullptr);
+  EXPECT_EQ(p2pCompress(connection, text.data(), 100, &packedSize, &flag), nullptr);
+
+  // Compressed and plain messages to all peers in both directions
+  client->setPeerSelectStrategy(p2pSelectRoundRobin);
+  xmstream out;
+  for (unsigned i = 0; i < 6; i++) {
+    std::vector<uint8_t> &request = i % 2 ? noise : text;
+    ASSERT_TRUE(client->ioRequest(request.data(), static_cast<uint32_t>(request.size()), 3000000, out));
+    ASSERT_EQ(out.sizeOf(), request.size());
+    EXPECT_EQ(memcmp(out.data(), request.data(), request.size()), 0);
+  }
+
+  std::vector<uint8_t> fixedOut(text.size());
+  for (unsigned i = 0; i < 3; i++) {
+    ASSERT_TRUE(client->ioRequest(text.data(), static_cast<uint32_t>(text.size()), 3000000, fixedOut.data(), static_cast<uint32_t>(fixedOut.size())));
+    EXPECT_EQ(memcmp(fixedOut.data(), text.data(), text.size()), 0);
+  }
+
+  postQuitOperation(ctx->base);
+}
+
+TEST(p2p, compression)
+{
+  P2PTestContext context;
+  p2pStartNodes(&context);
+  if (HasFatalFailure())
+    return;
+
+  uint32_t codecs = p2pCompressionLZ4 | p2pCompressionZstd;
+  for (unsigned i = 0; i < gP2PNodesNum; i++) {
+    context.servers[i].node->setMaxMessageSize(1u << 20);
+    if (i != 2)
+      context.servers[i].node->setCompression(codecs, 1024, nullptr);
+  }
+  context.client->setMaxMessageSize(1u << 20);
+  context.client->setCompression(codecs, 1024, nullptr);
+  coroutineCall(coroutineNew(p2pCompressionProc, &context, 0x10000));
+  asyncLoop(gBase);
+  EXPECT_TRUE(context.connected);
+  p2pStopNodes(&context);
+}
+
+__NO_PADDING_BEGIN
+struct P2PProtoCompressionContext {
+  asyncBase *base;
+  aioObject *serverSocket;
+  aioObject *clientSocket;
+  std::vector<uint8_t> text;
+  bool serverFinished;
+  bool clientFinished;
+};
+__NO_PADDING_END
+
+static p2pErrorTy p2pCompressionAcceptCb(AsyncOpStatus status, p2pConnection *connection, p2pConnectData *data, void *arg)
+{
+  __UNUSED(status);
+  __UNUSED(connection);
+  __UNUSED(data);
+  __UNUSED(arg);
+  return p2pOk;
+}
+
+static void p2pCompressionRecvCb(AsyncOpStatus status, p2pConnection *connection, p2pHeader header, void *buffer, void *arg)
+{
+  P2PProtoCompressionContext *ctx = static_cast<P2PProtoCompressionContext*>(arg);
+  EXPECT_EQ(status, aosSuccess);
+  EXPECT_EQ(header.type, static_cast<uint32_t>(p2pMsgResponse));
+  EXPECT_EQ(header.size, ctx->text.size());
+  EXPECT_EQ(memcmp(buffer, ctx->text.data(), ctx->text.size()), 0);
+  free(buffer);
+  p2pConnectionDelete(connection);
+  ctx->clientFinished = true;
+}
+
+static void p2pCompressionServer(void *arg)
+{
+  P2PProtoCompressionContext *ctx = static_cast<P2PProtoCompressionContext*>(arg);
+  socketTy socket = ioAccept(ctx->serverSocket, 1000000);
+  ASSERT_GT(socket, 0);
+  p2pConnection *connection = p2pConnectionNew(newSocketIo(ctx->base, socket));
+  p2pConnectionSetCompression(connection, p2pCompressionLZ4 | p2pCompressionZstd, 1024, nullptr);
+  ASSERT_EQ(iop2pAccept(connection, 1000000, p2pCompressionAcceptCb, ctx), 0);
+  EXPECT_EQ(connection->compression, p2pCompressionSupported() & p2pCompressionLZ4);
+
+  // Compressed message received into plain buffer
+  std::vector<uint8_t> buffer(2*ctx->text.size());
+  p2pHeader header;
+  EXPECT_EQ(iop2pRecv(connection, buffer.data(), static_cast<uint32_t>(buffer.size()), afNone, 1000000, &header), static_cast<ssize_t>(ctx->text.size()));
+  EXPECT_EQ(header.type, static_cast<uint32_t>(p2pMsgRequest));
+  EXPECT_EQ(memcmp(buffer.data(), ctx->text.data(), ctx->text.size()), 0);
+  EXPECT_EQ(iop2pRecv(connection, buffer.data(), static_cast<uint32_t>(ctx->text.size()/2), afNone, 1000000, &header), -aosBufferTooSmall);
+
+  iop2pSend(connection, ctx->text.data(), 1, p2pMsgResponse, static_cast<uint32_t>(ctx->text.size()), afNone, 1000000);
+  aioUserEvent *sleepEvent = newUserEvent(ctx->base, 0, nullptr, nullptr);
+  while (!ctx->clientFinished)
+    ioSleep(sleepEvent, 10000);
+  deleteUserEvent(sleepEvent);
+  p2pConnectionDelete(connection);
+  ctx->serverFinished = true;
+  postQuitOperation(ctx->base);
+}
+
+static void p2pCompressionClient(void *arg)
+{
+  P2PProtoCompressionContext *ctx = static_cast<P2PProtoCompressionContext*>(arg);
+  HostAddress address;
+  address.family = AF_INET;
+  address.ipv4 = inet_addr("127.0.0.1");
+  address.port = htons(gPort);
+  p2pConnectData data;
+  data.login = "p2pproto_compression_login";
+  data.password = "p2pproto_compression_password";
+  data.application = "p2pproto_compression_application";
+  p2pConnection *connection = p2pConnectionNew(ctx->clientSocket);
+  p2pConnectionSetCompression(connection, p2pCompressionLZ4, 1024, nullptr);
+  ASSERT_EQ(iop2pConnect(connection, &address, 1000000, &data), 0);
+  EXPECT_EQ(connection->compression, p2pCompressionSupported() & p2pCompressionLZ4);
+
+  uint32_t size = static_cast<uint32_t>(ctx->text.size());
+  iop2pSend(connection, ctx->text.data(), 1, p2pMsgRequest, size, afNone, 1000000);
+  iop2pSend(connection, ctx->text.data(), 2, p2pMsgRequest, size, afNone, 1000000);
+  aiop2pRecv(connection, malloc(size), size, afNone, 1000000, p2pCompressionRecvCb, ctx);
+}
+
+TEST(p2pproto, compression)
+{
+  P2PProtoCompressionContext context;
+  context.base = gBase;
+  context.text.resize(100000);
+  for (size_t i = 0; i < context.text.size(); i++)
+    context.text[i] = static_cast<uint8_t>("compressible message "[i % 21]);
+  context.serverFinished = false;
+  context.clientFinished = false;
+  context.serverSocket = startTCPServer(gBase, nullptr, &context, gPort);
+  context.clientSocket = initializeTCPClient(gBase, nullptr, &context, gPort);
+  ASSERT_NE(context.serverSocket, nullptr);
+  ASSERT_NE(context.clientSocket, nullptr);
+  coroutineCall(coroutineNew(p2pCompressionServer, &context, 0x10000));
+  coroutineCall(coroutineNew(p2pCompressionClient, &context, 0x10000));
+  asyncLoop(gBase);
+  deleteAioObject(context.serverSocket);
+  EXPECT_TRUE(context.serverFinished);
+  EXPECT_TRUE(context.clientFinished);
+}
+
+static constexpr unsigned gCompactMessagesNum = 1000;
+
+__NO_PADDING_BEGIN
+struct P2PProtoHeaderContext {
+  asyncBase *base;
+  aioObject *serverSocket;
+  aioObject *clientSocket;
+  uint32_t clientFeatures;
+  std::vector<uint8_t> large;
+  bool serverFinished;
+  bool clientFinished;
+};
+__NO_PADDING_END
+
+static void p2pHeaderRecvCb(AsyncOpStatus status, p2pConnection *connection, p2pHeader header, void *buffer, void *arg)
+{
+  P2PProtoHeaderContext *ctx = static_cast<P2PProtoHeaderContext*>(arg);
+  EXPECT_EQ(status, aosSuccess);
+  EXPECT_EQ(header.id, 0xFFFFFFFFu);
+  EXPECT_EQ(header.type, static_cast<uint32_t>(p2pMsgResponse));
+  EXPECT_EQ(header.size, ctx->large.size());
+  EXPECT_EQ(memcmp(buffer, ctx->large.data(), ctx->large.size()), 0);
+  free(buffer);
+  p2pConnectionDelete(connection);
+  ctx->clientFinished = true;
+}
+
+static void p2pHeaderServer(void *arg)
+{
+  P2PProtoHeaderContext *ctx = static_cast<P2PProtoHeaderContext*>(arg);
+  socketTy socket = ioAccept(ctx->serverSocket, 1000000);
+  ASSERT_GT(socket, 0);
+  p2pConnection *connection = p2pConnectionNew(newSocketIo(ctx->base, socket));
+  ASSERT_EQ(iop2pAccept(connection, 1000000, p2pCompressionAcceptCb, ctx), 0);
+  EXPECT_EQ(connection->features, ctx->clientFeatures);
+
+  // Small messages parsed from read buffer, received into buffer and stream by turns
+  uint8_t buffer[64];
+  p2pStream stream;
+  p2pHeader header;
+  for (unsigned i = 0; i < gCompactMessagesNum; i++) {
+    ssize_t result = (i % 2) ?
+      iop2pRecvStream(connection, stream, sizeof(buffer), afNone, 1000000, &header) :
+      iop2pRecv(connection, buffer, sizeof(buffer), afNone, 1000000, &header);
+    ASSERT_EQ(result, 16);
+    EXPECT_EQ(header.id, i*1000);
+    EXPECT_EQ(header.type, static_cast<uint32_t>(p2pMsgSignal));
+    const uint8_t *data = (i % 2) ? static_cast<const uint8_t*>(stream.data()) : buffer;
+    EXPECT_EQ(data[0], static_cast<uint8_t>(i));
+  }
+
+  // Message larger than read buffer and type out of type byte range
+  std::vector<uint8_t> large(ctx->large.size());
+  EXPECT_EQ(iop2pRecv(connection, large.data(), static_cast<uint32_t>(large.size()), afNone, 1000000, &header), static_cast<ssize_t>(large.size()));
+  EXPECT_EQ(header.type, 1000u);
+  EXPECT_EQ(large, ctx->large);
+  EXPECT_EQ(iop2pRecv(connection, buffer, 8, afNone, 1000000, &header), -aosBufferTooSmall);
+
+  iop2pSend(connection, ctx->large.data(), 0xFFFFFFFF, p2pMsgResponse, static_cast<uint32_t>(ctx->large.size()), afNone, 1000000);
+  aioUserEvent *sleepEvent = newUserEvent(ctx->base, 0, nullptr, nullptr);
+  while (!ctx->clientFinished)
+    ioSleep(sleepEvent, 10000);
+  deleteUserEvent(sleepEvent);
+  p2pConnectionDelete(connection);
+  ctx->serverFinished = true;
+  postQuitOperation(ctx->base);
+}
+
+static void p2pHeaderClient(void *arg)
+{
+  P2PProtoHeaderContext *ctx = static_cast<P2PProtoHeaderContext*>(arg);
+  HostAddress address;
+  address.family = AF_INET;
+  address.ipv4 = inet_addr("127.0.0.1");
+  address.port = htons(gPort);
+  p2pConnectData data;
+  data.login = "p2pproto_header_login";
+  data.password = "p2pproto_header_password";
+  data.application = "p2pproto_header_application";
+  p2pConnection *connection = p2pConnectionNew(ctx->clientSocket);
+  connection->featuresOffer = ctx->clientFeatures;
+  ASSERT_EQ(iop2pConnect(connection, &address, 1000000, &data), 0);
+  EXPECT_EQ(connection->features, ctx->clientFeatures);
+
+  uint8_t message[16] = {0};
+  for (unsigned i = 0; i < gCompactMessagesNum; i++) {
+    message[0] = static_cast<uint8_t>(i);
+    aiop2pSend(connection, message, i*1000, p2pMsgSignal, sizeof(message), afNone, 1000000, nullptr, nullptr);
+  }
+
+  uint32_t size = static_cast<uint32_t>(ctx->large.size());
+  iop2pSend(connection, ctx->large.data(), 1, 1000, size, afNone, 1000000);
+  iop2pSend(connection, ctx->large.data(), 2, p2pMsgRequest, 64, afNone, 1000000);
+  aiop2pRecv(connection, malloc(size), size, afNone, 1000000, p2pHeaderRecvCb, ctx);
+}
+
+TEST(p2pproto, compact_header)
+{
+  // Encoding: short header, escaped type, incomplete and malformed data
+  uint8_t data[P2P_COMPACT_HEADER_MAX_SIZE];
+  p2pHeader header;
+  size_t size = p2pEncodeCompactHeader(p2pHeader(300, p2pMsgSignal | p2pMsgFlagZstd, 16), data);
+  EXPECT_EQ(size, 4u);
+  for (size_t i = 0; i < size; i++)
+    EXPECT_EQ(p2pDecodeCompactHeader(data, i, &header), 0);
+  EXPECT_EQ(p2pDecodeCompactHeader(data, size, &header), 4);
+  EXPECT_EQ(header.id, 300u);
+  EXPECT_EQ(header.type, static_cast<uint32_t>(p2pMsgSignal | p2pMsgFlagZstd));
+  EXPECT_EQ(header.size, 16u);
+  size = p2pEncodeCompactHeader(p2pHeader(0xFFFFFFFF, 0xFFFFFFFF, UINT64_MAX), data);
+  EXPECT_EQ(size, static_cast<size_t>(P2P_COMPACT_HEADER_MAX_SIZE));
+  EXPECT_EQ(p2pDecodeCompactHeader(data, size, &header), P2P_COMPACT_HEADER_MAX_SIZE);
+  EXPECT_EQ(header.id, 0xFFFFFFFFu);
+  EXPECT_EQ(header.type, 0xFFFFFFFFu);
+  EXPECT_EQ(header.size, UINT64_MAX);
+  memset(data, 0xFF, sizeof(data));
+  data[0] = 0;
+  EXPECT_EQ(p2pDecodeCompactHeader(data, sizeof(data), &header), -1);
+
+  // Compact header negotiated by default, old format used when one side does not offer it
+  const uint32_t clientFeatures[] = {p2pFeatureCompactHeader, 0};
+  for (unsigned i = 0; i < 2; i++) {
+    P2PProtoHeaderContext context;
+    context.base = gBase;
+    context.clientFeatures = clientFeatures[i];
+    context.large.resize(100000);
+    for (size_t j = 0; j < context.large.size(); j++)
+      context.large[j] = static_cast<uint8_t>(j * 7);
+    context.serverFinished = false;
+    context.clientFinished = false;
+    context.serverSocket = startTCPServer(gBase, nullptr, &context, gPort);
+    context.clientSocket = initializeTCPClient(gBase, nullptr, &context, gPort);
+    ASSERT_NE(context.serverSocket, nullptr);
+    ASSERT_NE(context.clientSocket, nullptr);
+    coroutineCall(coroutineNew(p2pHeaderServer, &context, 0x10000));
+    coroutineCall(coroutineNew(p2pHeaderClient, &context, 0x10000));
+    asyncLoop(gBase);
+    deleteAioObject(context.serverSocket);
+    EXPECT_TRUE(context.serverFinished);
+    EXPECT_TRUE(context.clientFinished);
+  }
+}
+
+static constexpr unsigned gChunkSmallNum = 10;
+
+__NO_PADDING_BEGIN
+struct P2PProtoChunkContext {
+  asyncBase *base;
+  aioObject *serverSocket;
+  aioObject *clientSocket;
+  std::vector<uint8_t> large;
+  std::vector<uint8_t> other;
+  uint64_t streamed;
+  bool streamedLast;
+  bool received;
+  bool serverFinished;
+  bool clientFinished;
+};
+__NO_PADDING_END
+
+static bool p2pChunkHandler(p2pConnection *connection, uint32_t id, uint32_t type, uint64_t offset, const void *data, size_t size, bool last, void *arg)
+{
+  __UNUSED(connection);
+  P2PProtoChunkContext *ctx = static_cast<P2PProtoChunkContext*>(arg);
+  if (id != 7 || type != p2pMsgResponse)
+    return false;
+
+  EXPECT_EQ(offset, ctx->streamed);
+  EXPECT_LE(offset + size, ctx->large.size());
+  EXPECT_LE(size, static_cast<size_t>(P2P_DEFAULT_CHUNK_SIZE));
+  EXPECT_EQ(memcmp(data, ctx->large.data() + offset, size), 0);
+  ctx->streamed += size;
+  ctx->streamedLast = last;
+  return true;
+}
+
+static void p2pChunkServer(void *arg)
+{
+  P2PProtoChunkContext *ctx = static_cast<P2PProtoChunkContext*>(arg);
+  socketTy socket = ioAccept(ctx->serverSocket, 1000000);
+  ASSERT_GT(socket, 0);
+  p2pConnection *connection = p2pConnectionNew(newSocketIo(ctx->base, socket));
+  p2pConnectionSetChunkHandler(connection, p2pChunkHandler, ctx);
+  ASSERT_EQ(iop2pAccept(connection, 1000000, p2pCompressionAcceptCb, ctx), 0);
+  EXPECT_EQ(connection->features, static_cast<uint32_t>(p2pFeatureCompactHeader | p2pFeatureChunks));
+
+  // Small messages sent after first large one go between its chunks; large messages with same
+  // id and type arrive in send order, streamed message not received at all
+  std::vector<uint8_t> buffer(2*ctx->large.size());
+  p2pStream stream;
+  p2pHeader header;
+  unsigned smallBeforeLarge = 0;
+  unsigned largeNum = 0;
+  unsigned sameIdNum = 0;
+  bool endReceived = false;
+  for (unsigned i = 0; i < gChunkSmallNum + 4; i++) {
+    ssize_t result = (i % 2) ?
+      iop2pRecvStream(connection, stream, static_cast<uint32_t>(buffer.size()), afNone, 1000000, &header) :
+      iop2pRecv(connection, buffer.data(), static_cast<uint32_t>(buffer.size()), afNone, 1000000, &header);
+    ASSERT_GT(result, 0);
+    const uint8_t *data = (i % 2) ? static_cast<const uint8_t*>(stream.data()) : buffer.data();
+    if (header.id == 999) {
+      endReceived = true;
+      continue;
+    }
+    if (result == 16) {
+      EXPECT_EQ(header.type, static_cast<uint32_t>(p2pMsgSignal));
+      EXPECT_EQ(data[0], static_cast<uint8_t>(header.id - 100));
+      smallBeforeLarge += largeNum == 0;
+      continue;
+    }
+
+    largeNum++;
+    ASSERT_EQ(static_cast<size_t>(result), ctx->large.size());
+    if (header.id == 1) {
+      EXPECT_EQ(header.type, static_cast<uint32_t>(p2pMsgSignal));
+      const std::vector<uint8_t> &expected = sameIdNum++ ? ctx->other : ctx->large;
+      EXPECT_EQ(memcmp(data, expected.data(), expected.size()), 0);
+    } else {
+      EXPECT_EQ(header.id, 2u);
+      EXPECT_EQ(header.type, static_cast<uint32_t>(p2pMsgRequest));
+      EXPECT_EQ(memcmp(data, ctx->large.data(), ctx->large.size()), 0);
+    }
+  }
+
+  // Chunks of streamed message precede end message
+  EXPECT_TRUE(endReceived);
+  EXPECT_EQ(smallBeforeLarge, gChunkSmallNum);
+  EXPECT_EQ(largeNum, 3u);
+  EXPECT_EQ(sameIdNum, 2u);
+  EXPECT_EQ(ctx->streamed, ctx->large.size());
+  EXPECT_TRUE(ctx->streamedLast);
+
+  ctx->received = true;
+  aioUserEvent *sleepEvent = newUserEvent(ctx->base, 0, nullptr, nullptr);
+  while (!ctx->clientFinished)
+    ioSleep(sleepEvent, 10000);
+  deleteUserEvent(sleepEvent);
+  p2pConnectionDelete(connection);
+  ctx->serverFinished = true;
+  postQuitOperation(ctx->base);
+}
+
+static void p2pChunkClient(void *arg)
+{
+  P2PProtoChunkContext *ctx = static_cast<P2PProtoChunkContext*>(arg);
+  HostAddress address;
+  address.family = AF_INET;
+  address.ipv4 = inet_addr("127.0.0.1");
+  address.port = htons(gPort);
+  p2pConnectData data;
+  data.login = "p2pproto_chunk_login";
+  data.password = "p2pproto_chunk_password";
+  data.application = "p2pproto_chunk_application";
+  p2pConnection *connection = p2pConnectionNew(ctx->clientSocket);
+  ASSERT_EQ(iop2pConnect(connection, &address, 1000000, &data), 0);
+  EXPECT_EQ(connection->features, static_cast<uint32_t>(p2pFeatureCompactHeader | p2pFeatureChunks));
+
+  uint32_t size = static_cast<uint32_t>(ctx->large.size());
+  aiop2pSend(connection, ctx->large.data(), 1, p2pMsgSignal, size, afNone, 1000000, nullptr, nullptr);
+  uint8_t message[16] = {0};
+  for (unsigned i = 0; i < gChunkSmallNum; i++) {
+    message[0] = static_cast<uint8_t>(i);
+    aiop2pSend(connection, message, 100 + i, p2pMsgSignal, sizeof(message), afNone, 1000000, nullptr, nullptr);
+  }
+
+  aiop2pSend(connection, ctx->other.data(), 1, p2pMsgSignal, size, afNone, 1000000, nullptr, nullptr);
+  aiop2pSend(connection, ctx->large.data(), 2, p2pMsgRequest, size, afNone, 1000000, nullptr, nullptr);
+  EXPECT_EQ(iop2pSend(connection, ctx->large.data(), 7, p2pMsgResponse, size, afNone, 1000000), static_cast<ssize_t>(size));
+  EXPECT_EQ(iop2pSend(connection, message, 999, p2pMsgSignal, sizeof(message), afNone, 1000000), static_cast<ssize_t>(sizeof(message)));
+  aioUserEvent *sleepEvent = newUserEvent(ctx->base, 0, nullptr, nullptr);
+  while (!ctx->received)
+    ioSleep(sleepEvent, 10000);
+  deleteUserEvent(sleepEvent);
+  EXPECT_EQ(connection->sendQueueBytes, 0u);
+  p2pConnectionDelete(connection);
+  ctx->clientFinished = true;
+}
+
+TEST(p2pproto, chunked_messages)
+{
+  P2PProtoChunkContext context;
+  context.base = gBase;
+  context.large.resize(1u << 20);
+  context.other.resize(context.large.size());
+  for (size_t i = 0; i < context.large.size(); i++) {
+    context.large[i] = static_cast<uint8_t>(i * 7);
+    context.other[i] = static_cast<uint8_t>(i * 13);
+  }
+  context.streamed = 0;
+  context.streamedLast = false;
+  context.received = false;
+  context.serverFinished = false;
+  context.clientFinished = false;
+  context.serverSocket = startTCPServer(gBase, nullptr, &context, gPort);
+  context.clientSocket = initializeTCPClient(gBase, nullptr, &context, gPort);
+  ASSERT_NE(context.serverSocket, nullptr);
+  ASSERT_NE(context.clientSocket, nullptr);
+  coroutineCall(coroutineNew(p2pChunkServer, &context, 0x10000));
+  coroutineCall(coroutineNew(p2pChunkClient, &context, 0x10000));
+  asyncLoop(gBase);
+  deleteAioObject(context.serverSocket);
+  EXPECT_TRUE(context.serverFinished);
+  EXPECT_TRUE(context.clientFinished);
+}
+
+__NO_PADDING_BEGIN
+struct P2PProtoChunkLimitContext {
+  asyncBase *base;
+  aioObject *serverSocket;
+  aioObject *clientSocket;
+  // Client starts framesNum chunked messages and never finishes them
+  unsigned framesNum;
+  uint32_t frameSize;
+  ssize_t result;
+  bool received;
+  bool serverFinished;
+  bool clientFinished;
+};
+__NO_PADDING_END
+
+static void p2pChunkLimitServer(void *arg)
+{
+  P2PProtoChunkLimitContext *ctx = static_cast<P2PProtoChunkLimitContext*>(arg);
+  socketTy socket = ioAccept(ctx->serverSocket, 1000000);
+  ASSERT_GT(socket, 0);
+  p2pConnection *connection = p2pConnectionNew(newSocketIo(ctx->base, socket));
+  ASSERT_EQ(iop2pAccept(connection, 1000000, p2pCompressionAcceptCb, ctx), 0);
+  std::vector<uint8_t> buffer(P2P_DEFAULT_MAX_MESSAGE_SIZE);
+  p2pHeader header;
+  ctx->result = iop2pRecv(connection, buffer.data(), static_cast<uint32_t>(buffer.size()), afNone, 1000000, &header);
+  ctx->received = true;
+  aioUserEvent *sleepEvent = newUserEvent(ctx->base, 0, nullptr, nullptr);
+  while (!ctx->clientFinished)
+    ioSleep(sleepEvent, 10000);
+  deleteUserEvent(sleepEvent);
+  p2pConnectionDelete(connection);
+  ctx->serverFinished = true;
+  postQuitOperation(ctx->base);
+}
+
+static void p2pChunkLimitClient(void *arg)
+{
+  P2PProtoChunkLimitContext *ctx = static_cast<P2PProtoChunkLimitContext*>(arg);
+  HostAddress address;
+  address.family = AF_INET;
+  address.ipv4 = inet_addr("127.0.0.1");
+  address.port = htons(gPort);
+  p2pConnectData data;
+  data.login = "p2pproto_chunk_login";
+  data.password = "p2pproto_chunk_password";
+  data.application = "p2pproto_chunk_application";
+  p2pConnection *connection = p2pConnectionNew(ctx->clientSocket);
+  ASSERT_EQ(iop2pConnect(connection, &address, 1000000, &data), 0);
+  std::vector<uint8_t> frame(ctx->frameSize);
+  for (unsigned i = 0; i < ctx->framesNum; i++)
+    aiop2pSend(connection, frame.data(), i, p2pMsgSignal | p2pMsgFlagChunk, ctx->frameSize, afNone, 1000000, nullptr, nullptr);
+  aioUserEvent *sleepEvent = newUserEvent(ctx->base, 0, nullptr, nullptr);
+  while (!ctx->received)
+    ioSleep(sleepEvent, 10000);
+  deleteUserEvent(sleepEvent);
+  p2pConnectionDelete(connection);
+  ctx->clientFinished = true;
+}
+
+static ssize_t p2pChunkLimitRun(unsigned framesNum, uint32_t frameSize)
+{
+  P2PProtoChunkLimitContext context;
+  context.base = gBase;
+  context.framesNum = framesNum;
+  context.frameSize = frameSize;
+  context.result = 0;
+  context.received = false;
+  context.serverFinished = false;
+  context.clientFinished = false;
+  context.serverSocket = startTCPServer(gBase, nullptr, &context, gPort);
+  context.clientSocket = initializeTCPClient(gBase, nullptr, &context, gPort);
+  EXPECT_NE(context.serverSocket, nullptr);
+  EXPECT_NE(context.clientSocket, nullptr);
+  coroutineCall(coroutineNew(p2pChunkLimitServer, &context, 0x10000));
+  coroutineCall(coroutineNew(p2pChunkLimitClient, &context, 0x10000));
+  asyncLoop(gBase);
+  deleteAioObject(context.serverSocket);
+  EXPECT_TRUE(context.serverFinished);
+  EXPECT_TRUE(context.clientFinished);
+  return context.result;
+}
+
+TEST(p2pproto, chunked_messages_limits)
+{
+  // Too many messages reassembled at a time
+  EXPECT_EQ(p2pChunkLimitRun(P2P_MAX_CHUNK_STREAMS + 1, 16), -p2pMakeStatus(p2pStFormatError));
+  // Too many bytes buffered by incomplete messages, every one fits receive limit
+  uint32_t frameSize = P2P_DEFAULT_MAX_MESSAGE_SIZE - 1024;
+  EXPECT_EQ(p2pChunkLimitRun(P2P_CHUNK_BUFFERED_MESSAGES + 1, frameSize), -p2pMakeStatus(p2pStFormatError));
+}
+
+static void p2pSignalHandler(p2pPeer *peer, void *data, size_t size, void *arg)
+{
+  __UNUSED(peer);
+  P2PTestServer *server = static_cast<P2PTestServer*>(arg);
+  const uint8_t *p = static_cast<const uint8_t*>(data);
+  for (size_t i = 0; i < size; i++) {
+    if (p[i] != static_cast<uint8_t>(i * 13)) {
+      ADD_FAILURE() << "signal data mismatch at " << i;
+      break;
+    }
+  }
+  server->signals++;
+  server->signalBytes += size;
+}
+
+static bool p2pWaitSignals(P2PTestContext *ctx, P2PTestServer *clientCounter, const unsigned *expected, unsigned clientExpected)
+{
+  for (unsigned attempt = 0; attempt < 500; attempt++) {
+    bool done = clientCounter->signals == clientExpected;
+    for (unsigned i = 0; i < gP2PNodesNum; i++)
+      done &= ctx->servers[i].signals == expected[i];
+    if (done) {
+      // No duplicates arrive later
+      ioSleep(ctx->sleepEvent, 50000);
+      done = clientCounter->signals == clientExpected;
+      for (unsigned i = 0; i < gP2PNodesNum; i++)
+        done &= ctx->servers[i].signals == expected[i];
+      return done;
+    }
+    ioSleep(ctx->sleepEvent, 10000);
+  }
+
+  return false;
+}
+
+static void p2pBroadcastProc(void *arg)
+{
+  void **args = static_cast<void**>(arg);
+  P2PTestContext *ctx = static_cast<P2PTestContext*>(args[0]);
+  P2PTestServer *clientCounter = static_cast<P2PTestServer*>(args[1]);
+  ctx->connected = p2pWaitAllConnected(ctx);
+  for (unsigned attempt = 0; ctx->connected && attempt < 300; attempt++) {
+    // Node 0 connected to node 1, node 1 to node 2
+    if (ctx->servers[0].node->connected() && ctx->servers[1].node->connected())
+      break;
+    ioSleep(ctx->sleepEvent, 10000);
+  }
+  ctx->connected &= ctx->servers[0].node->connected() && ctx->servers[1].node->connected();
+  if (!ctx->connected) {
+    postQuitOperation(ctx->base);
+    return;
+  }
+
+  // Broadcast: every peer gets signal; next one skips peers with large message still in send queue
+  std::vector<uint8_t> data(16u << 20);
+  for (size_t i = 0; i < data.size(); i++)
+    data[i] = static_cast<uint8_t>(i * 13);
+  unsigned expected[gP2PNodesNum] = {1, 1, 1};
+  EXPECT_EQ(ctx->client->broadcast(data.data(), 1u << 20, 3000000), 3u);
+  EXPECT_TRUE(p2pWaitSignals(ctx, clientCounter, expected, 0));
+  for (unsigned i = 0; i < gP2PNodesNum; i++)
+    EXPECT_EQ(ctx->servers[i].signalBytes, 1u << 20);
+
+  ctx->client->setBroadcastWatermark(0);
+  EXPECT_EQ(ctx->client->broadcast(data.data(), static_cast<uint32_t>(data.size()), 3000000), 3u);
+  unsigned sent = ctx->client->broadcast(data.data(), 1024, 3000000);
+  uint64_t skipped = 0;
+  for (auto peer: ctx->client->peers())
+    skipped += peer->stats.signalsSkipped;
+  EXPECT_LT(sent, 3u);
+  EXPECT_EQ(sent + skipped, 3u);
+  for (unsigned i = 0; i < gP2PNodesNum; i++)
+    expected[i] += (ctx->client->peers()[i]->stats.signalsSkipped ? 1 : 2);
+  EXPECT_TRUE(p2pWaitSignals(ctx, clientCounter, expected, 0));
+  for (auto peer: ctx->client->peers())
+    EXPECT_EQ(peer->connection->sendQueueBytes, 0u);
+  ctx->client->setBroadcastWatermark(1u << 20);
+
+  // Gossip from client and from end of node chain reaches every node once
+  EXPECT_EQ(ctx->client->gossip(data.data(), 100, 3000000), 2u);
+  for (unsigned i = 0; i < gP2PNodesNum; i++)
+    expected[i]++;
+  EXPECT_TRUE(p2pWaitSignals(ctx, clientCounter, expected, 0));
+
+  EXPECT_EQ(ctx->servers[2].node->gossip(data.data(), 100, 3000000), 2u);
+  expected[0]++;
+  expected[1]++;
+  EXPECT_TRUE(p2pWaitSignals(ctx, clientCounter, expected, 1));
+  postQuitOperation(ctx->base);
+}
+
+TEST(p2p, broadcast_and_gossip)
+{
+  P2PTestContext context;
+  P2PTestServer clientCounter;
+  memset(&clientCounter, 0, sizeof(clientCounter));
+  p2pStartNodes(&context);
+  if (HasFatalFailure())
+    return;
+
+  context.client->setMaxMessageSize(32u << 20);
+  context.client->setSignalHandler(p2pSignalHandler, &clientCounter);
+  for (unsigned i = 0; i < gP2PNodesNum; i++) {
+    context.servers[i].node->setMaxMessageSize(32u << 20);
+    context.servers[i].node->setSignalHandler(p2pSignalHandler, &context.servers[i]);
+  }
+
+  for (unsigned i = 0; i + 1 < gP2PNodesNum; i++) {
+    HostAddress address;
+    address.family = AF_INET;
+    address.ipv4 = inet_addr("127.0.0.1");
+    address.port = htons(static_cast<uint16_t>(gPort + 2 + i));
+    context.servers[i].node->connectPeer(&address);
+  }
+
+  void *args[2] = {&context, &clientCounter};
+  coroutineCall(coroutineNew(p2pBroadcastProc, args, 0x10000));
+  asyncLoop(gBase);
+  EXPECT_TRUE(context.connected);
+  p2pStopNodes(&context);
+}
+
+static constexpr unsigned gMultithreadCoroutinesNum = 8;
+
+__NO_PADDING_BEGIN
+struct P2PMultithreadContext {
+  p2pNode *client;
+  unsigned nextId;
+  unsigned running;
+  unsigned failures;
+};
+__NO_PADDING_END
+
+static void p2pMultithreadProc(void *arg)
+{
+  // Coroutine resumed by threads of peers, requests made from all of them
+  P2PMultithreadContext *ctx = static_cast<P2PMultithreadContext*>(arg);
+  unsigned id = __uint_atomic_fetch_and_add(&ctx->nextId, 1);
+  for (unsigned i = 0; i < 50; i++) {
+    char request[32];
+    char response[32];
+    snprintf(request, sizeof(request), "request %u %u", id, i);
+    uint32_t size = static_cast<uint32_t>(strlen(request) + 1);
+    if (!ctx->client->ioRequest(request, size, 3000000, response, sizeof(response)) || strcmp(request, response) != 0)
+      __uint_atomic_fetch_and_add(&ctx->failures, 1);
+  }
+
+  char request[32];
+  char responses[2][32];
+  snprintf(request, sizeof(request), "quorum %u", id);
+  uint32_t size = static_cast<uint32_t>(strlen(request) + 1);
+  if (!ctx->client->ioRequestQuorum(3, 2, request, size, 3000000, responses, sizeof(responses[0])) ||
+      strcmp(request, responses[0]) != 0 ||
+      strcmp(request, responses[1]) != 0)
+    __uint_atomic_fetch_and_add(&ctx->failures, 1);
+
+  if (__uint_atomic_fetch_and_add(&ctx->running, static_cast<unsigned>(-1)) == 1)
+    postQuitOperation(gBase);
+}
+
+TEST(p2p, multithread_requests)
+{
+  asyncBase *clientBases[2] = {createAsyncBase(amOSDefault), createAsyncBase(amOSDefault)};
+  asyncBase *serverBases[2] = {gBase, clientBases[0]};
+  std::thread threads[2];
+  for (unsigned i = 0; i < 2; i++)
+    threads[i] = std::thread([](asyncBase *base) { asyncLoop(base); }, clientBases[i]);
+
+  // Connections of servers accepted by both threads
+  P2PTestServer servers[gP2PNodesNum];
+  HostAddress addresses[gP2PNodesNum];
+  memset(servers, 0, sizeof(servers));
+  for (unsigned i = 0; i < gP2PNodesNum; i++) {
+    HostAddress listenAddress;
+    listenAddress.family = AF_INET;
+    listenAddress.ipv4 = INADDR_ANY;
+    listenAddress.port = htons(static_cast<uint16_t>(gPort + 1 + i));
+    servers[i].node = p2pNode::createNode(serverBases, 2, &listenAddress, "p2ptest", true);
+    ASSERT_NE(servers[i].node, nullptr);
+    servers[i].node->setRequestHandler(p2pEchoHandler, &servers[i]);
+    servers[i].node->setSignalHandler(p2pSignalHandler, &servers[i]);
+    addresses[i].family = AF_INET;
+    addresses[i].ipv4 = inet_addr("127.0.0.1");
+    addresses[i].port = listenAddress.port;
+  }
+
+  P2PMultithreadContext context;
+  memset(&context, 0, sizeof(context));
+  context.client = p2pNode::createClient(clientBases, 2, addresses, gP2PNodesNum, "p2ptest");
+
+  bool connected = false;
+  for (unsigned attempt = 0; attempt < 300 && !connected; attempt++) {
+    p2pDrain(gBase, 10000);
+    connected = true;
+    for (auto peer: context.client->peers())
+      connected &= peer->_connected;
+  }
+  EXPECT_TRUE(connected);
+
+  // Peers distributed between threads
+  EXPECT_NE(context.client->peers()[0]->_worker, context.client->peers()[1]->_worker);
+  EXPECT_EQ(context.client->peers()[0]->_worker, context.client->peers()[2]->_worker);
+
+  if (connected) {
+    context.running = gMultithreadCoroutinesNum;
+    for (unsigned i = 0; i < gMultithreadCoroutinesNum; i++)
+      coroutineCall(coroutineNew(p2pMultithreadProc, &context, 0x10000));
+    asyncLoop(gBase);
+    EXPECT_EQ(context.failures, 0u);
+
+    uint8_t signal[64];
+    for (size_t i = 0; i < sizeof(signal); i++)
+      signal[i] = static_cast<uint8_t>(i * 13);
+    EXPECT_EQ(context.client->broadcast(signal, sizeof(signal), 1000000), gP2PNodesNum);
+    bool received = false;
+    for (unsigned attempt = 0; attempt < 300 && !received; attempt++) {
+      p2pDrain(gBase, 10000);
+      received = true;
+      for (unsigned i = 0; i < gP2PNodesNum; i++)
+        received &= __uint_atomic_fetch_and_add(&servers[i].signals, 0) == 1;
+    }
+    EXPECT_TRUE(received);
+  }
+
+  // Node and its peers deleted with stopped threads
+  for (unsigned i = 0; i < 2; i++) {
+    postQuitOperation(clientBases[i]);
+    threads[i].join();
+  }
+
+  delete context.client;
+  for (unsigned i = 0; i < 2; i++)
+    p2pDrain(clientBases[i], 50000);
+  p2pDrain(gBase, 50000);
+  for (unsigned i = 0; i < gP2PNodesNum; i++) {
+    delete servers[i].node;
+    p2pDrain(gBase, 20000);
+    p2pDrain(clientBases[0], 20000);
+  }
+}
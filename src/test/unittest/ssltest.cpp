@@ -0,0 +1,661 @@
+#include "unittest.h"
+#include "asyncio/http2.h"
+#include "asyncio/socket.h"
+#include "asyncio/socketSSL.h"
+#include <openssl/evp.h>
+#include <openssl/ec.h>
+#include <openssl/x509.h>
+#include <string.h>
+#include <string>
+
+__NO_PADDING_BEGIN
+struct SSLTestContext {
+  asyncBase *base;
+  SSLContext *serverContext;
+  SSLContext *clientContext;
+  aioObject *listener;
+  SSLSocket *serverSockets[2];
+  unsigned serverConnections;
+  unsigned clientRound;
+  int serverReused[2];
+  int clientReused[2];
+  bool echoValid[2];
+  uint8_t serverBuffer[4];
+  uint8_t clientBuffer[4];
+  SSLTestContext(asyncBase *baseArg) : base(baseArg), serverConnections(0), clientRound(0) {
+    for (unsigned i = 0; i < 2; i++) {
+      serverSockets[i] = nullptr;
+      serverReused[i] = -1;
+      clientReused[i] = -1;
+      echoValid[i] = false;
+    }
+  }
+};
+__NO_PADDING_END
+
+// Self-signed EC certificate, generated once per test run
+static bool generateCertificate(X509 **certificate, EVP_PKEY **key)
+{
+  *key = nullptr;
+  EVP_PKEY_CTX *keyContext = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, nullptr);
+  if (!keyContext ||
+      EVP_PKEY_keygen_init(keyContext) <= 0 ||
+      EVP_PKEY_CTX_set_ec_paramgen_curve_nid(keyContext, NID_X9_62_prime256v1) <= 0 ||
+      EVP_PKEY_keygen(keyContext, key) <= 0) {
+    EVP_PKEY_CTX_free(keyContext);
+    return false;
+  }
+  EVP_PKEY_CTX_free(keyContext);
+
+  X509 *x509 = X509_new();
+  ASN1_INTEGER_set(X509_get_serialNumber(x509), 1);
+  X509_gmtime_adj(X509_getm_notBefore(x509), 0);
+  X509_gmtime_adj(X509_getm_notAfter(x509), 3600);
+  X509_set_pubkey(x509, *key);
+  X509_NAME *name = X509_get_subject_name(x509);
+  X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, reinterpret_cast<const unsigned char*>("localhost"), -1, -1, 0);
+  X509_set_issuer_name(x509, name);
+  if (!X509_sign(x509, *key, EVP_sha256())) {
+    X509_free(x509);
+    EVP_PKEY_free(*key);
+    return false;
+  }
+
+  *certificate = x509;
+  return true;
+}
+
+static void sslClientConnect(SSLTestContext *ctx);
+
+static void sslServerWriteCb(AsyncOpStatus status, SSLSocket *socket, size_t transferred, void *arg)
+{
+  __UNUSED(socket);
+  __UNUSED(transferred);
+  __UNUSED(arg);
+  EXPECT_EQ(status, aosSuccess);
+}
+
+static void sslServerReadCb(AsyncOpStatus status, SSLSocket *socket, size_t transferred, void *arg)
+{
+  SSLTestContext *ctx = static_cast<SSLTestContext*>(arg);
+  EXPECT_EQ(status, aosSuccess);
+  if (status == aosSuccess && transferred == sizeof(ctx->serverBuffer))
+    aioSslWrite(socket, ctx->serverBuffer, transferred, afNone, 1000000, sslServerWriteCb, ctx);
+  else
+    postQuitOperation(ctx->base);
+}
+
+static void sslServerAcceptCb(AsyncOpStatus status, SSLSocket *socket, void *arg)
+{
+  SSLTestContext *ctx = static_cast<SSLTestContext*>(arg);
+  EXPECT_EQ(status, aosSuccess);
+  if (status == aosSuccess) {
+    ctx->serverReused[ctx->serverConnections-1] = sslSocketSessionReused(socket);
+    aioSslRead(socket, ctx->serverBuffer, sizeof(ctx->serverBuffer), afWaitAll, 1000000, sslServerReadCb, ctx);
+  } else {
+    postQuitOperation(ctx->base);
+  }
+}
+
+static void sslTcpAcceptCb(AsyncOpStatus status, aioObject *listener, HostAddress client, socketTy acceptSocket, void *arg)
+{
+  __UNUSED(client);
+  SSLTestContext *ctx = static_cast<SSLTestContext*>(arg);
+  EXPECT_EQ(status, aosSuccess);
+  if (status == aosSuccess && ctx->serverConnections < 2) {
+    SSLSocket *socket = sslSocketNewWithContext(ctx->base, newSocketIo(ctx->base, acceptSocket), ctx->serverContext);
+    ctx->serverSockets[ctx->serverConnections++] = socket;
+    aioSslAccept(socket, 1000000, sslServerAcceptCb, ctx);
+    if (ctx->serverConnections < 2)
+      aioAccept(listener, 1000000, sslTcpAcceptCb, ctx);
+  } else {
+    postQuitOperation(ctx->base);
+  }
+}
+
+static void sslClientReadCb(AsyncOpStatus status, SSLSocket *socket, size_t transferred, void *arg)
+{
+  SSLTestContext *ctx = static_cast<SSLTestContext*>(arg);
+  EXPECT_EQ(status, aosSuccess);
+  ctx->echoValid[ctx->clientRound] = status == aosSuccess &&
+                                     transferred == sizeof(ctx->clientBuffer) &&
+                                     memcmp(ctx->clientBuffer, "ping", 4) == 0;
+  ctx->clientReused[ctx->clientRound] = sslSocketSessionReused(socket);
+  sslSocketDelete(socket);
+
+  // Second connection must resume session received with first one
+  if (status == aosSuccess && ++ctx->clientRound < 2)
+    sslClientConnect(ctx);
+  else
+    postQuitOperation(ctx->base);
+}
+
+static void sslClientConnectCb(AsyncOpStatus status, SSLSocket *socket, void *arg)
+{
+  SSLTestContext *ctx = static_cast<SSLTestContext*>(arg);
+  EXPECT_EQ(status, aosSuccess);
+  if (status == aosSuccess) {
+    aioSslWrite(socket, "ping", 4, afNone, 1000000, nullptr, nullptr);
+    aioSslRead(socket, ctx->clientBuffer, sizeof(ctx->clientBuffer), afWaitAll, 1000000, sslClientReadCb, ctx);
+  } else {
+    sslSocketDelete(socket);
+    postQuitOperation(ctx->base);
+  }
+}
+
+static void sslClientConnect(SSLTestContext *ctx)
+{
+  HostAddress address;
+  address.family = AF_INET;
+  address.ipv4 = INADDR_ANY;
+  address.port = 0;
+  socketTy fd = socketCreate(AF_INET, SOCK_STREAM, IPPROTO_TCP, 1);
+  socketBind(fd, &address);
+
+  SSLSocket *socket = sslSocketNewWithContext(ctx->base, newSocketIo(ctx->base, fd), ctx->clientContext);
+  address.ipv4 = inet_addr("127.0.0.1");
+  address.port = htons(gPort);
+  memset(ctx->clientBuffer, 0, sizeof(ctx->clientBuffer));
+  aioSslConnect(socket, &address, "localhost", 1000000, sslClientConnectCb, ctx);
+}
+
+TEST(ssl, test_ssl_accept_resume)
+{
+  X509 *certificate = nullptr;
+  EVP_PKEY *key = nullptr;
+  ASSERT_TRUE(generateCertificate(&certificate, &key));
+
+  SSLTestContext context(gBase);
+  context.serverContext = sslContextNew(1);
+  context.clientContext = sslContextNew(0);
+  ASSERT_NE(context.serverContext, nullptr);
+  ASSERT_NE(context.clientContext, nullptr);
+  ASSERT_TRUE(sslContextUseCertificate(context.serverContext, certificate, key));
+
+  context.listener = startTCPServer(gBase, sslTcpAcceptCb, &context, gPort);
+  ASSERT_NE(context.listener, nullptr);
+  sslClientConnect(&context);
+  asyncLoop(gBase);
+
+  for (unsigned i = 0; i < context.serverConnections; i++)
+    sslSocketDelete(context.serverSockets[i]);
+  deleteAioObject(context.listener);
+  // Sockets keep own references, contexts may be released before them
+  sslContextDecrementReference(context.serverContext);
+  sslContextDecrementReference(context.clientContext);
+  X509_free(certificate);
+  EVP_PKEY_free(key);
+
+  EXPECT_TRUE(context.echoValid[0]);
+  EXPECT_TRUE(context.echoValid[1]);
+  EXPECT_EQ(context.serverReused[0], 0);
+  EXPECT_EQ(context.clientReused[0], 0);
+  EXPECT_EQ(context.serverReused[1], 1);
+  EXPECT_EQ(context.clientReused[1], 1);
+}
+
+// Same exchange with handshake steps of both sides running on worker threads
+TEST(ssl, test_ssl_handshake_pool)
+{
+  X509 *certificate = nullptr;
+  EVP_PKEY *key = nullptr;
+  ASSERT_TRUE(generateCertificate(&certificate, &key));
+
+  SSLHandshakePool *pool = sslHandshakePoolNew(2);
+  SSLTestContext context(gBase);
+  context.serverContext = sslContextNew(1);
+  context.clientContext = sslContextNew(0);
+  ASSERT_TRUE(sslContextUseCertificate(context.serverContext, certificate, key));
+  sslContextSetHandshakePool(context.serverContext, pool);
+  sslContextSetHandshakePool(context.clientContext, pool);
+
+  context.listener = startTCPServer(gBase, sslTcpAcceptCb, &context, gPort);
+  ASSERT_NE(context.listener, nullptr);
+  sslClientConnect(&context);
+  asyncLoop(gBase);
+
+  for (unsigned i = 0; i < context.serverConnections; i++)
+    sslSocketDelete(context.serverSockets[i]);
+  deleteAioObject(context.listener);
+  sslContextDecrementReference(context.serverContext);
+  sslContextDecrementReference(context.clientContext);
+  X509_free(certificate);
+  EVP_PKEY_free(key);
+
+  SSLHandshakePoolStats stats;
+  sslHandshakePoolGetStats(pool, &stats);
+  sslHandshakePoolDelete(pool);
+
+  EXPECT_TRUE(context.echoValid[0]);
+  EXPECT_TRUE(context.echoValid[1]);
+  EXPECT_EQ(context.serverReused[1], 1);
+  EXPECT_EQ(context.clientReused[1], 1);
+  // Client and server need at least two steps per connection
+  EXPECT_GE(stats.steps, 8u);
+  EXPECT_EQ(stats.queueDepth, 0u);
+  EXPECT_GE(stats.peakQueueDepth, 1u);
+  EXPECT_GE(stats.totalLatency, stats.totalWaitTime);
+}
+
+static constexpr unsigned gSslAbortedHandshakes = 32;
+
+__NO_PADDING_BEGIN
+struct SSLAbortTestContext {
+  asyncBase *base;
+  SSLSocket *sockets[gSslAbortedHandshakes];
+  unsigned finished;
+};
+__NO_PADDING_END
+
+static void sslAbortQuitCb(aioUserEvent *event, void *arg)
+{
+  __UNUSED(event);
+  postQuitOperation(static_cast<asyncBase*>(arg));
+}
+
+static void sslAbortDeleteCb(aioUserEvent *event, void *arg)
+{
+  __UNUSED(event);
+  SSLAbortTestContext *ctx = static_cast<SSLAbortTestContext*>(arg);
+  for (unsigned i = 0; i < gSslAbortedHandshakes; i++)
+    sslSocketDelete(ctx->sockets[i]);
+}
+
+static void sslAbortConnectCb(AsyncOpStatus status, SSLSocket *socket, void *arg)
+{
+  __UNUSED(socket);
+  SSLAbortTestContext *ctx = static_cast<SSLAbortTestContext*>(arg);
+  EXPECT_NE(status, aosSuccess);
+  ctx->finished++;
+}
+
+// Sockets deleted while their handshake steps wait in pool queue or run on worker
+TEST(ssl, test_ssl_handshake_pool_abort)
+{
+  SSLHandshakePool *pool = sslHandshakePoolNew(1);
+  SSLContext *clientContext = sslContextNew(0);
+  sslContextSetHandshakePool(clientContext, pool);
+  // Listener never accepts, connections completed by kernel backlog
+  aioObject *listener = startTCPServer(gBase, nullptr, nullptr, gPort);
+  ASSERT_NE(listener, nullptr);
+
+  SSLAbortTestContext context;
+  context.base = gBase;
+  context.finished = 0;
+  for (unsigned i = 0; i < gSslAbortedHandshakes; i++) {
+    HostAddress address;
+    address.family = AF_INET;
+    address.ipv4 = INADDR_ANY;
+    address.port = 0;
+    socketTy fd = socketCreate(AF_INET, SOCK_STREAM, IPPROTO_TCP, 1);
+    socketBind(fd, &address);
+    context.sockets[i] = sslSocketNewWithContext(gBase, newSocketIo(gBase, fd), clientContext);
+    address.ipv4 = inet_addr("127.0.0.1");
+    address.port = htons(gPort);
+    aioSslConnect(context.sockets[i], &address, "localhost", 1000000, sslAbortConnectCb, &context);
+  }
+
+  aioUserEvent *deleteEvent = newUserEvent(gBase, 0, sslAbortDeleteCb, &context);
+  aioUserEvent *quitEvent = newUserEvent(gBase, 0, sslAbortQuitCb, gBase);
+  userEventStartTimer(deleteEvent, 1000, 1);
+  // Sockets with running step released after it
+  userEventStartTimer(quitEvent, 200000, 1);
+  asyncLoop(gBase);
+
+  SSLHandshakePoolStats stats;
+  sslHandshakePoolGetStats(pool, &stats);
+  EXPECT_EQ(context.finished, gSslAbortedHandshakes);
+  EXPECT_EQ(stats.queueDepth, 0u);
+
+  deleteUserEvent(deleteEvent);
+  deleteUserEvent(quitEvent);
+  deleteAioObject(listener);
+  sslContextDecrementReference(clientContext);
+  sslHandshakePoolDelete(pool);
+}
+
+__NO_PADDING_BEGIN
+struct SSLEarlyTestContext {
+  asyncBase *base;
+  SSLContext *serverContext;
+  SSLSocket *serverSocket;
+  AsyncOpStatus acceptStatus;
+  AsyncOpStatus writeStatus;
+  AsyncOpStatus connectStatus;
+  size_t written;
+  bool readValid;
+  uint8_t clientBuffer[5];
+};
+__NO_PADDING_END
+
+static void sslEarlyAcceptCb(AsyncOpStatus status, SSLSocket *socket, void *arg)
+{
+  __UNUSED(socket);
+  static_cast<SSLEarlyTestContext*>(arg)->acceptStatus = status;
+}
+
+static void sslEarlyWriteCb(AsyncOpStatus status, SSLSocket *socket, size_t transferred, void *arg)
+{
+  __UNUSED(socket);
+  SSLEarlyTestContext *ctx = static_cast<SSLEarlyTestContext*>(arg);
+  ctx->writeStatus = status;
+  ctx->written = transferred;
+}
+
+static void sslEarlyTcpAcceptCb(AsyncOpStatus status, aioObject *listener, HostAddress client, socketTy acceptSocket, void *arg)
+{
+  __UNUSED(listener);
+  __UNUSED(client);
+  SSLEarlyTestContext *ctx = static_cast<SSLEarlyTestContext*>(arg);
+  ASSERT_EQ(status, aosSuccess);
+  ctx->serverSocket = sslSocketNewWithContext(ctx->base, newSocketIo(ctx->base, acceptSocket), ctx->serverContext);
+  // Accept uses read queue, write issued without waiting for it
+  aioSslAccept(ctx->serverSocket, 1000000, sslEarlyAcceptCb, ctx);
+  aioSslWrite(ctx->serverSocket, "hello", 5, afNone, 1000000, sslEarlyWriteCb, ctx);
+}
+
+static void sslEarlyConnectCb(AsyncOpStatus status, SSLSocket *socket, void *arg)
+{
+  __UNUSED(socket);
+  static_cast<SSLEarlyTestContext*>(arg)->connectStatus = status;
+}
+
+static void sslEarlyReadCb(AsyncOpStatus status, SSLSocket *socket, size_t transferred, void *arg)
+{
+  __UNUSED(socket);
+  SSLEarlyTestContext *ctx = static_cast<SSLEarlyTestContext*>(arg);
+  ctx->readValid = status == aosSuccess && transferred == 5 && memcmp(ctx->clientBuffer, "hello", 5) == 0;
+  postQuitOperation(ctx->base);
+}
+
+// Write and read started while handshake step runs on worker wait for handshake end
+TEST(ssl, test_ssl_handshake_pool_early_io)
+{
+  X509 *certificate = nullptr;
+  EVP_PKEY *key = nullptr;
+  ASSERT_TRUE(generateCertificate(&certificate, &key));
+
+  SSLHandshakePool *pool = sslHandshakePoolNew(2);
+  SSLContext *clientContext = sslContextNew(0);
+  SSLEarlyTestContext context;
+  context.base = gBase;
+  context.serverContext = sslContextNew(1);
+  context.serverSocket = nullptr;
+  context.acceptStatus = aosPending;
+  context.writeStatus = aosPending;
+  context.connectStatus = aosPending;
+  context.written = 0;
+  context.readValid = false;
+  ASSERT_TRUE(sslContextUseCertificate(context.serverContext, certificate, key));
+  sslContextSetHandshakePool(context.serverContext, pool);
+  sslContextSetHandshakePool(clientContext, pool);
+  aioObject *listener = startTCPServer(gBase, sslEarlyTcpAcceptCb, &context, gPort);
+  ASSERT_NE(listener, nullptr);
+
+  HostAddress address;
+  address.family = AF_INET;
+  address.ipv4 = INADDR_ANY;
+  address.port = 0;
+  socketTy fd = socketCreate(AF_INET, SOCK_STREAM, IPPROTO_TCP, 1);
+  socketBind(fd, &address);
+  SSLSocket *client = sslSocketNewWithContext(gBase, newSocketIo(gBase, fd), clientContext);
+  address.ipv4 = inet_addr("127.0.0.1");
+  address.port = htons(gPort);
+  // Connect uses read queue too, read queued after it
+  aioSslConnect(client, &address, "localhost", 1000000, sslEarlyConnectCb, &context);
+  aioSslRead(client, context.clientBuffer, sizeof(context.clientBuffer), afWaitAll, 1000000, sslEarlyReadCb, &context);
+  asyncLoop(gBase);
+
+  sslSocketDelete(client);
+  if (context.serverSocket)
+    sslSocketDelete(context.serverSocket);
+  deleteAioObject(listener);
+  sslContextDecrementReference(context.serverContext);
+  sslContextDecrementReference(clientContext);
+  X509_free(certificate);
+  EVP_PKEY_free(key);
+  sslHandshakePoolDelete(pool);
+
+  EXPECT_EQ(context.acceptStatus, aosSuccess);
+  EXPECT_EQ(context.connectStatus, aosSuccess);
+  EXPECT_EQ(context.writeStatus, aosSuccess);
+  EXPECT_EQ(context.written, 5u);
+  EXPECT_TRUE(context.readValid);
+}
+
+__NO_PADDING_BEGIN
+struct SSLHeldTimeoutTestContext {
+  asyncBase *base;
+  SSLContext *serverContext;
+  SSLContext *clientContext;
+  SSLSocket *serverSocket;
+  SSLSocket *clientSocket;
+  aioObject *tcpClient;
+  aioUserEvent *startEvent;
+  AsyncOpStatus acceptStatus;
+  AsyncOpStatus connectStatus;
+  AsyncOpStatus writeStatus;
+  unsigned finished;
+};
+__NO_PADDING_END
+
+static void sslHeldTimeoutFinish(SSLHeldTimeoutTestContext *ctx)
+{
+  if (++ctx->finished == 2)
+    postQuitOperation(ctx->base);
+}
+
+static void sslHeldTimeoutAcceptCb(AsyncOpStatus status, SSLSocket *socket, void *arg)
+{
+  __UNUSED(socket);
+  SSLHeldTimeoutTestContext *ctx = static_cast<SSLHeldTimeoutTestContext*>(arg);
+  ctx->acceptStatus = status;
+  sslHeldTimeoutFinish(ctx);
+}
+
+static void sslHeldTimeoutConnectCb(AsyncOpStatus status, SSLSocket *socket, void *arg)
+{
+  __UNUSED(socket);
+  SSLHeldTimeoutTestContext *ctx = static_cast<SSLHeldTimeoutTestContext*>(arg);
+  ctx->connectStatus = status;
+  sslHeldTimeoutFinish(ctx);
+}
+
+static void sslHeldTimeoutWriteCb(AsyncOpStatus status, SSLSocket *socket, size_t transferred, void *arg)
+{
+  __UNUSED(socket);
+  __UNUSED(transferred);
+  static_cast<SSLHeldTimeoutTestContext*>(arg)->writeStatus = status;
+}
+
+static void sslHeldTimeoutTcpAcceptCb(AsyncOpStatus status, aioObject *listener, HostAddress client, socketTy acceptSocket, void *arg)
+{
+  __UNUSED(listener);
+  __UNUSED(client);
+  SSLHeldTimeoutTestContext *ctx = static_cast<SSLHeldTimeoutTestContext*>(arg);
+  ASSERT_EQ(status, aosSuccess);
+  ctx->serverSocket = sslSocketNewWithContext(ctx->base, newSocketIo(ctx->base, acceptSocket), ctx->serverContext);
+  // Accept uses read queue and waits for ClientHello, write held by it expires long before
+  aioSslAccept(ctx->serverSocket, 1000000, sslHeldTimeoutAcceptCb, ctx);
+  aioSslWrite(ctx->serverSocket, "hello", 5, afRealtime, 10000, sslHeldTimeoutWriteCb, ctx);
+}
+
+static void sslHeldTimeoutStartCb(aioUserEvent *event, void *arg)
+{
+  __UNUSED(event);
+  SSLHeldTimeoutTestContext *ctx = static_cast<SSLHeldTimeoutTestContext*>(arg);
+  ctx->clientSocket = sslSocketNewWithContext(ctx->base, ctx->tcpClient, ctx->clientContext);
+  aioSslConnect(ctx->clientSocket, nullptr, "localhost", 1000000, sslHeldTimeoutConnectCb, ctx);
+}
+
+static void sslHeldTimeoutTcpConnectCb(AsyncOpStatus status, aioObject *object, void *arg)
+{
+  __UNUSED(object);
+  SSLHeldTimeoutTestContext *ctx = static_cast<SSLHeldTimeoutTestContext*>(arg);
+  ASSERT_EQ(status, aosSuccess);
+  // ClientHello sent after server write timeout
+  userEventStartTimer(ctx->startEvent, 50000, 1);
+}
+
+// Timeout of write held during handshake finishes write only, handshake socket I/O continues
+TEST(ssl, test_ssl_handshake_pool_held_timeout)
+{
+  X509 *certificate = nullptr;
+  EVP_PKEY *key = nullptr;
+  ASSERT_TRUE(generateCertificate(&certificate, &key));
+
+  SSLHandshakePool *pool = sslHandshakePoolNew(2);
+  SSLHeldTimeoutTestContext context;
+  context.base = gBase;
+  context.serverContext = sslContextNew(1);
+  context.clientContext = sslContextNew(0);
+  context.serverSocket = nullptr;
+  context.clientSocket = nullptr;
+  context.acceptStatus = aosPending;
+  context.connectStatus = aosPending;
+  context.writeStatus = aosPending;
+  context.finished = 0;
+  context.startEvent = newUserEvent(gBase, 0, sslHeldTimeoutStartCb, &context);
+  ASSERT_TRUE(sslContextUseCertificate(context.serverContext, certificate, key));
+  sslContextSetHandshakePool(context.serverContext, pool);
+  sslContextSetHandshakePool(context.clientContext, pool);
+  aioObject *listener = startTCPServer(gBase, sslHeldTimeoutTcpAcceptCb, &context, gPort);
+  ASSERT_NE(listener, nullptr);
+  context.tcpClient = initializeTCPClient(gBase, sslHeldTimeoutTcpConnectCb, &context, gPort);
+  asyncLoop(gBase);
+
+  if (context.clientSocket)
+    sslSocketDelete(context.clientSocket);
+  else
+    deleteAioObject(context.tcpClient);
+  if (context.serverSocket)
+    sslSocketDelete(context.serverSocket);
+  deleteAioObject(listener);
+  deleteUserEvent(context.startEvent);
+  sslContextDecrementReference(context.serverContext);
+  sslContextDecrementReference(context.clientContext);
+  X509_free(certificate);
+  EVP_PKEY_free(key);
+  sslHandshakePoolDelete(pool);
+
+  EXPECT_EQ(context.writeStatus, aosTimeout);
+  EXPECT_EQ(context.acceptStatus, aosSuccess);
+  EXPECT_EQ(context.connectStatus, aosSuccess);
+}
+
+__NO_PADDING_BEGIN
+struct SSLHttp2TestContext {
+  asyncBase *base;
+  SSLContext *serverContext;
+  SSLContext *clientContext;
+  aioObject *listener;
+  SSLSocket *serverSocket;
+  HTTP2Connection *server;
+  HTTP2Connection *client;
+  std::string serverProtocol;
+  unsigned requests;
+  unsigned responses;
+  unsigned failures;
+  SSLHttp2TestContext(asyncBase *baseArg) : base(baseArg), listener(nullptr), serverSocket(nullptr), server(nullptr), client(nullptr), requests(16), responses(0), failures(0) {}
+};
+__NO_PADDING_END
+
+static void sslHttp2RequestCb(HTTP2Stream *stream, const HTTP2Message *request, void *arg)
+{
+  __UNUSED(arg);
+  http2Respond(stream, 200, nullptr, 0, request->path.data, request->path.size);
+}
+
+static void sslHttp2ServerAcceptCb(AsyncOpStatus status, SSLSocket *socket, void *arg)
+{
+  SSLHttp2TestContext *ctx = static_cast<SSLHttp2TestContext*>(arg);
+  EXPECT_EQ(status, aosSuccess);
+  size_t size = 0;
+  const char *protocol = status == aosSuccess ? sslSocketAlpn(socket, &size) : nullptr;
+  if (protocol)
+    ctx->serverProtocol.assign(protocol, size);
+  if (ctx->serverProtocol == "h2")
+    ctx->server = http2sServerNew(ctx->base, socket, sslHttp2RequestCb, ctx);
+  else
+    postQuitOperation(ctx->base);
+}
+
+static void sslHttp2TcpAcceptCb(AsyncOpStatus status, aioObject *listener, HostAddress client, socketTy acceptSocket, void *arg)
+{
+  __UNUSED(listener);
+  __UNUSED(client);
+  SSLHttp2TestContext *ctx = static_cast<SSLHttp2TestContext*>(arg);
+  if (status == aosSuccess) {
+    ctx->serverSocket = sslSocketNewWithContext(ctx->base, newSocketIo(ctx->base, acceptSocket), ctx->serverContext);
+    aioSslAccept(ctx->serverSocket, 1000000, sslHttp2ServerAcceptCb, ctx);
+  }
+}
+
+static void sslHttp2ResponseCb(AsyncOpStatus status, HTTP2Connection *connection, const HTTP2Message *response, void *arg)
+{
+  __UNUSED(connection);
+  SSLHttp2TestContext *ctx = static_cast<SSLHttp2TestContext*>(arg);
+  unsigned index = ctx->responses++;
+  std::string expected = "/" + std::to_string(index);
+  if (status != aosSuccess || response->status != 200 || response->bodySize != expected.size() || memcmp(response->body, expected.data(), expected.size()) != 0)
+    ctx->failures++;
+  if (ctx->responses == ctx->requests)
+    postQuitOperation(ctx->base);
+}
+
+static void sslHttp2ConnectCb(AsyncOpStatus status, HTTP2Connection *connection, void *arg)
+{
+  SSLHttp2TestContext *ctx = static_cast<SSLHttp2TestContext*>(arg);
+  EXPECT_EQ(status, aosSuccess);
+  if (status != aosSuccess) {
+    postQuitOperation(ctx->base);
+    return;
+  }
+
+  // Same urgency, responses come in request order
+  for (unsigned i = 0; i < ctx->requests; i++) {
+    std::string path = "/" + std::to_string(i);
+    aioHttp2Request(connection, "GET", "localhost", path.c_str(), nullptr, 0, nullptr, 0, 3, 1000000, sslHttp2ResponseCb, ctx);
+  }
+}
+
+TEST(ssl, test_ssl_http2_alpn)
+{
+  X509 *certificate = nullptr;
+  EVP_PKEY *key = nullptr;
+  ASSERT_TRUE(generateCertificate(&certificate, &key));
+
+  static const char *const serverProtocols[] = {"h2", "http/1.1"};
+  SSLHttp2TestContext context(gBase);
+  context.serverContext = sslContextNew(1);
+  context.clientContext = sslContextNew(0);
+  ASSERT_TRUE(sslContextUseCertificate(context.serverContext, certificate, key));
+  ASSERT_TRUE(sslContextSetAlpn(context.serverContext, serverProtocols, 2));
+
+  context.listener = startTCPServer(gBase, sslHttp2TcpAcceptCb, &context, gPort);
+  ASSERT_NE(context.listener, nullptr);
+
+  HostAddress address;
+  address.family = AF_INET;
+  address.ipv4 = inet_addr("127.0.0.1");
+  address.port = htons(gPort);
+  socketTy fd = socketCreate(AF_INET, SOCK_STREAM, IPPROTO_TCP, 1);
+  context.client = http2sClientNew(gBase, sslSocketNewWithContext(gBase, newSocketIo(gBase, fd), context.clientContext));
+  aioHttp2Connect(context.client, &address, "localhost", 1000000, sslHttp2ConnectCb, &context);
+  asyncLoop(gBase);
+
+  http2ConnectionDelete(context.client);
+  if (context.server)
+    http2ConnectionDelete(context.server);
+  else if (context.serverSocket)
+    sslSocketDelete(context.serverSocket);
+  deleteAioObject(context.listener);
+
+  EXPECT_EQ(context.serverProtocol, "h2");
+  EXPECT_EQ(context.responses, context.requests);
+  EXPECT_EQ(context.failures, 0u);
+  sslContextDecrementReference(context.serverContext);
+  sslContextDecrementReference(context.clientContext);
+  X509_free(certificate);
+  EVP_PKEY_free(key);
+}
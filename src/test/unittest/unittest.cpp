@@ -3,10 +3,20 @@
 #include "asyncio/device.h"
 #include "asyncio/socket.h"
 #include "p2putils/HttpRequestParse.h"
+#include "p2putils/HttpScan.h"
+#include "p2putils/Hpack.h"
 #include "asyncioextras/rlpx.h"
 #include "atomic.h"
 #include <chrono>
+#include <ctype.h>
+#include <string.h>
+#include <string>
 #include <thread>
+#include <vector>
+#ifndef OS_WINDOWS
+#include <stdio.h>
+#include <unistd.h>
+#endif
 
 asyncBase *gBase = nullptr;
 
@@ -134,6 +144,350 @@ TEST(basic, test_pipe)
   }
 }
 
+__NO_PADDING_BEGIN
+struct WatermarkContext {
+  asyncBase *base;
+  aioObject *pipeRead;
+  aioObject *pipeWrite;
+  uint8_t buffer[16384];
+  size_t bytesWritten;
+  size_t bytesRead;
+  unsigned writesStarted;
+  unsigned writesFinished;
+  bool writable;
+  WatermarkContext(asyncBase *baseArg) : base(baseArg), bytesWritten(0), bytesRead(0), writesStarted(0), writesFinished(0), writable(false) {}
+};
+__NO_PADDING_END
+
+static void test_write_watermarks_check(WatermarkContext *ctx)
+{
+  if (ctx->writable && ctx->writesFinished == ctx->writesStarted && ctx->bytesRead == ctx->bytesWritten)
+    postQuitOperation(ctx->base);
+}
+
+void test_write_watermarks_writecb(AsyncOpStatus status, aioObject *object, size_t transferred, void *arg)
+{
+  __UNUSED(object);
+  WatermarkContext *ctx = static_cast<WatermarkContext*>(arg);
+  EXPECT_EQ(status, aosSuccess);
+  EXPECT_EQ(transferred, sizeof(ctx->buffer));
+  ctx->writesFinished++;
+  test_write_watermarks_check(ctx);
+}
+
+void test_write_watermarks_writablecb(AsyncOpStatus status, aioObject *object, void *arg)
+{
+  WatermarkContext *ctx = static_cast<WatermarkContext*>(arg);
+  EXPECT_EQ(status, aosSuccess);
+  aioWriteQueueStats stats;
+  aioGetWriteQueueStats(object, &stats);
+  EXPECT_EQ(stats.queuedBytes, 0u);
+  EXPECT_EQ(stats.queuedOps, 0u);
+  ctx->writable = true;
+  test_write_watermarks_check(ctx);
+}
+
+void test_write_watermarks_readcb(AsyncOpStatus status, aioObject *object, size_t transferred, void *arg)
+{
+  WatermarkContext *ctx = static_cast<WatermarkContext*>(arg);
+  EXPECT_EQ(status, aosSuccess);
+  if (status != aosSuccess) {
+    postQuitOperation(ctx->base);
+    return;
+  }
+
+  ctx->bytesRead += transferred;
+  if (ctx->bytesRead < ctx->bytesWritten)
+    aioRead(object, ctx->buffer, sizeof(ctx->buffer), afNone, 1000000, test_write_watermarks_readcb, ctx);
+  else
+    test_write_watermarks_check(ctx);
+}
+
+TEST(basic, test_write_watermarks)
+{
+  constexpr size_t highWatermark = 131072;
+  WatermarkContext context(gBase);
+  pipeTy unnamedPipe;
+  int result = pipeCreate(&unnamedPipe, 1);
+  EXPECT_EQ(result, 0);
+  if (result == 0) {
+    context.pipeRead = newDeviceIo(gBase, unnamedPipe.read);
+    context.pipeWrite = newDeviceIo(gBase, unnamedPipe.write);
+    aioSetWriteWatermarks(context.pipeWrite, 0, highWatermark, awpFailFast);
+
+    // Nobody reads pipe, write queue grows up to high watermark
+    ssize_t writeResult = 0;
+    for (unsigned i = 0; i < 4096; i++) {
+      writeResult = aioWrite(context.pipeWrite, context.buffer, sizeof(context.buffer), afWaitAll, 0, test_write_watermarks_writecb, &context);
+      if (writeResult == -aosQueueFull)
+        break;
+      context.writesStarted++;
+      context.bytesWritten += sizeof(context.buffer);
+    }
+
+    EXPECT_EQ(writeResult, -aosQueueFull);
+    aioWriteQueueStats stats;
+    aioGetWriteQueueStats(context.pipeWrite, &stats);
+    EXPECT_GE(stats.queuedBytes, highWatermark);
+    EXPECT_GE(stats.peakQueuedBytes, highWatermark);
+    EXPECT_GT(stats.queuedOps, 0u);
+    EXPECT_EQ(stats.rejectedWrites, 1u);
+
+    aioWaitWritable(context.pipeWrite, test_write_watermarks_writablecb, &context);
+    aioRead(context.pipeRead, context.buffer, sizeof(context.buffer), afNone, 1000000, test_write_watermarks_readcb, &context);
+    asyncLoop(gBase);
+
+    EXPECT_TRUE(context.writable);
+    EXPECT_EQ(context.writesFinished, context.writesStarted);
+    EXPECT_EQ(context.bytesRead, context.bytesWritten);
+    deleteAioObject(context.pipeRead);
+    deleteAioObject(context.pipeWrite);
+  }
+}
+
+static void test_write_watermarks_delete_check(WatermarkContext *ctx)
+{
+  if (ctx->writable && ctx->writesFinished == ctx->writesStarted)
+    postQuitOperation(ctx->base);
+}
+
+void test_write_watermarks_delete_writecb(AsyncOpStatus status, aioObject *object, size_t transferred, void *arg)
+{
+  __UNUSED(object);
+  __UNUSED(transferred);
+  WatermarkContext *ctx = static_cast<WatermarkContext*>(arg);
+  // Writes fitting into pipe buffer finish before delete
+  EXPECT_TRUE(status == aosSuccess || status == aosCanceled);
+  ctx->writesFinished++;
+  test_write_watermarks_delete_check(ctx);
+}
+
+void test_write_watermarks_delete_writablecb(AsyncOpStatus status, aioObject *object, void *arg)
+{
+  __UNUSED(object);
+  WatermarkContext *ctx = static_cast<WatermarkContext*>(arg);
+  EXPECT_EQ(status, aosCanceled);
+  EXPECT_FALSE(ctx->writable);
+  ctx->writable = true;
+  test_write_watermarks_delete_check(ctx);
+}
+
+TEST(basic, test_write_watermarks_delete)
+{
+  WatermarkContext context(gBase);
+  pipeTy unnamedPipe;
+  int result = pipeCreate(&unnamedPipe, 1);
+  EXPECT_EQ(result, 0);
+  if (result == 0) {
+    context.pipeRead = newDeviceIo(gBase, unnamedPipe.read);
+    context.pipeWrite = newDeviceIo(gBase, unnamedPipe.write);
+    aioSetWriteWatermarks(context.pipeWrite, 0, 0, awpNone);
+
+    // Nobody reads pipe, writable notification stays parked until object deleted
+    for (unsigned i = 0; i < 16; i++) {
+      aioWrite(context.pipeWrite, context.buffer, sizeof(context.buffer), afWaitAll, 0, test_write_watermarks_delete_writecb, &context);
+      context.writesStarted++;
+    }
+
+    aioWaitWritable(context.pipeWrite, test_write_watermarks_delete_writablecb, &context);
+    deleteAioObject(context.pipeWrite);
+    asyncLoop(gBase);
+
+    EXPECT_TRUE(context.writable);
+    EXPECT_EQ(context.writesFinished, context.writesStarted);
+    deleteAioObject(context.pipeRead);
+  }
+}
+
+__NO_PADDING_BEGIN
+struct CoalesceContext {
+  asyncBase *base;
+  uint8_t readBuffer[64*100];
+  unsigned writesFinished;
+  bool orderOk;
+  bool readFinished;
+  CoalesceContext(asyncBase *baseArg) : base(baseArg), writesFinished(0), orderOk(true), readFinished(false) {}
+};
+__NO_PADDING_END
+
+static void test_write_coalescing_check(CoalesceContext *ctx)
+{
+  if (ctx->readFinished && ctx->writesFinished == sizeof(ctx->readBuffer)/64)
+    postQuitOperation(ctx->base);
+}
+
+void test_write_coalescing_writecb(AsyncOpStatus status, aioObject *object, size_t transferred, void *arg)
+{
+  __UNUSED(object);
+  CoalesceContext *ctx = static_cast<CoalesceContext*>(arg);
+  EXPECT_EQ(status, aosSuccess);
+  EXPECT_EQ(transferred, 64u);
+  ctx->writesFinished++;
+  test_write_coalescing_check(ctx);
+}
+
+void test_write_coalescing_readcb(AsyncOpStatus status, aioObject *object, size_t transferred, void *arg)
+{
+  __UNUSED(object);
+  CoalesceContext *ctx = static_cast<CoalesceContext*>(arg);
+  EXPECT_EQ(status, aosSuccess);
+  EXPECT_EQ(transferred, sizeof(ctx->readBuffer));
+  for (size_t i = 0; i < sizeof(ctx->readBuffer); i++) {
+    if (ctx->readBuffer[i] != static_cast<uint8_t>(i/64))
+      ctx->orderOk = false;
+  }
+
+  ctx->readFinished = true;
+  if (status == aosSuccess)
+    test_write_coalescing_check(ctx);
+  else
+    postQuitOperation(ctx->base);
+}
+
+TEST(basic, test_write_coalescing)
+{
+  CoalesceContext context(gBase);
+  pipeTy unnamedPipe;
+  int result = pipeCreate(&unnamedPipe, 1);
+  EXPECT_EQ(result, 0);
+  if (result == 0) {
+    aioObject *pipeRead = newDeviceIo(gBase, unnamedPipe.read);
+    aioObject *pipeWrite = newDeviceIo(gBase, unnamedPipe.write);
+    // Limits smaller than burst: writes split into several gathered groups
+    aioSetWriteCoalescing(pipeWrite, 1024, 8);
+
+    uint8_t message[64];
+    for (unsigned i = 0; i < sizeof(context.readBuffer)/64; i++) {
+      memset(message, static_cast<int>(i), sizeof(message));
+      ssize_t writeResult = aioWrite(pipeWrite, message, sizeof(message), afWaitAll, 0, test_write_coalescing_writecb, &context);
+      EXPECT_EQ(writeResult, -aosPending);
+    }
+
+    aioRead(pipeRead, context.readBuffer, sizeof(context.readBuffer), afWaitAll, 1000000, test_write_coalescing_readcb, &context);
+    asyncLoop(gBase);
+
+    EXPECT_TRUE(context.orderOk);
+    EXPECT_EQ(context.writesFinished, sizeof(context.readBuffer)/64);
+    deleteAioObject(pipeRead);
+    deleteAioObject(pipeWrite);
+  }
+}
+
+__NO_PADDING_BEGIN
+struct TransferContext {
+  asyncBase *base;
+  std::vector<uint8_t> source;
+  std::vector<uint8_t> received;
+  AsyncOpStatus transferStatus;
+  size_t transferred;
+  bool transferFinished;
+  bool readFinished;
+  TransferContext(asyncBase *baseArg, size_t size) : base(baseArg), source(size), received(size), transferStatus(aosUnknown), transferred(0), transferFinished(false), readFinished(false) {
+    for (size_t i = 0; i < size; i++)
+      source[i] = static_cast<uint8_t>(i*7 + i/251);
+  }
+};
+__NO_PADDING_END
+
+static void test_transfer_check(TransferContext *ctx)
+{
+  if (ctx->transferFinished && ctx->readFinished)
+    postQuitOperation(ctx->base);
+}
+
+void test_transfer_writecb(AsyncOpStatus status, aioObject *object, size_t transferred, void *arg)
+{
+  __UNUSED(object);
+  TransferContext *ctx = static_cast<TransferContext*>(arg);
+  EXPECT_EQ(status, aosSuccess);
+  EXPECT_EQ(transferred, ctx->source.size());
+}
+
+void test_transfer_readcb(AsyncOpStatus status, aioObject *object, size_t transferred, void *arg)
+{
+  __UNUSED(object);
+  TransferContext *ctx = static_cast<TransferContext*>(arg);
+  EXPECT_EQ(status, aosSuccess);
+  EXPECT_EQ(transferred, ctx->received.size());
+  ctx->readFinished = true;
+  test_transfer_check(ctx);
+}
+
+void test_splice_cb(AsyncOpStatus status, aioObject *src, aioObject *dst, size_t transferred, void *arg)
+{
+  __UNUSED(src);
+  __UNUSED(dst);
+  TransferContext *ctx = static_cast<TransferContext*>(arg);
+  ctx->transferStatus = status;
+  ctx->transferred = transferred;
+  ctx->transferFinished = true;
+  test_transfer_check(ctx);
+}
+
+void test_sendfile_cb(AsyncOpStatus status, aioObject *socket, size_t transferred, void *arg)
+{
+  test_splice_cb(status, nullptr, socket, transferred, arg);
+}
+
+TEST(basic, test_splice)
+{
+  // More than pipe capacity, transfer needs several read/write stages
+  TransferContext context(gBase, 300000);
+  pipeTy input;
+  pipeTy output;
+  ASSERT_EQ(pipeCreate(&input, 1), 0);
+  ASSERT_EQ(pipeCreate(&output, 1), 0);
+  aioObject *inputRead = newDeviceIo(gBase, input.read);
+  aioObject *inputWrite = newDeviceIo(gBase, input.write);
+  aioObject *outputRead = newDeviceIo(gBase, output.read);
+  aioObject *outputWrite = newDeviceIo(gBase, output.write);
+
+  aioWrite(inputWrite, context.source.data(), context.source.size(), afWaitAll, 0, test_transfer_writecb, &context);
+  EXPECT_EQ(aioSplice(inputRead, outputWrite, context.source.size(), afWaitAll, 0, test_splice_cb, &context), 0);
+  aioRead(outputRead, context.received.data(), context.received.size(), afWaitAll, 0, test_transfer_readcb, &context);
+  asyncLoop(gBase);
+
+  EXPECT_EQ(context.transferStatus, aosSuccess);
+  EXPECT_EQ(context.transferred, context.source.size());
+  EXPECT_TRUE(context.source == context.received);
+  deleteAioObject(inputRead);
+  deleteAioObject(inputWrite);
+  deleteAioObject(outputRead);
+  deleteAioObject(outputWrite);
+}
+
+#ifndef OS_WINDOWS
+TEST(basic, test_sendfile)
+{
+  constexpr uint64_t offset = 1000;
+  TransferContext context(gBase, 200000);
+  FILE *file = tmpfile();
+  ASSERT_NE(file, nullptr);
+  std::vector<uint8_t> header(offset, 0);
+  ASSERT_EQ(fwrite(header.data(), 1, header.size(), file), header.size());
+  ASSERT_EQ(fwrite(context.source.data(), 1, context.source.size(), file), context.source.size());
+  fflush(file);
+
+  pipeTy output;
+  ASSERT_EQ(pipeCreate(&output, 1), 0);
+  aioObject *fileObject = newDeviceIo(gBase, dup(fileno(file)));
+  aioObject *outputRead = newDeviceIo(gBase, output.read);
+  aioObject *outputWrite = newDeviceIo(gBase, output.write);
+
+  EXPECT_EQ(aioSendFile(outputWrite, fileObject, offset, context.source.size(), 0, test_sendfile_cb, &context), 0);
+  aioRead(outputRead, context.received.data(), context.received.size(), afWaitAll, 0, test_transfer_readcb, &context);
+  asyncLoop(gBase);
+
+  EXPECT_EQ(context.transferStatus, aosSuccess);
+  EXPECT_EQ(context.transferred, context.source.size());
+  EXPECT_TRUE(context.source == context.received);
+  deleteAioObject(fileObject);
+  deleteAioObject(outputRead);
+  deleteAioObject(outputWrite);
+  fclose(file);
+}
+#endif
+
 void test_connect_accept_readcb(AsyncOpStatus status, aioObject *socket, size_t transferred, void *arg)
 {
   __UNUSED(transferred);
@@ -410,6 +764,35 @@ TEST(basic, test_userevent)
   ASSERT_TRUE(context.success);
 }
 
+static constexpr int gStressEventsNum = 100000;
+static constexpr int gStressEventsCounter = 3;
+
+void test_userevent_timer_stress_cb(aioUserEvent *event, void *arg)
+{
+  __UNUSED(event);
+  TestContext *ctx = static_cast<TestContext*>(arg);
+  if (++ctx->serverState == gStressEventsNum*gStressEventsCounter) {
+    ctx->success = true;
+    postQuitOperation(ctx->base);
+  }
+}
+
+TEST(basic, test_userevent_timer_stress)
+{
+  // All periodic events share one base timer, no kernel timer object per event
+  TestContext context(gBase);
+  std::vector<aioUserEvent*> events(gStressEventsNum);
+  for (int i = 0; i < gStressEventsNum; i++) {
+    events[i] = newUserEvent(gBase, 0, test_userevent_timer_stress_cb, &context);
+    userEventStartTimer(events[i], 1000 + static_cast<uint64_t>(i % 64)*100, gStressEventsCounter);
+  }
+
+  asyncLoop(gBase);
+  for (auto event: events)
+    deleteUserEvent(event);
+  ASSERT_TRUE(context.success);
+}
+
 void coroutine_create_proc(void *arg)
 {
   int *x = static_cast<int*>(arg);
@@ -1224,6 +1607,181 @@ TEST(http, http_request_parser)
   }
 }
 
+TEST(http, http_scan_kernels)
+{
+  // Every supported kernel must give same results as scalar one on all offsets and lengths
+  char buffer[256];
+  unsigned seed = 1;
+  for (unsigned iteration = 0; iteration < 64; iteration++) {
+    for (size_t i = 0; i < sizeof(buffer); i++) {
+      seed = seed * 1103515245 + 12345;
+      unsigned r = (seed >> 16) % 64;
+      // Mostly token characters with sparse delimiters and high bytes
+      buffer[i] = r < 50 ? "abcXYZ019-_~!|`^"[r % 16] : r < 54 ? '\r' : r < 58 ? '\n' : r < 61 ? ':' : static_cast<char>(0x80 + r);
+    }
+
+    for (int kernel = httpScanScalar+1; kernel < httpScanKernelLast; kernel++) {
+      if (!httpScanKernelSupported(static_cast<HttpScanKernelTy>(kernel)))
+        continue;
+      for (size_t offset = 0; offset < 40; offset++) {
+        for (size_t size = 0; offset + size <= sizeof(buffer); size += 7) {
+          const char *begin = buffer + offset;
+          const char *end = begin + size;
+          ASSERT_TRUE(httpScanSetKernel(httpScanScalar));
+          const char *crlf = httpScanCRLF(begin, end);
+          const char *token = httpScanToken(begin, end);
+          ASSERT_TRUE(httpScanSetKernel(static_cast<HttpScanKernelTy>(kernel)));
+          ASSERT_EQ(httpScanCRLF(begin, end), crlf) << httpScanKernelName(static_cast<HttpScanKernelTy>(kernel));
+          ASSERT_EQ(httpScanToken(begin, end), token) << httpScanKernelName(static_cast<HttpScanKernelTy>(kernel));
+        }
+      }
+    }
+  }
+
+  // Restore best kernel
+  for (int kernel = httpScanKernelLast-1; kernel >= httpScanScalar; kernel--) {
+    if (httpScanSetKernel(static_cast<HttpScanKernelTy>(kernel)))
+      break;
+  }
+}
+
+TEST(http, http_header_ids)
+{
+  // Every known name found in any letter case, near misses rejected
+  for (int id = 1; id < hhLast; id++) {
+    const char *name = httpHeaderName(id);
+    ASSERT_NE(name, nullptr);
+    size_t size = strlen(name);
+    ASSERT_EQ(httpHeaderId(name, size), id) << name;
+    std::string mixed(name);
+    for (size_t i = 0; i < size; i++)
+      mixed[i] = (i & 1) ? static_cast<char>(toupper(mixed[i])) : static_cast<char>(tolower(mixed[i]));
+    ASSERT_EQ(httpHeaderId(mixed.data(), size), id) << mixed;
+    if (size > 2) {
+      std::string nearMiss(name);
+      nearMiss[1] = nearMiss[1] == 'x' ? 'y' : 'x';
+      ASSERT_EQ(httpHeaderId(nearMiss.data(), size), 0) << nearMiss;
+    }
+  }
+
+  ASSERT_EQ(httpHeaderId("", 0), 0);
+  ASSERT_EQ(httpHeaderId("X-Custom-Header", 15), 0);
+  ASSERT_EQ(httpHeaderId("Content-Lengthy", 14), hhContentLength);
+  ASSERT_EQ(httpHeaderName(0), nullptr);
+  ASSERT_EQ(httpHeaderName(hhLast), nullptr);
+
+  const char *methods[] = {"GET", "HEAD", "POST", "PUT", "DELETE", "CONNECT", "OPTIONS", "TRACE", "PATCH"};
+  for (int id = hmGet; id < hmLast; id++)
+    ASSERT_EQ(httpMethodId(methods[id-1], strlen(methods[id-1])), id) << methods[id-1];
+  ASSERT_EQ(httpMethodId("get", 3), hmUnknown);
+  ASSERT_EQ(httpMethodId("BREW", 4), hmUnknown);
+  ASSERT_EQ(httpMethodId("GOT", 3), hmUnknown);
+  ASSERT_EQ(httpMethodId("", 0), hmUnknown);
+}
+
+static std::vector<uint8_t> hexDecode(const char *hex)
+{
+  std::vector<uint8_t> result;
+  for (const char *p = hex; p[0] && p[1]; p += 2) {
+    unsigned value;
+    sscanf(p, "%2x", &value);
+    result.push_back(static_cast<uint8_t>(value));
+  }
+  return result;
+}
+
+static int hpackCollectCb(const Raw *name, const Raw *value, void *arg)
+{
+  std::string *out = static_cast<std::string*>(arg);
+  out->append(name->data, name->size);
+  out->append(": ");
+  out->append(value->data, value->size);
+  out->append("\n");
+  return 1;
+}
+
+TEST(http, http_hpack_rfc7541)
+{
+  // RFC 7541 C.4: requests with Huffman coding, encoder must produce same bytes
+  static const char *requests[] = {
+    "828684418cf1e3c2e5f23a6ba0ab90f4ff",
+    "828684be5886a8eb10649cbf",
+    "828785bf408825a849e95ba97d7f8925a849e95bb8e8b4bf"
+  };
+  static const char *requestHeaders[] = {
+    ":method: GET\n:scheme: http\n:path: /\n:authority: www.example.com\n",
+    ":method: GET\n:scheme: http\n:path: /\n:authority: www.example.com\ncache-control: no-cache\n",
+    ":method: GET\n:scheme: https\n:path: /index.html\n:authority: www.example.com\ncustom-key: custom-value\n"
+  };
+  static const size_t requestTableSize[] = {57, 110, 164};
+
+  HpackEncoder *encoder = hpackEncoderNew(4096);
+  HpackDecoder *decoder = hpackDecoderNew(4096);
+  for (unsigned i = 0; i < 3; i++) {
+    std::vector<uint8_t> block = hexDecode(requests[i]);
+    std::string headers;
+    ASSERT_EQ(hpackDecode(decoder, block.data(), block.size(), hpackCollectCb, &headers), ParserResultOk);
+    ASSERT_EQ(headers, requestHeaders[i]);
+    ASSERT_EQ(hpackDecoderTableSize(decoder), requestTableSize[i]);
+
+    hpackEncodeBegin(encoder);
+    const char *p = requestHeaders[i];
+    while (*p) {
+      const char *colon = strstr(p + 1, ": ");
+      const char *eol = strchr(colon, '\n');
+      hpackEncodeHeader(encoder, p, static_cast<size_t>(colon - p), colon + 2, static_cast<size_t>(eol - colon - 2), hpackIndexed);
+      p = eol + 1;
+    }
+    size_t size;
+    const uint8_t *data = static_cast<const uint8_t*>(hpackEncodedData(encoder, &size));
+    ASSERT_EQ(std::vector<uint8_t>(data, data + size), block) << i;
+  }
+  hpackEncoderDelete(encoder);
+  hpackDecoderDelete(decoder);
+
+  // RFC 7541 C.6: responses with 256 bytes table, entries evicted
+  static const char *responses[] = {
+    "488264025885aec3771a4b6196d07abe941054d444a8200595040b8166e082a62d1bff6e919d29ad171863c78f0b97c8e9ae82ae43d3",
+    "4883640effc1c0bf",
+    "88c16196d07abe941054d444a8200595040b8166e084a62d1bffc05a839bd9ab77ad94e7821dd7f2e6c7b335dfdfcd5b3960d5af27087f3672c1ab270fb5291f9587316065c003ed4ee5b1063d5007"
+  };
+  static const char *responseHeaders[] = {
+    ":status: 302\ncache-control: private\ndate: Mon, 21 Oct 2013 20:13:21 GMT\nlocation: https://www.example.com\n",
+    ":status: 307\ncache-control: private\ndate: Mon, 21 Oct 2013 20:13:21 GMT\nlocation: https://www.example.com\n",
+    ":status: 200\ncache-control: private\ndate: Mon, 21 Oct 2013 20:13:22 GMT\nlocation: https://www.example.com\ncontent-encoding: gzip\nset-cookie: foo=ASDJKHQKBZXOQWEOPIUAXQWEOIU; max-age=3600; version=1\n"
+  };
+  static const size_t responseTableSize[] = {222, 222, 215};
+  decoder = hpackDecoderNew(256);
+  for (unsigned i = 0; i < 3; i++) {
+    std::vector<uint8_t> block = hexDecode(responses[i]);
+    std::string headers;
+    ASSERT_EQ(hpackDecode(decoder, block.data(), block.size(), hpackCollectCb, &headers), ParserResultOk);
+    ASSERT_EQ(headers, responseHeaders[i]);
+    ASSERT_EQ(hpackDecoderTableSize(decoder), responseTableSize[i]);
+  }
+
+  // Index out of table, EOS in string, padding longer than 7 bits, size update over limit
+  static const char *invalid[] = {"ff00", "0084ffffffff", "0081ff", "3fe21f"};
+  for (unsigned i = 0; i < 4; i++) {
+    std::vector<uint8_t> block = hexDecode(invalid[i]);
+    std::string headers;
+    EXPECT_EQ(hpackDecode(decoder, block.data(), block.size(), hpackCollectCb, &headers), ParserResultError) << invalid[i];
+  }
+  hpackDecoderDelete(decoder);
+
+  // Huffman round trip of all byte values
+  std::string all;
+  for (unsigned i = 0; i < 1024; i++)
+    all.push_back(static_cast<char>(i * 7 % 256));
+  std::vector<uint8_t> encoded(hpackHuffmanEncodedSize(all.data(), all.size()));
+  ASSERT_EQ(hpackHuffmanEncode(all.data(), all.size(), encoded.data()), encoded.size());
+  std::string decoded(encoded.size() * 8 / 5 + 1, 0);
+  size_t decodedSize = hpackHuffmanDecode(encoded.data(), encoded.size(), &decoded[0]);
+  ASSERT_EQ(decodedSize, all.size());
+  decoded.resize(decodedSize);
+  ASSERT_EQ(decoded, all);
+}
+
 int main(int argc, char **argv)
 {
   AsyncMethod method = amOSDefault;
@@ -1232,6 +1790,8 @@ int main(int argc, char **argv)
       method = amOSDefault;
     } else if (strcmp(argv[1], "select") == 0) {
       method = amSelect;
+    } else if (strcmp(argv[1], "poll") == 0) {
+      method = amPoll;
     } else if (strcmp(argv[1], "epoll") == 0) {
       method = amEPoll;
     } else if (strcmp(argv[1], "kqueue") == 0) {
@@ -0,0 +1,169 @@
+#include "asyncio/asyncio.h"
+#include "asyncio/socket.h"
+#include "asyncio/timer.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static uint16_t gPortBase = 63400;
+static uint64_t gTotalMessages = 2000000ULL;
+static unsigned gMessageSize = 64;
+static unsigned gBurstSize = 64;
+
+__NO_PADDING_BEGIN
+struct BenchContext {
+  asyncBase *base;
+  aioObject *listener;
+  aioObject *server;
+  aioObject *client;
+  uint64_t messagesStarted;
+  uint64_t messagesFinished;
+  uint64_t bytesReceived;
+  uint64_t totalBytes;
+  char message[65536];
+  char readBuffer[65536];
+  BenchContext() : listener(nullptr), server(nullptr), client(nullptr), messagesStarted(0), messagesFinished(0), bytesReceived(0), totalBytes(0) {
+    memset(message, 'm', sizeof(message));
+  }
+};
+__NO_PADDING_END
+
+static void writecb(AsyncOpStatus status, aioObject *object, size_t transferred, void *arg);
+
+static void sendBurst(BenchContext *ctx)
+{
+  for (unsigned i = 0; i < gBurstSize && ctx->messagesStarted < gTotalMessages; i++) {
+    ctx->messagesStarted++;
+    aioWrite(ctx->client, ctx->message, gMessageSize, afWaitAll, 0, writecb, ctx);
+  }
+}
+
+static void writecb(AsyncOpStatus status, aioObject *object, size_t transferred, void *arg)
+{
+  __UNUSED(object);
+  BenchContext *ctx = static_cast<BenchContext*>(arg);
+  if (status != aosSuccess || transferred != gMessageSize) {
+    fprintf(stderr, "write error %i, transferred %zu\n", static_cast<int>(status), transferred);
+    exit(1);
+  }
+
+  // Next burst starts when all callbacks of previous burst called
+  if (++ctx->messagesFinished == ctx->messagesStarted)
+    sendBurst(ctx);
+}
+
+static void readcb(AsyncOpStatus status, aioObject *object, size_t transferred, void *arg)
+{
+  BenchContext *ctx = static_cast<BenchContext*>(arg);
+  if (status != aosSuccess) {
+    fprintf(stderr, "read error %i\n", static_cast<int>(status));
+    exit(1);
+  }
+
+  ctx->bytesReceived += transferred;
+  if (ctx->bytesReceived >= ctx->totalBytes)
+    postQuitOperation(ctx->base);
+  else
+    aioRead(object, ctx->readBuffer, sizeof(ctx->readBuffer), afNone, 0, readcb, ctx);
+}
+
+static void acceptcb(AsyncOpStatus status, aioObject *listener, HostAddress client, socketTy acceptSocket, void *arg)
+{
+  __UNUSED(listener);
+  __UNUSED(client);
+  BenchContext *ctx = static_cast<BenchContext*>(arg);
+  if (status != aosSuccess) {
+    fprintf(stderr, "accept error %i\n", static_cast<int>(status));
+    exit(1);
+  }
+
+  ctx->server = newSocketIo(ctx->base, acceptSocket);
+  aioRead(ctx->server, ctx->readBuffer, sizeof(ctx->readBuffer), afNone, 0, readcb, ctx);
+}
+
+static void connectcb(AsyncOpStatus status, aioObject *object, void *arg)
+{
+  __UNUSED(object);
+  BenchContext *ctx = static_cast<BenchContext*>(arg);
+  if (status != aosSuccess) {
+    fprintf(stderr, "connect error %i\n", static_cast<int>(status));
+    exit(1);
+  }
+
+  sendBurst(ctx);
+}
+
+static void run(AsyncMethod method, const char *methodName, unsigned coalesceOps, uint16_t port)
+{
+  BenchContext ctx;
+  ctx.base = createAsyncBase(method);
+  ctx.totalBytes = gTotalMessages * gMessageSize;
+
+  HostAddress address;
+  address.family = AF_INET;
+  address.ipv4 = INADDR_ANY;
+  address.port = htons(port);
+  socketTy acceptSocket = socketCreate(AF_INET, SOCK_STREAM, IPPROTO_TCP, 1);
+  socketReuseAddr(acceptSocket);
+  if (socketBind(acceptSocket, &address) != 0 || socketListen(acceptSocket) != 0) {
+    fprintf(stderr, "can't listen port %u\n", static_cast<unsigned>(port));
+    exit(1);
+  }
+
+  ctx.listener = newSocketIo(ctx.base, acceptSocket);
+  aioAccept(ctx.listener, 0, acceptcb, &ctx);
+
+  address.port = 0;
+  socketTy connectSocket = socketCreate(AF_INET, SOCK_STREAM, IPPROTO_TCP, 1);
+  socketBind(connectSocket, &address);
+  ctx.client = newSocketIo(ctx.base, connectSocket);
+  if (coalesceOps > 1)
+    aioSetWriteCoalescing(ctx.client, 65536, coalesceOps);
+
+  address.ipv4 = inet_addr("127.0.0.1");
+  address.port = htons(port);
+  aioConnect(ctx.client, &address, 1000000, connectcb, &ctx);
+
+  timeMark beginPt = getTimeMark();
+  asyncLoop(ctx.base);
+  timeMark endPt = getTimeMark();
+
+  aioWriteQueueStats stats;
+  aioGetWriteQueueStats(ctx.client, &stats);
+  double totalSeconds = usDiff(beginPt, endPt) / 1000000.0;
+  printf("method=%s coalescing=%u message=%u burst=%u messages: %" PRIu64 ", write syscalls: %zu (%.3lf per message), elapsed time: %.3lf, rate: %.3lf msg/s\n",
+         methodName,
+         coalesceOps,
+         gMessageSize,
+         gBurstSize,
+         ctx.messagesFinished,
+         stats.writeCalls,
+         static_cast<double>(stats.writeCalls) / static_cast<double>(ctx.messagesFinished),
+         totalSeconds,
+         ctx.messagesFinished / totalSeconds);
+
+  deleteAioObject(ctx.client);
+  deleteAioObject(ctx.server);
+  deleteAioObject(ctx.listener);
+}
+
+int main(int argc, char **argv)
+{
+  if (argc >= 2)
+    gTotalMessages = strtoull(argv[1], nullptr, 10);
+  if (argc >= 3)
+    gBurstSize = static_cast<unsigned>(atoi(argv[2]));
+
+  initializeSocketSubsystem();
+  uint16_t port = gPortBase;
+
+  run(amOSDefault, "default", 0, port++);
+  run(amOSDefault, "default", 16, port++);
+  run(amOSDefault, "default", 64, port++);
+#if !defined(OS_WINDOWS)
+  run(amPoll, "poll", 0, port++);
+  run(amPoll, "poll", 64, port++);
+#endif
+  return 0;
+}